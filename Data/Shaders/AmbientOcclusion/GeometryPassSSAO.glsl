@@ -2,19 +2,24 @@
 
 #version 430 core
 
+#include "VertexAttributeDecoding.glsl"
+
 layout (location = 0) in vec3 vertexPosition;
-layout (location = 1) in vec3 vertexNormal;
+layout (location = 1) in DIRECTION_ATTRIBUTE_TYPE vertexNormal;
 
 out vec3 fragPosition;
 out vec3 fragNormal;
 
 void main()
 {
+    vec3 position = decodePosition(vertexPosition);
+    vec3 normal = decodeDirection(vertexNormal);
+
     mat4 modelViewMatrix = vMatrix * mMatrix;
     mat3 invModelViewMatrix = transpose(inverse(mat3(modelViewMatrix)));
-    fragPosition = (modelViewMatrix * vec4(vertexPosition, 1.0)).xyz;
-    fragNormal = invModelViewMatrix * vertexNormal;
-    gl_Position = mvpMatrix * vec4(vertexPosition, 1.0);
+    fragPosition = (modelViewMatrix * vec4(position, 1.0)).xyz;
+    fragNormal = invModelViewMatrix * normal;
+    gl_Position = mvpMatrix * vec4(position, 1.0);
 }
 
 -- Fragment
@@ -2,6 +2,8 @@
 
 #version 430 core
 
+#include "VertexAttributeDecoding.glsl"
+
 layout(location = 0) in vec3 vertexPosition;
 
 out vec3 screenSpacePosition;
@@ -11,8 +13,10 @@ uniform vec4 color;
 
 void main()
 {
-    screenSpacePosition = (vMatrix * mMatrix * vec4(vertexPosition, 1.0)).xyz;
-    gl_Position = mvpMatrix * vec4(vertexPosition, 1.0);
+    vec3 position = decodePosition(vertexPosition);
+
+    screenSpacePosition = (vMatrix * mMatrix * vec4(position, 1.0)).xyz;
+    gl_Position = mvpMatrix * vec4(position, 1.0);
 }
 
 
@@ -30,8 +30,10 @@
 
 #version 430 core
 
+#include "VertexAttributeDecoding.glsl"
+
 layout(location = 0) in vec3 vertexPosition;
-layout(location = 1) in vec3 vertexNormal;
+layout(location = 1) in DIRECTION_ATTRIBUTE_TYPE vertexNormal;
 
 out vec4 fragmentColor;
 out vec3 fragmentNormal;
@@ -44,12 +46,15 @@ uniform vec4 colorGlobal;
 
 void main()
 {
+    vec3 position = decodePosition(vertexPosition);
+    vec3 normal = decodeDirection(vertexNormal);
+
     fragmentColor = colorGlobal;
-    fragmentNormal = vertexNormal;
-    fragmentPositonLocal = (vec4(vertexPosition, 1.0)).xyz;
-    fragmentPositonWorld = (mMatrix * vec4(vertexPosition, 1.0)).xyz;
-    screenSpacePosition = (vMatrix * mMatrix * vec4(vertexPosition, 1.0)).xyz;
-    gl_Position = mvpMatrix * vec4(vertexPosition, 1.0);
+    fragmentNormal = normal;
+    fragmentPositonLocal = (vec4(position, 1.0)).xyz;
+    fragmentPositonWorld = (mMatrix * vec4(position, 1.0)).xyz;
+    screenSpacePosition = (vMatrix * mMatrix * vec4(position, 1.0)).xyz;
+    gl_Position = mvpMatrix * vec4(position, 1.0);
 }
 
 
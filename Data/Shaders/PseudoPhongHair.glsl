@@ -30,8 +30,10 @@
 
 #version 430 core
 
+#include "VertexAttributeDecoding.glsl"
+
 layout(location = 0) in vec3 vertexPosition;
-layout(location = 1) in vec3 vertexNormal;
+layout(location = 1) in DIRECTION_ATTRIBUTE_TYPE vertexNormal;
 #ifdef COLOR_ARRAY
 layout(location = 2) in vec4 vertexColor;
 #endif
@@ -45,16 +47,19 @@ out vec3 screenSpacePosition;
 
 void main()
 {
+    vec3 position = decodePosition(vertexPosition);
+    vec3 normal = decodeDirection(vertexNormal);
+
 #ifdef COLOR_ARRAY
     //fragmentColor = vec4(vertexColor.rgb, vertexColor.a * colorGlobal.a);
     fragmentColor = vertexColor;
 #else
     fragmentColor = vec4(1.0);//colorGlobal;
 #endif
-    fragmentNormal = vertexNormal;
-    fragmentPositonWorld = (mMatrix * vec4(vertexPosition, 1.0)).xyz;
-    screenSpacePosition = (vMatrix * mMatrix * vec4(vertexPosition, 1.0)).xyz;
-    gl_Position = mvpMatrix * vec4(vertexPosition, 1.0);
+    fragmentNormal = normal;
+    fragmentPositonWorld = (mMatrix * vec4(position, 1.0)).xyz;
+    screenSpacePosition = (vMatrix * mMatrix * vec4(position, 1.0)).xyz;
+    gl_Position = mvpMatrix * vec4(position, 1.0);
 }
 
 
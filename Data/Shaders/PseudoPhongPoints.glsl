@@ -31,6 +31,7 @@
 #version 430 core
 
 #include "VertexAttributeNames.glsl"
+#include "VertexAttributeDecoding.glsl"
 
 layout(location = 0) in vec3 vertexPosition;
 layout(location = 3) in float VERTEX_ATTRIBUTE;
@@ -43,7 +44,7 @@ out VertexData
 
 void main()
 {
-    pointPosition = vertexPosition;
+    pointPosition = decodePosition(vertexPosition);
     pointAttribute = VERTEX_ATTRIBUTE;
 }
 
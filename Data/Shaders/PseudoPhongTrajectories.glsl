@@ -31,9 +31,10 @@
 #version 430 core
 
 #include "VertexAttributeNames.glsl"
+#include "VertexAttributeDecoding.glsl"
 
 layout(location = 0) in vec3 vertexPosition;
-layout(location = 1) in vec3 vertexNormal;
+layout(location = 1) in DIRECTION_ATTRIBUTE_TYPE vertexNormal;
 layout(location = 3) in float VERTEX_ATTRIBUTE;
 
 out vec3 fragmentNormal;
@@ -44,14 +45,17 @@ out float fragmentAttribute;
 
 void main()
 {
-    fragmentNormal = vertexNormal;
-    vec3 binormal = cross(vec3(0,0,1), vertexNormal);
+    vec3 position = decodePosition(vertexPosition);
+    vec3 normal = decodeDirection(vertexNormal);
+
+    fragmentNormal = normal;
+    vec3 binormal = cross(vec3(0,0,1), normal);
     fragmentTangent = cross(binormal, fragmentNormal);
 
-    fragmentPositionWorld = (mMatrix * vec4(vertexPosition, 1.0)).xyz;
-    screenSpacePosition = (vMatrix * mMatrix * vec4(vertexPosition, 1.0)).xyz;
+    fragmentPositionWorld = (mMatrix * vec4(position, 1.0)).xyz;
+    screenSpacePosition = (vMatrix * mMatrix * vec4(position, 1.0)).xyz;
     fragmentAttribute = VERTEX_ATTRIBUTE;
-    gl_Position = mvpMatrix * vec4(vertexPosition, 1.0);
+    gl_Position = mvpMatrix * vec4(position, 1.0);
 }
 
 
@@ -82,7 +86,18 @@ struct LinePointData
     float padding;
 };
 
-#ifdef PROGRAMMABLE_FETCH_ARRAY_OF_STRUCTS
+#if defined(PROGRAMMABLE_FETCH_SHARED_POSITIONS)
+// Position and tangent interleaved (6 floats per point), shared by all attributes
+layout (std430, binding = 2) buffer LinePositionsTangents
+{
+    float linePositionsTangents[];
+};
+// Two 16-bit unorm attribute values per uint
+layout (std430, binding = 4) buffer VertexAttributesUnorm16
+{
+    uint vertexAttributesPacked[];
+};
+#elif defined(PROGRAMMABLE_FETCH_ARRAY_OF_STRUCTS)
 layout (std430, binding = 2) buffer LinePoints
 {
     LinePointData linePoints[];
@@ -105,7 +120,15 @@ layout (std430, binding = 4) buffer VertexAttributes
 void main()
 {
     uint pointIndex = gl_VertexID/2;
-    #ifdef PROGRAMMABLE_FETCH_ARRAY_OF_STRUCTS
+    #if defined(PROGRAMMABLE_FETCH_SHARED_POSITIONS)
+    uint pointOffset = pointIndex * 6u;
+    vec3 pointPosition = vec3(linePositionsTangents[pointOffset], linePositionsTangents[pointOffset+1u],
+            linePositionsTangents[pointOffset+2u]);
+    vec3 pointTangent = vec3(linePositionsTangents[pointOffset+3u], linePositionsTangents[pointOffset+4u],
+            linePositionsTangents[pointOffset+5u]);
+    float pointAttribute = unpackUnorm2x16(vertexAttributesPacked[pointIndex/2u])[pointIndex%2u];
+    LinePointData linePointData = {pointPosition, pointAttribute, pointTangent, 0.0};
+    #elif defined(PROGRAMMABLE_FETCH_ARRAY_OF_STRUCTS)
     LinePointData linePointData = linePoints[pointIndex];
     #else
     LinePointData linePointData = {vertexPositions[pointIndex].xyz, vertexAttributes[pointIndex],
@@ -138,10 +161,11 @@ void main()
 #version 430 core
 
 #include "VertexAttributeNames.glsl"
+#include "VertexAttributeDecoding.glsl"
 
 layout(location = 0) in vec3 vertexPosition;
-layout(location = 1) in vec3 vertexLineNormal;
-layout(location = 2) in vec3 vertexLineTangent;
+layout(location = 1) in DIRECTION_ATTRIBUTE_TYPE vertexLineNormal;
+layout(location = 2) in DIRECTION_ATTRIBUTE_TYPE vertexLineTangent;
 layout(location = 3) in float VERTEX_ATTRIBUTE;
 
 out VertexData
@@ -154,9 +178,9 @@ out VertexData
 
 void main()
 {
-    linePosition = vertexPosition;
-    lineNormal = vertexLineNormal;
-    lineTangent = vertexLineTangent;
+    linePosition = decodePosition(vertexPosition);
+    lineNormal = decodeDirection(vertexLineNormal);
+    lineTangent = decodeDirection(vertexLineTangent);
     lineAttribute = VERTEX_ATTRIBUTE;
 }
 
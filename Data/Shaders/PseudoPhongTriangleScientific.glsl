@@ -31,9 +31,10 @@
 #version 430 core
 
 #include "VertexAttributeNames.glsl"
+#include "VertexAttributeDecoding.glsl"
 
 layout(location = 0) in vec3 vertexPosition;
-layout(location = 1) in vec3 vertexNormal;
+layout(location = 1) in DIRECTION_ATTRIBUTE_TYPE vertexNormal;
 layout(location = 3) in float VERTEX_ATTRIBUTE;
 
 out vec3 fragmentNormal;
@@ -44,12 +45,15 @@ out float fragmentAttribute;
 
 void main()
 {
-    fragmentNormal = vertexNormal;
-    fragmentPositonLocal = (vec4(vertexPosition, 1.0)).xyz;
-    fragmentPositonWorld = (mMatrix * vec4(vertexPosition, 1.0)).xyz;
+    vec3 position = decodePosition(vertexPosition);
+    vec3 normal = decodeDirection(vertexNormal);
+
+    fragmentNormal = normal;
+    fragmentPositonLocal = (vec4(position, 1.0)).xyz;
+    fragmentPositonWorld = (mMatrix * vec4(position, 1.0)).xyz;
     fragmentAttribute = VERTEX_ATTRIBUTE;
-    screenSpacePosition = (vMatrix * mMatrix * vec4(vertexPosition, 1.0)).xyz;
-    gl_Position = mvpMatrix * vec4(vertexPosition, 1.0);
+    screenSpacePosition = (vMatrix * mMatrix * vec4(position, 1.0)).xyz;
+    gl_Position = mvpMatrix * vec4(position, 1.0);
 }
 
 
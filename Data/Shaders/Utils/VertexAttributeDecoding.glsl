@@ -0,0 +1,41 @@
+// Decoding of the quantized vertex attributes of binmesh files (see MeshQuantization.hpp). The attributes are uploaded
+// in their packed encoding as normalized integers:
+// - QUANTIZED_POSITIONS: 3x16-bit unsigned, i.e., in [0, 1] relative to the bounding box of the submesh.
+// - OCTAHEDRAL_DIRECTIONS: Normals and tangents in octahedral encoding with 2x16-bit or 2x8-bit signed, i.e., in
+//   [-1, 1]. The vertex shaders declare these inputs with the type DIRECTION_ATTRIBUTE_TYPE.
+
+#ifdef QUANTIZED_POSITIONS
+// Bounding box of the current submesh (set by MeshRenderer::render)
+uniform vec3 positionDequantizationMin;
+uniform vec3 positionDequantizationExtent;
+
+vec3 decodePosition(vec3 quantizedPosition)
+{
+    return positionDequantizationMin + quantizedPosition * positionDequantizationExtent;
+}
+#else
+vec3 decodePosition(vec3 position)
+{
+    return position;
+}
+#endif
+
+#ifdef OCTAHEDRAL_DIRECTIONS
+#define DIRECTION_ATTRIBUTE_TYPE vec2
+
+vec3 decodeDirection(vec2 p)
+{
+    vec3 v = vec3(p.x, p.y, 1.0 - abs(p.x) - abs(p.y));
+    if (v.z < 0.0) {
+        v.xy = (vec2(1.0) - abs(v.yx)) * vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+    }
+    return normalize(v);
+}
+#else
+#define DIRECTION_ATTRIBUTE_TYPE vec3
+
+vec3 decodeDirection(vec3 direction)
+{
+    return direction;
+}
+#endif
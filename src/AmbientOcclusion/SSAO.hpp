@@ -20,10 +20,11 @@ public:
     inline sgl::TexturePtr getSSAOTexture() { return ssaoTexture; }
     inline sgl::ShaderProgramPtr getGeometryPassShader() { return geometryPassShader; }
     inline bool isPreRenderPass() { return preRenderPass; }
+    // Needs to be called when the preprocessor defines of the vertex shaders change
+    void loadShaders();
 
 private:
     void init();
-    void loadShaders();
 
     // Shaders
     sgl::ShaderProgramPtr geometryPassShader;
@@ -12,17 +12,15 @@
 
 #include "../VoxelRaytracing/VoxelData.hpp"
 #include "../VoxelRaytracing/VoxelCurveDiscretizer.hpp"
+#include "../Utils/DerivedDataCache.hpp"
 
 #include "VoxelAO.hpp"
 
 void VoxelAOHelper::loadAOFactorsFromVoxelFile(const std::string &filename, TrajectoryType trajectoryType)
 {
-    // Check if voxel grid is already created
-    // Pure filename without extension (to create compressed .voxel filename)
+    // Pure filename without extension (to get the source filename of the voxel grid)
     std::string modelFilenamePure = sgl::FileUtils::get()->removeExtension(filename);
 
-    std::string modelFilenameVoxelGrid = modelFilenamePure + ".voxel";
-
     // Can be either hair dataset or trajectory dataset
     bool isHairDataset = boost::starts_with(
             modelFilenamePure, sgl::AppSettings::get()->getDataDirectory() + "Hair");
@@ -44,17 +42,32 @@ void VoxelAOHelper::loadAOFactorsFromVoxelFile(const std::string &filename, Traj
         voxelRes = 128;
     }
 
+    const int quantizationRes = 64;
+    int maxNumLinesPerVoxel = 32;
+    if (boost::starts_with(filename, sgl::AppSettings::get()->getDataDirectory() + "WCB")) {
+        maxNumLinesPerVoxel = 128;
+    } else if (boost::starts_with(
+            filename, sgl::AppSettings::get()->getDataDirectory() + "ConvectionRolls/turbulence20000")) {
+        maxNumLinesPerVoxel = 64;
+    }
+
+    // Check if voxel grid with the same build parameters is already created
+    DerivedDataKey voxelGridKey(modelFilenamePure + (isHairDataset ? ".hair" : ".obj"), "voxel",
+            VOXEL_GRID_FORMAT_VERSION);
+    voxelGridKey.addParameter("trajectoryType", int(trajectoryType));
+    voxelGridKey.addParameter("gridResolution", int(voxelRes));
+    voxelGridKey.addParameter("quantizationResolution", quantizationRes);
+    voxelGridKey.addParameter("maxNumLinesPerVoxel", maxNumLinesPerVoxel);
+#ifdef PACK_LINES
+    voxelGridKey.addParameter("packLines", true);
+#else
+    voxelGridKey.addParameter("packLines", false);
+#endif
+    std::string modelFilenameVoxelGrid = DerivedDataCache::get()->getArtifactFilename(voxelGridKey);
+
     VoxelGridDataCompressed compressedData;
-    if (!sgl::FileUtils::get()->exists(modelFilenameVoxelGrid)) {
-        VoxelCurveDiscretizer discretizer(glm::ivec3(voxelRes), glm::ivec3(64));
-
-        int maxNumLinesPerVoxel = 32;
-        if (boost::starts_with(filename, sgl::AppSettings::get()->getDataDirectory() + "WCB")) {
-            maxNumLinesPerVoxel = 128;
-        } else if (boost::starts_with(
-                filename, sgl::AppSettings::get()->getDataDirectory() + "ConvectionRolls/turbulence20000")) {
-            maxNumLinesPerVoxel = 64;
-        }
+    if (!DerivedDataCache::get()->lookup(modelFilenameVoxelGrid)) {
+        VoxelCurveDiscretizer discretizer(glm::ivec3(voxelRes), glm::ivec3(quantizationRes));
 
         if (isHairDataset) {
             std::string modelFilenameHair = modelFilenamePure + ".hair";
@@ -77,6 +90,7 @@ void VoxelAOHelper::loadAOFactorsFromVoxelFile(const std::string &filename, Traj
                                        + std::to_string(elapsed.count()));
 
         saveToFile(modelFilenameVoxelGrid, compressedData);
+        DerivedDataCache::get()->commit(modelFilenameVoxelGrid);
     } else {
         loadFromFile(modelFilenameVoxelGrid, compressedData);
     }
@@ -18,6 +18,7 @@
 #include <Graphics/Window.hpp>
 
 #include "MainApp.hpp"
+#include "Tests/DataProcessingTests.hpp"
 
 using namespace std;
 using namespace sgl;
@@ -43,6 +44,13 @@ int main(int argc, char *argv[]) {
     AppSettings::get()->createWindow();
     AppSettings::get()->initializeSubsystems();
 
+    // Only run the self-checks of the data processing code (see Tests/DataProcessingTests.hpp)
+    if (argc > 1 && string(argv[1]) == "--run-data-tests") {
+        bool passed = runDataProcessingTests();
+        AppSettings::get()->release();
+        return passed ? 0 : 1;
+    }
+
     AppLogic *app = new PixelSyncApp();
     app->run();
     delete app;
@@ -53,8 +53,12 @@
 #include "Utils/OBJLoader.hpp"
 #include "Utils/BinaryObjLoader.hpp"
 #include "Utils/PointRendering/PointFileLoader.hpp"
+#include "Utils/PointRendering/PointLod.hpp"
 #include "Utils/TrajectoryLoader.hpp"
+#include "Utils/NetCDFConverter.hpp"
 #include "Utils/HairLoader.hpp"
+#include "Utils/DerivedDataCache.hpp"
+#include "Utils/MeshQuantization.hpp"
 #include "OIT/BufferSizeWatch.hpp"
 #include "OIT/OIT_Dummy.hpp"
 #include "OIT/OIT_KBuffer.hpp"
@@ -460,6 +464,51 @@ void PixelSyncApp::loadCameraPositionFromFile(const std::string& filename)
 
 
 
+void PixelSyncApp::updateProgrammableFetchLayoutDefines()
+{
+    if (programmableFetchLayout == PROGRAMMABLE_FETCH_LAYOUT_AOS) {
+        sgl::ShaderManager->addPreprocessorDefine("PROGRAMMABLE_FETCH_ARRAY_OF_STRUCTS", "");
+    } else {
+        sgl::ShaderManager->removePreprocessorDefine("PROGRAMMABLE_FETCH_ARRAY_OF_STRUCTS");
+    }
+    if (programmableFetchLayout == PROGRAMMABLE_FETCH_LAYOUT_SHARED) {
+        sgl::ShaderManager->addPreprocessorDefine("PROGRAMMABLE_FETCH_SHARED_POSITIONS", "");
+    } else {
+        sgl::ShaderManager->removePreprocessorDefine("PROGRAMMABLE_FETCH_SHARED_POSITIONS");
+    }
+}
+
+void PixelSyncApp::updateVertexAttributeEncodingDefines()
+{
+    bool changed = false;
+    if (transparentObject.hasQuantizedPositions != quantizedPositionsMode) {
+        quantizedPositionsMode = transparentObject.hasQuantizedPositions;
+        if (quantizedPositionsMode) {
+            sgl::ShaderManager->addPreprocessorDefine("QUANTIZED_POSITIONS", "");
+        } else {
+            sgl::ShaderManager->removePreprocessorDefine("QUANTIZED_POSITIONS");
+        }
+        changed = true;
+    }
+    if (transparentObject.hasOctahedralDirections != octahedralDirectionsMode) {
+        octahedralDirectionsMode = transparentObject.hasOctahedralDirections;
+        if (octahedralDirectionsMode) {
+            sgl::ShaderManager->addPreprocessorDefine("OCTAHEDRAL_DIRECTIONS", "");
+        } else {
+            sgl::ShaderManager->removePreprocessorDefine("OCTAHEDRAL_DIRECTIONS");
+        }
+        changed = true;
+    }
+    if (changed) {
+        sgl::ShaderManager->invalidateShaderCache();
+        updateShaderMode(SHADER_MODE_UPDATE_NEW_MODEL);
+        transparentObject.setNewShader(transparencyShader);
+        if (ssaoHelper != NULL) {
+            ssaoHelper->loadShaders();
+        }
+    }
+}
+
 void PixelSyncApp::loadModel(const std::string &relativeFilename, bool resetCamera)
 {
     // Pure filename without extension (to create compressed .binmesh filename)
@@ -642,23 +691,75 @@ void PixelSyncApp::loadModel(const std::string &relativeFilename, bool resetCame
         modelFilenameOptimized += "_lines";
         useProgrammableFetch = true;
         sgl::ShaderManager->addPreprocessorDefine("USE_PROGRAMMABLE_FETCH", "");
-        if (programmableFetchUseAoS) {
-            sgl::ShaderManager->addPreprocessorDefine("PROGRAMMABLE_FETCH_ARRAY_OF_STRUCTS", "");
-        } else {
-            sgl::ShaderManager->removePreprocessorDefine("PROGRAMMABLE_FETCH_ARRAY_OF_STRUCTS");
-        }
+        updateProgrammableFetchLayoutDefines();
     } else {
         useProgrammableFetch = false;
         sgl::ShaderManager->removePreprocessorDefine("USE_PROGRAMMABLE_FETCH");
     }
 
-    if (!FileUtils::get()->exists(modelFilenameOptimized)) {
+    // Look up the binmesh file in the derived data cache
+    bool isLineMesh = boost::ends_with(modelFilenameOptimized, "_lines");
+    DerivedDataKey binmeshKey(absoluteFilename, "binmesh", MESH_FORMAT_VERSION);
+    binmeshKey.addParameter("modelType", int(modelType));
+    if (modelType == MODEL_TYPE_TRAJECTORIES) {
+        binmeshKey.addParameter("trajectoryType", int(trajectoryType));
+        binmeshKey.addParameter("lineMesh", isLineMesh);
+        binmeshKey.addParameter("importanceCriteria", IMPORTANCE_CRITERIA_VERSION);
+        if (boost::ends_with(absoluteFilename, ".nc")) {
+            addNetCdfSelectionParameters(binmeshKey, getNetCdfSelection());
+        }
+        if (!isLineMesh) {
+            binmeshKey.addParameter("lineRadius", lineRadius);
+        }
+    }
+    if (modelType == MODEL_TYPE_HAIR) {
+        binmeshKey.addParameter("hairTubeMesh", HAIR_TUBE_MESH_VERSION);
+    }
+    if (modelType == MODEL_TYPE_TRIANGLE_MESH_NORMAL && getObjWeldEpsilon() > 0.0f) {
+        binmeshKey.addParameter("weldEpsilon", getObjWeldEpsilon());
+    }
+    if (modelType == MODEL_TYPE_POINTS) {
+        binmeshKey.addParameter("mortonSort", getPointDataSetMortonSort());
+        binmeshKey.addParameter("pointLod", getPointDataSetLod() ? POINT_LOD_FORMAT_VERSION : 0);
+        binmeshKey.addParameter("densityNeighbors", getPointDataSetDensityNeighbors());
+        std::string sourceSignature = getPointDataSetSourceSignature(absoluteFilename);
+        if (!sourceSignature.empty()) {
+            binmeshKey.addParameter("brickSet", sourceSignature);
+        }
+    }
+    addMeshQuantizationParameters(binmeshKey, getMeshQuantizationSettings());
+    modelFilenameOptimized = DerivedDataCache::get()->getArtifactFilename(binmeshKey);
+
+    // Time-dependent trajectory data sets are directories or file name patterns of binmesh files (converted for the
+    // selected line rendering technique). The first time step is loaded like a static model, and the prefetch thread
+    // of the sequence reads the following ones while rendering (see updateTimeStep). Other model types use directories
+    // and patterns for their own purposes (e.g., the bricks of the cosmic web point data set).
+    timeStepSequence = std::shared_ptr<TimeStepSequence>();
+    if (modelType == MODEL_TYPE_TRAJECTORIES && isTimeStepSequence(absoluteFilename)) {
+        std::string timeStepPattern = absoluteFilename;
+        if (sgl::FileUtils::get()->directoryExists(absoluteFilename)) {
+            timeStepPattern += std::string("/*.binmesh") + (isLineMesh ? "_lines" : "");
+        }
+        std::vector<std::string> timeStepFilenames = findTimeStepFiles(timeStepPattern);
+        if (timeStepFilenames.empty()) {
+            Logfile::get()->writeError(std::string() + "Error in PixelSyncApp::loadModel: No time steps found for \""
+                    + timeStepPattern + "\".");
+            return;
+        }
+        modelFilenameOptimized = timeStepFilenames.front();
+        timeStepSequence = std::make_shared<TimeStepSequence>(timeStepFilenames, getTimeStepSequenceSettings());
+        timeStep = 0;
+        displayedTimeStep = 0;
+        timeStepTimer = 0.0f;
+    }
+
+    if (!timeStepSequence && !DerivedDataCache::get()->lookup(modelFilenameOptimized)) {
         if (modelFilenamePure.find("isosurface") != std::string::npos) {
             convertBinaryObjMeshToBinmesh(absoluteFilename, modelFilenameOptimized);
         } else if (modelType == MODEL_TYPE_TRIANGLE_MESH_NORMAL) {
             convertObjMeshToBinary(absoluteFilename, modelFilenameOptimized);
         } else if (modelType == MODEL_TYPE_TRAJECTORIES) {
-            if (boost::ends_with(modelFilenameOptimized, "_lines")) {
+            if (isLineMesh) {
                 convertTrajectoryDataToBinaryLineMesh(
                         trajectoryType, absoluteFilename, modelFilenameOptimized);
             } else {
@@ -676,6 +777,7 @@ void PixelSyncApp::loadModel(const std::string &relativeFilename, bool resetCame
         } else if (boost::starts_with(modelFilenamePure, "PointDatasets")) {
             convertPointDataSetToBinmesh(absoluteFilename, modelFilenameOptimized);
         }
+        DerivedDataCache::get()->commit(modelFilenameOptimized);
     }
 
     if (boost::starts_with(modelFilenamePure, "IsoSurfaces")
@@ -694,7 +796,7 @@ void PixelSyncApp::loadModel(const std::string &relativeFilename, bool resetCame
     if (modelType == MODEL_TYPE_TRIANGLE_MESH_NORMAL) {
         gatherShaderIDs = {"PseudoPhong.Vertex", "PseudoPhong.Fragment"};
     } else if (modelType == MODEL_TYPE_TRAJECTORIES) {
-        if (boost::ends_with(modelFilenameOptimized, "_lines")) {
+        if (isLineMesh) {
             if (!useProgrammableFetch) {
                 gatherShaderIDs = {"PseudoPhongTrajectories.Vertex", "PseudoPhongTrajectories.Geometry",
                                    "PseudoPhongTrajectories.Fragment"};
@@ -716,7 +818,8 @@ void PixelSyncApp::loadModel(const std::string &relativeFilename, bool resetCame
 
     if (mode != RENDER_MODE_VOXEL_RAYTRACING_LINES && mode != RENDER_MODE_RAYTRACING) {
         transparentObject = parseMesh3D(modelFilenameOptimized, transparencyShader, shuffleGeometry,
-                useProgrammableFetch, programmableFetchUseAoS, lineRadius);
+                useProgrammableFetch, programmableFetchLayout, lineRadius, shuffleSeed);
+        updateVertexAttributeEncodingDefines();
         if (shaderMode == SHADER_MODE_SCIENTIFIC_ATTRIBUTE) {
             recomputeHistogramForMesh();
         }
@@ -741,7 +844,7 @@ void PixelSyncApp::loadModel(const std::string &relativeFilename, bool resetCame
         }
     } else if (mode == RENDER_MODE_VOXEL_RAYTRACING_LINES) {
         transparentObject = parseMesh3D(modelFilenameOptimized, transparencyShader, shuffleGeometry,
-                useProgrammableFetch, programmableFetchUseAoS);
+                useProgrammableFetch, programmableFetchLayout);
         boundingBox = transparentObject.boundingBox;
         std::vector<float> lineAttributes;
         OIT_VoxelRaytracing *voxelRaytracer = (OIT_VoxelRaytracing*)oitRenderer.get();
@@ -756,7 +859,7 @@ void PixelSyncApp::loadModel(const std::string &relativeFilename, bool resetCame
 #ifdef USE_RAYTRACING
     } else if (mode == RENDER_MODE_RAYTRACING) {
         transparentObject = parseMesh3D(modelFilenameOptimized, transparencyShader, shuffleGeometry,
-                useProgrammableFetch, programmableFetchUseAoS);
+                useProgrammableFetch, programmableFetchLayout);
         boundingBox = transparentObject.boundingBox;
         std::vector<float> lineAttributes;
         OIT_RayTracing *raytracer = (OIT_RayTracing*)oitRenderer.get();
@@ -1177,8 +1280,10 @@ void PixelSyncApp::setNewState(const InternalState &newState)
         exit(1);
     }
     if (newModelIndex != usedModelIndex || shuffleGeometry != newState.testShuffleGeometry
+            || (newState.testShuffleGeometry && shuffleSeed != newState.shuffleSeed)
             || oldLineRenderingTechnique != lineRenderingTechnique) {
         shuffleGeometry = newState.testShuffleGeometry;
+        shuffleSeed = newState.shuffleSeed;
         loadModel(modelFilename);
     }
     usedModelIndex = newModelIndex;
@@ -1331,6 +1436,15 @@ void PixelSyncApp::render()
         renderOIT();
         reRender = false;
         Renderer->unbindFBO();
+
+        if (transparentObject.hasClusters()) {
+            lastClusterCullingStatistics = transparentObject.getClusterCullingStatistics();
+            transparentObject.resetClusterCullingStatistics();
+            if (perfMeasurementMode && clusterCulling) {
+                measurer->pushClusterCullingFrame(lastClusterCullingStatistics.getCulledFraction(),
+                        float(lastClusterCullingStatistics.cullingTimeMS));
+            }
+        }
     }
 
     if ((perfMeasurementMode && timeCoherence) || recording)
@@ -1599,6 +1713,11 @@ void PixelSyncApp::renderGUI()
                 fpsCounter = Timer->getTicksMicroseconds();
             }
             ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / fps, fps);
+            if (transparentObject.hasClusters() && clusterCulling) {
+                ImGui::Text("Culled clusters: %.1f%% (%.3f ms)",
+                        lastClusterCullingStatistics.getCulledFraction() * 100.0f,
+                        lastClusterCullingStatistics.cullingTimeMS);
+            }
             ImGui::Separator();
 
             // Mode selection of OIT algorithms
@@ -1754,12 +1873,9 @@ void PixelSyncApp::renderSceneSettingsGUI()
         }
         if (useProgrammableFetch) {
             ImGui::SameLine();
-            if (ImGui::Checkbox("AoS", &programmableFetchUseAoS)) {
-                if (programmableFetchUseAoS) {
-                    sgl::ShaderManager->addPreprocessorDefine("PROGRAMMABLE_FETCH_ARRAY_OF_STRUCTS", "");
-                } else {
-                    sgl::ShaderManager->removePreprocessorDefine("PROGRAMMABLE_FETCH_ARRAY_OF_STRUCTS");
-                }
+            if (ImGui::Combo("Fetch Layout", (int*)&programmableFetchLayout, PROGRAMMABLE_FETCH_LAYOUT_NAMES,
+                    IM_ARRAYSIZE(PROGRAMMABLE_FETCH_LAYOUT_NAMES))) {
+                updateProgrammableFetchLayoutDefines();
                 updateShaderMode(SHADER_MODE_UPDATE_EFFECT_CHANGE);
                 loadModel(MODEL_FILENAMES[usedModelIndex], false);
                 reRender = true;
@@ -1780,6 +1896,36 @@ void PixelSyncApp::renderSceneSettingsGUI()
             && ImGui::SliderFloat("Point radius", &pointRadius, 0.00005f, 0.005f, "%.5f")) {
             reRender = true;
         }
+        if (timeStepSequence) {
+            int numTimeSteps = int(timeStepSequence->getNumTimeSteps());
+            ImGui::SliderInt("Time step", &timeStep, 0, numTimeSteps - 1);
+            ImGui::Checkbox("Play time steps", &playTimeSteps);
+            ImGui::SliderFloat("Time steps/s", &timeStepsPerSecond, 1.0f, 60.0f, "%.0f");
+            TimeStepSequenceStatistics statistics = timeStepSequence->getStatistics();
+            ImGui::Text("Displayed: %d%s, loading: %.1f steps/s (%.1f MiB/s)", displayedTimeStep,
+                    displayedTimeStep == timeStep ? "" : " (not ready)", statistics.getTimeStepsPerSecond(),
+                    statistics.getMiBPerSecond());
+            if (ImGui::Button("Measure load throughput")) {
+                std::vector<std::string> timeStepFilenames;
+                for (int i = 0; i < numTimeSteps; i++) {
+                    timeStepFilenames.push_back(timeStepSequence->getFilename(size_t(i)));
+                }
+                benchmarkTimeStepSequence(timeStepFilenames, getTimeStepSequenceSettings());
+            }
+        }
+        if (modelType == MODEL_TYPE_POINTS && transparentObject.hasPointLodLevels()) {
+            if (ImGui::Checkbox("Point LOD", &pointLod)) {
+                reRender = true;
+            }
+            if (pointLod && ImGui::SliderFloat("LOD voxel size (px)", &pointLodMaxVoxelPixels, 0.5f, 16.0f, "%.1f")) {
+                reRender = true;
+            }
+            int lodLevel = transparentObject.getPointLodLevel();
+            if (pointLod && lodLevel >= 0) {
+                ImGui::Text("LOD level %d/%d (%u points)", lodLevel + 1, int(transparentObject.pointLodLevels.size()),
+                        transparentObject.pointLodLevels.at(lodLevel).numPoints);
+            }
+        }
     }
 
     if (shaderMode == SHADER_MODE_SCIENTIFIC_ATTRIBUTE) {
@@ -1858,10 +2004,17 @@ void PixelSyncApp::renderSceneSettingsGUI()
         reRender = true;
     }
     if (ImGui::Button("Shuffle")) {
+        // Use a new seed for each click
+        if (shuffleGeometry) {
+            shuffleSeed++;
+        }
         shuffleGeometry = true;
         loadModel(MODEL_FILENAMES[usedModelIndex], false);
         reRender = true;
     }
+    if (transparentObject.hasClusters() && ImGui::Checkbox("Cluster Culling", &clusterCulling)) {
+        reRender = true;
+    }
 
 //    ImVec2 cursorPosEnd = ImGui::GetCursorPos(); ImGui::SameLine();
 
@@ -1898,7 +2051,13 @@ sgl::ShaderProgramPtr PixelSyncApp::setUniformValues()
             transparencyShader->setUniform("maxCriterionValue", maxCriterionValue);
             if (transparencyShader->hasUniform("radius")) {
                 if (modelType == MODEL_TYPE_POINTS) {
-                    transparencyShader->setUniform("radius", pointRadius);
+                    // The points of coarse LOD levels represent a whole voxel
+                    float radius = pointRadius;
+                    int lodLevel = transparentObject.getPointLodLevel();
+                    if (lodLevel >= 0) {
+                        radius = std::max(radius, 0.5f * transparentObject.pointLodLevels.at(lodLevel).voxelSize);
+                    }
+                    transparencyShader->setUniform("radius", radius);
                 } else {
                     transparencyShader->setUniform("radius", lineRadius);
                 }
@@ -2001,6 +2160,18 @@ sgl::ShaderProgramPtr PixelSyncApp::setUniformValues()
 
 void PixelSyncApp::renderScene()
 {
+    if (transparentObject.hasPointLodLevels()) {
+        int lodLevel = -1;
+        if (pointLod) {
+            int viewportHeight = AppSettings::get()->getMainWindow()->getHeight();
+            lodLevel = selectPointLodLevel(
+                    transparentObject.pointLodLevels, transparentObject.boundingBox,
+                    camera->getViewMatrix() * rotation * scaling, camera->getProjectionMatrix(), viewportHeight,
+                    pointLodMaxVoxelPixels);
+        }
+        transparentObject.setPointLodLevel(lodLevel);
+    }
+
     ShaderProgramPtr transparencyShader;
     if (!boost::starts_with(oitRenderer->getGatherShader()->getShaderList().front()->getFileID(),
             "DepthPeelingGatherDepthComplexity")) {
@@ -2016,6 +2187,20 @@ void PixelSyncApp::renderScene()
     Renderer->setModelMatrix(rotation * scaling);
 
     bool isGBufferPass = currentAOTechnique == AO_TECHNIQUE_SSAO && ssaoHelper->isPreRenderPass();
+    if (transparentObject.hasClusters()) {
+        // Clusters with zero opacity can only be culled if the opacity is determined by the transfer function.
+        std::vector<float> opacityMap;
+        if (clusterCulling && shaderMode == SHADER_MODE_SCIENTIFIC_ATTRIBUTE && transparencyMapping
+                && !boost::starts_with(transparencyShader->getShaderList().front()->getFileID(),
+                        "DepthPeelingGatherDepthComplexity")) {
+            const std::vector<sgl::Color> &transferFunctionMap = transferFunctionWindow.getTransferFunctionMap_sRGB();
+            opacityMap.reserve(transferFunctionMap.size());
+            for (const sgl::Color &color : transferFunctionMap) {
+                opacityMap.push_back(color.getFloatA());
+            }
+        }
+        transparentObject.setClusterCulling(clusterCulling, lineRadius, opacityMap);
+    }
     transparentObject.render(transparencyShader, isGBufferPass, importanceCriterionIndex);
 }
 
@@ -2026,6 +2211,43 @@ void PixelSyncApp::processSDLEvent(const SDL_Event &event)
 }
 
 
+void PixelSyncApp::updateTimeStep(float dt)
+{
+    // The voxel ray tracer and the ray tracer use their own copy of the first time step.
+    if (!transparentObject.isLoaded()) {
+        return;
+    }
+
+    int numTimeSteps = int(timeStepSequence->getNumTimeSteps());
+    if (playTimeSteps) {
+        timeStepTimer += dt * timeStepsPerSecond;
+        if (timeStepTimer >= 1.0f) {
+            // Don't skip time steps if the prefetch thread can't keep up, but wait until the current one is displayed.
+            if (displayedTimeStep == timeStep) {
+                timeStep = (timeStep + 1) % numTimeSteps;
+            }
+            timeStepTimer = std::min(timeStepTimer - 1.0f, 1.0f);
+        }
+    }
+    if (timeStep == displayedTimeStep) {
+        return;
+    }
+
+    // If the time step isn't loaded yet, the last one is rendered until it is ready.
+    TimeStepDataPtr timeStepData = timeStepSequence->requestTimeStep(size_t(timeStep));
+    if (!timeStepData) {
+        return;
+    }
+    transparentObject = createMeshRenderer(timeStepData->mesh, transparencyShader, shuffleGeometry,
+            useProgrammableFetch, programmableFetchLayout, lineRadius, shuffleSeed);
+    updateVertexAttributeEncodingDefines();
+    if (shaderMode == SHADER_MODE_SCIENTIFIC_ATTRIBUTE) {
+        recomputeHistogramForMesh();
+    }
+    displayedTimeStep = timeStep;
+    reRender = true;
+}
+
 void PixelSyncApp::update(float dt)
 {
     AppLogic::update(dt);
@@ -2081,6 +2303,10 @@ void PixelSyncApp::update(float dt)
     }
     //recordingTime = 0.0f;
 
+    if (timeStepSequence) {
+        updateTimeStep(dt);
+    }
+
     if (Keyboard->keyPressed(SDLK_c)) {
         // ControlPoint(0.0f, 0.3f, 0.325f, 1.005f, 0.0f, 0.0f),
         std::cout << "ControlPoint(" << outputTime << ", " << camera->getPosition().x << ", " << camera->getPosition().y
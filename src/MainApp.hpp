@@ -21,6 +21,7 @@
 
 #include "Utils/VideoWriter.hpp"
 #include "Utils/MeshSerializer.hpp"
+#include "Utils/TimeStepSequence.hpp"
 #include "Utils/CameraPath.hpp"
 #include "Utils/ImportanceCriteria.hpp"
 #include "OIT/OIT_Renderer.hpp"
@@ -130,6 +131,9 @@ private:
     ShaderMode shaderMode = SHADER_MODE_PSEUDO_PHONG;
     std::string modelFilenamePure;
     bool shuffleGeometry = false; // For testing order dependency of OIT algorithms on triangle order
+    uint32_t shuffleSeed = 0;
+    bool clusterCulling = true; // CPU frustum and transfer function opacity culling of the mesh clusters
+    ClusterCullingStatistics lastClusterCullingStatistics;
     std::vector<std::string> gatherShaderIDs;
 
     // Off-screen rendering
@@ -144,6 +148,15 @@ private:
     glm::mat4 scaling;
     sgl::AABB3 boundingBox;
 
+    // Time-dependent data sets (sequence of binmesh files, one per time step)
+    void updateTimeStep(float dt);
+    std::shared_ptr<TimeStepSequence> timeStepSequence;
+    int timeStep = 0; // The time step requested from the sequence
+    int displayedTimeStep = 0; // The time step "transparentObject" was created from
+    bool playTimeSteps = false;
+    float timeStepsPerSecond = 10.0f;
+    float timeStepTimer = 0.0f;
+
     // User interface
     bool showSettingsWindow = true;
     int usedModelIndex = 0;
@@ -159,6 +172,8 @@ private:
     bool useLinearRGB = true;
     float lineRadius = 0.001f;
     float pointRadius = 0.0002f;
+    bool pointLod = true; // Select the level of detail of point data sets based on the camera distance
+    float pointLodMaxVoxelPixels = 2.0f;
     std::vector<float> fpsArray;
     size_t fpsArrayOffset = 0;
     glm::vec3 lightDirection = glm::vec3(1.0, 0.0, 0.0);
@@ -180,7 +195,7 @@ private:
     ImportanceCriterionTypeAneurysm importanceCriterionTypeAneurysm
             = IMPORTANCE_CRITERION_ANEURYSM_VORTICITY;
     ImportanceCriterionTypeWCB importanceCriterionTypeWCB
-            = IMPORTANCE_CRITERION_WCB_CURVATURE;
+            = IMPORTANCE_CRITERION_WCB_PRESSURE;
     ImportanceCriterionTypeConvectionRolls importanceCriterionTypeConvectionRolls
             = IMPORTANCE_CRITERION_CONVECTION_ROLLS_VORTICITY;
     ImportanceCriterionTypeCFD importanceCriterionTypeCFD
@@ -191,13 +206,19 @@ private:
     float minCriterionValue = 0.0f, maxCriterionValue = 1.0f;
     bool useGeometryShader = false;
     bool useProgrammableFetch = false;
-    bool programmableFetchUseAoS = true; // Array of structs
+    ProgrammableFetchLayout programmableFetchLayout = PROGRAMMABLE_FETCH_LAYOUT_AOS;
+    void updateProgrammableFetchLayoutDefines();
     void changeImportanceCriterionType();
     void recomputeHistogramForMesh();
 
     // Hair rendering
     bool colorArrayMode = false;
 
+    // Quantized vertex attributes of the loaded mesh (decoded in the vertex shaders, see createMeshRenderer)
+    bool quantizedPositionsMode = false;
+    bool octahedralDirectionsMode = false;
+    void updateVertexAttributeEncodingDefines();
+
     // Continuous rendering: Re-render each frame or only when scene changes?
     bool continuousRendering = false;
     bool reRender = true;
@@ -20,17 +20,19 @@ AutoPerfMeasurer::AutoPerfMeasurer(std::vector<InternalState> _states,
         const std::string &_csvFilename, const std::string &_depthComplexityFilename,
         std::function<void(const InternalState&)> _newStateCallback, bool measureTimeCoherence)
        : states(_states), currentStateIndex(0), newStateCallback(_newStateCallback), file(_csvFilename),
-         depthComplexityFile(_depthComplexityFilename), errorMetricFile("error_metrics.csv"), perfFile("performance_list.csv"), timeCoherence(measureTimeCoherence)
+         depthComplexityFile(_depthComplexityFilename), errorMetricFile("error_metrics.csv"), perfFile("performance_list.csv"),
+         clusterCullingFile("cluster_culling.csv"), timeCoherence(measureTimeCoherence)
 {
     sgl::FileUtils::get()->ensureDirectoryExists("images/");
 
     // Write header
     file.writeRow({"Name", "Average Time (ms)", "Image Filename", "Memory (GB)", "Buffer Size (GB)",
-                   "SSIM", "RMSE", "PSNR", "Time Stamp (s), Frame Time (ns)"});
+                   "SSIM", "RMSE", "PSNR", "Shuffle Seed", "Time Stamp (s), Frame Time (ns)"});
     depthComplexityFile.writeRow({"Current State", "Frame Number", "Min Depth Complexity", "Max Depth Complexity",
                                   "Avg Depth Complexity Used", "Avg Depth Complexity All", "Total Number of Fragments"});
     errorMetricFile.writeRow({"Name", "Error measures"});
     perfFile.writeRow({"Name", "Time per frame (ms)"});
+    clusterCullingFile.writeRow({"Current State", "Frame Number", "Culled Fraction", "Culling Time (ms)"});
     setPerformanceMeasurer(this);
 
     // Set initial state
@@ -45,6 +47,7 @@ AutoPerfMeasurer::~AutoPerfMeasurer()
     depthComplexityFile.close();
     errorMetricFile.close();
     perfFile.close();
+    clusterCullingFile.close();
     //perfTimeProfileFile.close();
 }
 
@@ -125,6 +128,7 @@ void AutoPerfMeasurer::writeCurrentModeData()
         file.writeCell(sgl::toString(0));
         file.writeCell(sgl::toString(0));
 //    }
+    file.writeCell(currentState.testShuffleGeometry ? sgl::toString(currentState.shuffleSeed) : "");
 
     auto performanceProfile = timerGL.getCurrentFrameTimeList();
     for (auto &perfPair : performanceProfile) {
@@ -271,6 +275,16 @@ void AutoPerfMeasurer::pushDepthComplexityFrame(uint64_t minComplexity, uint64_t
     depthComplexityFrameNumber++;
 }
 
+void AutoPerfMeasurer::pushClusterCullingFrame(float culledFraction, float cullingTimeMS)
+{
+    clusterCullingFile.writeCell(currentState.name);
+    clusterCullingFile.writeCell(sgl::toString((int)clusterCullingFrameNumber));
+    clusterCullingFile.writeCell(sgl::toString(culledFraction));
+    clusterCullingFile.writeCell(sgl::toString(cullingTimeMS));
+    clusterCullingFile.newRow();
+    clusterCullingFrameNumber++;
+}
+
 void AutoPerfMeasurer::setCurrentAlgorithmBufferSizeBytes(size_t numBytes)
 {
     currentAlgorithmsBufferSizeBytes = numBytes;
@@ -39,6 +39,9 @@ public:
     void pushDepthComplexityFrame(uint64_t minComplexity, uint64_t maxComplexity, float avgUsed, float avgAll,
             uint64_t totalNumFragments);
 
+    // Called by the application after each frame if the mesh renderer uses cluster culling
+    void pushClusterCullingFrame(float culledFraction, float cullingTimeMS);
+
     // Called by OIT algorithms
     void setCurrentAlgorithmBufferSizeBytes(size_t numBytes);
 
@@ -71,7 +74,9 @@ private:
     CsvWriter depthComplexityFile;
     CsvWriter errorMetricFile;
     CsvWriter perfFile;
+    CsvWriter clusterCullingFile;
     size_t depthComplexityFrameNumber = 0;
+    size_t clusterCullingFrameNumber = 0;
     size_t currentAlgorithmsBufferSizeBytes = 0;
 
     // For making screenshots and computing reference metrics
@@ -37,6 +37,7 @@ const char *const MODEL_FILENAMES[] = {
         "../../../../../../media/christoph/Elements/Datasets/Meshes/RichtmyerMeshkov/rm-80-isosurface.bobj",
         "PointDatasets/0.000xv000.dat",
         "PointDatasets/0.000xv001.dat",
+        "PointDatasets/CosmicWeb",
         "PointDatasets/OFC-wasatch-50Mpps.uda.001/t06002/timestep.xml",
         "Rings/rings.obj",
         "Trajectories/9213_streamlines.obj",
@@ -49,6 +50,7 @@ const char *const MODEL_FILENAMES[] = {
         "Trajectories/tornado.obj",
         "CFD/driven_cavity-streamlines.binlines",
         "CFD/rayleigh_benard_convection_8-2-1-streamlines.binlines",
+        "Trajectories/TimeSeries",
         "Models/Ship_04.obj",
 
 //        "WCB/EUR_LL10/20121015_00_lagranto_ensemble_forecast__START_20121017_06pressureDiff.nc",
@@ -85,6 +87,7 @@ const char *const MODEL_DISPLAYNAMES[] = {
         "Meshkov (80)",
         "Cosmic Web 0",
         "Cosmic Web 1",
+        "Cosmic Web (all bricks)",
         "Uintah Particle Data Set",
         "Rings",
         "Aneurysm",
@@ -97,6 +100,7 @@ const char *const MODEL_DISPLAYNAMES[] = {
         "Tornado",
         "Driven Cavity",
         "Rayleigh-Benard Convection",
+        "Time Series",
         "Ship",
 
 //        "Ponytail",
@@ -197,7 +201,8 @@ struct InternalState
                && this->useStencilBuffer == rhs.useStencilBuffer
                && this->testNoInvocationInterlock == rhs.testNoInvocationInterlock
                && this->testNoAtomicOperations == rhs.testNoAtomicOperations
-               && this->testShuffleGeometry == rhs.testShuffleGeometry;
+               && this->testShuffleGeometry == rhs.testShuffleGeometry
+               && this->shuffleSeed == rhs.shuffleSeed;
     }
     bool operator!=(const InternalState &rhs) const {
         return !(*this == rhs);
@@ -219,6 +224,7 @@ struct InternalState
     bool testNoInvocationInterlock = false; // Test without pixel sync
     bool testNoAtomicOperations = false; // Test without atomic operations
     bool testShuffleGeometry = false;
+    uint32_t shuffleSeed = 0; // Seed of the geometry shuffling (the same seed results in the same order)
     bool testPixelSyncUnordered = true;
 };
 
@@ -36,6 +36,8 @@
 #include <Utils/TrajectoryLoader.hpp>
 
 #include "../Utils/TrajectoryFile.hpp"
+#include "../Utils/DerivedDataCache.hpp"
+#include "../Utils/MeshQuantization.hpp"
 #include "OIT_RayTracing.hpp"
 #include "../OIT/BufferSizeWatch.hpp"
 
@@ -130,13 +132,21 @@ void OIT_RayTracing::fromFile(
 
     if (useTriangleMesh) {
         std::cout << "---- file name is " << filename << std::endl;
-        std::string modelFilenameBinmesh = sgl::FileUtils::get()->removeExtension(filename) + ".binmesh";
+        DerivedDataKey binmeshKey(filename, "binmesh", MESH_FORMAT_VERSION);
+        binmeshKey.addParameter("trajectoryType", int(trajectoryType));
+        binmeshKey.addParameter("lineRadius", lineRadius);
+        binmeshKey.addParameter("tubesGPU", true);
+        binmeshKey.addParameter("importanceCriteria", IMPORTANCE_CRITERIA_VERSION);
+        addMeshQuantizationParameters(binmeshKey, getMeshQuantizationSettings());
+        std::string modelFilenameBinmesh = DerivedDataCache::get()->getArtifactFilename(binmeshKey);
         BinaryMesh binmesh;
-        if (!sgl::FileUtils::get()->exists(modelFilenameBinmesh)) {
+        if (!DerivedDataCache::get()->lookup(modelFilenameBinmesh)) {
             //convertTrajectoryDataToBinaryTriangleMesh(trajectoryType, filename, modelFilenameBinmesh, lineRadius);
             convertTrajectoryDataToBinaryTriangleMeshGPU(trajectoryType, filename, modelFilenameBinmesh, lineRadius);
+            DerivedDataCache::get()->commit(modelFilenameBinmesh);
         }
         readMesh3D(modelFilenameBinmesh, binmesh);
+        dequantizeBinaryMesh(binmesh);
         BinarySubMesh &submesh = binmesh.submeshes.at(0);
         std::vector<uint32_t> &indices = submesh.indices;
         std::vector<glm::vec3> vertices;
@@ -120,16 +120,16 @@ void RTRenderBackend::loadTrajectories(const std::string &filename, const Trajec
     if(numOfLines > threshold) needSplit = true;
     for(int i = 0; i < trajectories.size(); i++){
         // one line 
-        Trajectory trajectory = trajectories[i];
+        ConstTrajectoryView trajectory = trajectories[i];
         // positions and attributes for one line
-        std::vector<glm::vec3> &positions = trajectory.positions;
-        std::vector<std::vector<float>> &attributes = trajectory.attributes;
+        const ConstTrajectoryView::PositionsView &positions = trajectory.positions;
+        const ConstTrajectoryView::AttributesView &attributes = trajectory.attributes;
         // std::cout << "node size " << trajectory.positions.size() << std::endl;
         ospcommon::vec4f color;
         // color.x = 1.0; color.y = 0.0; color.z = 0.0; color.w = 1.0;
 
         // std::cout << "point size of line #" << i << " is " << positions.size() << std::endl;
-        std::vector<float> &attr = attributes.at(0);
+        ArrayView<const float> attr = attributes.at(0);
         // std::cout << "attribute size " << attr.size() << std::endl;
         for(int k = 0; k < attr.size(); k++){
             float r = attr[k];
@@ -0,0 +1,40 @@
+//
+// Created by agent on 19.10.26.
+//
+
+#include <string>
+#include <Utils/File/Logfile.hpp>
+
+#include "DataProcessingTests.hpp"
+
+bool runDataProcessingTests()
+{
+    struct DataProcessingTest {
+        const char *name;
+        bool (*function)();
+    };
+    const DataProcessingTest tests[] = {
+            { "testImportanceCriteriaBatched", testImportanceCriteriaBatched },
+            { "testProgrammableFetchBuffers", testProgrammableFetchBuffers },
+            { "testVertexFaceAdjacency", testVertexFaceAdjacency },
+            { "testKDTree", testKDTree },
+            { "testMeshClusters", testMeshClusters },
+            { "testParseMesh3D", testParseMesh3D },
+    };
+
+    int numFailedTests = 0;
+    for (const DataProcessingTest &test : tests) {
+        sgl::Logfile::get()->writeInfo(std::string() + "Running " + test.name + "...");
+        if (test.function()) {
+            sgl::Logfile::get()->writeInfo(std::string() + test.name + ": Passed.");
+        } else {
+            sgl::Logfile::get()->writeError(std::string() + test.name + ": Failed.");
+            numFailedTests++;
+        }
+    }
+
+    int numTests = int(sizeof(tests) / sizeof(*tests));
+    sgl::Logfile::get()->writeInfo(std::string() + "Data processing tests: " + std::to_string(numTests - numFailedTests)
+            + " of " + std::to_string(numTests) + " passed.");
+    return numFailedTests == 0;
+}
@@ -0,0 +1,52 @@
+//
+// Created by agent on 19.10.26.
+//
+
+#ifndef PIXELSYNCOIT_DATAPROCESSINGTESTS_HPP
+#define PIXELSYNCOIT_DATAPROCESSINGTESTS_HPP
+
+/**
+ * Self-checks and micro benchmarks of the CPU data processing code (loaders, converters and buffer builders). They run
+ * on synthetic data, compare optimized code paths against simple reference implementations and write the results and
+ * timings to the log file. Start the program with "--run-data-tests" to run all of them (see Main.cpp).
+ * Each function returns whether the check passed.
+ */
+
+/// Compares computeImportanceCriteriaBatched against the scalar functions in ImportanceCriteria.cpp.
+bool testImportanceCriteriaBatched();
+
+/**
+ * Checks the offsets and strides of buildSharedLinePointBuffer and buildPackedUnorm16AttributeBuffer by fetching the
+ * values like the shader does, and the unorm16 round trip of the attributes.
+ */
+bool testProgrammableFetchBuffers();
+
+/**
+ * Compares the parallel vertex-face adjacency build of computeNormals against a serial build (with timings), and checks
+ * that computeNormals skips vertices not referenced by any triangle.
+ */
+bool testVertexFaceAdjacency();
+
+/**
+ * Compares the queries of KDTree against a brute force search on a clustered point set, and measures the build time
+ * and the time of batched queries.
+ */
+bool testKDTree();
+
+/**
+ * Checks that buildMeshClusters covers the index buffers of a triangle and a line submesh with valid cluster sizes,
+ * and compares the bounds, normal cones and attribute ranges of the clusters against a brute force pass.
+ */
+bool testMeshClusters();
+
+/**
+ * CPU benchmark of the parse stage of parseMesh3D on a synthetic line mesh with one million vertices: Times readMesh3D
+ * and the unpack/interleave pass of createMeshRenderer for the AoS and the shared programmable fetch layout (i.e.,
+ * everything before the upload, no OpenGL context needed), and checks the results.
+ */
+bool testParseMesh3D();
+
+/// Runs all tests above and returns whether all of them passed.
+bool runDataProcessingTests();
+
+#endif //PIXELSYNCOIT_DATAPROCESSINGTESTS_HPP
@@ -0,0 +1,183 @@
+//
+// Created by agent on 19.10.26.
+//
+
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+
+#include <Math/Math.hpp>
+#include <Utils/File/Logfile.hpp>
+
+#include "../Utils/ImportanceCriteria.hpp"
+#include "../Utils/ImportanceCriteriaBatched.hpp"
+#include "DataProcessingTests.hpp"
+
+static std::vector<float> computeImportanceCriterionScalar(
+        ImportanceCriterionKernel kernel, std::vector<glm::vec3> &positions, std::vector<float> &attributes)
+{
+    switch (kernel) {
+        case IMPORTANCE_CRITERION_KERNEL_ATTRIBUTE:
+            return attributes;
+        case IMPORTANCE_CRITERION_KERNEL_CURVATURE:
+            return computeCurvature(positions);
+        case IMPORTANCE_CRITERION_KERNEL_SEGMENT_LENGTH:
+            return computeSegmentLengths(positions);
+        case IMPORTANCE_CRITERION_KERNEL_SEGMENT_ATTRIBUTE_DIFFERENCE:
+            return computeSegmentAttributeDifference(positions, attributes);
+        case IMPORTANCE_CRITERION_KERNEL_TOTAL_ATTRIBUTE_DIFFERENCE:
+            return computeTotalAttributeDifference(positions, attributes);
+        case IMPORTANCE_CRITERION_KERNEL_ANGLE_OF_ASCENT:
+            return computeAngleOfAscent(positions);
+        case IMPORTANCE_CRITERION_KERNEL_SEGMENT_HEIGHT_DIFFERENCE:
+            return computeSegmentHeightDifference(positions);
+        default:
+            return std::vector<float>(positions.size(), 0.0f);
+    }
+}
+
+/**
+ * Random walk trajectories with 1 to 200 points. 2% of the segments are degenerate (i.e., duplicate points, which
+ * need the sequential curvature fallback) and 2% are vertical (angle of ascent of one).
+ */
+static void createRandomTrajectories(
+        size_t numTrajectories, std::vector<std::vector<glm::vec3>> &trajectoryPositions,
+        std::vector<std::vector<float>> &trajectoryAttributes, TrajectoryPointArrays &points)
+{
+    std::mt19937 generator(17);
+    std::uniform_real_distribution<float> valueDistribution(-1.0f, 1.0f);
+    std::uniform_int_distribution<size_t> lengthDistribution(1, 200);
+    std::uniform_int_distribution<int> segmentTypeDistribution(0, 99);
+
+    trajectoryPositions.resize(numTrajectories);
+    trajectoryAttributes.resize(numTrajectories);
+    points.trajectoryOffsets.push_back(0);
+    for (size_t i = 0; i < numTrajectories; i++) {
+        size_t n = lengthDistribution(generator);
+        glm::vec3 position(0.0f);
+        float attribute = 0.0f;
+        for (size_t j = 0; j < n; j++) {
+            int segmentType = segmentTypeDistribution(generator);
+            float dx = valueDistribution(generator);
+            float dy = valueDistribution(generator);
+            float dz = valueDistribution(generator);
+            if (segmentType < 2) {
+                // Duplicate point
+            } else if (segmentType < 4) {
+                position.y += std::abs(dy) * 0.01f;
+            } else {
+                position += glm::vec3(dx, dy, dz) * 0.01f;
+            }
+            attribute += valueDistribution(generator);
+
+            trajectoryPositions.at(i).push_back(position);
+            trajectoryAttributes.at(i).push_back(attribute);
+            points.positionsX.push_back(position.x);
+            points.positionsY.push_back(position.y);
+            points.positionsZ.push_back(position.z);
+            points.attributes.push_back(attribute);
+        }
+        points.trajectoryOffsets.push_back(points.positionsX.size());
+    }
+}
+
+bool testImportanceCriteriaBatched()
+{
+    const size_t NUM_TRAJECTORIES = 20000;
+    // The criteria using the polynomial acos approximation are angles normalized to [0, 1]. Close to an angle of zero,
+    // acos is ill-conditioned (one ulp of the cosine changes the normalized angle by 1e-4), and the two versions
+    // compute the cosine with different rounding. Thus, these criteria are compared by the cosine of the angle.
+    const float ANGLE_COSINE_TOLERANCE = 1e-6f;
+    // Relative tolerance of all other criteria (the operations are the same, but may be contracted differently).
+    const float RELATIVE_TOLERANCE = 1e-6f;
+
+    std::vector<std::vector<glm::vec3>> trajectoryPositions;
+    std::vector<std::vector<float>> trajectoryAttributes;
+    TrajectoryPointArrays points;
+    createRandomTrajectories(NUM_TRAJECTORIES, trajectoryPositions, trajectoryAttributes, points);
+    size_t numPoints = points.getNumPoints();
+
+    std::vector<ImportanceCriterionKernel> kernels;
+    for (int k = 0; k < NUM_IMPORTANCE_CRITERION_KERNELS; k++) {
+        kernels.push_back(ImportanceCriterionKernel(k));
+    }
+
+    // The scalar functions don't support trajectories without a line segment. The batched kernels write zero for the
+    // segment criteria of these trajectories.
+    auto startScalar = std::chrono::system_clock::now();
+    std::vector<std::vector<float>> referenceCriteria(kernels.size(), std::vector<float>(numPoints, 0.0f));
+    for (size_t i = 0; i < NUM_TRAJECTORIES; i++) {
+        size_t offset = points.trajectoryOffsets.at(i);
+        bool hasSegments = trajectoryPositions.at(i).size() >= 2;
+        for (size_t k = 0; k < kernels.size(); k++) {
+            if (!hasSegments && kernels.at(k) != IMPORTANCE_CRITERION_KERNEL_ATTRIBUTE
+                    && kernels.at(k) != IMPORTANCE_CRITERION_KERNEL_TOTAL_ATTRIBUTE_DIFFERENCE) {
+                continue;
+            }
+            std::vector<float> criterion = computeImportanceCriterionScalar(
+                    kernels.at(k), trajectoryPositions.at(i), trajectoryAttributes.at(i));
+            std::copy(criterion.begin(), criterion.end(), referenceCriteria.at(k).begin() + offset);
+        }
+    }
+    auto endScalar = std::chrono::system_clock::now();
+
+    auto startBatched = std::chrono::system_clock::now();
+    std::vector<std::vector<float>> batchedCriteria;
+    computeImportanceCriteriaBatched(points, kernels, batchedCriteria);
+    auto endBatched = std::chrono::system_clock::now();
+
+    auto elapsedScalar = std::chrono::duration_cast<std::chrono::milliseconds>(endScalar - startScalar);
+    auto elapsedBatched = std::chrono::duration_cast<std::chrono::milliseconds>(endBatched - startBatched);
+    sgl::Logfile::get()->writeInfo(std::string() + "Computational time to compute "
+            + std::to_string(kernels.size()) + " importance criteria for " + std::to_string(numPoints)
+            + " points with the scalar functions: " + std::to_string(elapsedScalar.count()));
+    sgl::Logfile::get()->writeInfo(std::string() + "Computational time to compute "
+            + std::to_string(kernels.size()) + " importance criteria for " + std::to_string(numPoints)
+            + " points with the batched kernels (all threads): " + std::to_string(elapsedBatched.count()));
+
+    bool passed = true;
+    for (size_t k = 0; k < kernels.size(); k++) {
+        bool isAngle = kernels.at(k) == IMPORTANCE_CRITERION_KERNEL_CURVATURE
+                || kernels.at(k) == IMPORTANCE_CRITERION_KERNEL_ANGLE_OF_ASCENT;
+        const std::vector<float> &reference = referenceCriteria.at(k);
+        const std::vector<float> &batched = batchedCriteria.at(k);
+        if (batched.size() != numPoints) {
+            sgl::Logfile::get()->writeError(std::string() + "Error in testImportanceCriteriaBatched: Kernel "
+                    + std::to_string(k) + " returned " + std::to_string(batched.size()) + " values instead of "
+                    + std::to_string(numPoints) + ".");
+            passed = false;
+            continue;
+        }
+
+        float maxError = 0.0f;
+        size_t numMismatches = 0;
+        for (size_t i = 0; i < numPoints; i++) {
+            float error = std::abs(batched.at(i) - reference.at(i));
+            bool isEqual;
+            if (isAngle) {
+                float cosineError = std::abs(
+                        std::cos(sgl::PI * batched.at(i)) - std::cos(sgl::PI * reference.at(i)));
+                isEqual = cosineError <= ANGLE_COSINE_TOLERANCE;
+            } else {
+                isEqual = error <= RELATIVE_TOLERANCE * std::max(1.0f, std::abs(reference.at(i)));
+            }
+            // NaN values are never equal
+            if (!isEqual) {
+                numMismatches++;
+            }
+            if (error > maxError) {
+                maxError = error;
+            }
+        }
+        sgl::Logfile::get()->writeInfo(std::string() + "testImportanceCriteriaBatched: Kernel " + std::to_string(k)
+                + ": Maximum difference to the scalar function " + std::to_string(maxError) + ".");
+        if (numMismatches != 0) {
+            sgl::Logfile::get()->writeError(std::string() + "Error in testImportanceCriteriaBatched: Kernel "
+                    + std::to_string(k) + " differs from the scalar function for " + std::to_string(numMismatches)
+                    + " points.");
+            passed = false;
+        }
+    }
+    return passed;
+}
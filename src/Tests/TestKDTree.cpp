@@ -0,0 +1,243 @@
+//
+// Created by agent on 19.10.26.
+//
+
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+
+#include <Utils/File/Logfile.hpp>
+
+#include "../Utils/KDTree.hpp"
+#include "DataProcessingTests.hpp"
+
+/**
+ * Points in [-0.5, 0.5]^3 like the normalized point data sets: 3/4 of them in Gaussian clusters of different sizes,
+ * the rest uniformly distributed, and 1% duplicates of other points. The cluster sizes differ by at most a factor of
+ * three, as the radius of the batched queries is chosen for the median density.
+ */
+static void createClusteredPoints(size_t numPoints, std::vector<glm::vec3> &points, std::mt19937 &generator)
+{
+    const int NUM_CLUSTERS = 50;
+    std::uniform_real_distribution<float> uniformDistribution(-0.5f, 0.5f);
+    std::uniform_real_distribution<float> clusterSizeDistribution(0.01f, 0.03f);
+    std::normal_distribution<float> normalDistribution(0.0f, 1.0f);
+    std::vector<glm::vec3> clusterCenters;
+    std::vector<float> clusterSizes;
+    for (int i = 0; i < NUM_CLUSTERS; i++) {
+        clusterCenters.push_back(glm::vec3(
+                uniformDistribution(generator), uniformDistribution(generator), uniformDistribution(generator)));
+        clusterSizes.push_back(clusterSizeDistribution(generator));
+    }
+
+    points.clear();
+    for (size_t i = 0; i < numPoints; i++) {
+        if (i % 100 == 99) {
+            points.push_back(points.at(std::uniform_int_distribution<size_t>(0, points.size() - 1)(generator)));
+        } else if (i % 4 == 3) {
+            points.push_back(glm::vec3(
+                    uniformDistribution(generator), uniformDistribution(generator), uniformDistribution(generator)));
+        } else {
+            int cluster = int(i % NUM_CLUSTERS);
+            glm::vec3 offset(
+                    normalDistribution(generator), normalDistribution(generator), normalDistribution(generator));
+            points.push_back(clusterCenters.at(cluster) + offset * clusterSizes.at(cluster));
+        }
+    }
+}
+
+/// Same operations as the distance test of the leaves in KDTree.cpp.
+static inline float getDistanceSquared(const glm::vec3 &p0, const glm::vec3 &p1)
+{
+    float dx = p0.x - p1.x;
+    float dy = p0.y - p1.y;
+    float dz = p0.z - p1.z;
+    return dx * dx + dy * dy + dz * dz;
+}
+
+/// Compares one query of each type against a brute force search over all points.
+static bool testKDTreeQueries(
+        const KDTree &kdTree, const std::vector<glm::vec3> &points, const glm::vec3 &queryPoint, float radius, int k)
+{
+    // The k-d tree may compute the distances with different rounding (e.g., contracted to FMA instructions).
+    const float DISTANCE_TOLERANCE = 1e-5f;
+
+    std::vector<float> distancesSquared(points.size());
+    for (size_t i = 0; i < points.size(); i++) {
+        distancesSquared.at(i) = getDistanceSquared(points.at(i), queryPoint);
+    }
+    std::vector<float> sortedDistancesSquared = distancesSquared;
+    std::partial_sort(
+            sortedDistancesSquared.begin(), sortedDistancesSquared.begin() + k, sortedDistancesSquared.end());
+
+    // k-nearest neighbors: The distances need to match the k smallest distances (the indices may differ for ties).
+    std::vector<uint32_t> neighborIndices;
+    std::vector<float> neighborDistancesSquared;
+    kdTree.findKNearestNeighbors(queryPoint, k, neighborIndices, &neighborDistancesSquared);
+    if (neighborIndices.size() != size_t(std::min(size_t(k), points.size()))) {
+        sgl::Logfile::get()->writeError(std::string() + "Error in testKDTree: findKNearestNeighbors returned "
+                + std::to_string(neighborIndices.size()) + " neighbors.");
+        return false;
+    }
+    for (size_t i = 0; i < neighborIndices.size(); i++) {
+        float tolerance = DISTANCE_TOLERANCE * std::max(sortedDistancesSquared.at(i), 1e-12f);
+        if (std::abs(neighborDistancesSquared.at(i) - sortedDistancesSquared.at(i)) > tolerance
+                || std::abs(distancesSquared.at(neighborIndices.at(i)) - neighborDistancesSquared.at(i)) > tolerance) {
+            sgl::Logfile::get()->writeError(std::string() + "Error in testKDTree: Neighbor " + std::to_string(i)
+                    + " of findKNearestNeighbors differs from the brute force search.");
+            return false;
+        }
+    }
+
+    // Nearest point with a maximum distance, which is the distance of the k-th neighbor or less.
+    float maxDistance = std::sqrt(sortedDistancesSquared.at(k - 1)) * 0.5f;
+    uint32_t nearestIndex = kdTree.findNearestPoint(queryPoint, maxDistance);
+    bool hasNearestPoint = sortedDistancesSquared.front() <= maxDistance * maxDistance;
+    if (hasNearestPoint != (nearestIndex != KDTREE_INVALID_INDEX) || (nearestIndex != KDTREE_INVALID_INDEX
+            && distancesSquared.at(nearestIndex) > sortedDistancesSquared.front()
+                    + DISTANCE_TOLERANCE * std::max(sortedDistancesSquared.front(), 1e-12f))) {
+        sgl::Logfile::get()->writeError("Error in testKDTree: findNearestPoint differs from the brute force search.");
+        return false;
+    }
+
+    // Radius query: All points clearly inside need to be found, and no point clearly outside.
+    std::vector<uint32_t> radiusIndices;
+    kdTree.findPointsInRadius(queryPoint, radius, radiusIndices);
+    std::vector<bool> isFound(points.size(), false);
+    float radiusSquared = radius * radius;
+    for (uint32_t index : radiusIndices) {
+        if (isFound.at(index) || distancesSquared.at(index) > radiusSquared * (1.0f + DISTANCE_TOLERANCE)) {
+            sgl::Logfile::get()->writeError("Error in testKDTree: findPointsInRadius returned a wrong point.");
+            return false;
+        }
+        isFound.at(index) = true;
+    }
+    for (size_t i = 0; i < points.size(); i++) {
+        if (!isFound.at(i) && distancesSquared.at(i) < radiusSquared * (1.0f - DISTANCE_TOLERANCE)) {
+            sgl::Logfile::get()->writeError("Error in testKDTree: findPointsInRadius missed a point.");
+            return false;
+        }
+    }
+
+    // Box query: The comparisons are exact.
+    sgl::AABB3 box(queryPoint - glm::vec3(radius), queryPoint + glm::vec3(radius));
+    std::vector<uint32_t> boxIndices;
+    kdTree.findPointsInAABB(box, boxIndices);
+    std::vector<uint32_t> referenceBoxIndices;
+    for (size_t i = 0; i < points.size(); i++) {
+        const glm::vec3 &p = points.at(i);
+        if (p.x >= box.getMinimum().x && p.y >= box.getMinimum().y && p.z >= box.getMinimum().z
+                && p.x <= box.getMaximum().x && p.y <= box.getMaximum().y && p.z <= box.getMaximum().z) {
+            referenceBoxIndices.push_back(uint32_t(i));
+        }
+    }
+    std::sort(boxIndices.begin(), boxIndices.end());
+    if (boxIndices != referenceBoxIndices) {
+        sgl::Logfile::get()->writeError("Error in testKDTree: findPointsInAABB differs from the brute force search.");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Measures the time of batched k-nearest neighbor and radius queries for (up to) one million of the points and checks
+ * that they return the same results as the single queries. The radius is chosen such that the radius queries find
+ * about as many points as the k-nearest neighbor queries.
+ */
+static bool testKDTreeBatchedQueries(const KDTree &kdTree, const std::vector<glm::vec3> &points, int k)
+{
+    const size_t MAX_NUM_QUERIES = 1000000;
+    const size_t NUM_COMPARED_QUERIES = 1000;
+
+    size_t queryStride = std::max(points.size() / MAX_NUM_QUERIES, size_t(1));
+    std::vector<glm::vec3> queryPoints;
+    for (size_t i = 0; i < points.size(); i += queryStride) {
+        queryPoints.push_back(points.at(i));
+    }
+
+    auto startKnn = std::chrono::system_clock::now();
+    std::vector<uint32_t> neighborIndices;
+    std::vector<float> neighborDistancesSquared;
+    kdTree.findKNearestNeighborsBatched(queryPoints, k, neighborIndices, &neighborDistancesSquared);
+    auto endKnn = std::chrono::system_clock::now();
+    auto elapsedKnn = std::chrono::duration_cast<std::chrono::milliseconds>(endKnn - startKnn);
+    sgl::Logfile::get()->writeInfo(std::string() + "Computational time for " + std::to_string(queryPoints.size())
+            + " " + std::to_string(k) + "-nearest neighbor queries: " + std::to_string(elapsedKnn.count()));
+
+    // Median distance of the k-th neighbor
+    std::vector<float> kthDistancesSquared;
+    for (size_t i = 0; i < queryPoints.size(); i++) {
+        kthDistancesSquared.push_back(neighborDistancesSquared.at(i * k + k - 1));
+    }
+    std::nth_element(kthDistancesSquared.begin(), kthDistancesSquared.begin() + kthDistancesSquared.size() / 2,
+            kthDistancesSquared.end());
+    float radius = std::sqrt(kthDistancesSquared.at(kthDistancesSquared.size() / 2));
+
+    auto startRadius = std::chrono::system_clock::now();
+    std::vector<size_t> resultOffsets;
+    std::vector<uint32_t> resultIndices;
+    kdTree.findPointsInRadiusBatched(queryPoints, radius, resultOffsets, resultIndices);
+    auto endRadius = std::chrono::system_clock::now();
+    auto elapsedRadius = std::chrono::duration_cast<std::chrono::milliseconds>(endRadius - startRadius);
+    sgl::Logfile::get()->writeInfo(std::string() + "Computational time for " + std::to_string(queryPoints.size())
+            + " radius queries (" + std::to_string(double(resultIndices.size()) / double(queryPoints.size()))
+            + " points on average): " + std::to_string(elapsedRadius.count()));
+
+    // The batched queries use the same traversal, so the results need to be identical.
+    for (size_t i = 0; i < std::min(queryPoints.size(), NUM_COMPARED_QUERIES); i++) {
+        std::vector<uint32_t> indices;
+        kdTree.findKNearestNeighbors(queryPoints.at(i), k, indices);
+        if (!std::equal(indices.begin(), indices.end(), neighborIndices.begin() + i * k)) {
+            sgl::Logfile::get()->writeError("Error in testKDTree: findKNearestNeighborsBatched differs from "
+                    "findKNearestNeighbors.");
+            return false;
+        }
+        indices.clear();
+        kdTree.findPointsInRadius(queryPoints.at(i), radius, indices);
+        if (indices.size() != resultOffsets.at(i + 1) - resultOffsets.at(i)
+                || !std::equal(indices.begin(), indices.end(), resultIndices.begin() + resultOffsets.at(i))) {
+            sgl::Logfile::get()->writeError("Error in testKDTree: findPointsInRadiusBatched differs from "
+                    "findPointsInRadius.");
+            return false;
+        }
+    }
+    return true;
+}
+
+bool testKDTree()
+{
+    const size_t NUM_POINTS = 2000000;
+    const size_t NUM_QUERIES = 200;
+    const int K = 16;
+
+    std::mt19937 generator(17);
+    std::vector<glm::vec3> points;
+    createClusteredPoints(NUM_POINTS, points, generator);
+
+    auto startBuild = std::chrono::system_clock::now();
+    KDTree kdTree;
+    kdTree.build(points);
+    auto endBuild = std::chrono::system_clock::now();
+    auto elapsedBuild = std::chrono::duration_cast<std::chrono::milliseconds>(endBuild - startBuild);
+    sgl::Logfile::get()->writeInfo(std::string() + "Computational time to build the k-d tree ("
+            + std::to_string(NUM_POINTS) + " points): " + std::to_string(elapsedBuild.count()));
+    if (kdTree.getNumPoints() != NUM_POINTS) {
+        sgl::Logfile::get()->writeError("Error in testKDTree: The k-d tree has the wrong number of points.");
+        return false;
+    }
+
+    // Half of the queries at points of the set (i.e., in dense regions), half at random positions.
+    std::uniform_real_distribution<float> uniformDistribution(-0.5f, 0.5f);
+    std::uniform_real_distribution<float> radiusDistribution(0.001f, 0.05f);
+    std::uniform_int_distribution<size_t> pointDistribution(0, NUM_POINTS - 1);
+    for (size_t i = 0; i < NUM_QUERIES; i++) {
+        glm::vec3 queryPoint = i % 2 == 0 ? points.at(pointDistribution(generator)) : glm::vec3(
+                uniformDistribution(generator), uniformDistribution(generator), uniformDistribution(generator));
+        if (!testKDTreeQueries(kdTree, points, queryPoint, radiusDistribution(generator), K)) {
+            return false;
+        }
+    }
+
+    return testKDTreeBatchedQueries(kdTree, points, K);
+}
@@ -0,0 +1,257 @@
+//
+// Created by agent on 19.10.26.
+//
+
+#include <string>
+#include <random>
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+
+#include <Utils/File/Logfile.hpp>
+
+#include "../Utils/MeshClustering.hpp"
+#include "DataProcessingTests.hpp"
+
+template<typename T>
+static BinaryMeshAttribute createAttribute(const std::string &name, sgl::VertexAttributeFormat format,
+        uint32_t numComponents, const std::vector<T> &values)
+{
+    BinaryMeshAttribute attribute;
+    attribute.name = name;
+    attribute.attributeFormat = format;
+    attribute.numComponents = numComponents;
+    attribute.data.resize(values.size() * sizeof(T));
+    std::copy((const uint8_t*)values.data(), (const uint8_t*)(values.data() + values.size()), attribute.data.begin());
+    return attribute;
+}
+
+/**
+ * Triangulated height field on a 256x256 grid (i.e., mostly front-facing normal cones) with a float and a normalized
+ * unsigned short attribute.
+ */
+static BinarySubMesh createTriangleSubmesh(std::mt19937 &generator)
+{
+    const int GRID_SIZE = 256;
+    std::uniform_real_distribution<float> heightDistribution(0.0f, 0.05f);
+
+    std::vector<glm::vec3> vertices;
+    std::vector<float> floatValues;
+    std::vector<uint16_t> unormValues;
+    for (int y = 0; y < GRID_SIZE; y++) {
+        for (int x = 0; x < GRID_SIZE; x++) {
+            float height = 0.1f * std::sin(float(x) * 0.05f) * std::cos(float(y) * 0.07f)
+                    + heightDistribution(generator);
+            vertices.push_back(glm::vec3(float(x) / float(GRID_SIZE), float(y) / float(GRID_SIZE), height));
+            floatValues.push_back(height * 10.0f - 0.5f);
+            unormValues.push_back(uint16_t((x * 257 + y * 31) % 65536));
+        }
+    }
+
+    BinarySubMesh submesh;
+    submesh.vertexMode = sgl::VERTEX_MODE_TRIANGLES;
+    for (int y = 0; y < GRID_SIZE - 1; y++) {
+        for (int x = 0; x < GRID_SIZE - 1; x++) {
+            uint32_t i0 = uint32_t(x + y * GRID_SIZE);
+            uint32_t i1 = i0 + 1;
+            uint32_t i2 = i0 + GRID_SIZE;
+            uint32_t i3 = i2 + 1;
+            submesh.indices.insert(submesh.indices.end(), { i0, i1, i2, i1, i3, i2 });
+        }
+    }
+
+    submesh.attributes.push_back(createAttribute("vertexPosition", sgl::ATTRIB_FLOAT, 3, vertices));
+    submesh.attributes.push_back(createAttribute("vertexAttribute", sgl::ATTRIB_FLOAT, 1, floatValues));
+    submesh.attributes.push_back(createAttribute("vertexImportance", sgl::ATTRIB_UNSIGNED_SHORT, 1, unormValues));
+    return submesh;
+}
+
+/**
+ * Random walks with 10 to 1000 segments each, i.e., the cluster boundaries are determined both by the jumps between
+ * the lines and by the maximum number of primitives per cluster.
+ */
+static BinarySubMesh createLineSubmesh(std::mt19937 &generator)
+{
+    const int NUM_LINES = 500;
+    std::uniform_real_distribution<float> positionDistribution(-1.0f, 1.0f);
+    std::uniform_int_distribution<int> numSegmentsDistribution(10, 1000);
+    std::normal_distribution<float> stepDistribution(0.0f, 0.002f);
+
+    std::vector<glm::vec3> vertices;
+    std::vector<float> values;
+    BinarySubMesh submesh;
+    submesh.vertexMode = sgl::VERTEX_MODE_LINES;
+    for (int lineIndex = 0; lineIndex < NUM_LINES; lineIndex++) {
+        glm::vec3 position(
+                positionDistribution(generator), positionDistribution(generator), positionDistribution(generator));
+        int numSegments = numSegmentsDistribution(generator);
+        for (int i = 0; i <= numSegments; i++) {
+            if (i > 0) {
+                submesh.indices.push_back(uint32_t(vertices.size() - 1));
+                submesh.indices.push_back(uint32_t(vertices.size()));
+            }
+            vertices.push_back(position);
+            values.push_back(float(lineIndex) + float(i) / float(numSegments));
+            position += glm::vec3(
+                    stepDistribution(generator), stepDistribution(generator), stepDistribution(generator));
+        }
+    }
+
+    submesh.attributes.push_back(createAttribute("vertexPosition", sgl::ATTRIB_FLOAT, 3, vertices));
+    submesh.attributes.push_back(createAttribute("vertexAttribute", sgl::ATTRIB_FLOAT, 1, values));
+    return submesh;
+}
+
+/// Value of a single-component attribute like the cluster ranges store it (normalized integers mapped to [0, 1]).
+static float getReferenceAttributeValue(const BinaryMeshAttribute &attribute, uint32_t vertexIndex)
+{
+    if (attribute.attributeFormat == sgl::ATTRIB_UNSIGNED_SHORT) {
+        return float(((const uint16_t*)attribute.data.data())[vertexIndex]) / 65535.0f;
+    }
+    return ((const float*)attribute.data.data())[vertexIndex];
+}
+
+/**
+ * Checks that the clusters cover the index buffer exactly once and in order with the allowed cluster sizes, and
+ * compares the bounds of each cluster against a brute force pass over its primitives.
+ */
+static bool checkMeshClusters(const BinarySubMesh &submesh, const MeshClusteringSettings &settings)
+{
+    // The bounding sphere and the normal cone are computed with a different order of the operations.
+    const float EPSILON = 1e-5f;
+
+    uint32_t indicesPerPrimitive = submesh.vertexMode == sgl::VERTEX_MODE_TRIANGLES ? 3 : 2;
+    const glm::vec3 *positions = (const glm::vec3*)submesh.attributes.front().data.data();
+    std::vector<const BinaryMeshAttribute*> scalarAttributes;
+    for (const BinaryMeshAttribute &attribute : submesh.attributes) {
+        if (attribute.numComponents == 1) {
+            scalarAttributes.push_back(&attribute);
+        }
+    }
+
+    if (submesh.clusters.empty()) {
+        sgl::Logfile::get()->writeError("Error in testMeshClusters: No clusters were created.");
+        return false;
+    }
+
+    uint32_t expectedIndexOffset = 0;
+    for (size_t clusterIndex = 0; clusterIndex < submesh.clusters.size(); clusterIndex++) {
+        const BinaryMeshCluster &cluster = submesh.clusters.at(clusterIndex);
+        std::string clusterName = "Cluster " + std::to_string(clusterIndex);
+
+        // Coverage: Consecutive ranges of whole primitives. Only the last cluster may be smaller than the minimum.
+        uint32_t numPrimitives = cluster.numIndices / indicesPerPrimitive;
+        bool isLastCluster = clusterIndex + 1 == submesh.clusters.size();
+        if (cluster.indexOffset != expectedIndexOffset || cluster.numIndices % indicesPerPrimitive != 0
+                || numPrimitives == 0 || numPrimitives > settings.maxPrimitivesPerCluster
+                || (numPrimitives < settings.minPrimitivesPerCluster && !isLastCluster)) {
+            sgl::Logfile::get()->writeError("Error in testMeshClusters: " + clusterName
+                    + " has an invalid index range.");
+            return false;
+        }
+        expectedIndexOffset += cluster.numIndices;
+
+        // Bounding box (exact) and bounding sphere
+        glm::vec3 aabbMin(FLT_MAX), aabbMax(-FLT_MAX);
+        for (uint32_t i = cluster.indexOffset; i < cluster.indexOffset + cluster.numIndices; i++) {
+            const glm::vec3 &position = positions[submesh.indices.at(i)];
+            aabbMin = glm::min(aabbMin, position);
+            aabbMax = glm::max(aabbMax, position);
+        }
+        if (aabbMin != cluster.aabbMin || aabbMax != cluster.aabbMax) {
+            sgl::Logfile::get()->writeError("Error in testMeshClusters: " + clusterName + " has a wrong AABB.");
+            return false;
+        }
+        float maxDistance = 0.0f;
+        for (uint32_t i = cluster.indexOffset; i < cluster.indexOffset + cluster.numIndices; i++) {
+            maxDistance = std::max(maxDistance, glm::length(positions[submesh.indices.at(i)] - cluster.sphereCenter));
+        }
+        if (maxDistance > cluster.sphereRadius * (1.0f + EPSILON) + EPSILON
+                || cluster.sphereRadius > glm::length(aabbMax - aabbMin) * 0.5f * (1.0f + EPSILON) + EPSILON) {
+            sgl::Logfile::get()->writeError("Error in testMeshClusters: " + clusterName
+                    + " has a wrong bounding sphere.");
+            return false;
+        }
+
+        // Normal cone: A cullable cone (half angle < 90 degrees) needs to contain the normals of all (non-degenerate)
+        // triangles. The test is done with the sine like the cutoff, as the cosine is imprecise for half angles close
+        // to 90 degrees.
+        if (indicesPerPrimitive == 2 && cluster.coneCutoff < 1.0f) {
+            sgl::Logfile::get()->writeError("Error in testMeshClusters: " + clusterName
+                    + " of a line submesh has a cullable normal cone.");
+            return false;
+        }
+        if (indicesPerPrimitive == 3 && cluster.coneCutoff < 1.0f) {
+            for (uint32_t i = cluster.indexOffset; i < cluster.indexOffset + cluster.numIndices; i += 3) {
+                const glm::vec3 &v0 = positions[submesh.indices.at(i)];
+                glm::vec3 normal = glm::cross(
+                        positions[submesh.indices.at(i+1)] - v0, positions[submesh.indices.at(i+2)] - v0);
+                float normalLength = glm::length(normal);
+                if (normalLength <= 0.0f) {
+                    continue;
+                }
+                float cosAngle = glm::dot(cluster.coneAxis, normal / normalLength);
+                float sinAngle = std::sqrt(std::max(1.0f - cosAngle * cosAngle, 0.0f));
+                if (cosAngle <= 0.0f || sinAngle > cluster.coneCutoff + EPSILON) {
+                    sgl::Logfile::get()->writeError("Error in testMeshClusters: The normal cone of " + clusterName
+                            + " doesn't contain all triangle normals.");
+                    return false;
+                }
+            }
+        }
+
+        // Attribute ranges (exact)
+        if (cluster.attributeRanges.size() != scalarAttributes.size()) {
+            sgl::Logfile::get()->writeError("Error in testMeshClusters: " + clusterName
+                    + " has the wrong number of attribute ranges.");
+            return false;
+        }
+        for (size_t j = 0; j < scalarAttributes.size(); j++) {
+            float minValue = FLT_MAX, maxValue = -FLT_MAX;
+            for (uint32_t i = cluster.indexOffset; i < cluster.indexOffset + cluster.numIndices; i++) {
+                float value = getReferenceAttributeValue(*scalarAttributes.at(j), submesh.indices.at(i));
+                minValue = std::min(minValue, value);
+                maxValue = std::max(maxValue, value);
+            }
+            if (cluster.attributeRanges.at(j).x != minValue || cluster.attributeRanges.at(j).y != maxValue) {
+                sgl::Logfile::get()->writeError("Error in testMeshClusters: " + clusterName
+                        + " has a wrong attribute range.");
+                return false;
+            }
+        }
+    }
+
+    if (expectedIndexOffset != submesh.indices.size()) {
+        sgl::Logfile::get()->writeError("Error in testMeshClusters: The clusters don't cover all indices.");
+        return false;
+    }
+    return true;
+}
+
+bool testMeshClusters()
+{
+    std::mt19937 generator(23);
+    BinaryMesh mesh;
+    mesh.submeshes.push_back(createTriangleSubmesh(generator));
+    mesh.submeshes.push_back(createLineSubmesh(generator));
+
+    // Also logs the cluster statistics and the computational time.
+    MeshClusteringSettings settings;
+    buildMeshClusters(mesh, settings);
+
+    for (const BinarySubMesh &submesh : mesh.submeshes) {
+        if (!checkMeshClusters(submesh, settings)) {
+            return false;
+        }
+    }
+
+    // Rebuilding replaces the old clusters.
+    BinarySubMesh &lineSubmesh = mesh.submeshes.back();
+    size_t numClusters = lineSubmesh.clusters.size();
+    buildMeshClusters(lineSubmesh, settings);
+    if (lineSubmesh.clusters.size() != numClusters) {
+        sgl::Logfile::get()->writeError("Error in testMeshClusters: Rebuilding the clusters appended new clusters.");
+        return false;
+    }
+    return true;
+}
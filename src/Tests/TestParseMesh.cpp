@@ -0,0 +1,205 @@
+//
+// Created by agent on 19.10.26.
+//
+
+#include <string>
+#include <random>
+#include <chrono>
+
+#include <boost/filesystem.hpp>
+
+#include <Utils/File/Logfile.hpp>
+
+#include "../Utils/MeshSerializer.hpp"
+#include "../Utils/ImportanceCriteria.hpp"
+#include "../Utils/ProgrammableFetchBuffers.hpp"
+#include "DataProcessingTests.hpp"
+
+template<typename T>
+static BinaryMeshAttribute createAttribute(const std::string &name, sgl::VertexAttributeFormat format,
+        uint32_t numComponents, const std::vector<T> &values)
+{
+    BinaryMeshAttribute attribute;
+    attribute.name = name;
+    attribute.attributeFormat = format;
+    attribute.numComponents = numComponents;
+    attribute.data.resize(values.size() * sizeof(T));
+    std::copy((const uint8_t*)values.data(), (const uint8_t*)(values.data() + values.size()), attribute.data.begin());
+    return attribute;
+}
+
+/**
+ * Line submesh like the converted trajectory data sets (positions, line normals and tangents, two importance
+ * criteria as 16-bit unorm values) with random walks of 1000 points each.
+ */
+static BinarySubMesh createLineSubmesh(size_t numLines, std::mt19937 &generator)
+{
+    const size_t NUM_LINE_POINTS = 1000;
+    std::uniform_real_distribution<float> positionDistribution(-0.5f, 0.5f);
+    std::uniform_real_distribution<float> attributeDistribution(0.0f, 1.0f);
+    std::normal_distribution<float> stepDistribution(0.0f, 0.001f);
+
+    size_t numVertices = numLines * NUM_LINE_POINTS;
+    std::vector<glm::vec3> positions, normals, tangents;
+    std::vector<float> attributes0, attributes1;
+    positions.reserve(numVertices);
+    normals.reserve(numVertices);
+    tangents.reserve(numVertices);
+    attributes0.reserve(numVertices);
+    attributes1.reserve(numVertices);
+    BinarySubMesh submesh;
+    submesh.vertexMode = sgl::VERTEX_MODE_LINES;
+    submesh.indices.reserve(numLines * (NUM_LINE_POINTS - 1) * 2);
+    for (size_t lineIndex = 0; lineIndex < numLines; lineIndex++) {
+        glm::vec3 position(
+                positionDistribution(generator), positionDistribution(generator), positionDistribution(generator));
+        for (size_t i = 0; i < NUM_LINE_POINTS; i++) {
+            if (i > 0) {
+                submesh.indices.push_back(uint32_t(positions.size() - 1));
+                submesh.indices.push_back(uint32_t(positions.size()));
+            }
+            glm::vec3 step(stepDistribution(generator), stepDistribution(generator), stepDistribution(generator));
+            positions.push_back(position);
+            tangents.push_back(step);
+            normals.push_back(glm::vec3(-step.y, step.x, 0.0f));
+            attributes0.push_back(attributeDistribution(generator));
+            attributes1.push_back(float(i) / float(NUM_LINE_POINTS - 1));
+            position += step;
+        }
+    }
+
+    std::vector<uint16_t> attributes0Unorm, attributes1Unorm;
+    packUnorm16Array(attributes0, attributes0Unorm);
+    packUnorm16Array(attributes1, attributes1Unorm);
+    submesh.attributes.push_back(createAttribute("vertexPosition", sgl::ATTRIB_FLOAT, 3, positions));
+    submesh.attributes.push_back(createAttribute("vertexLineNormal", sgl::ATTRIB_FLOAT, 3, normals));
+    submesh.attributes.push_back(createAttribute("vertexLineTangent", sgl::ATTRIB_FLOAT, 3, tangents));
+    submesh.attributes.push_back(createAttribute("vertexAttribute0", sgl::ATTRIB_UNSIGNED_SHORT, 1, attributes0Unorm));
+    submesh.attributes.push_back(createAttribute("vertexAttribute1", sgl::ATTRIB_UNSIGNED_SHORT, 1, attributes1Unorm));
+    return submesh;
+}
+
+static bool compareMeshes(const BinaryMesh &mesh, const BinaryMesh &readMesh)
+{
+    if (readMesh.submeshes.size() != mesh.submeshes.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < mesh.submeshes.size(); i++) {
+        const BinarySubMesh &submesh = mesh.submeshes.at(i);
+        const BinarySubMesh &readSubmesh = readMesh.submeshes.at(i);
+        if (readSubmesh.vertexMode != submesh.vertexMode || readSubmesh.indices != submesh.indices
+                || readSubmesh.attributes.size() != submesh.attributes.size()) {
+            return false;
+        }
+        for (size_t j = 0; j < submesh.attributes.size(); j++) {
+            const BinaryMeshAttribute &attribute = submesh.attributes.at(j);
+            const BinaryMeshAttribute &readAttribute = readSubmesh.attributes.at(j);
+            if (readAttribute.name != attribute.name || readAttribute.attributeFormat != attribute.attributeFormat
+                    || readAttribute.numComponents != attribute.numComponents
+                    || readAttribute.data != attribute.data) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * Checks the AoS line point data and the unpacked values against a serial unpack of the unorm values.
+ */
+static bool checkLinePointData(
+        const uint16_t *attributeValuesUnorm, const glm::vec3 *positions, const glm::vec3 *tangents,
+        size_t numVertices, const std::vector<float> &attributeValues, const std::vector<LinePointData> &linePointData)
+{
+    if (attributeValues.size() != numVertices || linePointData.size() != numVertices) {
+        return false;
+    }
+    for (size_t i = 0; i < numVertices; i++) {
+        float value = attributeValuesUnorm[i] / 65535.0f;
+        const LinePointData &linePoint = linePointData.at(i);
+        if (attributeValues.at(i) != value || linePoint.vertexAttribute != value
+                || linePoint.vertexPosition != positions[i] || linePoint.vertexTangent != tangents[i]
+                || linePoint.padding != 0.0f) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool testParseMesh3D()
+{
+    std::mt19937 generator(29);
+    const size_t NUM_LINES = 1000;
+    BinaryMesh mesh;
+    mesh.submeshes.push_back(createLineSubmesh(NUM_LINES, generator));
+    size_t numVertices = mesh.submeshes.front().attributes.front().data.size() / sizeof(glm::vec3);
+
+    std::string filename = (boost::filesystem::temp_directory_path() / boost::filesystem::unique_path(
+            "testParseMesh3D-%%%%-%%%%.binmesh")).string();
+    writeMesh3D(filename, mesh);
+
+    // Read stage of parseMesh3D
+    auto startRead = std::chrono::system_clock::now();
+    BinaryMesh readMesh;
+    readMesh3D(filename, readMesh);
+    auto endRead = std::chrono::system_clock::now();
+    auto elapsedRead = std::chrono::duration_cast<std::chrono::milliseconds>(endRead - startRead);
+    sgl::Logfile::get()->writeInfo(std::string() + "Computational time to read binmesh ("
+            + std::to_string(numVertices) + " vertices): " + std::to_string(elapsedRead.count()));
+    boost::system::error_code errorCode;
+    boost::filesystem::remove(filename, errorCode);
+
+    if (!compareMeshes(mesh, readMesh)) {
+        sgl::Logfile::get()->writeError("Error in testParseMesh3D: The mesh read with readMesh3D differs from the "
+                "written one.");
+        return false;
+    }
+
+    // Unpack/interleave stage of createMeshRenderer (everything before the upload) for the AoS and the shared layout
+    const BinarySubMesh &submesh = readMesh.submeshes.front();
+    const glm::vec3 *positions = (const glm::vec3*)&submesh.attributes.at(0).data.front();
+    const glm::vec3 *tangents = (const glm::vec3*)&submesh.attributes.at(2).data.front();
+    std::vector<std::vector<float>> attributeValuesAoS(2);
+    std::vector<std::vector<LinePointData>> linePointDataAoS(2);
+    auto startAoS = std::chrono::system_clock::now();
+    for (size_t i = 0; i < 2; i++) {
+        const uint16_t *attributeValuesUnorm = (const uint16_t*)&submesh.attributes.at(3 + i).data.front();
+        unpackUnorm16Attribute(
+                attributeValuesUnorm, numVertices, attributeValuesAoS.at(i), positions, tangents,
+                &linePointDataAoS.at(i));
+    }
+    auto endAoS = std::chrono::system_clock::now();
+    auto elapsedAoS = std::chrono::duration_cast<std::chrono::milliseconds>(endAoS - startAoS);
+    sgl::Logfile::get()->writeInfo(std::string() + "Computational time to unpack and interleave the attributes "
+            + "(AoS): " + std::to_string(elapsedAoS.count()));
+
+    std::vector<float> sharedLinePointData;
+    std::vector<std::vector<float>> attributeValuesShared(2);
+    std::vector<std::vector<uint32_t>> packedAttributeValues(2);
+    auto startShared = std::chrono::system_clock::now();
+    buildSharedLinePointBuffer(positions, tangents, numVertices, sharedLinePointData);
+    for (size_t i = 0; i < 2; i++) {
+        const uint16_t *attributeValuesUnorm = (const uint16_t*)&submesh.attributes.at(3 + i).data.front();
+        unpackUnorm16Attribute(attributeValuesUnorm, numVertices, attributeValuesShared.at(i));
+        buildPackedUnorm16AttributeBuffer(attributeValuesUnorm, numVertices, packedAttributeValues.at(i));
+    }
+    auto endShared = std::chrono::system_clock::now();
+    auto elapsedShared = std::chrono::duration_cast<std::chrono::milliseconds>(endShared - startShared);
+    sgl::Logfile::get()->writeInfo(std::string() + "Computational time to unpack and interleave the attributes "
+            + "(shared): " + std::to_string(elapsedShared.count()));
+
+    for (size_t i = 0; i < 2; i++) {
+        const uint16_t *attributeValuesUnorm = (const uint16_t*)&submesh.attributes.at(3 + i).data.front();
+        if (!checkLinePointData(
+                attributeValuesUnorm, positions, tangents, numVertices, attributeValuesAoS.at(i),
+                linePointDataAoS.at(i))) {
+            sgl::Logfile::get()->writeError("Error in testParseMesh3D: The AoS line point data is wrong.");
+            return false;
+        }
+        if (attributeValuesShared.at(i) != attributeValuesAoS.at(i)) {
+            sgl::Logfile::get()->writeError("Error in testParseMesh3D: The unpacked attribute values differ.");
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,128 @@
+//
+// Created by agent on 19.10.26.
+//
+
+#include <random>
+#include <cmath>
+#include <algorithm>
+
+#include <Utils/File/Logfile.hpp>
+
+#include "../Utils/ImportanceCriteria.hpp"
+#include "../Utils/ProgrammableFetchBuffers.hpp"
+#include "DataProcessingTests.hpp"
+
+/**
+ * CPU version of "unpackUnorm2x16(vertexAttributesPacked[pointIndex/2u])[pointIndex%2u]" in
+ * PseudoPhongTrajectories.glsl.
+ */
+static float fetchPackedUnorm16Attribute(const std::vector<uint32_t> &packedAttributeBuffer, size_t pointIndex)
+{
+    uint32_t packedValue = packedAttributeBuffer.at(pointIndex / 2);
+    uint32_t unormValue = pointIndex % 2 == 0 ? packedValue & 0xFFFFu : packedValue >> 16u;
+    return float(unormValue) / 65535.0f;
+}
+
+static bool testProgrammableFetchBuffersForSize(size_t numVertices, std::mt19937 &generator)
+{
+    std::uniform_real_distribution<float> valueDistribution(-100.0f, 100.0f);
+    std::vector<glm::vec3> positions(numVertices), tangents(numVertices);
+    std::vector<float> attributes(numVertices);
+    for (size_t i = 0; i < numVertices; i++) {
+        positions.at(i) = glm::vec3(
+                valueDistribution(generator), valueDistribution(generator), valueDistribution(generator));
+        tangents.at(i) = glm::vec3(
+                valueDistribution(generator), valueDistribution(generator), valueDistribution(generator));
+        attributes.at(i) = valueDistribution(generator);
+    }
+    std::string sizeString = " (" + std::to_string(numVertices) + " vertices)";
+
+    // Positions and tangents: 6 floats (24 bytes) per vertex, read as in the shader with pointOffset = 6*pointIndex.
+    std::vector<float> linePointBuffer;
+    buildSharedLinePointBuffer(&positions.front(), &tangents.front(), numVertices, linePointBuffer);
+    if (linePointBuffer.size() != numVertices * 6) {
+        sgl::Logfile::get()->writeError(std::string() + "Error in testProgrammableFetchBuffers: The line point "
+                + "buffer has " + std::to_string(linePointBuffer.size()) + " entries" + sizeString + ".");
+        return false;
+    }
+    size_t numPositionMismatches = 0;
+    for (size_t i = 0; i < numVertices; i++) {
+        size_t pointOffset = i * 6;
+        glm::vec3 pointPosition(
+                linePointBuffer.at(pointOffset), linePointBuffer.at(pointOffset + 1),
+                linePointBuffer.at(pointOffset + 2));
+        glm::vec3 pointTangent(
+                linePointBuffer.at(pointOffset + 3), linePointBuffer.at(pointOffset + 4),
+                linePointBuffer.at(pointOffset + 5));
+        if (pointPosition != positions.at(i) || pointTangent != tangents.at(i)) {
+            numPositionMismatches++;
+        }
+    }
+    if (numPositionMismatches != 0) {
+        sgl::Logfile::get()->writeError(std::string() + "Error in testProgrammableFetchBuffers: "
+                + std::to_string(numPositionMismatches) + " positions or tangents are stored at the wrong offset"
+                + sizeString + ".");
+        return false;
+    }
+
+    // Attributes: Two 16-bit unorm values per uint (2 bytes per vertex), zero padded for an odd number of vertices.
+    std::vector<uint16_t> attributesUnorm;
+    packUnorm16Array(attributes, attributesUnorm);
+    std::vector<uint32_t> packedAttributeBuffer;
+    buildPackedUnorm16AttributeBuffer(&attributesUnorm.front(), numVertices, packedAttributeBuffer);
+    if (packedAttributeBuffer.size() != (numVertices + 1) / 2) {
+        sgl::Logfile::get()->writeError(std::string() + "Error in testProgrammableFetchBuffers: The packed "
+                + "attribute buffer has " + std::to_string(packedAttributeBuffer.size()) + " entries" + sizeString
+                + ".");
+        return false;
+    }
+    if (numVertices % 2 == 1 && (packedAttributeBuffer.back() >> 16u) != 0u) {
+        sgl::Logfile::get()->writeError(std::string() + "Error in testProgrammableFetchBuffers: The padding of the "
+                + "packed attribute buffer isn't zero" + sizeString + ".");
+        return false;
+    }
+
+    // The fetched value must be exactly the value the SoA and AoS layouts store, and the round trip to the original
+    // attribute range must be within half a quantization step (plus float rounding).
+    float minAttribute = *std::min_element(attributes.begin(), attributes.end());
+    float maxAttribute = *std::max_element(attributes.begin(), attributes.end());
+    float attributeRange = maxAttribute - minAttribute;
+    float roundTripTolerance = attributeRange * (0.5f / 65535.0f) + attributeRange * 1e-6f;
+    float maxRoundTripError = 0.0f;
+    size_t numAttributeMismatches = 0;
+    for (size_t i = 0; i < numVertices; i++) {
+        float fetchedValue = fetchPackedUnorm16Attribute(packedAttributeBuffer, i);
+        if (fetchedValue != attributesUnorm.at(i) / 65535.0f) {
+            numAttributeMismatches++;
+        }
+        float roundTripError = std::abs(minAttribute + fetchedValue * attributeRange - attributes.at(i));
+        maxRoundTripError = std::max(maxRoundTripError, roundTripError);
+    }
+    if (numAttributeMismatches != 0) {
+        sgl::Logfile::get()->writeError(std::string() + "Error in testProgrammableFetchBuffers: "
+                + std::to_string(numAttributeMismatches) + " packed attributes differ from the unpacked ones"
+                + sizeString + ".");
+        return false;
+    }
+    if (!(maxRoundTripError <= roundTripTolerance)) {
+        sgl::Logfile::get()->writeError(std::string() + "Error in testProgrammableFetchBuffers: The unorm16 round "
+                + "trip error " + std::to_string(maxRoundTripError) + " exceeds half a quantization step"
+                + sizeString + ".");
+        return false;
+    }
+    return true;
+}
+
+bool testProgrammableFetchBuffers()
+{
+    std::mt19937 generator(17);
+    // Odd sizes test the padding of the last packed attribute value.
+    const size_t vertexCounts[] = { 2, 3, 1000, 100001 };
+    bool passed = true;
+    for (size_t numVertices : vertexCounts) {
+        if (!testProgrammableFetchBuffersForSize(numVertices, generator)) {
+            passed = false;
+        }
+    }
+    return passed;
+}
@@ -0,0 +1,155 @@
+//
+// Created by agent on 19.10.26.
+//
+
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+
+#include <Utils/File/Logfile.hpp>
+
+#include "../Utils/MeshTopology.hpp"
+#include "../Utils/ComputeNormals.hpp"
+#include "DataProcessingTests.hpp"
+
+/**
+ * Triangulated height field with (gridSize x gridSize) vertices. The triangles are shuffled, as the faces of a vertex
+ * are scattered over the whole index buffer in meshes loaded from files.
+ */
+static void createGridMesh(
+        size_t gridSize, std::vector<glm::vec3> &vertices, std::vector<uint32_t> &indices, std::mt19937 &generator)
+{
+    std::uniform_real_distribution<float> heightDistribution(-0.1f, 0.1f);
+    vertices.clear();
+    for (size_t y = 0; y < gridSize; y++) {
+        for (size_t x = 0; x < gridSize; x++) {
+            vertices.push_back(glm::vec3(float(x), heightDistribution(generator), float(y)));
+        }
+    }
+
+    std::vector<glm::uvec3> triangles;
+    for (size_t y = 0; y + 1 < gridSize; y++) {
+        for (size_t x = 0; x + 1 < gridSize; x++) {
+            uint32_t i00 = uint32_t(y * gridSize + x), i10 = i00 + 1;
+            uint32_t i01 = uint32_t(i00 + gridSize), i11 = i01 + 1;
+            triangles.push_back(glm::uvec3(i00, i01, i10));
+            triangles.push_back(glm::uvec3(i10, i01, i11));
+        }
+    }
+    std::shuffle(triangles.begin(), triangles.end(), generator);
+
+    indices.clear();
+    for (const glm::uvec3 &triangle : triangles) {
+        indices.push_back(triangle.x);
+        indices.push_back(triangle.y);
+        indices.push_back(triangle.z);
+    }
+}
+
+/**
+ * Compares the parallel CSR adjacency build against a serial reference build (one std::vector per vertex) and logs
+ * the timings. If the rows are sorted, the parallel build needs to be identical to the reference independent of the
+ * thread schedule.
+ */
+static bool testVertexFaceAdjacencyBuild(const std::vector<uint32_t> &indices, size_t numVertices)
+{
+    auto startSerial = std::chrono::system_clock::now();
+    std::vector<std::vector<uint32_t>> referenceMap(numVertices);
+    for (size_t j = 0; j < indices.size(); j++) {
+        referenceMap[indices[j]].push_back(uint32_t(j / 3));
+    }
+    auto endSerial = std::chrono::system_clock::now();
+    auto elapsedSerial = std::chrono::duration_cast<std::chrono::milliseconds>(endSerial - startSerial);
+    sgl::Logfile::get()->writeInfo(std::string() + "Computational time to build the vertex-face map serially: "
+            + std::to_string(elapsedSerial.count()));
+
+    VertexFaceAdjacency unsortedAdjacency;
+    auto startUnsorted = std::chrono::system_clock::now();
+    buildVertexFaceAdjacency(indices, numVertices, unsortedAdjacency, false);
+    auto endUnsorted = std::chrono::system_clock::now();
+    auto elapsedUnsorted = std::chrono::duration_cast<std::chrono::milliseconds>(endUnsorted - startUnsorted);
+    sgl::Logfile::get()->writeInfo(std::string() + "Computational time to build the CSR adjacency (unsorted): "
+            + std::to_string(elapsedUnsorted.count()));
+
+    VertexFaceAdjacency adjacency;
+    auto startSorted = std::chrono::system_clock::now();
+    buildVertexFaceAdjacency(indices, numVertices, adjacency, true);
+    auto endSorted = std::chrono::system_clock::now();
+    auto elapsedSorted = std::chrono::duration_cast<std::chrono::milliseconds>(endSorted - startSorted);
+    sgl::Logfile::get()->writeInfo(std::string() + "Computational time to build the CSR adjacency (sorted): "
+            + std::to_string(elapsedSorted.count()));
+
+    if (adjacency.getNumVertices() != numVertices || unsortedAdjacency.getNumVertices() != numVertices) {
+        sgl::Logfile::get()->writeError(std::string() + "Error in testVertexFaceAdjacency: The adjacency has the "
+                + "wrong number of vertices.");
+        return false;
+    }
+    size_t numMismatches = 0;
+    #pragma omp parallel for reduction(+:numMismatches)
+    for (size_t i = 0; i < numVertices; i++) {
+        const std::vector<uint32_t> &referenceFaces = referenceMap[i];
+        if (adjacency.getNumFaces(i) != referenceFaces.size()
+                || unsortedAdjacency.getNumFaces(i) != referenceFaces.size()
+                || !std::equal(referenceFaces.begin(), referenceFaces.end(), adjacency.facesBegin(i))
+                || !std::is_permutation(
+                        referenceFaces.begin(), referenceFaces.end(), unsortedAdjacency.facesBegin(i))) {
+            numMismatches++;
+        }
+    }
+    if (numMismatches != 0) {
+        sgl::Logfile::get()->writeError(std::string() + "Error in testVertexFaceAdjacency: The adjacency of "
+                + std::to_string(numMismatches) + " vertices differs from the serial reference.");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * computeNormals needs to skip vertices not referenced by any triangle (zero normal and curvature) instead of
+ * aborting, and compute finite normals and curvatures for all other vertices.
+ */
+static bool testComputeNormalsUnreferencedVertices(std::mt19937 &generator)
+{
+    std::vector<glm::vec3> vertices;
+    std::vector<uint32_t> indices;
+    createGridMesh(8, vertices, indices, generator);
+    size_t numReferencedVertices = vertices.size();
+    vertices.push_back(glm::vec3(100.0f, 0.0f, 0.0f));
+
+    std::vector<glm::vec3> normals;
+    std::vector<float> attributes;
+    computeNormals(vertices, indices, normals, attributes);
+    if (normals.size() != vertices.size() || attributes.size() != vertices.size()) {
+        sgl::Logfile::get()->writeError(std::string() + "Error in testVertexFaceAdjacency: computeNormals returned "
+                + "the wrong number of normals or attributes.");
+        return false;
+    }
+    if (normals.back() != glm::vec3(0.0f) || attributes.back() != 0.0f) {
+        sgl::Logfile::get()->writeError(std::string() + "Error in testVertexFaceAdjacency: The unreferenced vertex "
+                + "doesn't have a zero normal and curvature.");
+        return false;
+    }
+    for (size_t i = 0; i < numReferencedVertices; i++) {
+        if (!std::isfinite(normals.at(i).x) || !std::isfinite(normals.at(i).y) || !std::isfinite(normals.at(i).z)
+                || !std::isfinite(attributes.at(i))) {
+            sgl::Logfile::get()->writeError(std::string() + "Error in testVertexFaceAdjacency: The normal or "
+                    + "curvature of vertex " + std::to_string(i) + " isn't finite.");
+            return false;
+        }
+    }
+    return true;
+}
+
+bool testVertexFaceAdjacency()
+{
+    std::mt19937 generator(17);
+    std::vector<glm::vec3> vertices;
+    std::vector<uint32_t> indices;
+    createGridMesh(1000, vertices, indices, generator);
+    bool passed = testVertexFaceAdjacencyBuild(indices, vertices.size());
+    if (!testComputeNormalsUnreferencedVertices(generator)) {
+        passed = false;
+    }
+    return passed;
+}
@@ -0,0 +1,383 @@
+//
+// Created by agent on 19.10.26.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cfloat>
+#include <fstream>
+
+#include <boost/algorithm/string/case_conv.hpp>
+#include <boost/algorithm/string/predicate.hpp>
+
+#include <Utils/File/Logfile.hpp>
+
+#include "BinLinesFile.hpp"
+
+/**
+ * Copies a large block in chunks in parallel. When reading from a mapped file, the copy is limited by the page faults
+ * and not by the memory bandwidth, so it scales with the number of threads.
+ */
+static void copyBlockParallel(void *destination, const void *source, size_t sizeBytes)
+{
+    const size_t CHUNK_SIZE = size_t(1) << 22;
+    const size_t numChunks = (sizeBytes + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    #pragma omp parallel for schedule(dynamic)
+    for (size_t chunkIndex = 0; chunkIndex < numChunks; chunkIndex++) {
+        size_t offset = chunkIndex * CHUNK_SIZE;
+        memcpy((char*)destination + offset, (const char*)source + offset, std::min(CHUNK_SIZE, sizeBytes - offset));
+    }
+}
+
+/// @return Whether numElements elements of size elementSize starting at offset lie within a file of size fileSize.
+static inline bool isBlockInFile(uint64_t offset, uint64_t numElements, uint64_t elementSize, uint64_t fileSize)
+{
+    return offset % sizeof(float) == 0 && offset <= fileSize && numElements <= (fileSize - offset) / elementSize;
+}
+
+static inline uint64_t alignBlockOffset(uint64_t offset)
+{
+    return (offset + BINLINES_V2_BLOCK_ALIGNMENT - 1) / BINLINES_V2_BLOCK_ALIGNMENT * BINLINES_V2_BLOCK_ALIGNMENT;
+}
+
+
+bool MappedTrajectories::open(const std::string &filename, bool copyOnWrite)
+{
+    close();
+    file = std::make_shared<MappedFile>();
+    if (!file->open(filename, copyOnWrite)) {
+        file.reset();
+        return false;
+    }
+
+    const char *data = file->getData();
+    const uint64_t fileSize = file->getSize();
+    auto onError = [&](const std::string &errorMessage) {
+        sgl::Logfile::get()->writeError(std::string() + "Error in MappedTrajectories::open: " + errorMessage
+                + " (file \"" + filename + "\").");
+        close();
+        return false;
+    };
+
+    BinLinesHeaderV2 header;
+    if (fileSize < sizeof(BinLinesHeaderV2)) {
+        return onError("The file is too small for the header");
+    }
+    memcpy(&header, data, sizeof(BinLinesHeaderV2));
+    if (header.formatVersion != BINLINES_FORMAT_VERSION_2) {
+        return onError("Invalid format version " + std::to_string(header.formatVersion));
+    }
+    if (header.headerSize < sizeof(BinLinesHeaderV2)) {
+        return onError("Invalid header size");
+    }
+
+    // Check that all blocks lie within the file before creating any views.
+    const uint64_t numPoints = header.numPoints;
+    if (header.trajectoryOffsetsOffset % sizeof(uint64_t) != 0 || header.numTrajectories == UINT64_MAX
+            || !isBlockInFile(header.trajectoryOffsetsOffset, header.numTrajectories + 1, sizeof(uint64_t), fileSize)) {
+        return onError("The trajectory offsets exceed the file size");
+    }
+    if (!isBlockInFile(header.positionsOffset, numPoints, sizeof(glm::vec3), fileSize)) {
+        return onError("The positions exceed the file size");
+    }
+    if (header.numAttributes > 0) {
+        if (header.attributeStride < numPoints * sizeof(float) || header.attributesOffset > fileSize
+                || (header.attributeStride > 0 && uint64_t(header.numAttributes - 1)
+                        > (fileSize - header.attributesOffset) / header.attributeStride)) {
+            return onError("The attributes exceed the file size");
+        }
+        for (uint32_t attributeIndex = 0; attributeIndex < header.numAttributes; attributeIndex++) {
+            uint64_t attributeOffset = header.attributesOffset + attributeIndex * header.attributeStride;
+            if (!isBlockInFile(attributeOffset, numPoints, sizeof(float), fileSize)) {
+                return onError("The attributes exceed the file size");
+            }
+        }
+    }
+    if (!isBlockInFile(header.attributeRangesOffset, header.numAttributes, sizeof(glm::vec2), fileSize)) {
+        return onError("The attribute ranges exceed the file size");
+    }
+
+    numTrajectories = size_t(header.numTrajectories);
+    trajectoryOffsets = ArrayView<const uint64_t>(
+            (const uint64_t*)(data + header.trajectoryOffsetsOffset), numTrajectories + 1);
+    positions = ArrayView<const glm::vec3>((const glm::vec3*)(data + header.positionsOffset), size_t(numPoints));
+    attributes.reserve(header.numAttributes);
+    attributeRanges.resize(header.numAttributes);
+    for (uint32_t attributeIndex = 0; attributeIndex < header.numAttributes; attributeIndex++) {
+        const char *attributeData = data + header.attributesOffset + attributeIndex * header.attributeStride;
+        attributes.push_back(ArrayView<const float>((const float*)attributeData, size_t(numPoints)));
+    }
+    memcpy(attributeRanges.data(), data + header.attributeRangesOffset, header.numAttributes * sizeof(glm::vec2));
+    boundingBox = sgl::AABB3(
+            glm::vec3(header.boundingBoxMin[0], header.boundingBoxMin[1], header.boundingBoxMin[2]),
+            glm::vec3(header.boundingBoxMax[0], header.boundingBoxMax[1], header.boundingBoxMax[2]));
+
+    // The views of the trajectories rely on valid offsets.
+    bool offsetsValid = trajectoryOffsets.front() == 0 && trajectoryOffsets.back() == numPoints;
+    for (size_t i = 0; i < numTrajectories && offsetsValid; i++) {
+        offsetsValid = trajectoryOffsets[i] <= trajectoryOffsets[i + 1];
+    }
+    if (!offsetsValid) {
+        return onError("Invalid trajectory offsets");
+    }
+
+    return true;
+}
+
+void MappedTrajectories::close()
+{
+    // Containers created with mapTrajectories keep the file mapped.
+    file.reset();
+    numTrajectories = 0;
+    trajectoryOffsets = ArrayView<const uint64_t>();
+    positions = ArrayView<const glm::vec3>();
+    attributes.clear();
+    attributeRanges.clear();
+    boundingBox = sgl::AABB3();
+}
+
+void MappedTrajectories::copyTrajectories(
+        size_t firstTrajectory, size_t lastTrajectory, Trajectories &trajectories) const
+{
+    trajectories.clear();
+    trajectories.attributes.resize(getNumAttributes());
+
+    const size_t pointsBegin = size_t(trajectoryOffsets[firstTrajectory]);
+    const size_t numPoints = size_t(trajectoryOffsets[lastTrajectory]) - pointsBegin;
+    trajectories.trajectoryOffsets.resize(lastTrajectory - firstTrajectory + 1);
+    for (size_t i = firstTrajectory; i <= lastTrajectory; i++) {
+        trajectories.trajectoryOffsets[i - firstTrajectory] = size_t(trajectoryOffsets[i]) - pointsBegin;
+    }
+
+    trajectories.positions.resize(numPoints);
+    copyBlockParallel(trajectories.positions.data(), positions.data() + pointsBegin, numPoints * sizeof(glm::vec3));
+    for (size_t attributeIndex = 0; attributeIndex < getNumAttributes(); attributeIndex++) {
+        TrajectoryArray<float> &attributeArray = trajectories.attributes.at(attributeIndex);
+        attributeArray.resize(numPoints);
+        copyBlockParallel(
+                attributeArray.data(), attributes.at(attributeIndex).data() + pointsBegin, numPoints * sizeof(float));
+    }
+}
+
+void MappedTrajectories::mapTrajectories(Trajectories &trajectories) const
+{
+    trajectories.clear();
+    trajectories.attributes.resize(getNumAttributes());
+    trajectories.trajectoryOffsets.assign(trajectoryOffsets.begin(), trajectoryOffsets.end());
+
+    // The views were created from the read-only pointer to the same mapping.
+    char *writableData = file->getWritableData();
+    if (!writableData) {
+        throw std::logic_error("MappedTrajectories::mapTrajectories: The file is not mapped copy-on-write.");
+    }
+    const char *data = file->getData();
+    const size_t numPoints = getNumPoints();
+    trajectories.positions.setMappedData(
+            file, (glm::vec3*)(writableData + ((const char*)positions.data() - data)), numPoints);
+    for (size_t attributeIndex = 0; attributeIndex < getNumAttributes(); attributeIndex++) {
+        const char *attributeData = (const char*)attributes.at(attributeIndex).data();
+        trajectories.attributes.at(attributeIndex).setMappedData(
+                file, (float*)(writableData + (attributeData - data)), numPoints);
+    }
+}
+
+
+uint32_t getBinLinesFormatVersion(const std::string &filename)
+{
+    std::ifstream file(filename.c_str(), std::ifstream::binary);
+    uint32_t versionNumber = 0;
+    if (file.is_open()) {
+        file.read((char*)&versionNumber, sizeof(uint32_t));
+    }
+    return file.good() ? versionNumber : 0;
+}
+
+Trajectories loadTrajectoriesFromBinLinesV2(
+        const std::string &filename, sgl::AABB3 *boundingBox, std::vector<glm::vec2> *attributeRanges)
+{
+    auto start = std::chrono::system_clock::now();
+
+    Trajectories trajectories;
+    MappedTrajectories mappedTrajectories;
+    if (!mappedTrajectories.open(filename, true)) {
+        return trajectories;
+    }
+    mappedTrajectories.mapTrajectories(trajectories);
+    if (boundingBox) {
+        *boundingBox = mappedTrajectories.getBoundingBox();
+    }
+    if (attributeRanges) {
+        attributeRanges->clear();
+        for (size_t attributeIndex = 0; attributeIndex < mappedTrajectories.getNumAttributes(); attributeIndex++) {
+            attributeRanges->push_back(mappedTrajectories.getAttributeRange(attributeIndex));
+        }
+    }
+
+    auto end = std::chrono::system_clock::now();
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+    sgl::Logfile::get()->writeInfo(std::string() + "Computational time to map binlines v2 file: "
+            + std::to_string(elapsed.count()));
+
+    return trajectories;
+}
+
+bool streamTrajectoriesFromBinLinesV2(
+        const std::string &filename, size_t maxBatchSizeBytes,
+        std::function<void(Trajectories &batch, float progress)> batchCallback)
+{
+    MappedTrajectories mappedTrajectories;
+    if (!mappedTrajectories.open(filename)) {
+        return false;
+    }
+
+    const size_t numTrajectories = mappedTrajectories.size();
+    const size_t numPoints = mappedTrajectories.getNumPoints();
+    const size_t pointSizeBytes = sizeof(glm::vec3) + mappedTrajectories.getNumAttributes() * sizeof(float);
+    const ArrayView<const uint64_t> &trajectoryOffsets = mappedTrajectories.getTrajectoryOffsets();
+
+    // The batch container is reused like in the v1 code path.
+    Trajectories batch;
+    size_t firstTrajectory = 0;
+    while (firstTrajectory < numTrajectories) {
+        size_t lastTrajectory = firstTrajectory;
+        size_t batchSizeBytes = 0;
+        while (lastTrajectory < numTrajectories && batchSizeBytes < maxBatchSizeBytes) {
+            batchSizeBytes += mappedTrajectories.getNumPoints(lastTrajectory) * pointSizeBytes;
+            lastTrajectory++;
+        }
+
+        mappedTrajectories.copyTrajectories(firstTrajectory, lastTrajectory, batch);
+        float progress = numPoints == 0 ? 1.0f : float(double(trajectoryOffsets[lastTrajectory]) / double(numPoints));
+        batchCallback(batch, progress);
+        firstTrajectory = lastTrajectory;
+    }
+
+    return true;
+}
+
+bool writeTrajectoriesToBinLinesV2(const std::string &filename, const Trajectories &trajectories)
+{
+    const uint64_t numTrajectories = trajectories.size();
+    const uint64_t numPoints = trajectories.getNumPoints();
+    const uint32_t numAttributes = uint32_t(trajectories.attributes.size());
+    for (const TrajectoryArray<float> &attributeArray : trajectories.attributes) {
+        if (attributeArray.size() != numPoints) {
+            sgl::Logfile::get()->writeError(std::string() + "Error in writeTrajectoriesToBinLinesV2: The number of "
+                    + "attribute values doesn't match the number of points.");
+            return false;
+        }
+    }
+
+    std::ofstream file(filename.c_str(), std::ofstream::binary);
+    if (!file.is_open()) {
+        sgl::Logfile::get()->writeError(std::string() + "Error in writeTrajectoriesToBinLinesV2: File \""
+                + filename + "\" could not be opened for writing.");
+        return false;
+    }
+
+    BinLinesHeaderV2 header;
+    memset(&header, 0, sizeof(BinLinesHeaderV2));
+    header.formatVersion = BINLINES_FORMAT_VERSION_2;
+    header.headerSize = sizeof(BinLinesHeaderV2);
+    header.numAttributes = numAttributes;
+    header.blockAlignment = uint32_t(BINLINES_V2_BLOCK_ALIGNMENT);
+    header.numTrajectories = numTrajectories;
+    header.numPoints = numPoints;
+    header.trajectoryOffsetsOffset = alignBlockOffset(sizeof(BinLinesHeaderV2));
+    header.positionsOffset = alignBlockOffset(
+            header.trajectoryOffsetsOffset + (numTrajectories + 1) * sizeof(uint64_t));
+    header.attributesOffset = alignBlockOffset(header.positionsOffset + numPoints * sizeof(glm::vec3));
+    header.attributeStride = alignBlockOffset(numPoints * sizeof(float));
+    header.attributeRangesOffset = header.attributesOffset + numAttributes * header.attributeStride;
+
+    // Bounding box and attribute ranges (stored in the header so that readers don't need to touch all points)
+    float minX = FLT_MAX, minY = FLT_MAX, minZ = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX, maxZ = -FLT_MAX;
+    #pragma omp parallel for reduction(min:minX,minY,minZ) reduction(max:maxX,maxY,maxZ)
+    for (size_t i = 0; i < size_t(numPoints); i++) {
+        const glm::vec3 &position = trajectories.positions[i];
+        minX = std::min(minX, position.x);
+        minY = std::min(minY, position.y);
+        minZ = std::min(minZ, position.z);
+        maxX = std::max(maxX, position.x);
+        maxY = std::max(maxY, position.y);
+        maxZ = std::max(maxZ, position.z);
+    }
+    header.boundingBoxMin[0] = minX; header.boundingBoxMin[1] = minY; header.boundingBoxMin[2] = minZ;
+    header.boundingBoxMax[0] = maxX; header.boundingBoxMax[1] = maxY; header.boundingBoxMax[2] = maxZ;
+
+    std::vector<glm::vec2> attributeRanges(numAttributes);
+    for (uint32_t attributeIndex = 0; attributeIndex < numAttributes; attributeIndex++) {
+        const TrajectoryArray<float> &attributeArray = trajectories.attributes.at(attributeIndex);
+        float minAttr = FLT_MAX, maxAttr = -FLT_MAX;
+        #pragma omp parallel for reduction(min:minAttr) reduction(max:maxAttr)
+        for (size_t i = 0; i < attributeArray.size(); i++) {
+            minAttr = std::min(minAttr, attributeArray[i]);
+            maxAttr = std::max(maxAttr, attributeArray[i]);
+        }
+        attributeRanges.at(attributeIndex) = glm::vec2(minAttr, maxAttr);
+    }
+
+    uint64_t fileOffset = 0;
+    const char padding[BINLINES_V2_BLOCK_ALIGNMENT] = { 0 };
+    auto writeBlock = [&](uint64_t blockOffset, const void *blockData, uint64_t blockSize) {
+        file.write(padding, std::streamsize(blockOffset - fileOffset));
+        if (blockSize > 0) {
+            file.write((const char*)blockData, std::streamsize(blockSize));
+        }
+        fileOffset = blockOffset + blockSize;
+    };
+
+    std::vector<uint64_t> trajectoryOffsets(
+            trajectories.trajectoryOffsets.begin(), trajectories.trajectoryOffsets.end());
+    writeBlock(0, &header, sizeof(BinLinesHeaderV2));
+    writeBlock(header.trajectoryOffsetsOffset, trajectoryOffsets.data(), trajectoryOffsets.size() * sizeof(uint64_t));
+    writeBlock(header.positionsOffset, trajectories.positions.data(), numPoints * sizeof(glm::vec3));
+    for (uint32_t attributeIndex = 0; attributeIndex < numAttributes; attributeIndex++) {
+        writeBlock(header.attributesOffset + attributeIndex * header.attributeStride,
+                trajectories.attributes.at(attributeIndex).data(), numPoints * sizeof(float));
+    }
+    writeBlock(header.attributeRangesOffset, attributeRanges.data(), numAttributes * sizeof(glm::vec2));
+
+    if (!file.good()) {
+        sgl::Logfile::get()->writeError(std::string() + "Error in writeTrajectoriesToBinLinesV2: Writing to file \""
+                + filename + "\" failed.");
+        return false;
+    }
+    return true;
+}
+
+bool convertTrajectoriesToBinLinesV2(
+        const std::string &inputFilename, const std::string &outputFilename, TrajectoryType trajectoryType)
+{
+    auto start = std::chrono::system_clock::now();
+
+    Trajectories trajectories;
+    std::string lowerCaseFilename = boost::to_lower_copy(inputFilename);
+    if (boost::ends_with(lowerCaseFilename, ".obj")) {
+        trajectories = loadTrajectoriesFromObj(inputFilename, trajectoryType);
+    } else if (boost::ends_with(lowerCaseFilename, ".nc")) {
+        trajectories = loadTrajectoriesFromNetCdf(inputFilename, trajectoryType);
+    } else if (boost::ends_with(lowerCaseFilename, ".binlines")) {
+        trajectories = loadTrajectoriesFromBinLines(inputFilename, trajectoryType);
+    } else {
+        sgl::Logfile::get()->writeError(std::string() + "Error in convertTrajectoriesToBinLinesV2: Unknown file "
+                + "extension of file \"" + inputFilename + "\".");
+        return false;
+    }
+
+    if (trajectories.empty()) {
+        sgl::Logfile::get()->writeError(std::string() + "Error in convertTrajectoriesToBinLinesV2: No trajectories "
+                + "could be loaded from file \"" + inputFilename + "\".");
+        return false;
+    }
+    if (!writeTrajectoriesToBinLinesV2(outputFilename, trajectories)) {
+        return false;
+    }
+
+    auto end = std::chrono::system_clock::now();
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+    sgl::Logfile::get()->writeInfo(std::string() + "Computational time to convert to binlines v2: "
+            + std::to_string(elapsed.count()));
+    return true;
+}
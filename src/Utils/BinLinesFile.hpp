@@ -0,0 +1,192 @@
+//
+// Created by agent on 19.10.26.
+//
+
+#ifndef PIXELSYNCOIT_BINLINESFILE_HPP
+#define PIXELSYNCOIT_BINLINESFILE_HPP
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+#include <Math/Geometry/AABB3.hpp>
+
+#include "MappedFile.hpp"
+#include "TrajectoryFile.hpp"
+
+const uint32_t BINLINES_FORMAT_VERSION_1 = 1u;
+const uint32_t BINLINES_FORMAT_VERSION_2 = 2u;
+/// All blocks of a binlines v2 file start at a multiple of this alignment (in bytes).
+const uint64_t BINLINES_V2_BLOCK_ALIGNMENT = 64;
+
+/**
+ * Header of the binlines v2 format. In contrast to v1 (which stores the points and attributes of each trajectory
+ * consecutively), v2 stores the data like the flat Trajectories container. This means the file can be mapped into
+ * memory and viewed without parsing or copying anything:
+ *  - Header (128 bytes).
+ *  - Trajectory offsets: numTrajectories + 1 uint64_t point offsets (CSR, first entry 0, last entry numPoints).
+ *  - Positions: numPoints * 3 floats.
+ *  - Attributes: numAttributes blocks of numPoints floats, attributeStride bytes apart.
+ *  - Attribute ranges: numAttributes * (min, max) floats.
+ * All blocks are aligned to BINLINES_V2_BLOCK_ALIGNMENT bytes. The data is stored in little-endian byte order.
+ */
+struct BinLinesHeaderV2
+{
+    uint32_t formatVersion; ///< BINLINES_FORMAT_VERSION_2 (at the same place as the version number of v1).
+    uint32_t headerSize;
+    uint32_t numAttributes;
+    uint32_t blockAlignment;
+    uint64_t numTrajectories;
+    uint64_t numPoints;
+    uint64_t trajectoryOffsetsOffset;
+    uint64_t positionsOffset;
+    uint64_t attributesOffset;
+    uint64_t attributeStride;
+    uint64_t attributeRangesOffset;
+    float boundingBoxMin[3];
+    float boundingBoxMax[3];
+    uint32_t reserved[8];
+};
+static_assert(sizeof(BinLinesHeaderV2) == 128, "BinLinesHeaderV2 needs to be 128 bytes large.");
+
+/**
+ * View of one trajectory of a MappedTrajectories object. It has the same interface as ConstTrajectoryView.
+ */
+struct MappedTrajectoryView
+{
+    typedef ArrayView<const glm::vec3> PositionsView;
+    typedef TrajectoryAttributesView<const float, const std::vector<ArrayView<const float>>> AttributesView;
+
+    MappedTrajectoryView(const PositionsView &positions, const AttributesView &attributes)
+            : positions(positions), attributes(attributes) {}
+
+    PositionsView positions;
+    AttributesView attributes;
+};
+
+/**
+ * Read-only access to the trajectories of a binlines v2 file mapped into memory. Opening a file only validates the
+ * header and the offset table; the positions and attributes are only read from disk when they are accessed.
+ *
+ * Usage:
+ *     MappedTrajectories mappedTrajectories;
+ *     if (mappedTrajectories.open(filename)) {
+ *         for (size_t i = 0; i < mappedTrajectories.size(); i++) {
+ *             MappedTrajectoryView trajectory = mappedTrajectories[i];
+ *             ... trajectory.positions.at(j), trajectory.attributes.at(0).at(j) ...
+ *         }
+ *     }
+ */
+class MappedTrajectories
+{
+public:
+    /**
+     * @param copyOnWrite Whether the file is mapped copy-on-write (needed for mapTrajectories).
+     * @return False if the file is no valid binlines v2 file (an error is written to the log file).
+     */
+    bool open(const std::string &filename, bool copyOnWrite = false);
+    void close();
+    inline bool isOpen() const { return file && file->isOpen(); }
+
+    /// @return The number of trajectories.
+    inline size_t size() const { return numTrajectories; }
+    inline bool empty() const { return numTrajectories == 0; }
+    inline size_t getNumPoints() const { return positions.size(); }
+    inline size_t getNumPoints(size_t trajectoryIndex) const {
+        return size_t(trajectoryOffsets[trajectoryIndex + 1] - trajectoryOffsets[trajectoryIndex]);
+    }
+    inline size_t getNumAttributes() const { return attributes.size(); }
+
+    // The flat arrays of all trajectories (see Trajectories).
+    inline const ArrayView<const uint64_t> &getTrajectoryOffsets() const { return trajectoryOffsets; }
+    inline const ArrayView<const glm::vec3> &getPositions() const { return positions; }
+    inline const ArrayView<const float> &getAttribute(size_t attributeIndex) const {
+        return attributes.at(attributeIndex);
+    }
+
+    /// The bounding box of all positions and the ranges of the attributes are stored in the file.
+    inline const sgl::AABB3 &getBoundingBox() const { return boundingBox; }
+    inline const glm::vec2 &getAttributeRange(size_t attributeIndex) const {
+        return attributeRanges.at(attributeIndex);
+    }
+
+    inline MappedTrajectoryView operator[](size_t i) const {
+        size_t offset = size_t(trajectoryOffsets[i]);
+        size_t numPoints = getNumPoints(i);
+        return MappedTrajectoryView(
+                ArrayView<const glm::vec3>(positions.data() + offset, numPoints),
+                MappedTrajectoryView::AttributesView(&attributes, offset, numPoints));
+    }
+    inline MappedTrajectoryView at(size_t i) const {
+        if (i >= size()) {
+            throw std::out_of_range("MappedTrajectories::at: Index out of range.");
+        }
+        return (*this)[i];
+    }
+
+    /**
+     * Copies the trajectories with the indices firstTrajectory to lastTrajectory-1 to the passed container (the old
+     * content is replaced). The copies of the position and attribute blocks are parallelized.
+     */
+    void copyTrajectories(size_t firstTrajectory, size_t lastTrajectory, Trajectories &trajectories) const;
+
+    /**
+     * Makes the point arrays of the passed container views of the mapped file (see TrajectoryArray), i.e., nothing but
+     * the trajectory offsets is copied. The file needs to be opened copy-on-write, and it stays mapped as long as the
+     * container uses the views (also after close or destroying this object).
+     */
+    void mapTrajectories(Trajectories &trajectories) const;
+
+private:
+    std::shared_ptr<MappedFile> file;
+    size_t numTrajectories = 0;
+    ArrayView<const uint64_t> trajectoryOffsets;
+    ArrayView<const glm::vec3> positions;
+    std::vector<ArrayView<const float>> attributes;
+    std::vector<glm::vec2> attributeRanges;
+    sgl::AABB3 boundingBox;
+};
+
+/**
+ * @return The format version of the passed .binlines file (0 if the file could not be opened).
+ */
+uint32_t getBinLinesFormatVersion(const std::string &filename);
+
+/**
+ * Loads a binlines v2 file without copying the points: The file is mapped copy-on-write, and the point arrays of the
+ * returned container are views of the mapped blocks (see MappedTrajectories::mapTrajectories). Thus, the time and
+ * memory needed are proportional to the data that is actually accessed, and modifying the trajectories (e.g., the
+ * normalization in loadTrajectoriesFromFile) only creates private copies of the written pages.
+ * @param boundingBox If not null, the bounding box of all positions stored in the header is written to it.
+ * @param attributeRanges If not null, the ranges of all attributes stored in the file are written to it.
+ */
+Trajectories loadTrajectoriesFromBinLinesV2(
+        const std::string &filename, sgl::AABB3 *boundingBox = nullptr,
+        std::vector<glm::vec2> *attributeRanges = nullptr);
+
+/**
+ * Writes the passed trajectories to a binlines v2 file.
+ * @return False if the file could not be written.
+ */
+bool writeTrajectoriesToBinLinesV2(const std::string &filename, const Trajectories &trajectories);
+
+/**
+ * Converts a trajectory file (.obj, .nc or .binlines v1) to a binlines v2 file. The attributes written are the ones
+ * loadTrajectoriesFromFile would return (i.e., the importance criteria for .obj and .nc files), but without the
+ * normalization of the positions (which is applied when loading the file).
+ * @return False if the input file could not be loaded or the output file could not be written.
+ */
+bool convertTrajectoriesToBinLinesV2(
+        const std::string &inputFilename, const std::string &outputFilename, TrajectoryType trajectoryType);
+
+/**
+ * Version of streamTrajectoriesFromBinLines for binlines v2 files. The batches are copied from the mapped file, i.e.,
+ * only the part of the file belonging to the current batch needs to be resident in memory.
+ */
+bool streamTrajectoriesFromBinLinesV2(
+        const std::string &filename, size_t maxBatchSizeBytes,
+        std::function<void(Trajectories &batch, float progress)> batchCallback);
+
+#endif //PIXELSYNCOIT_BINLINESFILE_HPP
@@ -33,6 +33,9 @@
 #include <cstring>
 #include <Utils/File/Logfile.hpp>
 #include "MeshSerializer.hpp"
+#include "MeshOptimizer.hpp"
+#include "MeshClustering.hpp"
+#include "MeshQuantization.hpp"
 #include "ComputeNormals.hpp"
 #include "ImportanceCriteria.hpp"
 #include "BinaryObjLoader.hpp"
@@ -153,6 +156,13 @@ void convertBinaryObjMeshToBinmesh(
     attributes.clear(); attributes.shrink_to_fit();
     vertexAttributeData.clear(); vertexAttributeData.shrink_to_fit();
 
+    // The isosurfaces are very large, so the triangles are additionally sorted into spatially coherent clusters.
+    MeshOptimizationSettings optimizationSettings;
+    optimizationSettings.useMortonClusters = true;
+    optimizeBinaryMesh(binaryMesh, optimizationSettings);
+    buildMeshClusters(binaryMesh);
+    quantizeBinaryMesh(binaryMesh);
+
     sgl::Logfile::get()->writeInfo(std::string() + "Writing binary mesh...");
     writeMesh3D(binaryFilename, binaryMesh);
     sgl::Logfile::get()->writeInfo(std::string() + "Finished writing binary mesh.");
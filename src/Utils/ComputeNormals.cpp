@@ -26,9 +26,9 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
-#include <map>
 #include <Utils/Convert.hpp>
 #include <Utils/File/Logfile.hpp>
+#include "MeshTopology.hpp"
 #include "ComputeNormals.hpp"
 #include <iostream>
 #include <algorithm>
@@ -44,19 +44,13 @@ void computeNormals(
         std::vector<glm::vec3> &normals,
         std::vector<float> &attributes)
 {
-    // For finding all triangles with a specific index. Maps vertex index -> first triangle index.
+    // For finding all triangles with a specific index. Maps vertex index -> adjacent triangle indices (CSR).
+    // The faces of each vertex are always sorted: The curvature pass below pairs consecutive vertices of the 1-ring in
+    // the order of the faces, so an order depending on the thread schedule would change the curvature substantially.
     sgl::Logfile::get()->writeInfo(std::string() + "Creating index map for "
             + sgl::toString(indices.size()) + " indices...");
-    std::vector<std::vector<uint32_t>> indexMap;
-    indexMap.resize(vertices.size());
-
-#pragma omp parallel for
-    for (size_t j = 0; j < indices.size(); j++) {
-        size_t vindex = indices.at(j);
-        size_t faceIndex = j / 3;
-
-        indexMap[vindex].push_back(faceIndex);
-    }
+    VertexFaceAdjacency indexMap;
+    buildVertexFaceAdjacency(indices, vertices.size(), indexMap, true);
 
     std::vector<glm::vec3> faceNormals(indices.size() / 3);
     sgl::Logfile::get()->writeInfo(std::string() + "Computing face normals for "
@@ -65,8 +59,8 @@ void computeNormals(
     for (size_t f = 0; f < faceNormals.size(); ++f)
     {
         size_t vertIndex = f * 3;
-        size_t i1 = indices.at(vertIndex), i2 = indices.at(vertIndex+1), i3 = indices.at(vertIndex+2);
-        glm::vec3 faceNormal = glm::cross(vertices.at(i3) - vertices.at(i1), vertices.at(i2) - vertices.at(i1));
+        size_t i1 = indices[vertIndex], i2 = indices[vertIndex+1], i3 = indices[vertIndex+2];
+        glm::vec3 faceNormal = glm::cross(vertices[i3] - vertices[i1], vertices[i2] - vertices[i1]);
 //        faceNormal = glm::normalize(faceNormal);
         // don't normalize weights as triangle area is encoded in cross product
         // area is then used to weight contribution of normal to average normal at each vertex
@@ -77,144 +71,147 @@ void computeNormals(
             + sgl::toString(vertices.size()) + " vertices...");
     normals.resize(vertices.size());
 
-#pragma omp parallel for
+    size_t numUnreferencedVertices = 0;
+#pragma omp parallel for reduction(+:numUnreferencedVertices)
     for (size_t i = 0; i < vertices.size(); i++) {
 
         glm::vec3 normal(0.0f, 0.0f, 0.0f);
-        int numTrianglesSharedBy = 0;
+        size_t numTrianglesSharedBy = indexMap.getNumFaces(i);
 
-        const auto& faceIndices = indexMap[i];
-        for (const auto& face : faceIndices)
+        for (const uint32_t *face = indexMap.facesBegin(i); face != indexMap.facesEnd(i); face++)
         {
-//            size_t vertIndex = face * 3;
-//            size_t i1 = indices.at(vertIndex), i2 = indices.at(vertIndex+1), i3 = indices.at(vertIndex+2);
-//            glm::vec3 faceNormal = glm::cross(vertices.at(i3) - vertices.at(i1), vertices.at(i2) - vertices.at(i1));
-            const glm::vec3& faceNormal = faceNormals[face];
-            normal += faceNormal;
-            numTrianglesSharedBy++;
+            normal += faceNormals[*face];
         }
 
+        // Unreferenced vertices aren't rendered, so they just get a zero normal
         if (numTrianglesSharedBy == 0) {
-            sgl::Logfile::get()->writeError("Error in createNormals: numTrianglesSharedBy == 0");
-            exit(1);
+            numUnreferencedVertices++;
+            normals[i] = normal;
+            continue;
         }
         normal /= (float)numTrianglesSharedBy;
         normal = glm::normalize(normal);
         normals[i] = normal;
     }
+    if (numUnreferencedVertices != 0) {
+        sgl::Logfile::get()->writeError(std::string() + "Error in computeNormals: "
+                + sgl::toString(numUnreferencedVertices) + " vertices are not referenced by any triangle. "
+                + "They are skipped.");
+    }
 
     sgl::Logfile::get()->writeInfo(std::string() + "Computing curvature for "
                                    + sgl::toString(vertices.size()) + " vertices...");
     attributes.resize(vertices.size());
 
-#pragma omp parallel for
-    for (size_t i = 0; i < vertices.size(); i++)
+#pragma omp parallel
     {
-        // min curvature
-//        float k1 = std::numeric_limits<float>::max();
-//        float k2 = -std::numeric_limits<float>::min();
-
-        const auto& faceIndices = indexMap[i];
-        const glm::vec3& n0 = normals[i];
-        const glm::vec3& p0 = vertices[i];
-
-        // find edges
+        // find edges (reused by all vertices of a thread)
         std::vector<uint32_t> ring1Vertices;
+        std::vector<float> ring1Curvatures;
 
-        for (const auto& face : faceIndices)
+#pragma omp for
+        for (size_t i = 0; i < vertices.size(); i++)
         {
-            size_t vertIndex = face * 3;
-//            size_t i1 = indices.at(vertIndex), i2 = indices.at(vertIndex+1), i3 = indices.at(vertIndex+2);
-            std::vector<uint32_t> idx = { indices[vertIndex], indices[vertIndex+1], indices[vertIndex+2] };
+            // min curvature
+//            float k1 = std::numeric_limits<float>::max();
+//            float k2 = -std::numeric_limits<float>::min();
 
-            for (auto j = 0; j < 3; ++j)
-            {
-                auto vID = idx[j];
-                if (vID == i) { continue; }
+            const glm::vec3& n0 = normals[i];
+            const glm::vec3& p0 = vertices[i];
+
+            ring1Vertices.clear();
 
-                if (std::find(ring1Vertices.begin(), ring1Vertices.end(), vID) == ring1Vertices.end())
+            for (const uint32_t *face = indexMap.facesBegin(i); face != indexMap.facesEnd(i); face++)
+            {
+                size_t vertIndex = size_t(*face) * 3;
+                for (size_t j = 0; j < 3; ++j)
                 {
-                    ring1Vertices.push_back(vID);
+                    auto vID = indices[vertIndex + j];
+                    if (vID == i) { continue; }
+
+                    if (std::find(ring1Vertices.begin(), ring1Vertices.end(), vID) == ring1Vertices.end())
+                    {
+                        ring1Vertices.push_back(vID);
+                    }
                 }
             }
-        }
 
-        // compute curvature
-        std::vector<float> ring1Curvatures(ring1Vertices.size(), 0);
-
-        for (auto v = 0; v < ring1Vertices.size(); ++v)
-        {
-            const uint32_t vID = ring1Vertices[v];
-
-            const glm::vec3& n1 = normals[vID];
-            const glm::vec3& p1 = vertices[vID];
+            // No edge angle for unreferenced vertices
+            if (ring1Vertices.size() < 2) {
+                attributes[i] = 0.0f;
+                continue;
+            }
 
-            const glm::vec3 n = n1 - n0;
-            const glm::vec3 p = p1 - p0;
+            // compute curvature
+            ring1Curvatures.assign(ring1Vertices.size(), 0.0f);
+            for (auto v = 0; v < ring1Vertices.size(); ++v)
+            {
+                const uint32_t vID = ring1Vertices[v];
 
-            const float l2 = glm::length(p) * glm::length(p);
+                const glm::vec3& n1 = normals[vID];
+                const glm::vec3& p1 = vertices[vID];
 
-            ring1Curvatures[v] = glm::dot(n, p) / l2;
-        }
+                const glm::vec3 n = n1 - n0;
+                const glm::vec3 p = p1 - p0;
 
-        // compute edge curvatures
+                const float l2 = glm::length(p) * glm::length(p);
 
-        double totalCurvature = 0;
-        double totalAngle = 0;
+                ring1Curvatures[v] = glm::dot(n, p) / l2;
+            }
 
-        for (auto e = 0; e < ring1Vertices.size() - 1; ++e)
-        {
-            const glm::vec3& p1 = vertices[ring1Vertices[e]];
-            const glm::vec3& p2 = vertices[ring1Vertices[e + 1]];
-
-            // compute edge angle
-            glm::vec3 edge0 = p1 - p0;
-            glm::vec3 edge1 = p2 - p0;
-            glm::vec3 product = glm::cross(edge0, edge1);
-            double sineValue = glm::length(product) / (glm::length(edge0), glm::length(edge1));
-            double angle = glm::asin(std::min(1.0, sineValue));
-
-            totalAngle += angle;
-            totalCurvature += angle * (ring1Curvatures[e] + ring1Curvatures[e + 1]);
-        }
+            // compute edge curvatures
 
-        totalCurvature = totalCurvature / (2 * totalAngle);
-        attributes[i] = totalCurvature;
+            double totalCurvature = 0;
+            double totalAngle = 0;
 
-        ring1Curvatures.clear();
-        ring1Curvatures.shrink_to_fit();
+            for (auto e = 0; e < ring1Vertices.size() - 1; ++e)
+            {
+                const glm::vec3& p1 = vertices[ring1Vertices[e]];
+                const glm::vec3& p2 = vertices[ring1Vertices[e + 1]];
+
+                // compute edge angle
+                glm::vec3 edge0 = p1 - p0;
+                glm::vec3 edge1 = p2 - p0;
+                glm::vec3 product = glm::cross(edge0, edge1);
+                double sineValue = glm::length(product) / (glm::length(edge0), glm::length(edge1));
+                double angle = glm::asin(std::min(1.0, sineValue));
+
+                totalAngle += angle;
+                totalCurvature += angle * (ring1Curvatures[e] + ring1Curvatures[e + 1]);
+            }
 
-        ring1Vertices.clear();
-        ring1Vertices.shrink_to_fit();
+            totalCurvature = totalCurvature / (2 * totalAngle);
+            attributes[i] = totalCurvature;
 
-        // loop over faces
-//        for (const auto& face : faceIndices)
-//        {
-//            size_t vertIndex = face * 3;
-////            size_t i1 = indices.at(vertIndex), i2 = indices.at(vertIndex+1), i3 = indices.at(vertIndex+2);
-//            std::vector<uint32_t> idx = { indices[vertIndex], indices[vertIndex+1], indices[vertIndex+2] };
-//
-//            for (auto j = 0; j < 3; ++j)
+            // loop over faces
+//            for (const auto& face : faceIndices)
 //            {
-//                auto vID = idx[j];
-//                if (vID == i) { continue; }
+//                size_t vertIndex = face * 3;
+////                size_t i1 = indices.at(vertIndex), i2 = indices.at(vertIndex+1), i3 = indices.at(vertIndex+2);
+//                std::vector<uint32_t> idx = { indices[vertIndex], indices[vertIndex+1], indices[vertIndex+2] };
+//
+//                for (auto j = 0; j < 3; ++j)
+//                {
+//                    auto vID = idx[j];
+//                    if (vID == i) { continue; }
 //
-//                // compute curvature
-//                const glm::vec3& v1 = vertices[vID];
-//                const glm::vec3& n1 = normals[vID];
+//                    // compute curvature
+//                    const glm::vec3& v1 = vertices[vID];
+//                    const glm::vec3& n1 = normals[vID];
 //
-//                auto pD = glm::normalize(v1 - v0);
+//                    auto pD = glm::normalize(v1 - v0);
 //
-//                float k = glm::dot((n1 - n0), pD);
+//                    float k = glm::dot((n1 - n0), pD);
 //
-//                k1 = std::min(k, k1);
-//                k2 = std::max(k, k2);
+//                    k1 = std::min(k, k1);
+//                    k2 = std::max(k, k2);
+//                }
 //            }
-//        }
 
-        //float meanCurvature = (k1 + k2) / 2;
-//        float gaussianCurvature = k1 * k2;
-//        attributes[i] = meanCurvature;
+            //float meanCurvature = (k1 + k2) / 2;
+//            float gaussianCurvature = k1 * k2;
+//            attributes[i] = meanCurvature;
+        }
     }
 
 
@@ -222,7 +219,6 @@ void computeNormals(
     std::cout << "Free memory" << std::endl << std::flush;
     faceNormals.clear();
     faceNormals.shrink_to_fit();
-    indexMap.clear();
-    indexMap.shrink_to_fit();
+    indexMap = VertexFaceAdjacency();
     std::cout << "Free memory done." << std::endl << std::flush;
 }
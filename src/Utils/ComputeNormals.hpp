@@ -36,6 +36,7 @@
  * Creates normals for the specified indexed vertex set.
  * NOTE: If a vertex is indexed by more than one triangle, then the average normal is stored per vertex.
  * If you want to have non-smooth normals, then make sure each vertex is only referenced by one face.
+ * Vertices not referenced by any face get a zero normal and curvature (an error is written to the log file).
  */
 void computeNormals(
         const std::vector<glm::vec3> &vertices,
@@ -0,0 +1,218 @@
+//
+// Created by agent on 19.10.26.
+//
+
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <ctime>
+
+#include <boost/filesystem.hpp>
+
+#include <Utils/AppSettings.hpp>
+#include <Utils/File/FileUtils.hpp>
+#include <Utils/File/Logfile.hpp>
+
+#include "DerivedDataCache.hpp"
+
+// 64-bit FNV-1a hash
+const uint64_t FNV_OFFSET_BASIS = 14695981039346656037ull;
+const uint64_t FNV_PRIME = 1099511628211ull;
+
+static inline uint64_t hashBytes(uint64_t hash, const void *data, size_t numBytes)
+{
+    const uint8_t *bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < numBytes; i++) {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+static inline uint64_t hashString(uint64_t hash, const std::string &str)
+{
+    // Also hash the length so that e.g. ("ab", "c") and ("a", "bc") differ
+    uint64_t length = str.size();
+    hash = hashBytes(hash, &length, sizeof(uint64_t));
+    return hashBytes(hash, str.c_str(), str.size());
+}
+
+
+void DerivedDataKey::addParameter(const std::string &name, const std::string &value)
+{
+    parameters.push_back(std::make_pair(name, value));
+}
+
+void DerivedDataKey::addParameter(const std::string &name, int value)
+{
+    addParameter(name, std::to_string(value));
+}
+
+void DerivedDataKey::addParameter(const std::string &name, float value)
+{
+    std::ostringstream stream;
+    stream << std::setprecision(9) << value;
+    addParameter(name, stream.str());
+}
+
+void DerivedDataKey::addParameter(const std::string &name, bool value)
+{
+    addParameter(name, std::string(value ? "1" : "0"));
+}
+
+
+DerivedDataCache *DerivedDataCache::get()
+{
+    static DerivedDataCache instance;
+    return &instance;
+}
+
+DerivedDataCache::DerivedDataCache()
+        : maxCacheSizeBytes(uint64_t(32) << 30), useContentHash(false)
+{
+    sgl::SettingsFile &settings = sgl::AppSettings::get()->getSettings();
+    std::string directory = sgl::AppSettings::get()->getDataDirectory() + "DerivedDataCache/";
+    if (settings.hasKey("derivedDataCache-directory")) {
+        directory = settings.getValue("derivedDataCache-directory");
+    }
+    if (settings.hasKey("derivedDataCache-maxSizeMiB")) {
+        maxCacheSizeBytes = uint64_t(settings.getIntValue("derivedDataCache-maxSizeMiB")) << 20;
+    }
+    if (settings.hasKey("derivedDataCache-useContentHash")) {
+        useContentHash = settings.getBoolValue("derivedDataCache-useContentHash");
+    }
+    setCacheDirectory(directory);
+}
+
+void DerivedDataCache::setCacheDirectory(const std::string &directory)
+{
+    cacheDirectory = directory;
+    if (!cacheDirectory.empty() && cacheDirectory.back() != '/' && cacheDirectory.back() != '\\') {
+        cacheDirectory += "/";
+    }
+    sgl::FileUtils::get()->ensureDirectoryExists(cacheDirectory);
+}
+
+uint64_t DerivedDataCache::computeSourceHash(const std::string &sourceFilename)
+{
+    uint64_t hash = hashString(FNV_OFFSET_BASIS, sourceFilename);
+
+    boost::system::error_code errorCode;
+    uint64_t fileSize = boost::filesystem::file_size(sourceFilename, errorCode);
+    if (errorCode) {
+        // The source file doesn't exist (e.g. because the artifact is shipped without the original data).
+        return hash;
+    }
+    hash = hashBytes(hash, &fileSize, sizeof(uint64_t));
+
+    if (!useContentHash) {
+        int64_t lastWriteTime = int64_t(boost::filesystem::last_write_time(sourceFilename, errorCode));
+        return hashBytes(hash, &lastWriteTime, sizeof(int64_t));
+    }
+
+    std::ifstream file(sourceFilename.c_str(), std::ifstream::binary);
+    if (!file.is_open()) {
+        sgl::Logfile::get()->writeError(std::string() + "Error in DerivedDataCache::computeSourceHash: File \""
+                + sourceFilename + "\" could not be opened.");
+        return hash;
+    }
+    const size_t CHUNK_SIZE = size_t(16) << 20;
+    std::vector<char> buffer(CHUNK_SIZE);
+    while (file) {
+        file.read(&buffer.front(), CHUNK_SIZE);
+        hash = hashBytes(hash, &buffer.front(), size_t(file.gcount()));
+    }
+    return hash;
+}
+
+std::string DerivedDataCache::getArtifactFilename(const DerivedDataKey &key)
+{
+    uint64_t hash = computeSourceHash(key.sourceFilename);
+    hash = hashString(hash, key.artifactType);
+    hash = hashBytes(hash, &key.formatVersion, sizeof(uint32_t));
+    for (const std::pair<std::string, std::string> &parameter : key.parameters) {
+        hash = hashString(hash, parameter.first);
+        hash = hashString(hash, parameter.second);
+    }
+
+    // The stem of the source file is kept for better readability of the cache directory.
+    std::string sourceStem = boost::filesystem::path(key.sourceFilename).stem().string();
+    std::ostringstream filenameStream;
+    filenameStream << cacheDirectory << sourceStem << "_" << std::hex << std::setw(16) << std::setfill('0') << hash
+                   << "." << key.artifactType;
+    return filenameStream.str();
+}
+
+bool DerivedDataCache::lookup(const std::string &artifactFilename)
+{
+    if (!sgl::FileUtils::get()->exists(artifactFilename)) {
+        return false;
+    }
+
+    // Mark as most recently used
+    boost::system::error_code errorCode;
+    boost::filesystem::last_write_time(artifactFilename, std::time(nullptr), errorCode);
+    return true;
+}
+
+void DerivedDataCache::commit(const std::string &artifactFilename)
+{
+    if (!sgl::FileUtils::get()->exists(artifactFilename)) {
+        sgl::Logfile::get()->writeError(std::string() + "Error in DerivedDataCache::commit: The artifact \""
+                + artifactFilename + "\" was not created.");
+        return;
+    }
+    evict(maxCacheSizeBytes, artifactFilename);
+}
+
+struct CacheEntry
+{
+    boost::filesystem::path path;
+    std::time_t lastUsedTime;
+    uint64_t sizeBytes;
+};
+
+void DerivedDataCache::evict(uint64_t maxSizeBytes, const std::string &keepFilename)
+{
+    boost::system::error_code errorCode;
+    boost::filesystem::path keepPath = boost::filesystem::path(keepFilename);
+    std::vector<CacheEntry> entries;
+    uint64_t cacheSizeBytes = 0;
+    for (boost::filesystem::directory_iterator it(cacheDirectory, errorCode), end; !errorCode && it != end;
+            it.increment(errorCode)) {
+        if (!boost::filesystem::is_regular_file(it->path(), errorCode)) {
+            continue;
+        }
+        CacheEntry entry;
+        entry.path = it->path();
+        entry.lastUsedTime = boost::filesystem::last_write_time(entry.path, errorCode);
+        entry.sizeBytes = boost::filesystem::file_size(entry.path, errorCode);
+        if (errorCode) {
+            continue;
+        }
+        cacheSizeBytes += entry.sizeBytes;
+        if (!keepFilename.empty() && boost::filesystem::equivalent(entry.path, keepPath, errorCode)) {
+            continue;
+        }
+        entries.push_back(entry);
+    }
+
+    if (cacheSizeBytes <= maxSizeBytes) {
+        return;
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const CacheEntry &e1, const CacheEntry &e2) {
+        return e1.lastUsedTime < e2.lastUsedTime;
+    });
+    for (const CacheEntry &entry : entries) {
+        if (cacheSizeBytes <= maxSizeBytes) {
+            break;
+        }
+        if (boost::filesystem::remove(entry.path, errorCode)) {
+            sgl::Logfile::get()->writeInfo(std::string() + "DerivedDataCache: Evicted \""
+                    + entry.path.string() + "\".");
+            cacheSizeBytes -= entry.sizeBytes;
+        }
+    }
+}
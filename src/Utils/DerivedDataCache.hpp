@@ -0,0 +1,98 @@
+//
+// Created by agent on 19.10.26.
+//
+
+#ifndef PIXELSYNCOIT_DERIVEDDATACACHE_HPP
+#define PIXELSYNCOIT_DERIVEDDATACACHE_HPP
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstdint>
+
+/**
+ * Identifies an artifact derived from a source file (e.g. a .binmesh or .voxel file). Two keys are equal if the
+ * source file is unchanged and the artifact was built with the same build parameters and file format version.
+ */
+struct DerivedDataKey
+{
+    /**
+     * @param sourceFilename The file the artifact is created from.
+     * @param artifactType The file extension of the artifact (e.g. "binmesh" or "voxel").
+     * @param formatVersion The version of the file format of the artifact.
+     */
+    DerivedDataKey(const std::string &sourceFilename, const std::string &artifactType, uint32_t formatVersion)
+            : sourceFilename(sourceFilename), artifactType(artifactType), formatVersion(formatVersion) {}
+
+    // Build parameters the artifact depends on
+    void addParameter(const std::string &name, const std::string &value);
+    void addParameter(const std::string &name, const char *value) { addParameter(name, std::string(value)); }
+    void addParameter(const std::string &name, int value);
+    void addParameter(const std::string &name, float value);
+    void addParameter(const std::string &name, bool value);
+
+    std::string sourceFilename;
+    std::string artifactType;
+    uint32_t formatVersion;
+    std::vector<std::pair<std::string, std::string>> parameters;
+};
+
+/**
+ * Cache for data derived from the datasets (e.g. the binmesh and voxel files). The artifacts are stored in the cache
+ * directory with a filename containing a hash of the source file (size and modification time or, optionally, the
+ * content), the build parameters and the format version. Thus, changing e.g. the grid resolution of the voxel grid
+ * results in a new artifact instead of silently reusing stale data.
+ * If the size of the cache exceeds the budget, the least recently used artifacts are evicted. The access time is
+ * stored as the modification time of the artifact files, i.e., no separate index file is necessary.
+ *
+ * Settings (settings.txt): "derivedDataCache-directory", "derivedDataCache-maxSizeMiB" and
+ * "derivedDataCache-useContentHash".
+ *
+ * Usage:
+ *     DerivedDataKey key(sourceFilename, "voxel", VOXEL_GRID_FORMAT_VERSION);
+ *     key.addParameter("gridResolution", 256);
+ *     std::string artifactFilename = DerivedDataCache::get()->getArtifactFilename(key);
+ *     if (!DerivedDataCache::get()->lookup(artifactFilename)) {
+ *         ... create the file "artifactFilename" ...
+ *         DerivedDataCache::get()->commit(artifactFilename);
+ *     }
+ */
+class DerivedDataCache
+{
+public:
+    static DerivedDataCache *get();
+
+    void setCacheDirectory(const std::string &directory);
+    const std::string &getCacheDirectory() const { return cacheDirectory; }
+    void setMaxCacheSizeBytes(uint64_t maxSizeBytes) { maxCacheSizeBytes = maxSizeBytes; }
+    uint64_t getMaxCacheSizeBytes() const { return maxCacheSizeBytes; }
+    // Hashing the content is more robust than using the size and modification time, but slow for large datasets.
+    void setUseContentHash(bool useHash) { useContentHash = useHash; }
+
+    /// @return The filename of the artifact identified by "key" in the cache directory.
+    std::string getArtifactFilename(const DerivedDataKey &key);
+
+    /**
+     * @return True if the artifact exists in the cache. In this case, it is marked as most recently used.
+     */
+    bool lookup(const std::string &artifactFilename);
+
+    /**
+     * Needs to be called after the artifact file was written. Evicts the least recently used artifacts (except for
+     * "artifactFilename") if the cache size exceeds the budget.
+     */
+    void commit(const std::string &artifactFilename);
+
+    /// Removes the least recently used artifacts until the cache size is at most "maxSizeBytes".
+    void evict(uint64_t maxSizeBytes, const std::string &keepFilename = "");
+
+private:
+    DerivedDataCache();
+    uint64_t computeSourceHash(const std::string &sourceFilename);
+
+    std::string cacheDirectory;
+    uint64_t maxCacheSizeBytes;
+    bool useContentHash;
+};
+
+#endif //PIXELSYNCOIT_DERIVEDDATACACHE_HPP
@@ -2,15 +2,20 @@
 // Created by christoph on 22.01.19.
 //
 
+#include <chrono>
+#include <cmath>
+#include <cstring>
 #include <boost/algorithm/string.hpp>
 #include <boost/algorithm/string/split.hpp>
 
 #include <Utils/File/Logfile.hpp>
 #include <Utils/Convert.hpp>
-#include <Utils/Events/Stream/Stream.hpp>
 #include <Math/Geometry/MatrixUtil.hpp>
 
 #include "MeshSerializer.hpp"
+#include "MeshOptimizer.hpp"
+#include "MeshClustering.hpp"
+#include "MeshQuantization.hpp"
 #include "TrajectoryLoader.hpp"
 #include "HairLoader.hpp"
 
@@ -23,315 +28,430 @@ uint32_t toUint32Color(const glm::vec4 &vecColor) {
     return packedColor;
 }
 
-/**
- * Loads the specified hair file into memory.
- * For more on the file format see http://www.cemyuksel.com/research/hairmodels/
- */
-void loadHairFile(const std::string &hairFilename, HairData &hairData) {
-    std::ifstream file(hairFilename.c_str(), std::ifstream::binary);
-    if (!file.is_open()) {
-        sgl::Logfile::get()->writeError(std::string() +
-                "Error in readMesh3D: File \"" + hairFilename + "\" not found.");
-        return;
+bool MappedHairFile::open(const std::string &filename)
+{
+    close();
+    if (!file.open(filename)) {
+        return false;
     }
+    this->filename = filename;
+    const char *data = file.getData();
+    const size_t fileSize = file.getSize();
 
-    file.seekg(0, file.end);
-    size_t size = file.tellg();
-    file.seekg(0);
-    char *buffer = new char[size];
-    file.read(buffer, size);
-
-    // Read magic number
-    sgl::BinaryReadStream stream(buffer, size);
+    // Header (128 bytes)
+    const size_t HEADER_SIZE = 128;
     const uint32_t FILE_FORMAT_HAIR_MAGIC_NUMBER = 0x52494148; // 48 41 49 52
-    uint32_t magicNumber;
-    stream.read(magicNumber);
+    uint32_t magicNumber = 0, numStrands = 0, totalNumPoints = 0, settingsBitField = 0, defaultNumSegments = 0;
+    if (fileSize >= HEADER_SIZE) {
+        memcpy(&magicNumber, data, sizeof(uint32_t));
+    }
     if (magicNumber != FILE_FORMAT_HAIR_MAGIC_NUMBER) {
-        sgl::Logfile::get()->writeError(std::string() + "Error in loadHairFile: Invalid magic number in file \""
-                                        + hairFilename + "\".");
-        return;
+        sgl::Logfile::get()->writeError(std::string() + "Error in MappedHairFile::open: Invalid magic number in file \""
+                                        + filename + "\".");
+        close();
+        return false;
     }
-
-
-
-    // Rest of header after magic number
-    uint32_t numStrands, totalNumPoints, settingsBitField;
-    stream.read(numStrands);
-    stream.read(totalNumPoints);
-    stream.read(settingsBitField);
+    memcpy(&numStrands, data + 4, sizeof(uint32_t));
+    memcpy(&totalNumPoints, data + 8, sizeof(uint32_t));
+    memcpy(&settingsBitField, data + 12, sizeof(uint32_t));
+    memcpy(&defaultNumSegments, data + 16, sizeof(uint32_t));
+    memcpy(&defaultThickness, data + 20, sizeof(float));
+    memcpy(&defaultOpacity, data + 24, sizeof(float));
+    memcpy(&defaultColor, data + 28, sizeof(glm::vec3));
 
     // Read bitfield options
-    bool hasSegmentsArray, hasPointsArray, hasThicknessArray, hasOpacityArray, hasColorArray;
-    hasSegmentsArray = (settingsBitField & 0x1) == 1;
-    hasPointsArray = (settingsBitField >> 1 & 0x1) == 1;
-    hasThicknessArray = (settingsBitField >> 2 & 0x1) == 1;
-    hasOpacityArray = (settingsBitField >> 3 & 0x1) == 1;
-    hasColorArray = (settingsBitField >> 4 & 0x1) == 1;
+    bool hasSegmentsArray = (settingsBitField & 0x1) == 1;
+    bool hasPointsArray = (settingsBitField >> 1 & 0x1) == 1;
+    bool hasThicknessArray = (settingsBitField >> 2 & 0x1) == 1;
+    bool hasOpacityArray = (settingsBitField >> 3 & 0x1) == 1;
+    bool hasColorArray = (settingsBitField >> 4 & 0x1) == 1;
     // Assertion: Needs to have points array
     if (!hasPointsArray) {
-        sgl::Logfile::get()->writeError(std::string() + "Error in loadHairFile: Invalid bitfield in file \""
-                                        + hairFilename + "\".");
-        return;
+        sgl::Logfile::get()->writeError(std::string() + "Error in MappedHairFile::open: Invalid bitfield in file \""
+                                        + filename + "\".");
+        close();
+        return false;
     }
 
-    // Read default values
-    uint32_t defaultNumSegments;
-    float defaultThickness, defaultOpacity;
-    glm::vec3 defaultColor;
-    stream.read(defaultNumSegments);
-    stream.read(defaultThickness);
-    stream.read(defaultOpacity);
-    stream.read(defaultColor);
-
-    // Read file information
-    const size_t FILE_INFO_SIZE = 88;
-    char fileInformation[FILE_INFO_SIZE];
-    stream.read(fileInformation, FILE_INFO_SIZE);
-
-
-    // ---------- Starting from here: Read actual hair data ----------
-
-    // First: Read number of segments per strand and reserve data for point, thickness and color arrays (if necessary)
-    hairData.filename = hairFilename;
-    hairData.strands.resize(numStrands);
+    // Strand offsets (prefix sum over the number of points per strand)
+    size_t offset = HEADER_SIZE;
+    strandOffsets.resize(size_t(numStrands) + 1);
+    strandOffsets[0] = 0;
     if (hasSegmentsArray) {
-        std::vector<uint16_t> segmentsArray;
-        segmentsArray.resize(numStrands);
-        stream.read(&segmentsArray.front(), numStrands * sizeof(uint16_t));
+        if (offset + size_t(numStrands) * sizeof(uint16_t) > fileSize) {
+            sgl::Logfile::get()->writeError(std::string() + "Error in MappedHairFile::open: File \"" + filename
+                    + "\" is too small for its segments array.");
+            close();
+            return false;
+        }
         for (size_t i = 0; i < numStrands; i++) {
-            size_t numPoints = segmentsArray.at(i)+1;
-            HairStrand &strand = hairData.strands.at(i);
-            strand.points.resize(numPoints);
-            if (hasThicknessArray) {
-                strand.thicknesses.resize(numPoints);
-            }
-            if (hasOpacityArray || hasColorArray) {
-                strand.colors.resize(numPoints);
-            }
+            uint16_t numSegments;
+            memcpy(&numSegments, data + offset + i * sizeof(uint16_t), sizeof(uint16_t));
+            strandOffsets[i + 1] = strandOffsets[i] + size_t(numSegments) + 1;
         }
+        offset += size_t(numStrands) * sizeof(uint16_t);
     } else {
-        for (HairStrand &strand : hairData.strands) {
-            size_t numPoints = defaultNumSegments+1;
-            strand.points.resize(numPoints);
-            if (hasThicknessArray) {
-                strand.thicknesses.resize(numPoints);
-            }
-            if (hasOpacityArray || hasColorArray) {
-                strand.colors.resize(numPoints);
-            }
+        for (size_t i = 0; i < numStrands; i++) {
+            strandOffsets[i + 1] = strandOffsets[i] + size_t(defaultNumSegments) + 1;
         }
     }
+    const size_t numPoints = strandOffsets.back();
+    if (numPoints != size_t(totalNumPoints)) {
+        sgl::Logfile::get()->writeInfo(std::string() + "Warning in MappedHairFile::open: The number of points stored "
+                "in the header of \"" + filename + "\" doesn't match the segments array.");
+    }
 
-    // Next: Read points array (obligatory)
-    for (HairStrand &strand : hairData.strands) {
-        stream.read(&strand.points.front(), strand.points.size() * sizeof(float) * 3);
+    // The per-point arrays follow each other and consist of 4-byte values.
+    size_t numArrayFloats = numPoints * 3;
+    if (hasThicknessArray) numArrayFloats += numPoints;
+    if (hasOpacityArray) numArrayFloats += numPoints;
+    if (hasColorArray) numArrayFloats += numPoints * 3;
+    if (offset + numArrayFloats * sizeof(float) > fileSize) {
+        sgl::Logfile::get()->writeError(std::string() + "Error in MappedHairFile::open: File \"" + filename
+                + "\" is too small for its point arrays.");
+        close();
+        return false;
+    }
+    const float *arrayData = (const float*)(data + offset);
+    if (offset % sizeof(float) != 0) {
+        alignedArrayData.resize(numArrayFloats);
+        memcpy(alignedArrayData.data(), data + offset, numArrayFloats * sizeof(float));
+        arrayData = alignedArrayData.data();
     }
 
-    // Next: Read thickness array (optional)
-    hairData.hasThicknessArray = hasThicknessArray;
-    hairData.defaultThickness = defaultThickness;
+    points = ArrayView<const glm::vec3>((const glm::vec3*)arrayData, numPoints);
+    arrayData += numPoints * 3;
     if (hasThicknessArray) {
-        for (HairStrand &strand : hairData.strands) {
-            stream.read(&strand.thicknesses.front(), strand.thicknesses.size() * sizeof(float));
-        }
+        thicknesses = ArrayView<const float>(arrayData, numPoints);
+        arrayData += numPoints;
+    }
+    if (hasOpacityArray) {
+        opacities = ArrayView<const float>(arrayData, numPoints);
+        arrayData += numPoints;
+    }
+    if (hasColorArray) {
+        colors = ArrayView<const glm::vec3>((const glm::vec3*)arrayData, numPoints);
     }
 
-    // Next: Read opacity and color array (optional)
-    hairData.hasColorArray = hasOpacityArray || hasColorArray;
-    hairData.defaultOpacity = defaultOpacity;
-    hairData.defaultColor = defaultColor;
-    if (hairData.hasColorArray) {
-        // 1. Read color and opacity arrays (optional)
-        std::vector<std::vector<float>> opacityArrays;
-        std::vector<std::vector<glm::vec3>> colorArrays;
-        opacityArrays.resize(numStrands);
-        colorArrays.resize(numStrands);
-        if (hasOpacityArray) {
-            for (size_t i = 0; i < numStrands; i++) {
-                std::vector<float> &opacityArray = opacityArrays.at(i);
-                opacityArray.resize(hairData.strands.at(i).colors.size());
-                stream.read(&opacityArray.front(), hairData.strands.at(i).points.size() * sizeof(float));
-            }
-        }
-        if (hasColorArray) {
-            for (size_t i = 0; i < numStrands; i++) {
-                std::vector<glm::vec3> &colorArray = colorArrays.at(i);
-                colorArray.resize(hairData.strands.at(i).colors.size());
-                stream.read(&colorArray.front(), hairData.strands.at(i).points.size() * sizeof(glm::vec3));
-            }
-        }
-
-        // 2. Merge the arrays
-        std::vector<std::vector<glm::vec4>> mergedColorOpacityArrays;
-        mergedColorOpacityArrays.resize(numStrands);
-        if (hasOpacityArray && hasColorArray) {
-            for (size_t i = 0; i < numStrands; i++) {
-                size_t numPoints = hairData.strands.at(i).points.size();
-                std::vector<float> &opacityArray = opacityArrays.at(i);
-                std::vector<glm::vec3> &colorArray = colorArrays.at(i);
-                std::vector<glm::vec4> &mergedColorOpacityArray = mergedColorOpacityArrays.at(i);
-                mergedColorOpacityArray.resize(hairData.strands.at(i).colors.size());
-                for (size_t j = 0; j < numPoints; j++) {
-                    mergedColorOpacityArray.at(j) = glm::vec4(colorArray.at(j), opacityArray.at(j));
-                }
-            }
-        } else if (hasOpacityArray && !hasColorArray) {
-            for (size_t i = 0; i < numStrands; i++) {
-                size_t numPoints = hairData.strands.at(i).points.size();
-                std::vector<float> &opacityArray = opacityArrays.at(i);
-                std::vector<glm::vec4> &mergedColorOpacityArray = mergedColorOpacityArrays.at(i);
-                mergedColorOpacityArray.resize(hairData.strands.at(i).colors.size());
-                for (size_t j = 0; j < numPoints; j++) {
-                    mergedColorOpacityArray.at(j) = glm::vec4(defaultColor, opacityArray.at(j));
-                }
-            }
-        } else { //if (!hasOpacityArray && hasColorArray) {
-            for (size_t i = 0; i < numStrands; i++) {
-                size_t numPoints = hairData.strands.at(i).points.size();
-                std::vector<glm::vec3> &colorArray = colorArrays.at(i);
-                std::vector<glm::vec4> &mergedColorOpacityArray = mergedColorOpacityArrays.at(i);
-                mergedColorOpacityArray.resize(hairData.strands.at(i).colors.size());
-                for (size_t j = 0; j < numPoints; j++) {
-                    mergedColorOpacityArray.at(j) = glm::vec4(colorArray.at(j), defaultOpacity);
-                }
-            }
-        }
+    return true;
+}
 
-        // 3. Convert floating point colors & opacities to 32-bit RGBA colors
-        for (size_t i = 0; i < numStrands; i++) {
-            size_t numPoints = hairData.strands.at(i).points.size();
-            std::vector<glm::vec4> &mergedColorOpacityArray = mergedColorOpacityArrays.at(i);
-            std::vector<uint32_t> &colorArray = hairData.strands.at(i).colors;
-            for (size_t j = 0; j < numPoints; j++) {
-                colorArray.at(j) = toUint32Color(mergedColorOpacityArray.at(j));
-            }
-        }
+void MappedHairFile::close()
+{
+    file.close();
+    filename.clear();
+    alignedArrayData = std::vector<float>();
+    strandOffsets = std::vector<size_t>();
+    points = ArrayView<const glm::vec3>();
+    thicknesses = ArrayView<const float>();
+    opacities = ArrayView<const float>();
+    colors = ArrayView<const glm::vec3>();
+}
 
-    }
+uint32_t MappedHairFile::getPackedColor(size_t pointIndex) const
+{
+    glm::vec3 color = colors.empty() ? defaultColor : colors[pointIndex];
+    float opacity = opacities.empty() ? defaultOpacity : opacities[pointIndex];
+    return toUint32Color(glm::vec4(color, opacity));
 }
 
-void downscaleHairData(HairData &hairData, float scalingFactor)
+glm::mat4 getHairDataTransform(const std::string &hairFilename, float scalingFactor)
 {
-    hairData.defaultThickness *= scalingFactor;
-    for (HairStrand &hairStrand : hairData.strands) {
-        for (glm::vec3 &pt : hairStrand.points) {
-            pt *= scalingFactor;
-        }
-    }
+    glm::mat4 scalingMatrix = sgl::matrixScaling(glm::vec3(scalingFactor));
 
     // For some hair data files: Swap y-axis and z-axis
-    if (!boost::ends_with(hairData.filename, "ponytail.hair")
-            && !boost::ends_with(hairData.filename, "bear.hair")) {
+    if (!boost::ends_with(hairFilename, "ponytail.hair") && !boost::ends_with(hairFilename, "bear.hair")) {
         glm::mat4 hairRotationMatrix = sgl::matrixRowMajor(
                 1.0f, 0.0f, 0.0f, 0.0f,
                 0.0f, 0.0f, 1.0f, 0.0f,
                 0.0f, 1.0f, 0.0f, 0.0f,
                 0.0f, 0.0f, 0.0f, 1.0f
         );
-        for (HairStrand &hairStrand : hairData.strands) {
-            for (glm::vec3 &pt : hairStrand.points) {
-                pt = sgl::transformPoint(hairRotationMatrix, pt);
+        return hairRotationMatrix * scalingMatrix;
+    }
+    return scalingMatrix;
+}
+
+/**
+ * Loads the specified hair file into memory.
+ * For more on the file format see http://www.cemyuksel.com/research/hairmodels/
+ */
+void loadHairFile(const std::string &hairFilename, HairData &hairData) {
+    MappedHairFile hairFile;
+    if (!hairFile.open(hairFilename)) {
+        return;
+    }
+
+    hairData.filename = hairFilename;
+    hairData.hasThicknessArray = hairFile.hasThicknessArray();
+    hairData.hasColorArray = hairFile.hasColorArray() || hairFile.hasOpacityArray();
+    hairData.defaultThickness = hairFile.getDefaultThickness();
+    hairData.defaultOpacity = hairFile.getDefaultOpacity();
+    hairData.defaultColor = hairFile.getDefaultColor();
+
+    const size_t numStrands = hairFile.getNumStrands();
+    const std::vector<size_t> &strandOffsets = hairFile.getStrandOffsets();
+    hairData.strands.resize(numStrands);
+    #pragma omp parallel for schedule(dynamic, 1024)
+    for (size_t i = 0; i < numStrands; i++) {
+        HairStrand &strand = hairData.strands[i];
+        size_t pointsBegin = strandOffsets[i], pointsEnd = strandOffsets[i + 1];
+        const ArrayView<const glm::vec3> &points = hairFile.getPoints();
+        strand.points.assign(points.data() + pointsBegin, points.data() + pointsEnd);
+        if (hairData.hasThicknessArray) {
+            const ArrayView<const float> &thicknesses = hairFile.getThicknesses();
+            strand.thicknesses.assign(thicknesses.data() + pointsBegin, thicknesses.data() + pointsEnd);
+        }
+        if (hairData.hasColorArray) {
+            strand.colors.resize(pointsEnd - pointsBegin);
+            for (size_t j = pointsBegin; j < pointsEnd; j++) {
+                strand.colors[j - pointsBegin] = hairFile.getPackedColor(j);
             }
         }
     }
 }
 
-void convertHairDataToBinaryTriangleMesh(
-        const std::string &hairFilename,
-        const std::string &binaryFilename)
+void downscaleHairData(HairData &hairData, float scalingFactor)
 {
-    // First, load the hair data from the specified file
-    HairData hairData;
-    loadHairFile(hairFilename, hairData);
-    downscaleHairData(hairData, HAIR_MODEL_SCALING_FACTOR);
+    hairData.defaultThickness *= scalingFactor;
+    glm::mat4 transform = getHairDataTransform(hairData.filename, scalingFactor);
 
-    BinaryMesh binaryMesh;
-    binaryMesh.submeshes.push_back(BinarySubMesh());
-    BinarySubMesh &submesh = binaryMesh.submeshes.front();
-    submesh.vertexMode = sgl::VERTEX_MODE_TRIANGLES;
+    const size_t numStrands = hairData.strands.size();
+    #pragma omp parallel for schedule(dynamic, 1024)
+    for (size_t i = 0; i < numStrands; i++) {
+        HairStrand &hairStrand = hairData.strands[i];
+        for (glm::vec3 &pt : hairStrand.points) {
+            pt = sgl::transformPoint(transform, pt);
+        }
+        for (float &thickness : hairStrand.thicknesses) {
+            thickness *= scalingFactor;
+        }
+    }
+}
 
-    std::vector<glm::vec3> globalVertexPositions;
-    std::vector<glm::vec3> globalNormals;
-    std::vector<uint32_t> globalColors;
-    std::vector<uint32_t> globalIndices;
 
-    initializeCircleData(3, hairData.defaultThickness);
+/// Applies the passed transformation to the points of a strand (see getHairDataTransform).
+static inline void transformHairStrand(
+        const ArrayView<const glm::vec3> &points, const glm::mat4 &transform, std::vector<glm::vec3> &transformedPoints)
+{
+    transformedPoints.resize(points.size());
+    for (size_t i = 0; i < points.size(); i++) {
+        transformedPoints[i] = sgl::transformPoint(transform, points[i]);
+    }
+}
 
-    size_t numStrands = hairData.strands.size();
-    for (HairStrand &strand : hairData.strands) {
-        std::vector<glm::vec3> &pathLineCenters = strand.points;
-        std::vector<float> &pathLineThicknesses = strand.thicknesses;
-        std::vector<uint32_t> &pathLineColors = strand.colors;
+/**
+ * Computes the points of a strand used as tube nodes. This follows the rules of createTubeRenderData (i.e., invalid
+ * points and points too close to their successor are skipped, and closed strands are removed), so strands with
+ * constant thickness result in the same tubes as before.
+ * @return The number of tube nodes of the strand, or 0 if the strand results in no tube (less than two nodes).
+ */
+static size_t getHairTubeNodes(
+        const std::vector<glm::vec3> &points, std::vector<uint32_t> &nodePointIndices, std::vector<glm::vec3> &tangents)
+{
+    nodePointIndices.clear();
+    tangents.clear();
+    size_t n = points.size();
+    if (n < 2 || glm::length(points.front() - points.back()) < 0.01f) {
+        return 0;
+    }
 
-        // Create tube render data
-        std::vector<glm::vec3> localVertices;
-        std::vector<uint32_t> localColors;
-        std::vector<glm::vec3> localNormals;
-        std::vector<uint32_t> localIndices;
-        if (hairData.hasThicknessArray) {
-            sgl::Logfile::get()->writeError("Error in convertHairDataToBinaryTriangleMesh: Variable thickness not yet "
-                                            "supported.");
-        } else {
-            createTubeRenderData(pathLineCenters, pathLineColors, localVertices, localNormals, localColors, localIndices);
+    const float MAX_VAL = 1e10;
+    for (size_t i = 0; i < n; i++) {
+        const glm::vec3 &center = points[i];
+        if (std::fabs(center.x) > MAX_VAL || std::fabs(center.y) > MAX_VAL || std::fabs(center.z) > MAX_VAL) {
+            continue;
         }
-        //createTubeRenderData(pathLineCenters, pathLineThicknesses, hairData.defaultThickness, pathLineColors,
-        //        localVertices, localColors, localIndices);
-        //createNormals(localVertices, localIndices, localNormals);
 
-        // Local -> global
-        for (size_t i = 0; i < localIndices.size(); i++) {
-            globalIndices.push_back(localIndices.at(i) + globalVertexPositions.size());
+        glm::vec3 tangent;
+        if (i == n - 1) {
+            tangent = points[i] - points[i - 1];
+        } else {
+            tangent = points[i + 1] - points[i];
         }
-        globalVertexPositions.insert(globalVertexPositions.end(), localVertices.begin(), localVertices.end());
-        globalColors.insert(globalColors.end(), localColors.begin(), localColors.end());
-        globalNormals.insert(globalNormals.end(), localNormals.begin(), localNormals.end());
+        if (glm::length(tangent) < 0.0001f) {
+            continue;
+        }
+
+        nodePointIndices.push_back(uint32_t(i));
+        tangents.push_back(glm::normalize(tangent));
     }
 
+    return nodePointIndices.size() >= 2 ? nodePointIndices.size() : 0;
+}
 
-    submesh.material.diffuseColor = hairData.defaultColor;
-    submesh.material.opacity = hairData.defaultOpacity;
-    submesh.indices = globalIndices;
+void convertHairDataToBinaryTriangleMesh(
+        const std::string &hairFilename,
+        const std::string &binaryFilename)
+{
+    // The strands are read directly from the mapped file and transformed on the fly.
+    MappedHairFile hairFile;
+    if (!hairFile.open(hairFilename)) {
+        return;
+    }
+    hairFile.adviseSequential();
+    const glm::mat4 transform = getHairDataTransform(hairFilename, HAIR_MODEL_SCALING_FACTOR);
+    const float thicknessScale = HAIR_MODEL_SCALING_FACTOR;
+
+    auto startTubes = std::chrono::system_clock::now();
+    const size_t numStrands = hairFile.getNumStrands();
+    // Colors and opacities are merged to one RGBA8 attribute if either of them is given (see getPackedColor).
+    const bool hasVertexColors = hairFile.hasColorArray() || hairFile.hasOpacityArray();
+
+    // The circle is scaled by the thickness of the individual points.
+    std::vector<glm::vec2> unitCirclePoints;
+    getPointsOnCircle(unitCirclePoints, glm::vec2(0.0f, 0.0f), 1.0f, 3);
+    const size_t numCirclePoints = unitCirclePoints.size();
+
+    // Pass 1: Count the number of vertices and indices of the tube of each strand.
+    std::vector<size_t> strandVertexOffsets(numStrands + 1, 0);
+    #pragma omp parallel
+    {
+        std::vector<glm::vec3> strandPoints;
+        std::vector<uint32_t> nodePointIndices;
+        std::vector<glm::vec3> tangents;
+        #pragma omp for schedule(dynamic, 1024)
+        for (size_t i = 0; i < numStrands; i++) {
+            transformHairStrand(hairFile.getStrandPoints(i), transform, strandPoints);
+            size_t numNodes = getHairTubeNodes(strandPoints, nodePointIndices, tangents);
+            strandVertexOffsets[i + 1] = numNodes * numCirclePoints;
+        }
+    }
+    for (size_t i = 0; i < numStrands; i++) {
+        strandVertexOffsets[i + 1] += strandVertexOffsets[i];
+    }
+    // Each tube with m nodes has (m - 1) * numCirclePoints * 6 indices, i.e., numCirclePoints * 6 less than the
+    // number of its vertices times six.
+    std::vector<size_t> strandIndexOffsets(numStrands + 1, 0);
+    for (size_t i = 0; i < numStrands; i++) {
+        size_t numVertices = strandVertexOffsets[i + 1] - strandVertexOffsets[i];
+        strandIndexOffsets[i + 1] = strandIndexOffsets[i] + (numVertices > 0 ? (numVertices - numCirclePoints) * 6 : 0);
+    }
+    const size_t totalNumVertices = strandVertexOffsets.back();
+    const size_t totalNumIndices = strandIndexOffsets.back();
+    if (totalNumVertices > size_t(UINT32_MAX)) {
+        sgl::Logfile::get()->writeError(std::string() + "Error in convertHairDataToBinaryTriangleMesh: File \""
+                + hairFilename + "\" results in more than UINT32_MAX vertices (not supported currently).");
+        return;
+    }
 
-    BinaryMeshAttribute positionAttribute;
+    // Allocate the attribute buffers of the binary mesh and fill them directly.
+    BinaryMesh binaryMesh;
+    binaryMesh.submeshes.push_back(BinarySubMesh());
+    BinarySubMesh &submesh = binaryMesh.submeshes.front();
+    submesh.vertexMode = sgl::VERTEX_MODE_TRIANGLES;
+    submesh.material.diffuseColor = hairFile.getDefaultColor();
+    submesh.material.opacity = hairFile.getDefaultOpacity();
+    submesh.indices.resize(totalNumIndices);
+
+    submesh.attributes.resize(hasVertexColors ? 3 : 2);
+    BinaryMeshAttribute &positionAttribute = submesh.attributes.at(0);
     positionAttribute.name = "vertexPosition";
     positionAttribute.attributeFormat = sgl::ATTRIB_FLOAT;
     positionAttribute.numComponents = 3;
-    positionAttribute.data.resize(globalVertexPositions.size() * sizeof(glm::vec3));
-    memcpy(&positionAttribute.data.front(), &globalVertexPositions.front(), globalVertexPositions.size() * sizeof(glm::vec3));
-    submesh.attributes.push_back(positionAttribute);
+    positionAttribute.data.resize(totalNumVertices * sizeof(glm::vec3));
 
-    BinaryMeshAttribute lineNormalsAttribute;
+    BinaryMeshAttribute &lineNormalsAttribute = submesh.attributes.at(1);
     lineNormalsAttribute.name = "vertexNormal";
     lineNormalsAttribute.attributeFormat = sgl::ATTRIB_FLOAT;
     lineNormalsAttribute.numComponents = 3;
-    lineNormalsAttribute.data.resize(globalNormals.size() * sizeof(glm::vec3));
-    memcpy(&lineNormalsAttribute.data.front(), &globalNormals.front(), globalNormals.size() * sizeof(glm::vec3));
-    submesh.attributes.push_back(lineNormalsAttribute);
+    lineNormalsAttribute.data.resize(totalNumVertices * sizeof(glm::vec3));
 
-    if (hairData.hasColorArray) {
-        BinaryMeshAttribute colorsAttribute;
+    glm::vec3 *vertexPositions = (glm::vec3*)positionAttribute.data.data();
+    glm::vec3 *vertexNormals = (glm::vec3*)lineNormalsAttribute.data.data();
+    uint32_t *vertexColors = nullptr;
+    if (hasVertexColors) {
+        BinaryMeshAttribute &colorsAttribute = submesh.attributes.at(2);
         colorsAttribute.name = "vertexColor";
         colorsAttribute.attributeFormat = sgl::ATTRIB_UNSIGNED_BYTE;
         colorsAttribute.numComponents = 4;
-        colorsAttribute.data.resize(globalColors.size() * sizeof(uint32_t));
-        memcpy(&colorsAttribute.data.front(), &globalColors.front(), globalColors.size() * sizeof(uint32_t));
-        submesh.attributes.push_back(colorsAttribute);
+        colorsAttribute.data.resize(totalNumVertices * sizeof(uint32_t));
+        vertexColors = (uint32_t*)colorsAttribute.data.data();
     }
+    uint32_t *indices = submesh.indices.data();
+
+    // Pass 2: Create the tubes (a 3D oriented circle at each node, see insertOrientedCirclePoints).
+    #pragma omp parallel
+    {
+        std::vector<glm::vec3> strandPoints;
+        std::vector<uint32_t> nodePointIndices;
+        std::vector<glm::vec3> tangents;
+        #pragma omp for schedule(dynamic, 1024)
+        for (size_t strandIndex = 0; strandIndex < numStrands; strandIndex++) {
+            size_t vertexOffset = strandVertexOffsets[strandIndex];
+            size_t numVertices = strandVertexOffsets[strandIndex + 1] - vertexOffset;
+            if (numVertices == 0) {
+                continue;
+            }
+            size_t pointOffset = hairFile.getStrandOffsets()[strandIndex];
+            transformHairStrand(hairFile.getStrandPoints(strandIndex), transform, strandPoints);
+            size_t numNodes = getHairTubeNodes(strandPoints, nodePointIndices, tangents);
+
+            glm::vec3 lastNormal = glm::vec3(1.0f, 0.0f, 0.0f);
+            for (size_t node = 0; node < numNodes; node++) {
+                uint32_t pointIndex = nodePointIndices[node];
+                const glm::vec3 &center = strandPoints[pointIndex];
+                const glm::vec3 &tangent = tangents[node];
+                float radius = hairFile.getThickness(pointOffset + pointIndex) * thicknessScale;
+
+                glm::vec3 helperAxis = lastNormal;
+                if (glm::length(glm::cross(helperAxis, tangent)) < 0.01f) {
+                    helperAxis = glm::vec3(0.0f, 1.0f, 0.0f);
+                }
+                glm::vec3 normal = glm::normalize(helperAxis - tangent * glm::dot(helperAxis, tangent));
+                glm::vec3 binormal = glm::normalize(glm::cross(tangent, normal));
+                lastNormal = normal;
+
+                size_t nodeVertexOffset = vertexOffset + node * numCirclePoints;
+                uint32_t color = hasVertexColors ? hairFile.getPackedColor(pointOffset + pointIndex) : 0u;
+                for (size_t j = 0; j < numCirclePoints; j++) {
+                    const glm::vec2 &circlePoint = unitCirclePoints[j];
+                    glm::vec3 offset = circlePoint.x * normal + circlePoint.y * binormal;
+                    vertexPositions[nodeVertexOffset + j] = center + radius * offset;
+                    vertexNormals[nodeVertexOffset + j] = glm::normalize(offset);
+                    if (vertexColors) {
+                        vertexColors[nodeVertexOffset + j] = color;
+                    }
+                }
+            }
 
-    if (hairData.hasThicknessArray) {
-        // TODO
-        /*BinaryMeshAttribute thicknessesAttribute;
-        thicknessesAttribute.name = "vertexThickness";
-        thicknessesAttribute.attributeFormat = sgl::ATTRIB_UNSIGNED_INT;
-        thicknessesAttribute.numComponents = 1;
-        thicknessesAttribute.data.resize(globalColors.size() * sizeof(uint32_t));
-        memcpy(&thicknessesAttribute.data.front(), &globalThicknesses.front(), globalThicknesses.size() * sizeof(float));
-        submesh.attributes.push_back(thicknessesAttribute);*/
+            // Two CCW triangles (one quad) for each side of each segment.
+            uint32_t *strandIndices = indices + strandIndexOffsets[strandIndex];
+            const uint32_t c = uint32_t(numCirclePoints);
+            for (uint32_t i = 0; i < uint32_t(numNodes - 1); i++) {
+                uint32_t current = uint32_t(vertexOffset) + i * c;
+                uint32_t next = current + c;
+                for (uint32_t j = 0; j < c; j++) {
+                    uint32_t jNext = (j + 1) % c;
+                    *strandIndices++ = current + j;
+                    *strandIndices++ = current + jNext;
+                    *strandIndices++ = next + jNext;
+                    *strandIndices++ = current + j;
+                    *strandIndices++ = next + jNext;
+                    *strandIndices++ = next + j;
+                }
+            }
+        }
     }
 
-    sgl::Logfile::get()->writeInfo(std::string() + "Summary: "
-                              + sgl::toString(globalVertexPositions.size()) + " vertices, "
-                              + sgl::toString(globalIndices.size()) + " indices.");
+    hairFile.close();
+
+    auto endTubes = std::chrono::system_clock::now();
+    auto elapsedTubes = std::chrono::duration_cast<std::chrono::milliseconds>(endTubes - startTubes);
+    sgl::Logfile::get()->writeInfo(std::string() + "Computational time to create hair tubes: "
+            + std::to_string(elapsedTubes.count()));
+
+    size_t meshSizeBytes = submesh.indices.size() * sizeof(uint32_t);
+    for (const BinaryMeshAttribute &attribute : submesh.attributes) {
+        meshSizeBytes += attribute.data.size();
+    }
+    sgl::Logfile::get()->writeInfo(std::string() + "Summary: " + sgl::toString(numStrands) + " strands, "
+                              + sgl::toString(totalNumVertices) + " vertices, "
+                              + sgl::toString(totalNumIndices) + " indices, "
+                              + sgl::toString(meshSizeBytes / (1024 * 1024)) + " MiB.");
+    optimizeBinaryMesh(binaryMesh);
+    buildMeshClusters(binaryMesh);
+    quantizeBinaryMesh(binaryMesh);
     sgl::Logfile::get()->writeInfo(std::string() + "Writing binary mesh...");
     writeMesh3D(binaryFilename, binaryMesh);
 }
@@ -11,7 +11,15 @@
 
 #include <glm/glm.hpp>
 
+#include "MappedFile.hpp"
+#include "TrajectoryFile.hpp"
+
 const float HAIR_MODEL_SCALING_FACTOR = 0.005f;
+/**
+ * Version of the triangle meshes created by convertHairDataToBinaryTriangleMesh (part of the derived data cache key).
+ * Version 2 supports variable thickness.
+ */
+const int HAIR_TUBE_MESH_VERSION = 2;
 
 struct HairStrand {
     // Obligatory data
@@ -38,15 +46,106 @@ struct HairData {
 };
 
 /**
- * Loads the specified hair file into memory.
+ * Read-only access to a hair file mapped into memory. The .hair format stores the points and the optional per-point
+ * arrays (thickness, opacity, color) of all strands consecutively, so they are exposed as flat views of the mapped
+ * file together with the CSR offsets of the strands (the prefix sum over the segments array). The per-point arrays
+ * are only read from disk when they are accessed.
+ * For more on the file format see http://www.cemyuksel.com/research/hairmodels/
+ *
+ * Usage:
+ *     MappedHairFile hairFile;
+ *     if (hairFile.open(filename)) {
+ *         for (size_t i = 0; i < hairFile.getNumStrands(); i++) {
+ *             for (size_t j = hairFile.getStrandOffsets()[i]; j < hairFile.getStrandOffsets()[i+1]; j++) {
+ *                 ... hairFile.getPoints()[j], hairFile.getThickness(j), hairFile.getPackedColor(j) ...
+ *             }
+ *         }
+ *     }
+ */
+class MappedHairFile
+{
+public:
+    /// @return False if the file is no valid hair file (an error is written to the log file).
+    bool open(const std::string &filename);
+    void close();
+    inline bool isOpen() const { return file.isOpen(); }
+    inline const std::string &getFilename() const { return filename; }
+    /// Hint for the operating system that the file is read sequentially (see MappedFile::adviseSequential).
+    inline void adviseSequential() { file.adviseSequential(); }
+
+    inline size_t getNumStrands() const { return strandOffsets.empty() ? 0 : strandOffsets.size() - 1; }
+    inline size_t getNumPoints() const { return points.size(); }
+    inline size_t getNumPoints(size_t strandIndex) const {
+        return strandOffsets[strandIndex + 1] - strandOffsets[strandIndex];
+    }
+    /// The points of strand i are stored at getPoints()[getStrandOffsets()[i]] to [getStrandOffsets()[i+1]-1].
+    inline const std::vector<size_t> &getStrandOffsets() const { return strandOffsets; }
+    inline const ArrayView<const glm::vec3> &getPoints() const { return points; }
+    inline ArrayView<const glm::vec3> getStrandPoints(size_t strandIndex) const {
+        return ArrayView<const glm::vec3>(points.data() + strandOffsets[strandIndex], getNumPoints(strandIndex));
+    }
+
+    // The optional per-point arrays (empty if not stored in the file).
+    inline bool hasThicknessArray() const { return !thicknesses.empty(); }
+    inline bool hasOpacityArray() const { return !opacities.empty(); }
+    inline bool hasColorArray() const { return !colors.empty(); }
+    inline const ArrayView<const float> &getThicknesses() const { return thicknesses; }
+    inline const ArrayView<const float> &getOpacities() const { return opacities; }
+    inline const ArrayView<const glm::vec3> &getColors() const { return colors; }
+
+    /// @return The thickness of the passed point (or the default thickness).
+    inline float getThickness(size_t pointIndex) const {
+        return thicknesses.empty() ? defaultThickness : thicknesses[pointIndex];
+    }
+    /**
+     * @return The color and opacity of the passed point as RGBA8. If only one of the two arrays is stored in the file,
+     * the default value is used for the other one.
+     */
+    uint32_t getPackedColor(size_t pointIndex) const;
+
+    inline float getDefaultThickness() const { return defaultThickness; }
+    inline float getDefaultOpacity() const { return defaultOpacity; }
+    inline const glm::vec3 &getDefaultColor() const { return defaultColor; }
+
+private:
+    std::string filename;
+    MappedFile file;
+    /// Only used if the arrays in the file are not aligned to 4 bytes (i.e., the number of strands is odd).
+    std::vector<float> alignedArrayData;
+    std::vector<size_t> strandOffsets;
+    ArrayView<const glm::vec3> points;
+    ArrayView<const float> thicknesses;
+    ArrayView<const float> opacities;
+    ArrayView<const glm::vec3> colors;
+    float defaultThickness = 0.0f;
+    float defaultOpacity = 1.0f;
+    glm::vec3 defaultColor = glm::vec3(1.0f);
+};
+
+/**
+ * The transformation applied to the points of the passed hair file before using them (scaling by "scalingFactor",
+ * and swapping the y- and z-axis for some data sets). The thicknesses only need to be scaled by "scalingFactor".
+ */
+glm::mat4 getHairDataTransform(const std::string &hairFilename, float scalingFactor);
+
+/**
+ * Loads the specified hair file into memory (i.e., copies the arrays of MappedHairFile to one HairStrand per strand).
  * For more on the file format see http://www.cemyuksel.com/research/hairmodels/
  */
 void loadHairFile(const std::string &hairFilename, HairData &hairData);
 
+/**
+ * Converts a hair file to a triangle mesh consisting of one tube per strand. If the file stores per-point thicknesses
+ * or colors, the tube radius and the vertex colors vary along the strands.
+ * The tubes are created in two parallel passes: The first one computes the number of vertices and indices of each
+ * strand, and the second one writes the tubes directly to the attribute buffers of the binary mesh at the offsets
+ * given by the prefix sums of the counts (i.e., no temporary per-strand or global arrays are needed).
+ */
 void convertHairDataToBinaryTriangleMesh(
         const std::string &hairFilename,
         const std::string &binaryFilename);
 
+/// Scales the positions and thicknesses (and swaps the y- and z-axis for some data sets).
 void downscaleHairData(HairData &hairData, float scalingFactor);
 
 #endif //PIXELSYNCOIT_HAIRLOADER_HPP
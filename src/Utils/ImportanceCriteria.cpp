@@ -4,6 +4,7 @@
 
 #include <Math/Math.hpp>
 #include "ImportanceCriteria.hpp"
+#include "ImportanceCriteriaBatched.hpp"
 
 /// https://www.khronos.org/registry/OpenGL-Refpages/gl4/html/packUnorm.xhtml
 void packUnorm16Array(const std::vector<float> &floatVector, std::vector<uint16_t> &unormVector)
@@ -240,52 +241,23 @@ void computeTrajectoryAttributes(
         std::vector<float> &vertexAttributes,
         std::vector<std::vector<float>> &importanceCriteria)
 {
-    if (trajectoryType == TRAJECTORY_TYPE_ANEURYSM) {
-        // 0. Vorticity/Attribute
-        importanceCriteria.push_back(vertexAttributes);
-//        // 1. Curvature
-//        importanceCriteria.push_back(computeCurvature(vertexPositions));
-    } else if (trajectoryType == TRAJECTORY_TYPE_WCB) {
-        // 0. Pressure mapped to [0, 1]
-        importanceCriteria.push_back(vertexAttributes);
-        // 1. Curvature
-        importanceCriteria.push_back(computeCurvature(vertexPositions));
-//        importanceCriteria.push_back(computeSegmentLengths(vertexPositions));
-//        // 2. Trajectory pressure/attribute difference per segment
-//        importanceCriteria.push_back(computeSegmentAttributeDifference(vertexPositions, vertexAttributes));
-//        // 3. Total trajectory pressure/attribute difference
-//        importanceCriteria.push_back(computeTotalAttributeDifference(vertexPositions, vertexAttributes));
-//        // 4. Angle of ascent
-//        importanceCriteria.push_back(computeAngleOfAscent(vertexPositions));
-//        // 5. Height difference per segment
-//        importanceCriteria.push_back(computeSegmentHeightDifference(vertexPositions));
-    } else if (trajectoryType == TRAJECTORY_TYPE_CONVECTION_ROLLS) {
-        // 0. Vorticity/Attribute
-        importanceCriteria.push_back(vertexAttributes);
-        // 1. Curvature
-//        importanceCriteria.push_back(computeCurvature(vertexPositions));
-//        // 2. Segment length
-//        importanceCriteria.push_back(computeSegmentLengths(vertexPositions));
-    } else if (trajectoryType == TRAJECTORY_TYPE_CONVECTION_ROLLS_NEW) {
-        // 0. Vorticity/Attribute
-        importanceCriteria.push_back(vertexAttributes);
-        // 1. Curvature
-//        importanceCriteria.push_back(computeCurvature(vertexPositions));
-//        // 2. Segment length
-//        importanceCriteria.push_back(computeSegmentLengths(vertexPositions));
-    } else if (trajectoryType == TRAJECTORY_TYPE_RINGS) {
-        // 0. Vorticity/Attribute
-        importanceCriteria.push_back(vertexAttributes);
-//
-//        importanceCriteria.push_back(computeCurvature(vertexPositions));
-//
-//        importanceCriteria.push_back(computeSegmentLengths(vertexPositions));
-    } else if (trajectoryType == TRAJECTORY_TYPE_UCLA) {
-        // 0. Vorticity/Attrsibute
-        importanceCriteria.push_back(vertexAttributes);
-        //
-//        importanceCriteria.push_back(computeCurvature(vertexPositions));
-        //
-        //        importanceCriteria.push_back(computeSegmentLengths(vertexPositions));
+    size_t n = vertexPositions.size();
+    TrajectoryPointArrays points;
+    points.positionsX.resize(n);
+    points.positionsY.resize(n);
+    points.positionsZ.resize(n);
+    for (size_t i = 0; i < n; i++) {
+        points.positionsX[i] = vertexPositions[i].x;
+        points.positionsY[i] = vertexPositions[i].y;
+        points.positionsZ[i] = vertexPositions[i].z;
+    }
+    points.attributes = vertexAttributes;
+    points.attributes.resize(n, 0.0f);
+    points.trajectoryOffsets = { 0, n };
+
+    std::vector<std::vector<float>> trajectoryCriteria;
+    computeImportanceCriteriaBatched(points, getImportanceCriterionKernels(trajectoryType), trajectoryCriteria);
+    for (std::vector<float> &criterion : trajectoryCriteria) {
+        importanceCriteria.push_back(std::move(criterion));
     }
 }
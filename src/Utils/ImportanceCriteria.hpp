@@ -14,10 +14,12 @@ enum TrajectoryType {
 };
 enum ImportanceCriterionTypeAneurysm {
     IMPORTANCE_CRITERION_ANEURYSM_VORTICITY = 0,
-    IMPORTANCE_CRITERION_ANEURYSM_LINE_CURVATURE
+    IMPORTANCE_CRITERION_ANEURYSM_LINE_CURVATURE,
+    IMPORTANCE_CRITERION_ANEURYSM_SEGMENT_LENGTH
 };
 enum ImportanceCriterionTypeWCB {
-    IMPORTANCE_CRITERION_WCB_CURVATURE = 0,
+    IMPORTANCE_CRITERION_WCB_PRESSURE = 0,
+    IMPORTANCE_CRITERION_WCB_CURVATURE,
     IMPORTANCE_CRITERION_SEGMENT_LENGTH,
     IMPORTANCE_CRITERION_WCB_SEGMENT_PRESSURE_DIFFERENCE,
     IMPORTANCE_CRITERION_WCB_TOTAL_PRESSURE_DIFFERENCE,
@@ -42,12 +44,11 @@ enum ImportanceCriterionTypeCFD {
 };
 
 const char *const IMPORTANCE_CRITERION_ANEURYSM_DISPLAYNAMES[] = {
-        "Vorticity", "Line Curvature"
+        "Vorticity", "Line Curvature", "Segment Length"
 };
 const char *const IMPORTANCE_CRITERION_WCB_DISPLAYNAMES[] = {
-        "Pressure", "Line Curvature"
-//        "Line Curvature", "Segment Length", "Segment Pressure Difference", "Total Pressure Difference",
-//        "Angle of Ascent", "Height Difference per Segment"
+        "Pressure", "Line Curvature", "Segment Length", "Segment Pressure Difference", "Total Pressure Difference",
+        "Angle of Ascent", "Height Difference per Segment"
 };
 const char *const IMPORTANCE_CRITERION_CONVECTION_ROLLS_DISPLAYNAMES[] = {
         "Vorticity", "Line Curvature", "Segment Length"
@@ -58,6 +59,13 @@ const char *const IMPORTANCE_CRITERION_CFD_DISPLAYNAMES[] = {
 };
 
 
+/**
+ * Version of the set of importance criteria computed for trajectory data sets (part of the derived data cache key of
+ * the converted meshes). Needs to be incremented whenever getImportanceCriterionKernels changes.
+ */
+const int IMPORTANCE_CRITERIA_VERSION = 2;
+
+
 /// https://www.khronos.org/registry/OpenGL-Refpages/gl4/html/packUnorm.xhtml
 void packUnorm16Array(const std::vector<float> &floatVector, std::vector<uint16_t> &unormVector);
 
@@ -69,6 +77,22 @@ void packUnorm16ArrayOfArrays(
 /// https://www.khronos.org/registry/OpenGL-Refpages/gl4/html/unpackUnorm.xhtml
 void unpackUnorm16Array(uint16_t *unormVector, size_t vectorSize, std::vector<float> &floatVector);
 
+// Scalar reference implementations of the criteria of one trajectory (see ImportanceCriteriaBatched.hpp).
+std::vector<float> computeSegmentLengths(std::vector<glm::vec3> &vertexPositions);
+std::vector<float> computeCurvature(std::vector<glm::vec3> &vertexPositions);
+std::vector<float> computeSegmentAttributeDifference(
+        std::vector<glm::vec3> &vertexPositions,
+        std::vector<float> &vertexAttributes);
+std::vector<float> computeTotalAttributeDifference(
+        std::vector<glm::vec3> &vertexPositions,
+        std::vector<float> &vertexAttributes);
+std::vector<float> computeAngleOfAscent(std::vector<glm::vec3> &vertexPositions);
+std::vector<float> computeSegmentHeightDifference(std::vector<glm::vec3> &vertexPositions);
+
+/**
+ * Appends the importance criteria of one trajectory (see getImportanceCriterionKernels) to "importanceCriteria".
+ * Use computeTrajectoryAttributesBatched for whole data sets.
+ */
 void computeTrajectoryAttributes(
         TrajectoryType trajectoryType,
         std::vector<glm::vec3> &vertexPositions,
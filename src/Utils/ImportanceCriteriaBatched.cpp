@@ -0,0 +1,285 @@
+//
+// Created by agent on 19.10.26.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cfloat>
+
+#include <Math/Math.hpp>
+#include <Utils/File/Logfile.hpp>
+
+#include "ImportanceCriteriaBatched.hpp"
+
+std::vector<ImportanceCriterionKernel> getImportanceCriterionKernels(TrajectoryType trajectoryType)
+{
+    std::vector<ImportanceCriterionKernel> kernels;
+    if (trajectoryType == TRAJECTORY_TYPE_WCB) {
+        kernels = {
+                IMPORTANCE_CRITERION_KERNEL_ATTRIBUTE,
+                IMPORTANCE_CRITERION_KERNEL_CURVATURE,
+                IMPORTANCE_CRITERION_KERNEL_SEGMENT_LENGTH,
+                IMPORTANCE_CRITERION_KERNEL_SEGMENT_ATTRIBUTE_DIFFERENCE,
+                IMPORTANCE_CRITERION_KERNEL_TOTAL_ATTRIBUTE_DIFFERENCE,
+                IMPORTANCE_CRITERION_KERNEL_ANGLE_OF_ASCENT,
+                IMPORTANCE_CRITERION_KERNEL_SEGMENT_HEIGHT_DIFFERENCE
+        };
+    } else if (trajectoryType == TRAJECTORY_TYPE_ANEURYSM || trajectoryType == TRAJECTORY_TYPE_CONVECTION_ROLLS
+            || trajectoryType == TRAJECTORY_TYPE_CONVECTION_ROLLS_NEW || trajectoryType == TRAJECTORY_TYPE_RINGS
+            || trajectoryType == TRAJECTORY_TYPE_UCLA) {
+        kernels = {
+                IMPORTANCE_CRITERION_KERNEL_ATTRIBUTE,
+                IMPORTANCE_CRITERION_KERNEL_CURVATURE,
+                IMPORTANCE_CRITERION_KERNEL_SEGMENT_LENGTH
+        };
+    }
+    return kernels;
+}
+
+void flattenTrajectories(const Trajectories &trajectories, TrajectoryPointArrays &points)
+{
+    points.trajectoryOffsets = trajectories.trajectoryOffsets;
+
+    size_t numPoints = trajectories.getNumPoints();
+    points.positionsX.resize(numPoints);
+    points.positionsY.resize(numPoints);
+    points.positionsZ.resize(numPoints);
+    points.attributes.resize(numPoints);
+
+    bool hasAttribute = !trajectories.attributes.empty();
+    #pragma omp parallel for
+    for (size_t i = 0; i < numPoints; i++) {
+        const glm::vec3 &position = trajectories.positions[i];
+        points.positionsX[i] = position.x;
+        points.positionsY[i] = position.y;
+        points.positionsZ[i] = position.z;
+        points.attributes[i] = hasAttribute ? trajectories.attributes.front()[i] : 0.0f;
+    }
+}
+
+/**
+ * Vectorizable arc cosine for x in [0, 1] (all angles computed below are clamped to this range). Approximation
+ * 4.4.46 from Abramowitz and Stegun, "Handbook of Mathematical Functions", with an absolute error <= 2e-8.
+ */
+static inline float acosUnitInterval(float x)
+{
+    float polynomial = -0.0012624911f;
+    polynomial = polynomial * x + 0.0066700901f;
+    polynomial = polynomial * x - 0.0170881256f;
+    polynomial = polynomial * x + 0.0308918810f;
+    polynomial = polynomial * x - 0.0501743046f;
+    polynomial = polynomial * x + 0.0889789874f;
+    polynomial = polynomial * x - 0.2145988016f;
+    polynomial = polynomial * x + 1.5707963050f;
+    return std::sqrt(1.0f - x) * polynomial;
+}
+
+/**
+ * Scalar fallback for the curvature of trajectories with (almost) identical consecutive points. In this case,
+ * computeCurvature skips the degenerate segment and compares the next tangent with the last valid one, which is a
+ * sequential dependency the vectorized loop can't express.
+ */
+static void computeCurvatureSequential(
+        const float *x, const float *y, const float *z, size_t n, float *curvatures)
+{
+    glm::vec3 tangent, lastTangent = glm::vec3(1.0f, 0.0f, 0.0f);
+    for (size_t i = 0; i < n; i++) {
+        size_t segmentIndex = i == n - 1 ? i - 1 : i;
+        tangent = glm::vec3(
+                x[segmentIndex + 1] - x[segmentIndex],
+                y[segmentIndex + 1] - y[segmentIndex],
+                z[segmentIndex + 1] - z[segmentIndex]);
+        if (glm::length(tangent) < 1E-08f) {
+            curvatures[i] = 0.0f;
+            continue;
+        }
+
+        tangent = glm::normalize(tangent);
+        float curvatureAngle = 0.0f;
+        if (i != 0 && i != n - 1) {
+            float cosAngle = glm::clamp(glm::dot(tangent, lastTangent), 0.0f, 1.0f);
+            curvatureAngle = std::acos(cosAngle) / sgl::PI;
+        }
+        lastTangent = tangent;
+        curvatures[i] = curvatureAngle;
+    }
+}
+
+/**
+ * Computes all requested criteria of one trajectory.
+ * @param outputs The output array for each ImportanceCriterionKernel (nullptr if the criterion isn't requested),
+ * already offset to the first point of the trajectory.
+ */
+static void computeImportanceCriteriaTrajectory(
+        const float *x, const float *y, const float *z, const float *a, size_t n,
+        float *const outputs[NUM_IMPORTANCE_CRITERION_KERNELS])
+{
+    float *attribute = outputs[IMPORTANCE_CRITERION_KERNEL_ATTRIBUTE];
+    float *curvature = outputs[IMPORTANCE_CRITERION_KERNEL_CURVATURE];
+    float *segmentLength = outputs[IMPORTANCE_CRITERION_KERNEL_SEGMENT_LENGTH];
+    float *segmentAttributeDifference = outputs[IMPORTANCE_CRITERION_KERNEL_SEGMENT_ATTRIBUTE_DIFFERENCE];
+    float *totalAttributeDifference = outputs[IMPORTANCE_CRITERION_KERNEL_TOTAL_ATTRIBUTE_DIFFERENCE];
+    float *angleOfAscent = outputs[IMPORTANCE_CRITERION_KERNEL_ANGLE_OF_ASCENT];
+    float *segmentHeightDifference = outputs[IMPORTANCE_CRITERION_KERNEL_SEGMENT_HEIGHT_DIFFERENCE];
+
+    if (attribute) {
+        std::copy(a, a + n, attribute);
+    }
+    if (totalAttributeDifference) {
+        float minAttribute = FLT_MAX;
+        float maxAttribute = -FLT_MAX;
+        #pragma omp simd reduction(min:minAttribute) reduction(max:maxAttribute)
+        for (size_t i = 0; i < n; i++) {
+            minAttribute = std::min(minAttribute, a[i]);
+            maxAttribute = std::max(maxAttribute, a[i]);
+        }
+        std::fill(totalAttributeDifference, totalAttributeDifference + n, maxAttribute - minAttribute);
+    }
+
+    if (n < 2) {
+        // No line segment (the scalar functions don't support this case)
+        float *segmentOutputs[] = {
+                curvature, segmentLength, segmentAttributeDifference, angleOfAscent, segmentHeightDifference };
+        for (float *output : segmentOutputs) {
+            if (output) {
+                std::fill(output, output + n, 0.0f);
+            }
+        }
+        return;
+    }
+
+    // Point i uses the segment (i, i+1). The last point uses the segment (n-2, n-1), i.e., copies from point n-2.
+    // The trajectory is small enough to stay in the cache, so every criterion gets its own branch-free SIMD loop.
+    const size_t numSegments = n - 1;
+    if (segmentLength) {
+        #pragma omp simd
+        for (size_t i = 0; i < numSegments; i++) {
+            float dx = x[i + 1] - x[i];
+            float dy = y[i + 1] - y[i];
+            float dz = z[i + 1] - z[i];
+            segmentLength[i] = std::sqrt(dx * dx + dy * dy + dz * dz);
+        }
+        segmentLength[n - 1] = segmentLength[n - 2];
+    }
+    if (segmentHeightDifference) {
+        #pragma omp simd
+        for (size_t i = 0; i < numSegments; i++) {
+            segmentHeightDifference[i] = y[i + 1] - y[i];
+        }
+        segmentHeightDifference[n - 1] = segmentHeightDifference[n - 2];
+    }
+    if (segmentAttributeDifference) {
+        #pragma omp simd
+        for (size_t i = 0; i < numSegments; i++) {
+            segmentAttributeDifference[i] = std::abs(a[i + 1] - a[i]);
+        }
+        segmentAttributeDifference[n - 1] = segmentAttributeDifference[n - 2];
+    }
+    if (angleOfAscent) {
+        // Angle between line segment and xz-plane
+        #pragma omp simd
+        for (size_t i = 0; i < numSegments; i++) {
+            float dx = x[i + 1] - x[i];
+            float dy = y[i + 1] - y[i];
+            float dz = z[i + 1] - z[i];
+            float length = std::sqrt(dx * dx + dy * dy + dz * dz);
+            // Clamp the divisor instead of branching, as the vectorizer can't if-convert a trapping division.
+            float cosAngle = std::min(std::max(dy / std::max(length, 0.0001f), 0.0f), 1.0f);
+            float angle = 1.0f - acosUnitInterval(cosAngle) / sgl::PI;
+            angleOfAscent[i] = length < 0.0001f ? 0.0f : angle;
+        }
+        angleOfAscent[n - 1] = angleOfAscent[n - 2];
+    }
+    if (curvature) {
+        // Angle between the tangents of the segments (i-1, i) and (i, i+1); zero for the first and last point.
+        int hasDegenerateSegment = 0;
+        curvature[0] = 0.0f;
+        #pragma omp simd reduction(max:hasDegenerateSegment)
+        for (size_t i = 1; i < numSegments; i++) {
+            float dx = x[i + 1] - x[i];
+            float dy = y[i + 1] - y[i];
+            float dz = z[i + 1] - z[i];
+            float lastDx = x[i] - x[i - 1];
+            float lastDy = y[i] - y[i - 1];
+            float lastDz = z[i] - z[i - 1];
+            float lengthSquared = dx * dx + dy * dy + dz * dz;
+            float lastLengthSquared = lastDx * lastDx + lastDy * lastDy + lastDz * lastDz;
+            float minLengthSquared = std::min(lengthSquared, lastLengthSquared);
+            // Degenerate segments are handled by computeCurvatureSequential below.
+            float cosAngle = (dx * lastDx + dy * lastDy + dz * lastDz)
+                    / std::sqrt(std::max(lengthSquared * lastLengthSquared, 1E-32f));
+            cosAngle = std::min(std::max(cosAngle, 0.0f), 1.0f);
+            curvature[i] = acosUnitInterval(cosAngle) / sgl::PI;
+            hasDegenerateSegment = std::max(hasDegenerateSegment, int(minLengthSquared < 1E-16f));
+        }
+        curvature[n - 1] = 0.0f;
+        if (hasDegenerateSegment) {
+            computeCurvatureSequential(x, y, z, n, curvature);
+        }
+    }
+}
+
+void computeImportanceCriteriaBatched(
+        const TrajectoryPointArrays &points, const std::vector<ImportanceCriterionKernel> &kernels,
+        std::vector<std::vector<float>> &importanceCriteria)
+{
+    size_t numPoints = points.getNumPoints();
+    size_t numTrajectories = points.getNumTrajectories();
+
+    importanceCriteria.resize(kernels.size());
+    float *outputs[NUM_IMPORTANCE_CRITERION_KERNELS] = {};
+    for (size_t i = 0; i < kernels.size(); i++) {
+        importanceCriteria.at(i).resize(numPoints);
+        if (outputs[kernels.at(i)] != nullptr) {
+            // Requested twice: Copy the result after the computation
+            continue;
+        }
+        outputs[kernels.at(i)] = numPoints > 0 ? &importanceCriteria.at(i).front() : nullptr;
+    }
+
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (size_t i = 0; i < numTrajectories; i++) {
+        size_t offset = points.trajectoryOffsets[i];
+        size_t n = points.trajectoryOffsets[i + 1] - offset;
+        if (n == 0) {
+            continue;
+        }
+        float *trajectoryOutputs[NUM_IMPORTANCE_CRITERION_KERNELS];
+        for (int k = 0; k < NUM_IMPORTANCE_CRITERION_KERNELS; k++) {
+            trajectoryOutputs[k] = outputs[k] ? outputs[k] + offset : nullptr;
+        }
+        computeImportanceCriteriaTrajectory(
+                &points.positionsX[offset], &points.positionsY[offset], &points.positionsZ[offset],
+                &points.attributes[offset], n, trajectoryOutputs);
+    }
+
+    for (size_t i = 0; i < kernels.size(); i++) {
+        if (numPoints > 0 && outputs[kernels.at(i)] != &importanceCriteria.at(i).front()) {
+            std::copy(outputs[kernels.at(i)], outputs[kernels.at(i)] + numPoints, importanceCriteria.at(i).begin());
+        }
+    }
+}
+
+void computeTrajectoryAttributesBatched(TrajectoryType trajectoryType, Trajectories &trajectories)
+{
+    auto start = std::chrono::system_clock::now();
+
+    TrajectoryPointArrays points;
+    flattenTrajectories(trajectories, points);
+
+    std::vector<ImportanceCriterionKernel> kernels = getImportanceCriterionKernels(trajectoryType);
+    // The criteria arrays have the layout of the flat attribute arrays of the container.
+    std::vector<std::vector<float>> importanceCriteria;
+    computeImportanceCriteriaBatched(points, kernels, importanceCriteria);
+    trajectories.attributes.clear();
+    for (std::vector<float> &criterion : importanceCriteria) {
+        trajectories.attributes.push_back(TrajectoryArray<float>(std::move(criterion)));
+    }
+
+    auto end = std::chrono::system_clock::now();
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+    sgl::Logfile::get()->writeInfo(std::string() + "Computational time to compute importance criteria ("
+            + std::to_string(kernels.size()) + " criteria, " + std::to_string(points.getNumPoints())
+            + " points): " + std::to_string(elapsed.count()));
+}
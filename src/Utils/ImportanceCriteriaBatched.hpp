@@ -0,0 +1,76 @@
+//
+// Created by agent on 19.10.26.
+//
+
+#ifndef PIXELSYNCOIT_IMPORTANCECRITERIABATCHED_HPP
+#define PIXELSYNCOIT_IMPORTANCECRITERIABATCHED_HPP
+
+#include <vector>
+#include <cstddef>
+
+#include "ImportanceCriteria.hpp"
+#include "TrajectoryFile.hpp"
+
+/**
+ * Flat structure-of-arrays representation of the points of all trajectories of a data set. The points of trajectory
+ * i are stored at the indices trajectoryOffsets[i] to trajectoryOffsets[i+1]-1 of all arrays.
+ */
+struct TrajectoryPointArrays
+{
+    std::vector<float> positionsX;
+    std::vector<float> positionsY;
+    std::vector<float> positionsZ;
+    std::vector<float> attributes; ///< The attribute the criteria are derived from (e.g., pressure or vorticity).
+    std::vector<size_t> trajectoryOffsets; ///< numTrajectories + 1 entries.
+
+    inline size_t getNumTrajectories() const {
+        return trajectoryOffsets.empty() ? 0 : trajectoryOffsets.size() - 1;
+    }
+    inline size_t getNumPoints() const { return positionsX.size(); }
+};
+
+/**
+ * The per-point criteria the batched kernels can compute. They match the scalar functions in ImportanceCriteria.cpp
+ * (e.g., IMPORTANCE_CRITERION_KERNEL_CURVATURE corresponds to computeCurvature).
+ */
+enum ImportanceCriterionKernel
+{
+    IMPORTANCE_CRITERION_KERNEL_ATTRIBUTE = 0,
+    IMPORTANCE_CRITERION_KERNEL_CURVATURE,
+    IMPORTANCE_CRITERION_KERNEL_SEGMENT_LENGTH,
+    IMPORTANCE_CRITERION_KERNEL_SEGMENT_ATTRIBUTE_DIFFERENCE,
+    IMPORTANCE_CRITERION_KERNEL_TOTAL_ATTRIBUTE_DIFFERENCE,
+    IMPORTANCE_CRITERION_KERNEL_ANGLE_OF_ASCENT,
+    IMPORTANCE_CRITERION_KERNEL_SEGMENT_HEIGHT_DIFFERENCE,
+    NUM_IMPORTANCE_CRITERION_KERNELS
+};
+
+/**
+ * @return The criteria computed for a trajectory type in the order they are stored in Trajectories::attributes
+ * (i.e., the order of the IMPORTANCE_CRITERION_*_DISPLAYNAMES).
+ */
+std::vector<ImportanceCriterionKernel> getImportanceCriterionKernels(TrajectoryType trajectoryType);
+
+/**
+ * Copies the positions and the first attribute of all trajectories to the SoA arrays (in parallel).
+ * If the trajectories have no attributes, the attribute value is zero.
+ */
+void flattenTrajectories(const Trajectories &trajectories, TrajectoryPointArrays &points);
+
+/**
+ * Computes the passed criteria for all trajectories in one pass over the points. The loop over the trajectories is
+ * parallelized with OpenMP, the loop over the line segments of one trajectory is written branch-free over plain
+ * arrays so that it can be vectorized.
+ * @param importanceCriteria One array with getNumPoints() values per kernel (in the order of "kernels").
+ */
+void computeImportanceCriteriaBatched(
+        const TrajectoryPointArrays &points, const std::vector<ImportanceCriterionKernel> &kernels,
+        std::vector<std::vector<float>> &importanceCriteria);
+
+/**
+ * Batched version of computeTrajectoryAttributes for a whole data set: The first attribute of each trajectory is used
+ * as the input attribute, and Trajectories::attributes is replaced by the criteria of getImportanceCriterionKernels.
+ */
+void computeTrajectoryAttributesBatched(TrajectoryType trajectoryType, Trajectories &trajectories);
+
+#endif //PIXELSYNCOIT_IMPORTANCECRITERIABATCHED_HPP
@@ -2,97 +2,376 @@
 // Created by christoph on 28.08.18.
 //
 
+#include <algorithm>
+#include <cmath>
+
 #include "KDTree.hpp"
 
-bool Rectangle::contains(const glm::vec3 &pt) const
+/// Subtrees with less points are built sequentially by the thread that created them.
+const uint32_t KDTREE_PARALLEL_BUILD_THRESHOLD = 1u << 15;
+/// Upper bound for the depth of the tree (the leaves of a tree with 2^32 points have a depth of less than 32).
+const int KDTREE_MAX_STACK_SIZE = 64;
+
+void KDTree::build(const std::vector<glm::vec3> &points)
 {
-    if (pt.x >= min.x && pt.y >= min.y && pt.z >= min.z
-        && pt.x <= max.x && pt.y <= max.y && pt.z <= max.z)
-        return true;
-    return false;
+    build(points.data(), points.size());
 }
 
-void KDTree::build(const std::vector<Point*> &points)
+void KDTree::build(const glm::vec3 *points, size_t numPoints)
 {
-    root = _build(points, 0);
+    nodes.clear();
+    pointIndices.clear();
+    pointsX.clear();
+    pointsY.clear();
+    pointsZ.clear();
+    if (numPoints == 0) {
+        return;
+    }
+
+    float minX = FLT_MAX, minY = FLT_MAX, minZ = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX, maxZ = -FLT_MAX;
+    #pragma omp parallel for reduction(min:minX,minY,minZ) reduction(max:maxX,maxY,maxZ)
+    for (size_t i = 0; i < numPoints; i++) {
+        minX = std::min(minX, points[i].x);
+        minY = std::min(minY, points[i].y);
+        minZ = std::min(minZ, points[i].z);
+        maxX = std::max(maxX, points[i].x);
+        maxY = std::max(maxY, points[i].y);
+        maxZ = std::max(maxZ, points[i].z);
+    }
+
+    // The points are partitioned together with their indices, as the indirect accesses of partitioning only an
+    // index array cause a cache miss per comparison.
+    std::vector<KDIndexedPoint> indexedPoints(numPoints);
+    #pragma omp parallel for
+    for (size_t i = 0; i < numPoints; i++) {
+        indexedPoints[i].position = points[i];
+        indexedPoints[i].index = uint32_t(i);
+    }
+
+    // The node indices of all subtrees are known in advance, so the subtrees can be built independently.
+    numSubtreeNodesMap.clear();
+    computeNumSubtreeNodes(uint32_t(numPoints));
+    nodes.resize(numSubtreeNodesMap[uint32_t(numPoints)]);
+
+    #pragma omp parallel
+    {
+        #pragma omp single
+        buildRecursive(
+                0, 0, uint32_t(numPoints), glm::vec3(minX, minY, minZ), glm::vec3(maxX, maxY, maxZ),
+                indexedPoints.data());
+    }
+
+    pointIndices.resize(numPoints);
+    pointsX.resize(numPoints);
+    pointsY.resize(numPoints);
+    pointsZ.resize(numPoints);
+    #pragma omp parallel for
+    for (size_t i = 0; i < numPoints; i++) {
+        const KDIndexedPoint &indexedPoint = indexedPoints[i];
+        pointIndices[i] = indexedPoint.index;
+        pointsX[i] = indexedPoint.position.x;
+        pointsY[i] = indexedPoint.position.y;
+        pointsZ[i] = indexedPoint.position.z;
+    }
 }
 
-std::shared_ptr<KDNode> KDTree::_build(std::vector<Point*> points, int depth)
+void KDTree::computeNumSubtreeNodes(uint32_t numPoints)
 {
-    const int k = 3; // Number of dimensions
-
-    if (points.size() == 0) {
-        return std::shared_ptr<KDNode>();
-    }
-
-    int axis = depth % k;
-    std::sort(points.begin(), points.end(), [axis](Point *a, Point *b) {
-        if (axis == 0) return a->position.x < b->position.x;
-        if (axis == 1) return a->position.y < b->position.y;
-        return a->position.z < b->position.z;
-    });
-    size_t medianIndex = points.size() / 2;
-    std::vector<Point*> leftPoints = std::vector<Point*>(points.begin(), points.begin() + medianIndex);
-    std::vector<Point*> rightPoints = std::vector<Point*>(points.begin() + medianIndex + 1, points.end());
-
-    std::shared_ptr<KDNode> node = std::shared_ptr<KDNode>(new KDNode);
-    node->axis = axis;
-    node->location = points.at(medianIndex);
-    node->left = _build(leftPoints, depth + 1);
-    node->right = _build(rightPoints, depth + 1);
-    return node;
+    if (numSubtreeNodesMap.find(numPoints) != numSubtreeNodesMap.end()) {
+        return;
+    }
+    if (numPoints <= KDTREE_MAX_LEAF_SIZE) {
+        numSubtreeNodesMap[numPoints] = 1;
+        return;
+    }
+    // There are at most two different subtree sizes per level, i.e., the map stays small.
+    uint32_t numPointsLeft = numPoints / 2, numPointsRight = numPoints - numPoints / 2;
+    computeNumSubtreeNodes(numPointsLeft);
+    computeNumSubtreeNodes(numPointsRight);
+    numSubtreeNodesMap[numPoints] = 1 + numSubtreeNodesMap[numPointsLeft] + numSubtreeNodesMap[numPointsRight];
 }
 
+void KDTree::buildRecursive(
+        uint32_t nodeIndex, uint32_t pointsBegin, uint32_t pointsEnd,
+        glm::vec3 boundsMin, glm::vec3 boundsMax, KDIndexedPoint *points)
+{
+    KDNode &node = nodes[nodeIndex];
+    node.pointsBegin = pointsBegin;
+    node.pointsEnd = pointsEnd;
+    const uint32_t numPoints = pointsEnd - pointsBegin;
+    if (numPoints <= KDTREE_MAX_LEAF_SIZE) {
+        node.axis = LEAF_AXIS;
+        node.splitPosition = 0.0f;
+        node.rightChild = 0;
+        return;
+    }
+
+    // Split at the median along the largest axis of the node bounds.
+    glm::vec3 extent = boundsMax - boundsMin;
+    int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+    uint32_t pointsMid = pointsBegin + numPoints / 2;
+    std::nth_element(
+            points + pointsBegin, points + pointsMid, points + pointsEnd,
+            [axis](const KDIndexedPoint &a, const KDIndexedPoint &b) {
+                return a.position[axis] < b.position[axis];
+            });
+    float splitPosition = points[pointsMid].position[axis];
+
+    uint32_t leftChild = nodeIndex + 1;
+    uint32_t rightChild = leftChild + numSubtreeNodesMap.find(numPoints / 2)->second;
+    node.axis = uint32_t(axis);
+    node.splitPosition = splitPosition;
+    node.rightChild = rightChild;
+
+    glm::vec3 leftBoundsMax = boundsMax;
+    glm::vec3 rightBoundsMin = boundsMin;
+    leftBoundsMax[axis] = splitPosition;
+    rightBoundsMin[axis] = splitPosition;
+
+#if defined(_OPENMP) && _OPENMP >= 200805
+    if (numPoints >= KDTREE_PARALLEL_BUILD_THRESHOLD) {
+        #pragma omp task
+        buildRecursive(leftChild, pointsBegin, pointsMid, boundsMin, leftBoundsMax, points);
+        #pragma omp task
+        buildRecursive(rightChild, pointsMid, pointsEnd, rightBoundsMin, boundsMax, points);
+        #pragma omp taskwait
+        return;
+    }
+#endif
+    buildRecursive(leftChild, pointsBegin, pointsMid, boundsMin, leftBoundsMax, points);
+    buildRecursive(rightChild, pointsMid, pointsEnd, rightBoundsMin, boundsMax, points);
+}
+
+
+/**
+ * Computes the squared distances of the points of a leaf bucket to "point" (vectorized).
+ */
+static inline void computeLeafDistancesSquared(
+        const float *pointsX, const float *pointsY, const float *pointsZ, uint32_t numPoints,
+        const glm::vec3 &point, float *distancesSquared)
+{
+    const float px = point.x, py = point.y, pz = point.z;
+    #pragma omp simd
+    for (uint32_t i = 0; i < numPoints; i++) {
+        float dx = pointsX[i] - px;
+        float dy = pointsY[i] - py;
+        float dz = pointsZ[i] - pz;
+        distancesSquared[i] = dx * dx + dy * dy + dz * dz;
+    }
+}
+
+void KDTree::findPointsInAABB(const sgl::AABB3 &box, std::vector<uint32_t> &indices) const
+{
+    if (nodes.empty()) {
+        return;
+    }
+    const glm::vec3 boxMin = box.getMinimum(), boxMax = box.getMaximum();
+
+    uint32_t stack[KDTREE_MAX_STACK_SIZE];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+    while (stackSize > 0) {
+        const KDNode &node = nodes[stack[--stackSize]];
+        if (node.axis == LEAF_AXIS) {
+            for (uint32_t i = node.pointsBegin; i < node.pointsEnd; i++) {
+                if (pointsX[i] >= boxMin.x && pointsY[i] >= boxMin.y && pointsZ[i] >= boxMin.z
+                        && pointsX[i] <= boxMax.x && pointsY[i] <= boxMax.y && pointsZ[i] <= boxMax.z) {
+                    indices.push_back(pointIndices[i]);
+                }
+            }
+            continue;
+        }
+
+        // Points lying on the split plane can be stored in both subtrees.
+        if (boxMax[node.axis] >= node.splitPosition) {
+            stack[stackSize++] = node.rightChild;
+        }
+        if (boxMin[node.axis] <= node.splitPosition) {
+            stack[stackSize++] = uint32_t(&node - nodes.data()) + 1;
+        }
+    }
+}
 
-std::vector<Point*> KDTree::findPointsInRectangle(const Rectangle &rect)
+void KDTree::findPointsInRadius(const glm::vec3 &center, float radius, std::vector<uint32_t> &indices) const
 {
-    std::vector<Point*> points;
-    _findPointsInRectangle(rect, points, root);
-    return points;
+    if (nodes.empty()) {
+        return;
+    }
+    const float radiusSquared = radius * radius;
+    float distancesSquared[KDTREE_MAX_LEAF_SIZE];
+
+    uint32_t stack[KDTREE_MAX_STACK_SIZE];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+    while (stackSize > 0) {
+        const KDNode &node = nodes[stack[--stackSize]];
+        if (node.axis == LEAF_AXIS) {
+            const uint32_t begin = node.pointsBegin, numPoints = node.pointsEnd - node.pointsBegin;
+            computeLeafDistancesSquared(
+                    pointsX.data() + begin, pointsY.data() + begin, pointsZ.data() + begin, numPoints,
+                    center, distancesSquared);
+            for (uint32_t i = 0; i < numPoints; i++) {
+                if (distancesSquared[i] <= radiusSquared) {
+                    indices.push_back(pointIndices[begin + i]);
+                }
+            }
+            continue;
+        }
+
+        float planeDistance = center[node.axis] - node.splitPosition;
+        if (planeDistance + radius >= 0.0f) {
+            stack[stackSize++] = node.rightChild;
+        }
+        if (planeDistance - radius <= 0.0f) {
+            stack[stackSize++] = uint32_t(&node - nodes.data()) + 1;
+        }
+    }
 }
 
-void KDTree::_findPointsInRectangle(const Rectangle &rect, std::vector<Point*> &points, std::shared_ptr<KDNode> node)
+int KDTree::findKNearestNeighbors(
+        const glm::vec3 &point, int k, float maxDistanceSquared,
+        uint32_t *neighborIndices, float *neighborDistancesSquared) const
 {
-    if (rect.contains(node->location->position)) {
-        points.push_back(node->location);
+    if (nodes.empty() || k <= 0) {
+        return 0;
     }
+    float distancesSquared[KDTREE_MAX_LEAF_SIZE];
+    int numNeighbors = 0;
+
+    // The stack stores the nodes together with a lower bound of the squared distance to their points.
+    struct StackEntry { uint32_t nodeIndex; float minDistanceSquared; };
+    StackEntry stack[KDTREE_MAX_STACK_SIZE];
+    int stackSize = 0;
+    stack[stackSize++] = { 0, 0.0f };
+    while (stackSize > 0) {
+        StackEntry entry = stack[--stackSize];
+        float maxNeighborDistanceSquared =
+                numNeighbors < k ? maxDistanceSquared : neighborDistancesSquared[numNeighbors - 1];
+        if (entry.minDistanceSquared > maxNeighborDistanceSquared) {
+            continue;
+        }
 
-    if ((node->axis == 0 && rect.min.x <= node->location->position.x)
-        || (node->axis == 1 && rect.min.y <= node->location->position.y)
-        || (node->axis == 2 && rect.min.z <= node->location->position.z)) {
-        _findPointsInRectangle(rect, points, node->left);
+        const KDNode &node = nodes[entry.nodeIndex];
+        if (node.axis == LEAF_AXIS) {
+            const uint32_t begin = node.pointsBegin, numPoints = node.pointsEnd - node.pointsBegin;
+            computeLeafDistancesSquared(
+                    pointsX.data() + begin, pointsY.data() + begin, pointsZ.data() + begin, numPoints,
+                    point, distancesSquared);
+            for (uint32_t i = 0; i < numPoints; i++) {
+                float distanceSquared = distancesSquared[i];
+                if (distanceSquared > maxNeighborDistanceSquared) {
+                    continue;
+                }
+                // Insertion into the sorted neighbor list (k is usually small).
+                int insertPosition = numNeighbors < k ? numNeighbors : k - 1;
+                while (insertPosition > 0 && neighborDistancesSquared[insertPosition - 1] > distanceSquared) {
+                    neighborDistancesSquared[insertPosition] = neighborDistancesSquared[insertPosition - 1];
+                    neighborIndices[insertPosition] = neighborIndices[insertPosition - 1];
+                    insertPosition--;
+                }
+                neighborDistancesSquared[insertPosition] = distanceSquared;
+                neighborIndices[insertPosition] = pointIndices[begin + i];
+                numNeighbors = std::min(numNeighbors + 1, k);
+                maxNeighborDistanceSquared =
+                        numNeighbors < k ? maxDistanceSquared : neighborDistancesSquared[numNeighbors - 1];
+            }
+            continue;
+        }
+
+        // Visit the child on the side of the point first (i.e., push it last).
+        float planeDistance = point[node.axis] - node.splitPosition;
+        uint32_t leftChild = entry.nodeIndex + 1;
+        uint32_t nearChild = planeDistance <= 0.0f ? leftChild : node.rightChild;
+        uint32_t farChild = planeDistance <= 0.0f ? node.rightChild : leftChild;
+        stack[stackSize++] = { farChild, std::max(entry.minDistanceSquared, planeDistance * planeDistance) };
+        stack[stackSize++] = { nearChild, entry.minDistanceSquared };
     }
-    if ((node->axis == 0 && rect.max.x >= node->location->position.x)
-        || (node->axis == 1 && rect.max.y >= node->location->position.y)
-        || (node->axis == 2 && rect.max.z >= node->location->position.z)) {
-        _findPointsInRectangle(rect, points, node->right);
+
+    return numNeighbors;
+}
+
+uint32_t KDTree::findNearestPoint(const glm::vec3 &point, float maxDistance) const
+{
+    uint32_t nearestIndex = KDTREE_INVALID_INDEX;
+    float nearestDistanceSquared = FLT_MAX;
+    float maxDistanceSquared = maxDistance < std::sqrt(FLT_MAX) ? maxDistance * maxDistance : FLT_MAX;
+    findKNearestNeighbors(point, 1, maxDistanceSquared, &nearestIndex, &nearestDistanceSquared);
+    return nearestIndex;
+}
+
+void KDTree::findKNearestNeighbors(
+        const glm::vec3 &point, int k, std::vector<uint32_t> &indices, std::vector<float> *distancesSquared) const
+{
+    k = std::max(k, 0);
+    indices.resize(k);
+    std::vector<float> localDistancesSquared;
+    std::vector<float> &neighborDistancesSquared = distancesSquared ? *distancesSquared : localDistancesSquared;
+    neighborDistancesSquared.resize(k);
+    int numNeighbors = findKNearestNeighbors(point, k, FLT_MAX, indices.data(), neighborDistancesSquared.data());
+    indices.resize(numNeighbors);
+    neighborDistancesSquared.resize(numNeighbors);
+}
+
+void KDTree::findPointsInRadiusBatched(
+        const std::vector<glm::vec3> &queryPoints, float radius,
+        std::vector<size_t> &resultOffsets, std::vector<uint32_t> &resultIndices) const
+{
+    // The queries are processed in blocks. Each block first writes its results to a block-local array.
+    const size_t QUERY_BLOCK_SIZE = 256;
+    const size_t numQueries = queryPoints.size();
+    const size_t numBlocks = (numQueries + QUERY_BLOCK_SIZE - 1) / QUERY_BLOCK_SIZE;
+    std::vector<std::vector<uint32_t>> blockResults(numBlocks);
+    resultOffsets.resize(numQueries + 1);
+    resultOffsets.front() = 0;
+
+    #pragma omp parallel for schedule(dynamic)
+    for (size_t blockIndex = 0; blockIndex < numBlocks; blockIndex++) {
+        std::vector<uint32_t> &blockResult = blockResults[blockIndex];
+        size_t queryEnd = std::min((blockIndex + 1) * QUERY_BLOCK_SIZE, numQueries);
+        for (size_t queryIndex = blockIndex * QUERY_BLOCK_SIZE; queryIndex < queryEnd; queryIndex++) {
+            findPointsInRadius(queryPoints[queryIndex], radius, blockResult);
+            resultOffsets[queryIndex + 1] = blockResult.size();
+        }
+    }
+
+    // Block-local offsets -> global offsets.
+    std::vector<size_t> blockOffsets(numBlocks + 1, 0);
+    for (size_t blockIndex = 0; blockIndex < numBlocks; blockIndex++) {
+        blockOffsets[blockIndex + 1] = blockOffsets[blockIndex] + blockResults[blockIndex].size();
     }
-};
+    resultIndices.resize(blockOffsets.back());
 
+    #pragma omp parallel for schedule(dynamic)
+    for (size_t blockIndex = 0; blockIndex < numBlocks; blockIndex++) {
+        size_t queryEnd = std::min((blockIndex + 1) * QUERY_BLOCK_SIZE, numQueries);
+        for (size_t queryIndex = blockIndex * QUERY_BLOCK_SIZE; queryIndex < queryEnd; queryIndex++) {
+            resultOffsets[queryIndex + 1] += blockOffsets[blockIndex];
+        }
+        std::copy(blockResults[blockIndex].begin(), blockResults[blockIndex].end(),
+                resultIndices.begin() + blockOffsets[blockIndex]);
+    }
+}
 
-Point *KDTree::findCloseIndexedPoint(Point *centerPoint, float maxDistance)
+void KDTree::findKNearestNeighborsBatched(
+        const std::vector<glm::vec3> &queryPoints, int k, std::vector<uint32_t> &resultIndices,
+        std::vector<float> *resultDistancesSquared) const
 {
-    // Find all points in bounding rectangle and test if their distance is less or equal than searched one
-    Rectangle rect;
-    rect.min = glm::vec3(
-            centerPoint->position.x - maxDistance,
-            centerPoint->position.y - maxDistance,
-            centerPoint->position.z - maxDistance);
-    rect.max = glm::vec3(
-            centerPoint->position.x + maxDistance,
-            centerPoint->position.y + maxDistance,
-            centerPoint->position.z + maxDistance);
-
-    std::vector<Point*> rectPoints = findPointsInRectangle(rect);
-
-    Point *closestPoint = NULL;
-    float closestDistance = FLT_MAX;
-    for (Point *point : rectPoints) {
-        float currDistance = (centerPoint->position - point->position).length();
-        if (currDistance < closestDistance && currDistance < maxDistance) {
-            closestPoint = point;
-            closestDistance = currDistance;
+    k = std::max(k, 0);
+    const size_t numQueries = queryPoints.size();
+    resultIndices.resize(numQueries * k);
+    std::vector<float> localDistancesSquared;
+    std::vector<float> &distancesSquared = resultDistancesSquared ? *resultDistancesSquared : localDistancesSquared;
+    distancesSquared.resize(numQueries * k);
+
+    #pragma omp parallel for schedule(dynamic, 256)
+    for (size_t queryIndex = 0; queryIndex < numQueries; queryIndex++) {
+        uint32_t *neighborIndices = resultIndices.data() + queryIndex * k;
+        float *neighborDistancesSquared = distancesSquared.data() + queryIndex * k;
+        int numNeighbors = findKNearestNeighbors(
+                queryPoints[queryIndex], k, FLT_MAX, neighborIndices, neighborDistancesSquared);
+        for (int i = numNeighbors; i < k; i++) {
+            neighborIndices[i] = KDTREE_INVALID_INDEX;
+            neighborDistancesSquared[i] = FLT_MAX;
         }
     }
-    return closestPoint;
 }
@@ -5,49 +5,109 @@
 #ifndef PIXELSYNCOIT_KDTREE_HPP
 #define PIXELSYNCOIT_KDTREE_HPP
 
-#include <algorithm>
-#include <memory>
 #include <vector>
+#include <map>
+#include <cstdint>
+#include <cfloat>
 #include <glm/glm.hpp>
+#include <Math/Geometry/AABB3.hpp>
 
-class Point
-{
-public:
-    glm::vec3 position;
-    int index;
-};
+/// Returned by the queries if no point was found.
+const uint32_t KDTREE_INVALID_INDEX = 0xFFFFFFFFu;
+/// The maximum number of points in a leaf bucket.
+const uint32_t KDTREE_MAX_LEAF_SIZE = 16;
 
-class Rectangle
+/**
+ * KD-tree over a point set for range, radius and k-nearest neighbor queries.
+ *
+ * The tree is stored in a flat node array in pre-order (i.e., the left child of a node directly follows it) and is
+ * built with median splits (std::nth_element) along the largest axis of the node bounds. The top levels are built in
+ * parallel with OpenMP tasks. The leaves store buckets of up to KDTREE_MAX_LEAF_SIZE points whose coordinates are
+ * copied to structure-of-arrays form in the order of the leaves, so that the distance tests of a leaf are a single
+ * vectorizable loop over contiguous memory.
+ *
+ * All queries return the indices of the points in the array passed to build, and the batched queries are
+ * parallelized over the query points.
+ */
+class KDTree
 {
 public:
-    glm::vec3 min, max;
-    bool contains(const glm::vec3 &pt) const;
-};
+    /**
+     * Builds the tree over the passed points. The tree doesn't reference the passed array after the build.
+     */
+    void build(const std::vector<glm::vec3> &points);
+    void build(const glm::vec3 *points, size_t numPoints);
 
-class KDNode
-{
-public:
-    int axis;
-    Point *location;
-    std::shared_ptr<KDNode> left;
-    std::shared_ptr<KDNode> right;
-};
+    inline size_t getNumPoints() const { return pointIndices.size(); }
+    inline bool empty() const { return pointIndices.empty(); }
 
-class KDTree
-{
-    void build(const std::vector<Point*> &points);
+    /// Appends the indices of all points in the passed box to "indices".
+    void findPointsInAABB(const sgl::AABB3 &box, std::vector<uint32_t> &indices) const;
+    /// Appends the indices of all points with a distance of at most "radius" to "center" to "indices".
+    void findPointsInRadius(const glm::vec3 &center, float radius, std::vector<uint32_t> &indices) const;
+
+    /**
+     * Used for e.g. giving points that are approx. the same (i.e. low distance) the same index.
+     * @return The index of the point closest to "point" with a distance of at most "maxDistance", or
+     * KDTREE_INVALID_INDEX if no such point exists.
+     */
+    uint32_t findNearestPoint(const glm::vec3 &point, float maxDistance = FLT_MAX) const;
+
+    /**
+     * Returns the (at most) k nearest neighbors of the passed point sorted by their distance.
+     * @param distancesSquared If not null, the squared distances of the neighbors are stored in this array.
+     */
+    void findKNearestNeighbors(
+            const glm::vec3 &point, int k, std::vector<uint32_t> &indices,
+            std::vector<float> *distancesSquared = nullptr) const;
 
-    /// Used for e.g. giving points that are approx. the same (i.e. low distance)
-    /// the same index.
-    Point *findCloseIndexedPoint(Point *centerPoint, float maxDistance);
-    std::vector<Point*> findPointsInRectangle(const Rectangle &rect);
+    /**
+     * Batched radius query (in parallel). The result is stored in CSR form, i.e., the indices of the points found for
+     * query point i are stored at resultIndices[resultOffsets[i]] to resultIndices[resultOffsets[i+1]-1].
+     */
+    void findPointsInRadiusBatched(
+            const std::vector<glm::vec3> &queryPoints, float radius,
+            std::vector<size_t> &resultOffsets, std::vector<uint32_t> &resultIndices) const;
+
+    /**
+     * Batched k-nearest neighbor query (in parallel). The neighbors of query point i are stored at resultIndices[i*k]
+     * to resultIndices[i*k+k-1] sorted by their distance. If less than k points exist, the remaining entries are
+     * KDTREE_INVALID_INDEX (and FLT_MAX for the distances).
+     */
+    void findKNearestNeighborsBatched(
+            const std::vector<glm::vec3> &queryPoints, int k, std::vector<uint32_t> &resultIndices,
+            std::vector<float> *resultDistancesSquared = nullptr) const;
 
 private:
-    // Internal implementations
-    std::shared_ptr<KDNode> _build(std::vector<Point*> points, int depth);
-    void _findPointsInRectangle(const Rectangle &rect, std::vector<Point*> &points, std::shared_ptr<KDNode> node);
+    struct KDNode
+    {
+        float splitPosition;
+        uint32_t axis; ///< 0, 1 or 2 for inner nodes, LEAF_AXIS for leaves.
+        uint32_t pointsBegin, pointsEnd; ///< Range of the points of the subtree in pointIndices.
+        uint32_t rightChild; ///< The left child is the next node.
+    };
+    static const uint32_t LEAF_AXIS = 3;
+
+    struct KDIndexedPoint
+    {
+        glm::vec3 position;
+        uint32_t index;
+    };
+
+    void buildRecursive(
+            uint32_t nodeIndex, uint32_t pointsBegin, uint32_t pointsEnd,
+            glm::vec3 boundsMin, glm::vec3 boundsMax, KDIndexedPoint *points);
+    void computeNumSubtreeNodes(uint32_t numPoints);
+    /// @return The number of neighbors found (at most k, sorted by distance).
+    int findKNearestNeighbors(
+            const glm::vec3 &point, int k, float maxDistanceSquared,
+            uint32_t *neighborIndices, float *neighborDistancesSquared) const;
 
-    std::shared_ptr<KDNode> root;
+    std::vector<KDNode> nodes;
+    std::vector<uint32_t> pointIndices; ///< Original index of the points in the order of the leaves.
+    std::vector<float> pointsX, pointsY, pointsZ; ///< The point coordinates in the order of the leaves.
+    /// The shape of the tree only depends on the number of points (the number of nodes of a subtree with n points).
+    std::map<uint32_t, uint32_t> numSubtreeNodesMap;
 };
 
 #endif //PIXELSYNCOIT_KDTREE_HPP
@@ -0,0 +1,184 @@
+//
+// Created by agent on 19.10.26.
+//
+
+#include <algorithm>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <Utils/File/Logfile.hpp>
+
+#include "MappedFile.hpp"
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::open(const std::string &filename, bool copyOnWrite)
+{
+    close();
+
+    HANDLE file = CreateFileA(
+            filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        sgl::Logfile::get()->writeError(std::string() + "Error in MappedFile::open: File \"" + filename
+                + "\" could not be opened.");
+        return false;
+    }
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+        sgl::Logfile::get()->writeError(std::string() + "Error in MappedFile::open: File \"" + filename
+                + "\" is empty.");
+        CloseHandle(file);
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, copyOnWrite ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, nullptr);
+    void *view = mapping ? MapViewOfFile(mapping, copyOnWrite ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (!view) {
+        sgl::Logfile::get()->writeError(std::string() + "Error in MappedFile::open: File \"" + filename
+                + "\" could not be mapped into memory.");
+        if (mapping) {
+            CloseHandle(mapping);
+        }
+        CloseHandle(file);
+        return false;
+    }
+
+    fileHandle = file;
+    mappingHandle = mapping;
+    data = (char*)view;
+    size = size_t(fileSize.QuadPart);
+    this->copyOnWrite = copyOnWrite;
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (data) {
+        UnmapViewOfFile(data);
+        CloseHandle(mappingHandle);
+        CloseHandle(fileHandle);
+    }
+    data = nullptr;
+    size = 0;
+    copyOnWrite = false;
+    fileHandle = nullptr;
+    mappingHandle = nullptr;
+}
+
+void MappedFile::adviseSequential()
+{
+}
+
+// PrefetchVirtualMemory only exists since Windows 8 and is only declared for _WIN32_WINNT >= 0x0602 (which older MinGW
+// versions don't support). Thus, it is looked up at runtime, and the hint is skipped on older systems.
+struct MemoryRangeEntry
+{
+    PVOID VirtualAddress;
+    SIZE_T NumberOfBytes;
+};
+typedef BOOL (WINAPI *PrefetchVirtualMemoryFunction)(HANDLE, ULONG_PTR, MemoryRangeEntry*, ULONG);
+
+static PrefetchVirtualMemoryFunction getPrefetchVirtualMemoryFunction()
+{
+    static PrefetchVirtualMemoryFunction prefetchVirtualMemory = (PrefetchVirtualMemoryFunction)GetProcAddress(
+            GetModuleHandleA("kernel32.dll"), "PrefetchVirtualMemory");
+    return prefetchVirtualMemory;
+}
+
+void MappedFile::adviseWillNeed(size_t offset, size_t length)
+{
+    PrefetchVirtualMemoryFunction prefetchVirtualMemory = getPrefetchVirtualMemoryFunction();
+    if (!data || offset >= size || !prefetchVirtualMemory) {
+        return;
+    }
+    MemoryRangeEntry range;
+    range.VirtualAddress = (PVOID)(data + offset);
+    range.NumberOfBytes = std::min(length, size - offset);
+    prefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+}
+
+#else
+
+bool MappedFile::open(const std::string &filename, bool copyOnWrite)
+{
+    close();
+
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        sgl::Logfile::get()->writeError(std::string() + "Error in MappedFile::open: File \"" + filename
+                + "\" could not be opened.");
+        return false;
+    }
+
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0) {
+        sgl::Logfile::get()->writeError(std::string() + "Error in MappedFile::open: File \"" + filename
+                + "\" is empty.");
+        ::close(fd);
+        return false;
+    }
+
+    void *mapping = mmap(
+            nullptr, size_t(fileStat.st_size), copyOnWrite ? PROT_READ | PROT_WRITE : PROT_READ,
+            copyOnWrite ? MAP_PRIVATE : MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED) {
+        sgl::Logfile::get()->writeError(std::string() + "Error in MappedFile::open: File \"" + filename
+                + "\" could not be mapped into memory.");
+        ::close(fd);
+        return false;
+    }
+
+    fileDescriptor = fd;
+    data = (char*)mapping;
+    size = size_t(fileStat.st_size);
+    this->copyOnWrite = copyOnWrite;
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (data) {
+        munmap(data, size);
+        ::close(fileDescriptor);
+    }
+    data = nullptr;
+    size = 0;
+    copyOnWrite = false;
+    fileDescriptor = -1;
+}
+
+void MappedFile::adviseSequential()
+{
+    if (data) {
+        madvise((void*)data, size, MADV_SEQUENTIAL);
+    }
+}
+
+void MappedFile::adviseWillNeed(size_t offset, size_t length)
+{
+    if (!data || offset >= size) {
+        return;
+    }
+    // madvise needs a page-aligned start address.
+    const size_t pageSize = size_t(sysconf(_SC_PAGESIZE));
+    size_t alignedOffset = offset / pageSize * pageSize;
+    size_t end = std::min(offset + length, size);
+    madvise((void*)(data + alignedOffset), end - alignedOffset, MADV_WILLNEED);
+}
+
+#endif
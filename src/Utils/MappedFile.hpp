@@ -0,0 +1,57 @@
+//
+// Created by agent on 19.10.26.
+//
+
+#ifndef PIXELSYNCOIT_MAPPEDFILE_HPP
+#define PIXELSYNCOIT_MAPPEDFILE_HPP
+
+#include <string>
+#include <cstddef>
+
+/**
+ * Read-only memory mapping of a file (mmap on POSIX systems, file mappings on Windows). The pages of the file are only
+ * read from disk when they are accessed, i.e., the memory used is proportional to the part of the file that is touched,
+ * and the pages can be evicted by the operating system at any time without being written to the swap file.
+ * Files can also be mapped copy-on-write: Then, the mapped memory can be written, and the operating system creates
+ * private copies of the written pages (the file itself is never changed).
+ */
+class MappedFile
+{
+public:
+    MappedFile() {}
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile &operator=(const MappedFile&) = delete;
+
+    /**
+     * Maps the passed file into memory. A previously opened file is closed.
+     * @param copyOnWrite Whether the mapped memory can be written (see getWritableData).
+     * @return False if the file could not be opened or is empty (an error is written to the log file).
+     */
+    bool open(const std::string &filename, bool copyOnWrite = false);
+    void close();
+
+    inline bool isOpen() const { return data != nullptr; }
+    inline const char *getData() const { return data; }
+    /// @return The mapped memory if the file was opened copy-on-write, and nullptr otherwise.
+    inline char *getWritableData() const { return copyOnWrite ? data : nullptr; }
+    inline size_t getSize() const { return size; }
+
+    /// Hint for the operating system that the file is read sequentially (i.e., read-ahead is worthwhile).
+    void adviseSequential();
+    /// Hint for the operating system that the passed range will be accessed soon.
+    void adviseWillNeed(size_t offset, size_t length);
+
+private:
+    char *data = nullptr;
+    size_t size = 0;
+    bool copyOnWrite = false;
+#ifdef _WIN32
+    void *fileHandle = nullptr;
+    void *mappingHandle = nullptr;
+#else
+    int fileDescriptor = -1;
+#endif
+};
+
+#endif //PIXELSYNCOIT_MAPPEDFILE_HPP
@@ -0,0 +1,250 @@
+//
+// Created by agent on 19.10.26.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cfloat>
+#include <limits>
+
+#include <glm/glm.hpp>
+
+#include <Utils/File/Logfile.hpp>
+#include <Utils/Convert.hpp>
+
+#include "MeshClustering.hpp"
+
+static const glm::vec3 *getSubmeshPositions(const BinarySubMesh &submesh, size_t &numVertices)
+{
+    for (const BinaryMeshAttribute &attribute : submesh.attributes) {
+        if (attribute.name == "vertexPosition" && attribute.attributeFormat == sgl::ATTRIB_FLOAT
+                && attribute.numComponents == 3 && !attribute.data.empty()) {
+            numVertices = attribute.data.size() / sizeof(glm::vec3);
+            return (const glm::vec3*)&attribute.data.front();
+        }
+    }
+    numVertices = 0;
+    return nullptr;
+}
+
+static inline float getAttributeValue(const BinaryMeshAttribute &attribute, uint32_t vertexIndex)
+{
+    if (attribute.attributeFormat == sgl::ATTRIB_UNSIGNED_SHORT) {
+        return ((const uint16_t*)&attribute.data.front())[vertexIndex] / 65535.0f;
+    } else if (attribute.attributeFormat == sgl::ATTRIB_UNSIGNED_BYTE) {
+        return ((const uint8_t*)&attribute.data.front())[vertexIndex] / 255.0f;
+    } else if (attribute.attributeFormat == sgl::ATTRIB_UNSIGNED_INT) {
+        return float(((const uint32_t*)&attribute.data.front())[vertexIndex]);
+    }
+    return ((const float*)&attribute.data.front())[vertexIndex];
+}
+
+static void computeClusterBounds(
+        const BinarySubMesh &submesh, const glm::vec3 *positions, uint32_t indicesPerPrimitive,
+        const std::vector<const BinaryMeshAttribute*> &scalarAttributes, BinaryMeshCluster &cluster)
+{
+    const uint32_t *indices = &submesh.indices.front() + cluster.indexOffset;
+
+    // Bounding box and bounding sphere (centered at the center of the bounding box)
+    glm::vec3 aabbMin(FLT_MAX), aabbMax(-FLT_MAX);
+    for (uint32_t i = 0; i < cluster.numIndices; i++) {
+        aabbMin = glm::min(aabbMin, positions[indices[i]]);
+        aabbMax = glm::max(aabbMax, positions[indices[i]]);
+    }
+    cluster.aabbMin = aabbMin;
+    cluster.aabbMax = aabbMax;
+    cluster.sphereCenter = (aabbMin + aabbMax) * 0.5f;
+    float squaredRadius = 0.0f;
+    for (uint32_t i = 0; i < cluster.numIndices; i++) {
+        glm::vec3 diff = positions[indices[i]] - cluster.sphereCenter;
+        squaredRadius = std::max(squaredRadius, glm::dot(diff, diff));
+    }
+    cluster.sphereRadius = std::sqrt(squaredRadius);
+
+    // Normal cone (only for triangles)
+    cluster.coneAxis = glm::vec3(0.0f, 0.0f, 1.0f);
+    cluster.coneCutoff = 1.0f;
+    if (indicesPerPrimitive == 3) {
+        glm::vec3 normalSum(0.0f);
+        for (uint32_t i = 0; i < cluster.numIndices; i += 3) {
+            const glm::vec3 &v0 = positions[indices[i]];
+            glm::vec3 normal = glm::cross(positions[indices[i+1]] - v0, positions[indices[i+2]] - v0);
+            float normalLength = glm::length(normal);
+            if (normalLength > 0.0f) {
+                normalSum += normal / normalLength;
+            }
+        }
+        float axisLength = glm::length(normalSum);
+        if (axisLength > 0.0f) {
+            glm::vec3 coneAxis = normalSum / axisLength;
+            float minDot = 1.0f;
+            for (uint32_t i = 0; i < cluster.numIndices; i += 3) {
+                const glm::vec3 &v0 = positions[indices[i]];
+                glm::vec3 normal = glm::cross(positions[indices[i+1]] - v0, positions[indices[i+2]] - v0);
+                float normalLength = glm::length(normal);
+                if (normalLength > 0.0f) {
+                    minDot = std::min(minDot, glm::dot(coneAxis, normal / normalLength));
+                }
+            }
+            cluster.coneAxis = coneAxis;
+            // Half angle >= 90 degrees: Some triangle is always front-facing.
+            cluster.coneCutoff = minDot <= 0.0f ? 1.0f : std::sqrt(1.0f - minDot * minDot);
+        }
+    }
+
+    // Attribute ranges (e.g. for culling clusters that are fully transparent due to the transfer function)
+    cluster.attributeRanges.resize(scalarAttributes.size());
+    for (size_t j = 0; j < scalarAttributes.size(); j++) {
+        glm::vec2 range(FLT_MAX, -FLT_MAX);
+        for (uint32_t i = 0; i < cluster.numIndices; i++) {
+            float value = getAttributeValue(*scalarAttributes.at(j), indices[i]);
+            range.x = std::min(range.x, value);
+            range.y = std::max(range.y, value);
+        }
+        cluster.attributeRanges.at(j) = range;
+    }
+}
+
+void buildMeshClusters(BinarySubMesh &submesh, const MeshClusteringSettings &settings)
+{
+    submesh.clusters.clear();
+
+    uint32_t indicesPerPrimitive = 0;
+    if (submesh.vertexMode == sgl::VERTEX_MODE_TRIANGLES) {
+        indicesPerPrimitive = 3;
+    } else if (submesh.vertexMode == sgl::VERTEX_MODE_LINES) {
+        indicesPerPrimitive = 2;
+    }
+    size_t numVertices = 0;
+    const glm::vec3 *positions = getSubmeshPositions(submesh, numVertices);
+    if (indicesPerPrimitive == 0 || positions == nullptr || submesh.indices.size() < indicesPerPrimitive) {
+        return;
+    }
+
+    std::vector<const BinaryMeshAttribute*> scalarAttributes;
+    for (const BinaryMeshAttribute &attribute : submesh.attributes) {
+        if (attribute.numComponents == 1 && attribute.data.size() > 0) {
+            scalarAttributes.push_back(&attribute);
+        }
+    }
+
+    glm::vec3 submeshMin(FLT_MAX), submeshMax(-FLT_MAX);
+    for (size_t i = 0; i < numVertices; i++) {
+        submeshMin = glm::min(submeshMin, positions[i]);
+        submeshMax = glm::max(submeshMax, positions[i]);
+    }
+    float maxClusterExtent = settings.maxClusterExtentFactor * glm::length(submeshMax - submeshMin);
+    uint32_t maxPrimitivesPerCluster = std::max(settings.maxPrimitivesPerCluster, 1u);
+
+    // 1. Determine the cluster boundaries by greedily growing the clusters along the index buffer
+    size_t numPrimitives = submesh.indices.size() / indicesPerPrimitive;
+    std::vector<uint32_t> clusterPrimitiveOffsets;
+    glm::vec3 clusterMin(FLT_MAX), clusterMax(-FLT_MAX);
+    uint32_t numPrimitivesInCluster = 0;
+    for (size_t primitiveIndex = 0; primitiveIndex < numPrimitives; primitiveIndex++) {
+        glm::vec3 primitiveMin(FLT_MAX), primitiveMax(-FLT_MAX);
+        for (uint32_t k = 0; k < indicesPerPrimitive; k++) {
+            const glm::vec3 &position = positions[submesh.indices[primitiveIndex * indicesPerPrimitive + k]];
+            primitiveMin = glm::min(primitiveMin, position);
+            primitiveMax = glm::max(primitiveMax, position);
+        }
+
+        if (numPrimitivesInCluster > 0) {
+            glm::vec3 newMin = glm::min(clusterMin, primitiveMin);
+            glm::vec3 newMax = glm::max(clusterMax, primitiveMax);
+            bool isClusterFull = numPrimitivesInCluster >= maxPrimitivesPerCluster
+                    || (numPrimitivesInCluster >= settings.minPrimitivesPerCluster
+                        && glm::length(newMax - newMin) > maxClusterExtent);
+            if (isClusterFull) {
+                numPrimitivesInCluster = 0;
+                clusterMin = glm::vec3(FLT_MAX);
+                clusterMax = glm::vec3(-FLT_MAX);
+            }
+        }
+        if (numPrimitivesInCluster == 0) {
+            clusterPrimitiveOffsets.push_back(uint32_t(primitiveIndex));
+        }
+        clusterMin = glm::min(clusterMin, primitiveMin);
+        clusterMax = glm::max(clusterMax, primitiveMax);
+        numPrimitivesInCluster++;
+    }
+    clusterPrimitiveOffsets.push_back(uint32_t(numPrimitives));
+
+    // 2. Compute the bounds of the clusters in parallel
+    int numClusters = int(clusterPrimitiveOffsets.size()) - 1;
+    submesh.clusters.resize(numClusters);
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (int clusterIndex = 0; clusterIndex < numClusters; clusterIndex++) {
+        BinaryMeshCluster &cluster = submesh.clusters.at(clusterIndex);
+        cluster.indexOffset = clusterPrimitiveOffsets.at(clusterIndex) * indicesPerPrimitive;
+        cluster.numIndices = (clusterPrimitiveOffsets.at(clusterIndex + 1) - clusterPrimitiveOffsets.at(clusterIndex))
+                * indicesPerPrimitive;
+        computeClusterBounds(submesh, positions, indicesPerPrimitive, scalarAttributes, cluster);
+    }
+}
+
+void buildMeshClusters(BinaryMesh &mesh, const MeshClusteringSettings &settings)
+{
+    auto start = std::chrono::system_clock::now();
+
+    int numSubmeshes = int(mesh.submeshes.size());
+    #pragma omp parallel for schedule(dynamic) if(numSubmeshes > 1)
+    for (int submeshIndex = 0; submeshIndex < numSubmeshes; submeshIndex++) {
+        buildMeshClusters(mesh.submeshes.at(submeshIndex), settings);
+    }
+
+    for (int submeshIndex = 0; submeshIndex < numSubmeshes; submeshIndex++) {
+        MeshClusterStatistics statistics = computeMeshClusterStatistics(mesh.submeshes.at(submeshIndex));
+        if (statistics.numClusters == 0) {
+            continue;
+        }
+        sgl::Logfile::get()->writeInfo(std::string() + "Clusters (submesh " + sgl::toString(submeshIndex) + "): "
+                + sgl::toString(statistics.numClusters) + " clusters, primitives per cluster min "
+                + sgl::toString(statistics.minPrimitivesPerCluster) + " avg "
+                + sgl::toString(statistics.avgPrimitivesPerCluster) + " max "
+                + sgl::toString(statistics.maxPrimitivesPerCluster) + ", avg relative sphere radius "
+                + sgl::toString(statistics.avgRelativeSphereRadius) + ", cullable normal cones "
+                + sgl::toString(statistics.cullableConeFraction * 100.0f) + "%");
+    }
+
+    auto end = std::chrono::system_clock::now();
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+    sgl::Logfile::get()->writeInfo(std::string() + "Computational time to build the mesh clusters: "
+            + std::to_string(elapsed.count()));
+}
+
+MeshClusterStatistics computeMeshClusterStatistics(const BinarySubMesh &submesh)
+{
+    MeshClusterStatistics statistics;
+    statistics.numClusters = submesh.clusters.size();
+    if (statistics.numClusters == 0) {
+        return statistics;
+    }
+
+    size_t indicesPerPrimitive = submesh.vertexMode == sgl::VERTEX_MODE_TRIANGLES ? 3 : 2;
+    glm::vec3 submeshMin(FLT_MAX), submeshMax(-FLT_MAX);
+    statistics.minPrimitivesPerCluster = std::numeric_limits<size_t>::max();
+    size_t numPrimitives = 0;
+    size_t numCullableCones = 0;
+    float sphereRadiusSum = 0.0f;
+    for (const BinaryMeshCluster &cluster : submesh.clusters) {
+        size_t numClusterPrimitives = cluster.numIndices / indicesPerPrimitive;
+        statistics.minPrimitivesPerCluster = std::min(statistics.minPrimitivesPerCluster, numClusterPrimitives);
+        statistics.maxPrimitivesPerCluster = std::max(statistics.maxPrimitivesPerCluster, numClusterPrimitives);
+        numPrimitives += numClusterPrimitives;
+        sphereRadiusSum += cluster.sphereRadius;
+        if (cluster.coneCutoff < 1.0f) {
+            numCullableCones++;
+        }
+        submeshMin = glm::min(submeshMin, cluster.aabbMin);
+        submeshMax = glm::max(submeshMax, cluster.aabbMax);
+    }
+
+    float submeshRadius = glm::length(submeshMax - submeshMin) * 0.5f;
+    statistics.avgPrimitivesPerCluster = float(numPrimitives) / float(statistics.numClusters);
+    statistics.avgRelativeSphereRadius = submeshRadius > 0.0f
+            ? sphereRadiusSum / float(statistics.numClusters) / submeshRadius : 0.0f;
+    statistics.cullableConeFraction = float(numCullableCones) / float(statistics.numClusters);
+    return statistics;
+}
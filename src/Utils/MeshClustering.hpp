@@ -0,0 +1,50 @@
+//
+// Created by agent on 19.10.26.
+//
+
+#ifndef PIXELSYNCOIT_MESHCLUSTERING_HPP
+#define PIXELSYNCOIT_MESHCLUSTERING_HPP
+
+#include "MeshSerializer.hpp"
+
+/**
+ * Offline partitioning of binmesh submeshes into clusters of spatially coherent primitives (triangles or line
+ * segments). The order of the index buffer is kept (i.e., the clustering can be applied after optimizeBinaryMesh):
+ * Consecutive primitives are added to the current cluster until it contains "maxPrimitivesPerCluster" primitives,
+ * or until it contains at least "minPrimitivesPerCluster" primitives and its AABB would grow larger than
+ * "maxClusterExtentFactor" times the diagonal of the submesh. The second criterion splits e.g. at jumps between
+ * different lines.
+ */
+struct MeshClusteringSettings
+{
+    uint32_t minPrimitivesPerCluster = 64;
+    uint32_t maxPrimitivesPerCluster = 256;
+    float maxClusterExtentFactor = 0.02f;
+};
+
+struct MeshClusterStatistics
+{
+    size_t numClusters = 0;
+    size_t minPrimitivesPerCluster = 0;
+    size_t maxPrimitivesPerCluster = 0;
+    float avgPrimitivesPerCluster = 0.0f;
+    // Average bounding sphere radius relative to the radius of the bounding sphere of the submesh
+    float avgRelativeSphereRadius = 0.0f;
+    // Fraction of the clusters with a normal cone that allows back-face culling
+    float cullableConeFraction = 0.0f;
+};
+
+/**
+ * Creates the clusters of a submesh (VERTEX_MODE_TRIANGLES or VERTEX_MODE_LINES with an index buffer). Any old
+ * clusters are replaced.
+ */
+void buildMeshClusters(BinarySubMesh &submesh, const MeshClusteringSettings &settings = MeshClusteringSettings());
+
+/**
+ * Creates the clusters of all submeshes (in parallel) and writes the cluster statistics to the log file.
+ */
+void buildMeshClusters(BinaryMesh &mesh, const MeshClusteringSettings &settings = MeshClusteringSettings());
+
+MeshClusterStatistics computeMeshClusterStatistics(const BinarySubMesh &submesh);
+
+#endif //PIXELSYNCOIT_MESHCLUSTERING_HPP
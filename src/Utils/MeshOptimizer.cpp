@@ -0,0 +1,407 @@
+//
+// Created by agent on 19.10.26.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <climits>
+#include <limits>
+
+#include <glm/glm.hpp>
+
+#include <Utils/File/Logfile.hpp>
+#include <Utils/Convert.hpp>
+#include <Math/Geometry/AABB3.hpp>
+
+#include "MeshOptimizer.hpp"
+
+VertexCacheStatistics simulateVertexCache(const std::vector<uint32_t> &indices, size_t numVertices, int cacheSize)
+{
+    VertexCacheStatistics statistics;
+    size_t numTriangles = indices.size() / 3;
+    if (numTriangles == 0 || numVertices == 0) {
+        return statistics;
+    }
+
+    // A vertex is in the FIFO cache if it was inserted less than "cacheSize" insertions ago.
+    std::vector<size_t> insertionTimestamps(numVertices, std::numeric_limits<size_t>::max());
+    std::vector<uint8_t> vertexUsed(numVertices, 0);
+    size_t numTransformedVertices = 0;
+    size_t numUsedVertices = 0;
+    for (size_t i = 0; i < numTriangles * 3; i++) {
+        uint32_t vertexIndex = indices[i];
+        size_t timestamp = insertionTimestamps[vertexIndex];
+        if (timestamp == std::numeric_limits<size_t>::max() || numTransformedVertices - timestamp >= size_t(cacheSize)) {
+            insertionTimestamps[vertexIndex] = numTransformedVertices;
+            numTransformedVertices++;
+        }
+        if (!vertexUsed[vertexIndex]) {
+            vertexUsed[vertexIndex] = 1;
+            numUsedVertices++;
+        }
+    }
+
+    statistics.acmr = float(numTransformedVertices) / float(numTriangles);
+    statistics.atvr = float(numTransformedVertices) / float(numUsedVertices);
+    return statistics;
+}
+
+
+
+// Constants of the scoring function proposed by Tom Forsyth
+const float FORSYTH_CACHE_DECAY_POWER = 1.5f;
+const float FORSYTH_LAST_TRI_SCORE = 0.75f;
+const float FORSYTH_VALENCE_BOOST_SCALE = 2.0f;
+const float FORSYTH_VALENCE_BOOST_POWER = 0.5f;
+
+static float computeForsythVertexScore(int cachePosition, uint32_t numActiveTriangles, int cacheSize)
+{
+    if (numActiveTriangles == 0) {
+        // No triangle needs this vertex anymore
+        return -1.0f;
+    }
+
+    float score = 0.0f;
+    if (cachePosition >= 0) {
+        if (cachePosition < 3) {
+            // The vertex was used in the last triangle. Use a fixed score so that the triangle order of strips
+            // doesn't depend on the order of the vertices within the last triangle.
+            score = FORSYTH_LAST_TRI_SCORE;
+        } else {
+            float scaler = 1.0f / float(cacheSize - 3);
+            score = std::pow(1.0f - float(cachePosition - 3) * scaler, FORSYTH_CACHE_DECAY_POWER);
+        }
+    }
+
+    // Boost the score of vertices with few remaining triangles to get rid of lone vertices quickly
+    score += FORSYTH_VALENCE_BOOST_SCALE * std::pow(float(numActiveTriangles), -FORSYTH_VALENCE_BOOST_POWER);
+    return score;
+}
+
+void optimizeTriangleOrderForsyth(std::vector<uint32_t> &indices, size_t numVertices, int cacheSize)
+{
+    const size_t numTriangles = indices.size() / 3;
+    if (numTriangles == 0) {
+        return;
+    }
+    cacheSize = std::max(cacheSize, 4);
+
+    // Compute the vertex -> triangle adjacency in CSR format
+    std::vector<uint32_t> numActiveTriangles(numVertices, 0);
+    for (size_t i = 0; i < numTriangles * 3; i++) {
+        numActiveTriangles[indices[i]]++;
+    }
+    std::vector<uint32_t> adjacencyOffsets(numVertices + 1);
+    adjacencyOffsets[0] = 0;
+    for (size_t i = 0; i < numVertices; i++) {
+        adjacencyOffsets[i+1] = adjacencyOffsets[i] + numActiveTriangles[i];
+    }
+    std::vector<uint32_t> adjacentTriangles(numTriangles * 3);
+    std::vector<uint32_t> writeOffsets(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+    for (size_t i = 0; i < numTriangles * 3; i++) {
+        adjacentTriangles[writeOffsets[indices[i]]++] = uint32_t(i / 3);
+    }
+    writeOffsets = std::vector<uint32_t>();
+
+    // Initial scores
+    std::vector<int> cachePositions(numVertices, -1);
+    std::vector<float> vertexScores(numVertices);
+    for (size_t i = 0; i < numVertices; i++) {
+        vertexScores[i] = computeForsythVertexScore(-1, numActiveTriangles[i], cacheSize);
+    }
+    std::vector<uint8_t> triangleEmitted(numTriangles, 0);
+    int64_t bestTriangle = -1;
+    float bestScore = -1.0f;
+    for (size_t i = 0; i < numTriangles; i++) {
+        float score = vertexScores[indices[i*3]] + vertexScores[indices[i*3+1]] + vertexScores[indices[i*3+2]];
+        if (score > bestScore) {
+            bestScore = score;
+            bestTriangle = int64_t(i);
+        }
+    }
+
+    std::vector<uint32_t> cache, newCache;
+    cache.reserve(cacheSize + 3);
+    newCache.reserve(cacheSize + 3);
+    std::vector<uint32_t> newIndices;
+    newIndices.reserve(numTriangles * 3);
+    size_t searchCursor = 0;
+
+    for (size_t numEmittedTriangles = 0; numEmittedTriangles < numTriangles; numEmittedTriangles++) {
+        if (bestTriangle < 0) {
+            // Dead end: No triangle adjacent to the cached vertices is left. Continue with the next triangle in the
+            // original order (keeps the algorithm linear instead of searching for the globally best triangle).
+            while (triangleEmitted[searchCursor]) {
+                searchCursor++;
+            }
+            bestTriangle = int64_t(searchCursor);
+        }
+
+        // Emit the triangle and remove it from the active triangle lists of its vertices
+        uint32_t triangleIndex = uint32_t(bestTriangle);
+        triangleEmitted[triangleIndex] = 1;
+        newCache.clear();
+        for (int k = 0; k < 3; k++) {
+            uint32_t vertexIndex = indices[triangleIndex*3 + k];
+            newIndices.push_back(vertexIndex);
+
+            uint32_t adjacencyBegin = adjacencyOffsets[vertexIndex];
+            uint32_t adjacencyEnd = adjacencyBegin + numActiveTriangles[vertexIndex];
+            for (uint32_t j = adjacencyBegin; j < adjacencyEnd; j++) {
+                if (adjacentTriangles[j] == triangleIndex) {
+                    std::swap(adjacentTriangles[j], adjacentTriangles[adjacencyEnd - 1]);
+                    break;
+                }
+            }
+            numActiveTriangles[vertexIndex]--;
+
+            if (std::find(newCache.begin(), newCache.end(), vertexIndex) == newCache.end()) {
+                newCache.push_back(vertexIndex);
+            }
+        }
+
+        // The vertices of the emitted triangle move to the front of the LRU cache
+        size_t numNewVertices = newCache.size();
+        for (uint32_t vertexIndex : cache) {
+            if (std::find(newCache.begin(), newCache.begin() + numNewVertices, vertexIndex)
+                    == newCache.begin() + numNewVertices) {
+                newCache.push_back(vertexIndex);
+            }
+        }
+
+        // Update the scores of the vertices in the cache (and of the ones that just dropped out of it)
+        for (size_t i = 0; i < newCache.size(); i++) {
+            uint32_t vertexIndex = newCache[i];
+            cachePositions[vertexIndex] = int(i) < cacheSize ? int(i) : -1;
+            vertexScores[vertexIndex] = computeForsythVertexScore(
+                    cachePositions[vertexIndex], numActiveTriangles[vertexIndex], cacheSize);
+        }
+
+        // Find the best triangle adjacent to the vertices in the cache
+        bestTriangle = -1;
+        bestScore = -1.0f;
+        for (size_t i = 0; i < newCache.size(); i++) {
+            uint32_t vertexIndex = newCache[i];
+            uint32_t adjacencyBegin = adjacencyOffsets[vertexIndex];
+            uint32_t adjacencyEnd = adjacencyBegin + numActiveTriangles[vertexIndex];
+            for (uint32_t j = adjacencyBegin; j < adjacencyEnd; j++) {
+                uint32_t adjacentTriangle = adjacentTriangles[j];
+                float score = vertexScores[indices[adjacentTriangle*3]] + vertexScores[indices[adjacentTriangle*3+1]]
+                        + vertexScores[indices[adjacentTriangle*3+2]];
+                if (score > bestScore) {
+                    bestScore = score;
+                    bestTriangle = int64_t(adjacentTriangle);
+                }
+            }
+        }
+
+        if (int(newCache.size()) > cacheSize) {
+            newCache.resize(cacheSize);
+        }
+        cache.swap(newCache);
+    }
+
+    indices.swap(newIndices);
+}
+
+
+
+static size_t getAttributeFormatNumBytes(sgl::VertexAttributeFormat format)
+{
+    if (format == sgl::ATTRIB_UNSIGNED_BYTE) {
+        return 1;
+    } else if (format == sgl::ATTRIB_UNSIGNED_SHORT) {
+        return 2;
+    }
+    return 4;
+}
+
+static size_t getSubmeshNumVertices(const BinarySubMesh &submesh)
+{
+    for (const BinaryMeshAttribute &attribute : submesh.attributes) {
+        if (attribute.name == "vertexPosition") {
+            return attribute.data.size() / (attribute.numComponents
+                    * getAttributeFormatNumBytes(attribute.attributeFormat));
+        }
+    }
+    return 0;
+}
+
+// Spreads the lower 10 bits of v to every third bit
+static inline uint32_t expandBits10(uint32_t v)
+{
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+static void sortTrianglesByMortonCode(std::vector<uint32_t> &indices, const glm::vec3 *positions, size_t numVertices)
+{
+    size_t numTriangles = indices.size() / 3;
+    sgl::AABB3 aabb;
+    for (size_t i = 0; i < numVertices; i++) {
+        aabb.combine(positions[i]);
+    }
+    glm::vec3 minimum = aabb.getMinimum();
+    glm::vec3 extent = glm::max(aabb.getMaximum() - minimum, glm::vec3(1e-6f));
+
+    std::vector<std::pair<uint32_t, uint32_t>> mortonCodes(numTriangles);
+    #pragma omp parallel for
+    for (int64_t i = 0; i < int64_t(numTriangles); i++) {
+        glm::vec3 centroid = (positions[indices[i*3]] + positions[indices[i*3+1]] + positions[indices[i*3+2]]) / 3.0f;
+        glm::ivec3 quantizedPosition = glm::clamp(
+                glm::ivec3((centroid - minimum) / extent * 1024.0f), glm::ivec3(0), glm::ivec3(1023));
+        uint32_t mortonCode = (expandBits10(uint32_t(quantizedPosition.x)) << 2)
+                | (expandBits10(uint32_t(quantizedPosition.y)) << 1) | expandBits10(uint32_t(quantizedPosition.z));
+        mortonCodes[i] = std::make_pair(mortonCode, uint32_t(i));
+    }
+    std::sort(mortonCodes.begin(), mortonCodes.end());
+
+    std::vector<uint32_t> sortedIndices(numTriangles * 3);
+    #pragma omp parallel for
+    for (int64_t i = 0; i < int64_t(numTriangles); i++) {
+        uint32_t triangleIndex = mortonCodes[i].second;
+        sortedIndices[i*3] = indices[triangleIndex*3];
+        sortedIndices[i*3+1] = indices[triangleIndex*3+1];
+        sortedIndices[i*3+2] = indices[triangleIndex*3+2];
+    }
+    indices.swap(sortedIndices);
+}
+
+/**
+ * Applies optimizeTriangleOrderForsyth independently to consecutive clusters of MORTON_CLUSTER_NUM_TRIANGLES
+ * triangles (in parallel). The order of the clusters themselves is kept.
+ */
+static void optimizeTriangleOrderClusters(std::vector<uint32_t> &indices, int cacheSize)
+{
+    size_t numTriangles = indices.size() / 3;
+    int numClusters = int((numTriangles + MORTON_CLUSTER_NUM_TRIANGLES - 1) / MORTON_CLUSTER_NUM_TRIANGLES);
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int clusterIndex = 0; clusterIndex < numClusters; clusterIndex++) {
+        size_t indexStart = size_t(clusterIndex) * MORTON_CLUSTER_NUM_TRIANGLES * 3;
+        size_t indexEnd = std::min(indexStart + MORTON_CLUSTER_NUM_TRIANGLES * 3, numTriangles * 3);
+        std::vector<uint32_t> clusterIndices(indices.begin() + indexStart, indices.begin() + indexEnd);
+
+        // Global -> cluster-local vertex indices
+        std::vector<uint32_t> clusterVertices = clusterIndices;
+        std::sort(clusterVertices.begin(), clusterVertices.end());
+        clusterVertices.erase(std::unique(clusterVertices.begin(), clusterVertices.end()), clusterVertices.end());
+        for (uint32_t &index : clusterIndices) {
+            index = uint32_t(std::lower_bound(clusterVertices.begin(), clusterVertices.end(), index)
+                    - clusterVertices.begin());
+        }
+
+        optimizeTriangleOrderForsyth(clusterIndices, clusterVertices.size(), cacheSize);
+
+        for (size_t i = 0; i < clusterIndices.size(); i++) {
+            indices[indexStart + i] = clusterVertices[clusterIndices[i]];
+        }
+    }
+}
+
+/**
+ * Renumbers the vertices in the order of their first use in the index buffer and permutes all vertex attributes
+ * accordingly. Unreferenced vertices are moved to the end.
+ */
+static bool optimizeVertexFetchOrder(BinarySubMesh &submesh, size_t numVertices)
+{
+    for (const BinaryMeshAttribute &attribute : submesh.attributes) {
+        if (attribute.data.size() % numVertices != 0) {
+            return false;
+        }
+    }
+
+    std::vector<uint32_t> newVertexIndices(numVertices, UINT32_MAX);
+    uint32_t numRemappedVertices = 0;
+    for (uint32_t &index : submesh.indices) {
+        if (newVertexIndices[index] == UINT32_MAX) {
+            newVertexIndices[index] = numRemappedVertices++;
+        }
+        index = newVertexIndices[index];
+    }
+    for (size_t i = 0; i < numVertices; i++) {
+        if (newVertexIndices[i] == UINT32_MAX) {
+            newVertexIndices[i] = numRemappedVertices++;
+        }
+    }
+
+    for (BinaryMeshAttribute &attribute : submesh.attributes) {
+        size_t bytesPerVertex = attribute.data.size() / numVertices;
+        std::vector<uint8_t> newData(attribute.data.size());
+        #pragma omp parallel for
+        for (int64_t i = 0; i < int64_t(numVertices); i++) {
+            memcpy(&newData[size_t(newVertexIndices[i]) * bytesPerVertex], &attribute.data[size_t(i) * bytesPerVertex],
+                    bytesPerVertex);
+        }
+        attribute.data.swap(newData);
+    }
+    return true;
+}
+
+void optimizeBinaryMesh(BinaryMesh &mesh, const MeshOptimizationSettings &settings)
+{
+    auto start = std::chrono::system_clock::now();
+
+    int numSubmeshes = int(mesh.submeshes.size());
+    std::vector<VertexCacheStatistics> statisticsBefore(numSubmeshes), statisticsAfter(numSubmeshes);
+    std::vector<uint8_t> submeshOptimized(numSubmeshes, 0);
+
+    // Only parallelize over the submeshes if there are multiple ones (the cluster optimization is parallel itself).
+    #pragma omp parallel for schedule(dynamic) if(numSubmeshes > 1)
+    for (int submeshIndex = 0; submeshIndex < numSubmeshes; submeshIndex++) {
+        BinarySubMesh &submesh = mesh.submeshes.at(submeshIndex);
+        size_t numVertices = getSubmeshNumVertices(submesh);
+        if (submesh.vertexMode != sgl::VERTEX_MODE_TRIANGLES || submesh.indices.empty() || numVertices == 0) {
+            continue;
+        }
+
+        statisticsBefore.at(submeshIndex) = simulateVertexCache(submesh.indices, numVertices, settings.cacheSize);
+
+        if (settings.optimizeVertexCache) {
+            const BinaryMeshAttribute *positionAttribute = nullptr;
+            for (const BinaryMeshAttribute &attribute : submesh.attributes) {
+                if (attribute.name == "vertexPosition") {
+                    positionAttribute = &attribute;
+                }
+            }
+            bool canUseMortonClusters = positionAttribute != nullptr
+                    && positionAttribute->attributeFormat == sgl::ATTRIB_FLOAT
+                    && positionAttribute->numComponents == 3;
+            if (settings.useMortonClusters && canUseMortonClusters) {
+                sortTrianglesByMortonCode(submesh.indices, (const glm::vec3*)&positionAttribute->data.front(),
+                        numVertices);
+                optimizeTriangleOrderClusters(submesh.indices, settings.cacheSize);
+            } else {
+                optimizeTriangleOrderForsyth(submesh.indices, numVertices, settings.cacheSize);
+            }
+        }
+        if (settings.optimizeVertexFetch) {
+            optimizeVertexFetchOrder(submesh, numVertices);
+        }
+
+        statisticsAfter.at(submeshIndex) = simulateVertexCache(submesh.indices, numVertices, settings.cacheSize);
+        submeshOptimized.at(submeshIndex) = 1;
+    }
+
+    for (int submeshIndex = 0; submeshIndex < numSubmeshes; submeshIndex++) {
+        if (!submeshOptimized.at(submeshIndex)) {
+            continue;
+        }
+        const VertexCacheStatistics &before = statisticsBefore.at(submeshIndex);
+        const VertexCacheStatistics &after = statisticsAfter.at(submeshIndex);
+        sgl::Logfile::get()->writeInfo(std::string() + "Vertex cache optimization (submesh "
+                + sgl::toString(submeshIndex) + ", cache size " + sgl::toString(settings.cacheSize) + "): ACMR "
+                + sgl::toString(before.acmr) + " -> " + sgl::toString(after.acmr) + ", ATVR "
+                + sgl::toString(before.atvr) + " -> " + sgl::toString(after.atvr));
+    }
+
+    auto end = std::chrono::system_clock::now();
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+    sgl::Logfile::get()->writeInfo(std::string() + "Computational time to optimize the mesh: "
+            + std::to_string(elapsed.count()));
+}
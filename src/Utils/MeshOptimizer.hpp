@@ -0,0 +1,62 @@
+//
+// Created by agent on 19.10.26.
+//
+
+#ifndef PIXELSYNCOIT_MESHOPTIMIZER_HPP
+#define PIXELSYNCOIT_MESHOPTIMIZER_HPP
+
+#include <vector>
+#include <cstdint>
+
+#include "MeshSerializer.hpp"
+
+/**
+ * Offline optimization of the triangle and vertex order of binmesh files (applied before writeMesh3D).
+ *  1. (Optional) The triangles are sorted by the Morton code of their centroids and split into clusters of
+ *     MORTON_CLUSTER_NUM_TRIANGLES triangles. This improves the spatial locality of very large meshes.
+ *  2. The triangles are reordered for the post-transform vertex cache using the algorithm by Tom Forsyth
+ *     ("Linear-Speed Vertex Cache Optimisation", 2006). If Morton clusters are used, the clusters are optimized
+ *     independently in parallel.
+ *  3. The vertices are reordered in the order of their first use in the index buffer (vertex fetch locality).
+ */
+struct MeshOptimizationSettings
+{
+    bool optimizeVertexCache = true;
+    bool optimizeVertexFetch = true;
+    bool useMortonClusters = false;
+    // Size of the (simulated) FIFO post-transform vertex cache
+    int cacheSize = 32;
+};
+
+const size_t MORTON_CLUSTER_NUM_TRIANGLES = 4096;
+
+/**
+ * Statistics of a simulated FIFO post-transform vertex cache.
+ * ACMR: Average cache miss ratio, i.e., the number of transformed vertices per triangle (optimum: ~0.5).
+ * ATVR: Average transform to vertex ratio, i.e., the number of transformed vertices per vertex (optimum: 1.0).
+ */
+struct VertexCacheStatistics
+{
+    float acmr = 0.0f;
+    float atvr = 0.0f;
+};
+
+/**
+ * Simulates a FIFO vertex cache with "cacheSize" entries for the triangle list "indices".
+ */
+VertexCacheStatistics simulateVertexCache(
+        const std::vector<uint32_t> &indices, size_t numVertices, int cacheSize = 32);
+
+/**
+ * Reorders the triangles in "indices" (a triangle list referencing "numVertices" vertices) using the algorithm by
+ * Tom Forsyth to reduce the number of misses in the post-transform vertex cache.
+ */
+void optimizeTriangleOrderForsyth(std::vector<uint32_t> &indices, size_t numVertices, int cacheSize = 32);
+
+/**
+ * Optimizes all indexed triangle submeshes of the passed mesh (in parallel over the submeshes). The ACMR and ATVR
+ * before and after the optimization are written to the log file.
+ */
+void optimizeBinaryMesh(BinaryMesh &mesh, const MeshOptimizationSettings &settings = MeshOptimizationSettings());
+
+#endif //PIXELSYNCOIT_MESHOPTIMIZER_HPP
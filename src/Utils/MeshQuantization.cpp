@@ -0,0 +1,302 @@
+//
+// Created by agent on 19.10.26.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cfloat>
+
+#include <glm/glm.hpp>
+
+#include <Utils/AppSettings.hpp>
+#include <Utils/File/Logfile.hpp>
+#include <Utils/Convert.hpp>
+
+#include "DerivedDataCache.hpp"
+#include "MeshQuantization.hpp"
+
+MeshQuantizationSettings getMeshQuantizationSettings()
+{
+    MeshQuantizationSettings quantizationSettings;
+    sgl::SettingsFile &settings = sgl::AppSettings::get()->getSettings();
+    if (settings.hasKey("meshQuantization-positions")) {
+        quantizationSettings.quantizePositions = settings.getBoolValue("meshQuantization-positions");
+    }
+    if (settings.hasKey("meshQuantization-directions")) {
+        quantizationSettings.quantizeDirections = settings.getBoolValue("meshQuantization-directions");
+    }
+    if (settings.hasKey("meshQuantization-directions8Bit")) {
+        quantizationSettings.useDirections8Bit = settings.getBoolValue("meshQuantization-directions8Bit");
+    }
+    return quantizationSettings;
+}
+
+void addMeshQuantizationParameters(DerivedDataKey &key, const MeshQuantizationSettings &settings)
+{
+    key.addParameter("quantizePositions", settings.quantizePositions);
+    key.addParameter("quantizeDirections", settings.quantizeDirections);
+    if (settings.quantizeDirections) {
+        key.addParameter("directions8Bit", settings.useDirections8Bit);
+    }
+}
+
+
+static inline bool isDirectionAttribute(const BinaryMeshAttribute &attribute)
+{
+    return attribute.name == "vertexNormal" || attribute.name == "vertexLineNormal"
+            || attribute.name == "vertexLineTangent";
+}
+
+static inline glm::vec2 signNotZero(const glm::vec2 &v)
+{
+    return glm::vec2(v.x >= 0.0f ? 1.0f : -1.0f, v.y >= 0.0f ? 1.0f : -1.0f);
+}
+
+/// Maps a unit vector to the octahedron unfolded to [-1, 1]^2.
+static inline glm::vec2 octahedralEncode(const glm::vec3 &v)
+{
+    glm::vec2 p = glm::vec2(v.x, v.y) * (1.0f / (std::abs(v.x) + std::abs(v.y) + std::abs(v.z)));
+    if (v.z < 0.0f) {
+        p = (glm::vec2(1.0f) - glm::abs(glm::vec2(p.y, p.x))) * signNotZero(p);
+    }
+    return p;
+}
+
+static inline glm::vec3 octahedralDecode(const glm::vec2 &p)
+{
+    glm::vec3 v(p.x, p.y, 1.0f - std::abs(p.x) - std::abs(p.y));
+    if (v.z < 0.0f) {
+        glm::vec2 xy = (glm::vec2(1.0f) - glm::abs(glm::vec2(v.y, v.x))) * signNotZero(glm::vec2(v.x, v.y));
+        v.x = xy.x;
+        v.y = xy.y;
+    }
+    return glm::normalize(v);
+}
+
+/**
+ * Quantizes a unit vector to two signed normalized integers with "maxValue" = 2^(bits-1) - 1. Out of the four
+ * neighboring grid points of the exact encoding, the one with the smallest angular error is chosen.
+ */
+static inline glm::ivec2 quantizeDirection(const glm::vec3 &direction, int maxValue)
+{
+    glm::vec2 p = octahedralEncode(direction) * float(maxValue);
+    glm::ivec2 bestQuantized(0);
+    float bestCosAngle = -2.0f;
+    for (int i = 0; i < 4; i++) {
+        glm::ivec2 quantized(
+                int((i & 1) ? std::ceil(p.x) : std::floor(p.x)), int((i & 2) ? std::ceil(p.y) : std::floor(p.y)));
+        quantized = glm::clamp(quantized, glm::ivec2(-maxValue), glm::ivec2(maxValue));
+        float cosAngle = glm::dot(octahedralDecode(glm::vec2(quantized) / float(maxValue)), direction);
+        if (cosAngle > bestCosAngle) {
+            bestCosAngle = cosAngle;
+            bestQuantized = quantized;
+        }
+    }
+    return bestQuantized;
+}
+
+static inline float computeAngleDegrees(const glm::vec3 &v0, const glm::vec3 &v1)
+{
+    return glm::degrees(std::acos(glm::clamp(glm::dot(v0, v1), -1.0f, 1.0f)));
+}
+
+static void quantizePositionAttribute(BinaryMeshAttribute &attribute, MeshQuantizationErrors &errors)
+{
+    const glm::vec3 *positions = (const glm::vec3*)&attribute.data.front();
+    size_t numVertices = attribute.data.size() / sizeof(glm::vec3);
+
+    float minX = FLT_MAX, minY = FLT_MAX, minZ = FLT_MAX;
+    float maxX = -FLT_MAX, maxY = -FLT_MAX, maxZ = -FLT_MAX;
+    #pragma omp parallel for reduction(min:minX,minY,minZ) reduction(max:maxX,maxY,maxZ)
+    for (size_t i = 0; i < numVertices; i++) {
+        minX = std::min(minX, positions[i].x);
+        minY = std::min(minY, positions[i].y);
+        minZ = std::min(minZ, positions[i].z);
+        maxX = std::max(maxX, positions[i].x);
+        maxY = std::max(maxY, positions[i].y);
+        maxZ = std::max(maxZ, positions[i].z);
+    }
+    glm::vec3 aabbMin(minX, minY, minZ);
+    glm::vec3 aabbExtent = glm::vec3(maxX, maxY, maxZ) - aabbMin;
+    // Avoid division by zero for flat meshes
+    glm::vec3 scale = glm::vec3(
+            aabbExtent.x > 0.0f ? 65535.0f / aabbExtent.x : 0.0f,
+            aabbExtent.y > 0.0f ? 65535.0f / aabbExtent.y : 0.0f,
+            aabbExtent.z > 0.0f ? 65535.0f / aabbExtent.z : 0.0f);
+
+    std::vector<uint8_t> quantizedData(numVertices * 3 * sizeof(uint16_t));
+    uint16_t *quantizedPositions = (uint16_t*)&quantizedData.front();
+    float maxError = 0.0f;
+    #pragma omp parallel for reduction(max:maxError)
+    for (size_t i = 0; i < numVertices; i++) {
+        glm::vec3 normalizedPosition = glm::clamp((positions[i] - aabbMin) * scale, 0.0f, 65535.0f);
+        glm::vec3 decodedPosition = aabbMin;
+        for (int c = 0; c < 3; c++) {
+            uint16_t quantizedValue = uint16_t(std::round(normalizedPosition[c]));
+            quantizedPositions[i*3 + c] = quantizedValue;
+            decodedPosition[c] += quantizedValue / 65535.0f * aabbExtent[c];
+        }
+        maxError = std::max(maxError, glm::length(decodedPosition - positions[i]));
+    }
+
+    attribute.data = std::move(quantizedData);
+    attribute.attributeFormat = sgl::ATTRIB_UNSIGNED_SHORT;
+    attribute.numComponents = 3;
+    attribute.encoding = ATTRIBUTE_ENCODING_POSITION_UNORM16;
+    attribute.encodingParameters = {
+            aabbMin.x, aabbMin.y, aabbMin.z, aabbExtent.x, aabbExtent.y, aabbExtent.z
+    };
+
+    float aabbDiagonal = glm::length(aabbExtent);
+    errors.maxPositionError = std::max(errors.maxPositionError, maxError);
+    if (aabbDiagonal > 0.0f) {
+        errors.maxPositionErrorRelative = std::max(errors.maxPositionErrorRelative, maxError / aabbDiagonal);
+    }
+}
+
+template<typename T>
+static void quantizeDirectionAttribute(
+        BinaryMeshAttribute &attribute, BinaryMeshAttributeEncoding encoding, MeshQuantizationErrors &errors)
+{
+    const int maxValue = (1 << (sizeof(T) * 8 - 1)) - 1;
+    const glm::vec3 *directions = (const glm::vec3*)&attribute.data.front();
+    size_t numVertices = attribute.data.size() / sizeof(glm::vec3);
+
+    std::vector<uint8_t> quantizedData(numVertices * 2 * sizeof(T));
+    T *quantizedDirections = (T*)&quantizedData.front();
+    float maxErrorDegrees = 0.0f;
+    #pragma omp parallel for reduction(max:maxErrorDegrees)
+    for (size_t i = 0; i < numVertices; i++) {
+        float length = glm::length(directions[i]);
+        if (length <= 0.0f) {
+            // Degenerate vectors (e.g., tangents of single points) are decoded as (0, 0, 1).
+            quantizedDirections[i*2] = 0;
+            quantizedDirections[i*2+1] = 0;
+            continue;
+        }
+        glm::vec3 direction = directions[i] / length;
+        glm::ivec2 quantized = quantizeDirection(direction, maxValue);
+        quantizedDirections[i*2] = T(quantized.x);
+        quantizedDirections[i*2+1] = T(quantized.y);
+        glm::vec3 decodedDirection = octahedralDecode(glm::vec2(quantized) / float(maxValue));
+        maxErrorDegrees = std::max(maxErrorDegrees, computeAngleDegrees(direction, decodedDirection));
+    }
+
+    attribute.data = std::move(quantizedData);
+    attribute.attributeFormat = sizeof(T) == 1 ? sgl::ATTRIB_BYTE : sgl::ATTRIB_SHORT;
+    attribute.numComponents = 2;
+    attribute.encoding = encoding;
+    attribute.encodingParameters.clear();
+
+    errors.maxDirectionErrorDegrees = std::max(errors.maxDirectionErrorDegrees, maxErrorDegrees);
+}
+
+MeshQuantizationErrors quantizeBinaryMesh(BinaryMesh &mesh, const MeshQuantizationSettings &settings)
+{
+    MeshQuantizationErrors errors;
+    if (!settings.quantizePositions && !settings.quantizeDirections) {
+        return errors;
+    }
+
+    auto start = std::chrono::system_clock::now();
+
+    size_t sizeBeforeBytes = 0, sizeAfterBytes = 0;
+    for (BinarySubMesh &submesh : mesh.submeshes) {
+        for (BinaryMeshAttribute &attribute : submesh.attributes) {
+            if (attribute.encoding != ATTRIBUTE_ENCODING_NONE || attribute.attributeFormat != sgl::ATTRIB_FLOAT
+                    || attribute.numComponents != 3 || attribute.data.empty()) {
+                continue;
+            }
+
+            sizeBeforeBytes += attribute.data.size();
+            if (settings.quantizePositions && attribute.name == "vertexPosition") {
+                quantizePositionAttribute(attribute, errors);
+            } else if (settings.quantizeDirections && isDirectionAttribute(attribute)) {
+                if (settings.useDirections8Bit) {
+                    quantizeDirectionAttribute<int8_t>(attribute, ATTRIBUTE_ENCODING_OCTAHEDRAL_SNORM8, errors);
+                } else {
+                    quantizeDirectionAttribute<int16_t>(attribute, ATTRIBUTE_ENCODING_OCTAHEDRAL_SNORM16, errors);
+                }
+            }
+            sizeAfterBytes += attribute.data.size();
+        }
+    }
+
+    auto end = std::chrono::system_clock::now();
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+    sgl::Logfile::get()->writeInfo(std::string() + "Mesh quantization: "
+            + sgl::toString(sizeBeforeBytes / (1024.0 * 1024.0)) + " MiB -> "
+            + sgl::toString(sizeAfterBytes / (1024.0 * 1024.0)) + " MiB, max. position error: "
+            + sgl::toString(errors.maxPositionError) + " (relative to AABB diagonal: "
+            + sgl::toString(errors.maxPositionErrorRelative) + "), max. normal/tangent error: "
+            + sgl::toString(errors.maxDirectionErrorDegrees) + " degrees");
+    sgl::Logfile::get()->writeInfo(std::string() + "Computational time to quantize mesh: "
+            + std::to_string(elapsed.count()));
+
+    return errors;
+}
+
+
+void dequantizeBinaryMeshAttribute(BinaryMeshAttribute &attribute)
+{
+    if (attribute.encoding == ATTRIBUTE_ENCODING_NONE) {
+        return;
+    }
+
+    std::vector<uint8_t> decodedData;
+    if (attribute.encoding == ATTRIBUTE_ENCODING_POSITION_UNORM16) {
+        if (attribute.encodingParameters.size() != 6) {
+            sgl::Logfile::get()->writeError(std::string() + "Error in dequantizeBinaryMeshAttribute: Invalid "
+                    + "dequantization parameters for attribute \"" + attribute.name + "\".");
+            return;
+        }
+        const std::vector<float> &params = attribute.encodingParameters;
+        glm::vec3 aabbMin(params.at(0), params.at(1), params.at(2));
+        glm::vec3 scale = glm::vec3(params.at(3), params.at(4), params.at(5)) / 65535.0f;
+        const uint16_t *quantizedPositions = (const uint16_t*)&attribute.data.front();
+        size_t numVertices = attribute.data.size() / (3 * sizeof(uint16_t));
+        decodedData.resize(numVertices * sizeof(glm::vec3));
+        glm::vec3 *positions = (glm::vec3*)&decodedData.front();
+        #pragma omp parallel for
+        for (size_t i = 0; i < numVertices; i++) {
+            glm::vec3 quantized(quantizedPositions[i*3], quantizedPositions[i*3+1], quantizedPositions[i*3+2]);
+            positions[i] = aabbMin + quantized * scale;
+        }
+    } else if (attribute.encoding == ATTRIBUTE_ENCODING_OCTAHEDRAL_SNORM16
+            || attribute.encoding == ATTRIBUTE_ENCODING_OCTAHEDRAL_SNORM8) {
+        bool is8Bit = attribute.encoding == ATTRIBUTE_ENCODING_OCTAHEDRAL_SNORM8;
+        float maxValue = is8Bit ? 127.0f : 32767.0f;
+        size_t numVertices = attribute.data.size() / (2 * (is8Bit ? sizeof(int8_t) : sizeof(int16_t)));
+        decodedData.resize(numVertices * sizeof(glm::vec3));
+        glm::vec3 *directions = (glm::vec3*)&decodedData.front();
+        const int8_t *quantizedDirections8 = (const int8_t*)&attribute.data.front();
+        const int16_t *quantizedDirections16 = (const int16_t*)&attribute.data.front();
+        #pragma omp parallel for
+        for (size_t i = 0; i < numVertices; i++) {
+            glm::vec2 quantized = is8Bit
+                    ? glm::vec2(quantizedDirections8[i*2], quantizedDirections8[i*2+1])
+                    : glm::vec2(quantizedDirections16[i*2], quantizedDirections16[i*2+1]);
+            directions[i] = octahedralDecode(glm::max(quantized / maxValue, glm::vec2(-1.0f)));
+        }
+    } else {
+        sgl::Logfile::get()->writeError(std::string() + "Error in dequantizeBinaryMeshAttribute: Unknown encoding "
+                + "of attribute \"" + attribute.name + "\".");
+        return;
+    }
+
+    attribute.data = std::move(decodedData);
+    attribute.attributeFormat = sgl::ATTRIB_FLOAT;
+    attribute.numComponents = 3;
+    attribute.encoding = ATTRIBUTE_ENCODING_NONE;
+    attribute.encodingParameters.clear();
+}
+
+void dequantizeBinaryMesh(BinaryMesh &mesh)
+{
+    for (BinarySubMesh &submesh : mesh.submeshes) {
+        for (BinaryMeshAttribute &attribute : submesh.attributes) {
+            dequantizeBinaryMeshAttribute(attribute);
+        }
+    }
+}
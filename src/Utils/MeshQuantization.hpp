@@ -0,0 +1,64 @@
+//
+// Created by agent on 19.10.26.
+//
+
+#ifndef PIXELSYNCOIT_MESHQUANTIZATION_HPP
+#define PIXELSYNCOIT_MESHQUANTIZATION_HPP
+
+#include "MeshSerializer.hpp"
+
+class DerivedDataKey;
+
+/**
+ * Optional quantized encodings of the vertex attributes of binmesh files (applied by the converters before
+ * writeMesh3D, after optimizeBinaryMesh and buildMeshClusters):
+ *  - "vertexPosition": 3x16-bit relative to the AABB of the submesh (ATTRIBUTE_ENCODING_POSITION_UNORM16).
+ *  - "vertexNormal", "vertexLineNormal" and "vertexLineTangent": Octahedral encoding with 2x16-bit or 2x8-bit
+ *    (ATTRIBUTE_ENCODING_OCTAHEDRAL_SNORM16/8).
+ * The settings are read from the application settings ("meshQuantization-positions",
+ * "meshQuantization-directions" and "meshQuantization-directions8Bit"). By default, no attributes are quantized.
+ */
+struct MeshQuantizationSettings
+{
+    bool quantizePositions = false;
+    bool quantizeDirections = false;
+    bool useDirections8Bit = false;
+};
+
+/**
+ * The maximum errors introduced by the quantization of a mesh.
+ */
+struct MeshQuantizationErrors
+{
+    float maxPositionError = 0.0f; // Absolute (in world units)
+    float maxPositionErrorRelative = 0.0f; // Relative to the diagonal of the AABB of the submesh
+    float maxDirectionErrorDegrees = 0.0f; // Angle between original and decoded unit vector
+};
+
+MeshQuantizationSettings getMeshQuantizationSettings();
+
+/**
+ * Adds the quantization settings to the key of a binmesh artifact of the derived data cache.
+ */
+void addMeshQuantizationParameters(DerivedDataKey &key, const MeshQuantizationSettings &settings);
+
+/**
+ * Quantizes the positions, normals and tangents of all submeshes (in parallel over the vertices). The maximum errors
+ * are written to the log file and returned.
+ */
+MeshQuantizationErrors quantizeBinaryMesh(
+        BinaryMesh &mesh, const MeshQuantizationSettings &settings = getMeshQuantizationSettings());
+
+/**
+ * Decodes a quantized attribute back to 32-bit float vec3 data (no-op for ATTRIBUTE_ENCODING_NONE).
+ */
+void dequantizeBinaryMeshAttribute(BinaryMeshAttribute &attribute);
+
+/**
+ * Decodes all quantized attributes of the passed mesh. Needs to be called after readMesh3D by all code that
+ * accesses the attribute data directly on the CPU (e.g., the ray tracer). For rasterization, createMeshRenderer
+ * uploads the packed data and the vertex shaders decode it (see VertexAttributeDecoding.glsl).
+ */
+void dequantizeBinaryMesh(BinaryMesh &mesh);
+
+#endif //PIXELSYNCOIT_MESHQUANTIZATION_HPP
@@ -7,11 +7,13 @@
 
 #include <fstream>
 #include <algorithm>
-#include <random>
 #include <chrono>
 #include <cmath>
+#include <cfloat>
+#include <cstring>
 
 #include <boost/algorithm/string/predicate.hpp>
+#include <GL/glew.h>
 #include <glm/glm.hpp>
 
 #include <Utils/Events/Stream/Stream.hpp>
@@ -22,12 +24,90 @@
 #include <Graphics/Renderer.hpp>
 
 #include "ImportanceCriteria.hpp"
+#include "MeshQuantization.hpp"
+#include "ProgrammableFetchBuffers.hpp"
+#include "PointRendering/PointLod.hpp"
 #include "MeshSerializer.hpp"
 
 using namespace std;
 using namespace sgl;
 
-const uint32_t MESH_FORMAT_VERSION = 4u;
+/**
+ * Computes the bounding box of the vertex positions of a submesh. For quantized positions, the bounding box stored
+ * in the dequantization parameters is used.
+ */
+static void computeSubmeshBoundingBox(const BinarySubMesh &submesh, glm::vec3 &aabbMin, glm::vec3 &aabbMax)
+{
+    aabbMin = glm::vec3(0.0f);
+    aabbMax = glm::vec3(0.0f);
+    for (const BinaryMeshAttribute &attribute : submesh.attributes) {
+        if (attribute.name != "vertexPosition" || attribute.data.empty()) {
+            continue;
+        }
+        if (attribute.encoding == ATTRIBUTE_ENCODING_POSITION_UNORM16 && attribute.encodingParameters.size() == 6) {
+            const std::vector<float> &params = attribute.encodingParameters;
+            aabbMin = glm::vec3(params.at(0), params.at(1), params.at(2));
+            aabbMax = aabbMin + glm::vec3(params.at(3), params.at(4), params.at(5));
+        } else if (attribute.encoding == ATTRIBUTE_ENCODING_NONE && attribute.attributeFormat == ATTRIB_FLOAT
+                && attribute.numComponents == 3) {
+            const glm::vec3 *positions = (const glm::vec3*)&attribute.data.front();
+            size_t numVertices = attribute.data.size() / sizeof(glm::vec3);
+            float minX = FLT_MAX, minY = FLT_MAX, minZ = FLT_MAX;
+            float maxX = -FLT_MAX, maxY = -FLT_MAX, maxZ = -FLT_MAX;
+            #pragma omp parallel for reduction(min:minX,minY,minZ) reduction(max:maxX,maxY,maxZ)
+            for (size_t i = 0; i < numVertices; i++) {
+                minX = std::min(minX, positions[i].x);
+                minY = std::min(minY, positions[i].y);
+                minZ = std::min(minZ, positions[i].z);
+                maxX = std::max(maxX, positions[i].x);
+                maxY = std::max(maxY, positions[i].y);
+                maxZ = std::max(maxZ, positions[i].z);
+            }
+            aabbMin = glm::vec3(minX, minY, minZ);
+            aabbMax = glm::vec3(maxX, maxY, maxZ);
+        }
+        return;
+    }
+}
+
+template<typename T>
+static glm::vec2 computeValueRange(const T *values, size_t numValues, float scale)
+{
+    if (numValues == 0) {
+        return glm::vec2(0.0f);
+    }
+    T minValue = values[0], maxValue = values[0];
+    #pragma omp parallel for reduction(min:minValue) reduction(max:maxValue)
+    for (size_t i = 0; i < numValues; i++) {
+        minValue = std::min(minValue, values[i]);
+        maxValue = std::max(maxValue, values[i]);
+    }
+    return glm::vec2(float(minValue) * scale, float(maxValue) * scale);
+}
+
+/**
+ * Computes the minimum and maximum value of a single-component attribute (normalized integers are mapped to [0, 1]).
+ */
+static glm::vec2 computeAttributeValueRange(const BinaryMeshAttribute &attribute)
+{
+    if (attribute.numComponents != 1 || attribute.data.empty()) {
+        return glm::vec2(0.0f);
+    }
+    if (attribute.attributeFormat == ATTRIB_UNSIGNED_SHORT) {
+        return computeValueRange(
+                (const uint16_t*)&attribute.data.front(), attribute.data.size() / sizeof(uint16_t), 1.0f / 65535.0f);
+    } else if (attribute.attributeFormat == ATTRIB_UNSIGNED_BYTE) {
+        return computeValueRange(
+                (const uint8_t*)&attribute.data.front(), attribute.data.size(), 1.0f / 255.0f);
+    } else if (attribute.attributeFormat == ATTRIB_UNSIGNED_INT) {
+        return computeValueRange(
+                (const uint32_t*)&attribute.data.front(), attribute.data.size() / sizeof(uint32_t), 1.0f);
+    } else if (attribute.attributeFormat == ATTRIB_FLOAT) {
+        return computeValueRange(
+                (const float*)&attribute.data.front(), attribute.data.size() / sizeof(float), 1.0f);
+    }
+    return glm::vec2(0.0f);
+}
 
 void writeMesh3D(const std::string &filename, const BinaryMesh &mesh) {
 #ifndef __MINGW32__
@@ -52,6 +132,10 @@ void writeMesh3D(const std::string &filename, const BinaryMesh &mesh) {
         stream.write(submesh.material);
         stream.write((uint32_t)submesh.vertexMode);
         stream.writeArray(submesh.indices);
+        glm::vec3 aabbMin, aabbMax;
+        computeSubmeshBoundingBox(submesh, aabbMin, aabbMax);
+        stream.write(aabbMin);
+        stream.write(aabbMax);
 
         // Write attributes
         stream.write((uint32_t)submesh.attributes.size());
@@ -60,6 +144,9 @@ void writeMesh3D(const std::string &filename, const BinaryMesh &mesh) {
             stream.write((uint32_t)attribute.attributeFormat);
             stream.write((uint32_t)attribute.numComponents);
             stream.writeArray(attribute.data);
+            stream.write((uint32_t)attribute.encoding);
+            stream.writeArray(attribute.encodingParameters);
+            stream.write(computeAttributeValueRange(attribute));
         }
 
         // Write uniforms
@@ -70,6 +157,20 @@ void writeMesh3D(const std::string &filename, const BinaryMesh &mesh) {
             stream.write((uint32_t)uniform.numComponents);
             stream.writeArray(uniform.data);
         }
+
+        // Write clusters
+        stream.write((uint32_t)submesh.clusters.size());
+        for (const BinaryMeshCluster &cluster : submesh.clusters) {
+            stream.write(cluster.indexOffset);
+            stream.write(cluster.numIndices);
+            stream.write(cluster.aabbMin);
+            stream.write(cluster.aabbMax);
+            stream.write(cluster.sphereCenter);
+            stream.write(cluster.sphereRadius);
+            stream.write(cluster.coneAxis);
+            stream.write(cluster.coneCutoff);
+            stream.writeArray(cluster.attributeRanges);
+        }
     }
 
 #ifndef __MINGW32__
@@ -118,7 +219,7 @@ void readMesh3D(const std::string &filename, BinaryMesh &mesh) {
     sgl::BinaryReadStream stream(buffer, size);
     uint32_t version;
     stream.read(version);
-    if (version != MESH_FORMAT_VERSION) {
+    if (version > MESH_FORMAT_VERSION || version < 4u) {
         Logfile::get()->writeError(std::string() + "Error in readMesh3D: Invalid version in file \""
                 + filename + "\".");
         return;
@@ -135,6 +236,10 @@ void readMesh3D(const std::string &filename, BinaryMesh &mesh) {
         stream.read(vertexMode);
         submesh.vertexMode = (sgl::VertexMode)vertexMode;
         stream.readArray(mesh.submeshes.at(i).indices);
+        if (version >= 7u) {
+            stream.read(submesh.aabbMin);
+            stream.read(submesh.aabbMax);
+        }
 
         // Read attributes
         uint32_t numAttributes;
@@ -149,6 +254,17 @@ void readMesh3D(const std::string &filename, BinaryMesh &mesh) {
             attribute.attributeFormat = (sgl::VertexAttributeFormat)format;
             stream.read(attribute.numComponents);
             stream.readArray(attribute.data);
+            if (version >= 6u) {
+                uint32_t encoding;
+                stream.read(encoding);
+                attribute.encoding = (BinaryMeshAttributeEncoding)encoding;
+                stream.readArray(attribute.encodingParameters);
+            }
+            if (version >= 7u) {
+                stream.read(attribute.valueRange);
+            } else {
+                attribute.valueRange = computeAttributeValueRange(attribute);
+            }
         }
 
         // Read uniforms
@@ -165,6 +281,31 @@ void readMesh3D(const std::string &filename, BinaryMesh &mesh) {
             stream.read(uniform.numComponents);
             stream.readArray(uniform.data);
         }
+
+        if (version < 7u) {
+            computeSubmeshBoundingBox(submesh, submesh.aabbMin, submesh.aabbMax);
+        }
+
+        // Read clusters
+        if (version < 5u) {
+            continue;
+        }
+        uint32_t numClusters;
+        stream.read(numClusters);
+        submesh.clusters.resize(numClusters);
+
+        for (uint32_t j = 0; j < numClusters; j++) {
+            BinaryMeshCluster &cluster = submesh.clusters.at(j);
+            stream.read(cluster.indexOffset);
+            stream.read(cluster.numIndices);
+            stream.read(cluster.aabbMin);
+            stream.read(cluster.aabbMax);
+            stream.read(cluster.sphereCenter);
+            stream.read(cluster.sphereRadius);
+            stream.read(cluster.coneAxis);
+            stream.read(cluster.coneCutoff);
+            stream.readArray(cluster.attributeRanges);
+        }
     }
 
     //delete[] buffer; // BinaryReadStream does deallocation
@@ -185,6 +326,10 @@ void MeshRenderer::render(sgl::ShaderProgramPtr passShader, bool isGBufferPass,
         }
     }
 
+    if (useClusterCulling && hasClusters()) {
+        cullClusters(attributeIndex);
+    }
+
     for (size_t i = 0; i < shaderAttributes.size(); i++) {
         //ShaderProgram *shader = shaderAttributes.at(i)->getShaderProgram();
         if (!boost::starts_with(passShader->getShaderList().front()->getFileID(), "PseudoPhongVorticity")
@@ -206,139 +351,518 @@ void MeshRenderer::render(sgl::ShaderProgramPtr passShader, bool isGBufferPass,
                 passShader->setUniform("opacity", materials.at(i).opacity);
             }
         }
-        Renderer->render(shaderAttributes.at(i), passShader);
+        if (i < positionDequantization.size() && passShader->hasUniform("positionDequantizationMin")) {
+            passShader->setUniform("positionDequantizationMin", positionDequantization.at(i).aabbMin);
+            passShader->setUniform("positionDequantizationExtent", positionDequantization.at(i).aabbExtent);
+        }
+        if (useClusterCulling && i < submeshClusterData.size() && !submeshClusterData.at(i).clusters.empty()) {
+            SubmeshClusterData &clusterData = submeshClusterData.at(i);
+            if (clusterData.drawCounts.empty()) {
+                continue;
+            }
+            renderIndexRanges(shaderAttributes.at(i), passShader, clusterData.drawCounts, clusterData.drawOffsets);
+        } else if (i == pointLodSubmeshIndex && !pointLodChunks.empty()) {
+            // Level k consists of the chunks 0 to k (all chunks if no level is selected)
+            int lastChunk = int(pointLodChunks.size()) - 1;
+            if (pointLodLevel >= 0 && pointLodLevel < lastChunk) {
+                lastChunk = pointLodLevel;
+            }
+            for (int chunk = 0; chunk <= lastChunk; chunk++) {
+                if (pointLodChunks.at(chunk)) {
+                    Renderer->render(pointLodChunks.at(chunk), passShader);
+                }
+            }
+        } else {
+            Renderer->render(shaderAttributes.at(i), passShader);
+        }
     }
 }
 
-void MeshRenderer::setNewShader(sgl::ShaderProgramPtr newShader)
+/**
+ * Queries the binding point, the size and the member offsets of the uniform block "MatrixBlock" of the currently bound
+ * shader program (i.e., the layout the shader was compiled with).
+ */
+static MatrixBlockLayout queryMatrixBlockLayout()
 {
-    for (size_t i = 0; i < shaderAttributes.size(); i++) {
-        shaderAttributes.at(i) = shaderAttributes.at(i)->copy(newShader, false);
+    MatrixBlockLayout layout;
+    GLint shaderProgramID = 0;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &shaderProgramID);
+    GLuint blockIndex = glGetUniformBlockIndex(GLuint(shaderProgramID), "MatrixBlock");
+    if (blockIndex == GL_INVALID_INDEX) {
+        return layout;
     }
+    glGetActiveUniformBlockiv(GLuint(shaderProgramID), blockIndex, GL_UNIFORM_BLOCK_BINDING, &layout.bindingPoint);
+    glGetActiveUniformBlockiv(GLuint(shaderProgramID), blockIndex, GL_UNIFORM_BLOCK_DATA_SIZE, &layout.dataSize);
+
+    const GLchar *memberNames[4] = { "mMatrix", "vMatrix", "pMatrix", "mvpMatrix" };
+    GLuint memberIndices[4];
+    glGetUniformIndices(GLuint(shaderProgramID), 4, memberNames, memberIndices);
+    for (int i = 0; i < 4; i++) {
+        if (memberIndices[i] != GL_INVALID_INDEX) {
+            glGetActiveUniformsiv(GLuint(shaderProgramID), 1, &memberIndices[i], GL_UNIFORM_OFFSET,
+                    &layout.memberOffsets[i]);
+        }
+    }
+    return layout;
 }
 
+void MeshRenderer::renderIndexRanges(
+        ShaderAttributesPtr &renderData, ShaderProgramPtr &passShader,
+        const std::vector<int> &drawCounts, const std::vector<const void*> &drawOffsets)
+{
+    renderData->bind(passShader);
+
+    // The layout is taken from the shader when it is used for the first time.
+    auto layoutIt = matrixBlockLayouts.find(passShader);
+    if (layoutIt == matrixBlockLayouts.end()) {
+        layoutIt = matrixBlockLayouts.insert(std::make_pair(passShader, queryMatrixBlockLayout())).first;
+    }
+    const MatrixBlockLayout &layout = layoutIt->second;
+
+    if (layout.dataSize > 0) {
+        const glm::mat4 &modelMatrix = Renderer->getModelMatrix();
+        const glm::mat4 &viewMatrix = Renderer->getViewMatrix();
+        const glm::mat4 &projectionMatrix = Renderer->getProjectionMatrix();
+        const glm::mat4 matrices[4] = {
+                modelMatrix, viewMatrix, projectionMatrix, projectionMatrix * viewMatrix * modelMatrix };
+        bool isNewBufferSize = matrixBlockData.size() != size_t(layout.dataSize);
+        matrixBlockData.resize(size_t(layout.dataSize));
+        for (int i = 0; i < 4; i++) {
+            if (layout.memberOffsets[i] >= 0) {
+                memcpy(&matrixBlockData.at(layout.memberOffsets[i]), &matrices[i], sizeof(glm::mat4));
+            }
+        }
+        if (!matrixBlockBuffer || isNewBufferSize) {
+            matrixBlockBuffer = Renderer->createGeometryBuffer(
+                    matrixBlockData.size(), &matrixBlockData.front(), UNIFORM_BUFFER);
+        } else {
+            matrixBlockBuffer->subData(0, matrixBlockData.size(), &matrixBlockData.front());
+        }
+
+        // The matrix buffer of the renderer is queried once (it is created once by the renderer and stays bound).
+        if (!isRendererMatrixBlockBufferQueried) {
+            GLint rendererBuffer = 0;
+            glGetIntegeri_v(GL_UNIFORM_BUFFER_BINDING, GLuint(layout.bindingPoint), &rendererBuffer);
+            rendererMatrixBlockBuffer = uint32_t(rendererBuffer);
+            isRendererMatrixBlockBufferQueried = true;
+        }
+        ShaderManager->bindUniformBuffer(layout.bindingPoint, matrixBlockBuffer);
+    }
 
-sgl::AABB3 computeAABB(const std::vector<glm::vec3> &vertices)
+    glMultiDrawElements(
+            (GLenum)renderData->getVertexMode(), &drawCounts.front(), GL_UNSIGNED_INT,
+            &drawOffsets.front(), (GLsizei)drawCounts.size());
+
+    if (layout.dataSize > 0) {
+        glBindBufferBase(GL_UNIFORM_BUFFER, GLuint(layout.bindingPoint), GLuint(rendererMatrixBlockBuffer));
+    }
+}
+
+void MeshRenderer::setClusterCulling(
+        bool useClusterCulling, float boundsPadding, const std::vector<float> &opacityMap)
 {
-    if (vertices.size() < 1) {
-        Logfile::get()->writeError("computeAABB: vertices.size() < 1");
-        return sgl::AABB3();
+    this->useClusterCulling = useClusterCulling;
+    if (clusterBoundsPadding != boundsPadding) {
+        clusterBoundsPadding = boundsPadding;
+        cullingResultValid = false;
+    }
+    if (this->opacityMap == opacityMap) {
+        return;
     }
 
-    glm::vec3 minV = glm::vec3(FLT_MAX, FLT_MAX, FLT_MAX);
-    glm::vec3 maxV = glm::vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
-    for (const glm::vec3 &pt : vertices) {
-        minV.x = std::min(minV.x, pt.x);
-        minV.y = std::min(minV.y, pt.y);
-        minV.z = std::min(minV.z, pt.z);
-        maxV.x = std::max(maxV.x, pt.x);
-        maxV.y = std::max(maxV.y, pt.y);
-        maxV.z = std::max(maxV.z, pt.z);
+    this->opacityMap = opacityMap;
+    opacityMapNonZeroPrefixSum.resize(opacityMap.size() + 1);
+    opacityMapNonZeroPrefixSum.at(0) = 0;
+    for (size_t i = 0; i < opacityMap.size(); i++) {
+        opacityMapNonZeroPrefixSum.at(i+1) = opacityMapNonZeroPrefixSum.at(i) + (opacityMap.at(i) > 0.0f ? 1 : 0);
     }
+    cullingResultValid = false;
+}
 
-    return sgl::AABB3(minV, maxV);
+/**
+ * Returns the frustum planes (Gribb & Hartmann) of the passed model-view-projection matrix. The normals point inside.
+ */
+static void extractFrustumPlanes(const glm::mat4 &mvp, glm::vec4 planes[6])
+{
+    glm::vec4 rows[4];
+    for (int i = 0; i < 4; i++) {
+        rows[i] = glm::vec4(mvp[0][i], mvp[1][i], mvp[2][i], mvp[3][i]);
+    }
+    for (int i = 0; i < 3; i++) {
+        planes[i*2] = rows[3] + rows[i];
+        planes[i*2+1] = rows[3] - rows[i];
+    }
 }
 
-std::vector<uint32_t> shuffleIndicesLines(const std::vector<uint32_t> &indices) {
-    size_t numSegments = indices.size() / 2;
-    std::vector<size_t> shuffleOffsets;
-    for (size_t i = 0; i < numSegments; i++) {
-        shuffleOffsets.push_back(i);
+static bool isAABBOutsideFrustum(const glm::vec3 &aabbMin, const glm::vec3 &aabbMax, const glm::vec4 planes[6])
+{
+    for (int i = 0; i < 6; i++) {
+        const glm::vec4 &plane = planes[i];
+        // Test the corner of the AABB farthest in the direction of the plane normal
+        glm::vec3 positiveVertex(
+                plane.x >= 0.0f ? aabbMax.x : aabbMin.x,
+                plane.y >= 0.0f ? aabbMax.y : aabbMin.y,
+                plane.z >= 0.0f ? aabbMax.z : aabbMin.z);
+        if (glm::dot(glm::vec3(plane), positiveVertex) + plane.w < 0.0f) {
+            return true;
+        }
     }
-    auto rng = std::default_random_engine{};
-    rng.seed(std::chrono::system_clock::now().time_since_epoch().count());
-    std::shuffle(std::begin(shuffleOffsets), std::end(shuffleOffsets), rng);
+    return false;
+}
 
-    std::vector<uint32_t> shuffledIndices;
-    shuffledIndices.reserve(numSegments*2);
-    for (size_t i = 0; i < numSegments; i++) {
-        size_t lineIndex = shuffleOffsets.at(i);
-        shuffledIndices.push_back(indices.at(lineIndex*2));
-        shuffledIndices.push_back(indices.at(lineIndex*2+1));
+void MeshRenderer::cullClusters(int attributeIndex)
+{
+    glm::mat4 mvpMatrix = Renderer->getProjectionMatrix() * Renderer->getViewMatrix() * Renderer->getModelMatrix();
+    if (cullingResultValid && cullingMvpMatrix == mvpMatrix && cullingAttributeIndex == attributeIndex) {
+        // Multiple passes with the same matrices (e.g. gather pass of depth peeling): Reuse the last result.
+        for (SubmeshClusterData &clusterData : submeshClusterData) {
+            clusterCullingStatistics.numClusters += clusterData.clusters.size();
+            clusterCullingStatistics.numCulledClusters += clusterData.numCulledClusters;
+        }
+        return;
     }
 
-    return shuffledIndices;
+    auto startTime = std::chrono::system_clock::now();
+
+    glm::vec4 frustumPlanes[6];
+    extractFrustumPlanes(mvpMatrix, frustumPlanes);
+
+    // Transfer function opacity culling is only possible for a known attribute with a non-empty value range
+    std::string attributeName;
+    float minAttribute = 0.0f, maxAttribute = 0.0f;
+    if (!opacityMap.empty() && attributeIndex >= 0 && attributeIndex < int(importanceCriterionAttributes.size())) {
+        const ImportanceCriterionAttribute &attribute = importanceCriterionAttributes.at(attributeIndex);
+        if (attribute.maxAttribute > attribute.minAttribute) {
+            attributeName = attribute.name;
+            minAttribute = attribute.minAttribute;
+            maxAttribute = attribute.maxAttribute;
+        }
+    }
+    const int maxOpacityIndex = int(opacityMap.size()) - 1;
+
+    std::vector<uint8_t> clusterVisible;
+    const glm::vec3 boundsPadding(clusterBoundsPadding);
+    for (SubmeshClusterData &clusterData : submeshClusterData) {
+        const std::vector<BinaryMeshCluster> &clusters = clusterData.clusters;
+        int rangeIndex = -1;
+        if (!attributeName.empty()) {
+            auto it = std::find(
+                    clusterData.attributeRangeNames.begin(), clusterData.attributeRangeNames.end(), attributeName);
+            if (it != clusterData.attributeRangeNames.end()) {
+                rangeIndex = int(it - clusterData.attributeRangeNames.begin());
+            }
+        }
+
+        clusterVisible.resize(clusters.size());
+        #pragma omp parallel for
+        for (size_t clusterIdx = 0; clusterIdx < clusters.size(); clusterIdx++) {
+            const BinaryMeshCluster &cluster = clusters.at(clusterIdx);
+            bool visible = !isAABBOutsideFrustum(
+                    cluster.aabbMin - boundsPadding, cluster.aabbMax + boundsPadding, frustumPlanes);
+            if (visible && rangeIndex >= 0) {
+                // Same mapping as in the shaders. The range is expanded by one texel (filtering of the TF texture).
+                const glm::vec2 &attributeRange = cluster.attributeRanges.at(rangeIndex);
+                float t0 = glm::clamp((attributeRange.x - minAttribute) / (maxAttribute - minAttribute), 0.0f, 1.0f);
+                float t1 = glm::clamp((attributeRange.y - minAttribute) / (maxAttribute - minAttribute), 0.0f, 1.0f);
+                int idx0 = std::max(int(std::floor(t0 * maxOpacityIndex)) - 1, 0);
+                int idx1 = std::min(int(std::ceil(t1 * maxOpacityIndex)) + 1, maxOpacityIndex);
+                visible = opacityMapNonZeroPrefixSum.at(idx1 + 1) - opacityMapNonZeroPrefixSum.at(idx0) > 0;
+            }
+            clusterVisible.at(clusterIdx) = visible ? 1 : 0;
+        }
+
+        // Compact the visible clusters to index ranges for glMultiDrawElements
+        clusterData.drawCounts.clear();
+        clusterData.drawOffsets.clear();
+        clusterData.numCulledClusters = 0;
+        uint32_t rangeEnd = 0;
+        for (size_t clusterIdx = 0; clusterIdx < clusters.size(); clusterIdx++) {
+            const BinaryMeshCluster &cluster = clusters.at(clusterIdx);
+            if (!clusterVisible.at(clusterIdx)) {
+                clusterData.numCulledClusters++;
+                continue;
+            }
+            if (!clusterData.drawCounts.empty() && cluster.indexOffset == rangeEnd) {
+                clusterData.drawCounts.back() += int(cluster.numIndices);
+            } else {
+                clusterData.drawCounts.push_back(int(cluster.numIndices));
+                clusterData.drawOffsets.push_back((const void*)(size_t(cluster.indexOffset) * sizeof(uint32_t)));
+            }
+            rangeEnd = cluster.indexOffset + cluster.numIndices;
+        }
+
+        clusterCullingStatistics.numClusters += clusters.size();
+        clusterCullingStatistics.numCulledClusters += clusterData.numCulledClusters;
+    }
+
+    cullingResultValid = true;
+    cullingMvpMatrix = mvpMatrix;
+    cullingAttributeIndex = attributeIndex;
+
+    auto endTime = std::chrono::system_clock::now();
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(endTime - startTime);
+    clusterCullingStatistics.cullingTimeMS += elapsed.count() * 1e-3;
 }
 
-std::vector<uint32_t> shuffleLineOrder(const std::vector<uint32_t> &indices) {
-    size_t numSegments = indices.size() / 2;
+void MeshRenderer::setNewShader(sgl::ShaderProgramPtr newShader)
+{
+    matrixBlockLayouts.clear();
+    for (size_t i = 0; i < shaderAttributes.size(); i++) {
+        shaderAttributes.at(i) = shaderAttributes.at(i)->copy(newShader, false);
+    }
+    for (ShaderAttributesPtr &chunkRenderData : pointLodChunks) {
+        if (chunkRenderData) {
+            chunkRenderData = chunkRenderData->copy(newShader, false);
+        }
+    }
+}
 
-    // 1. Compute list of all lines
-    std::vector<std::vector<uint32_t>> lines;
-    std::vector<uint32_t> currentLine;
-    for (size_t i = 0; i < numSegments; i++) {
-        uint32_t idx0 = indices.at(i*2);
-        uint32_t idx1 = indices.at(i*2+1);
 
-        // Start new line?
-        if (i > 0 && idx0 != indices.at((i-1)*2+1)) {
-            lines.push_back(currentLine);
-            currentLine.clear();
+/**
+ * A pseudo-random permutation of [0, size) that can be evaluated independently for each index (and thus in parallel).
+ * A balanced Feistel network is a bijection on [0, 2^(2*halfBits)); indices outside of [0, size) are mapped again
+ * until they fall into the range (cycle walking). As the domain is smaller than 4*size, the expected number of
+ * evaluations is less than four. The same seed always results in the same permutation.
+ */
+class RandomPermutation
+{
+public:
+    RandomPermutation(uint64_t size, uint32_t seed) : size(size) {
+        int numBits = 0;
+        while ((uint64_t(1) << numBits) < size) {
+            numBits++;
         }
+        halfBits = std::max((numBits + 1) / 2, 1);
+        halfMask = (uint64_t(1) << halfBits) - 1;
+        for (int i = 0; i < NUM_ROUNDS; i++) {
+            roundKeys[i] = mixBits(uint64_t(seed) * NUM_ROUNDS + uint64_t(i) + 0x9E3779B97F4A7C15ull);
+        }
+    }
 
-        // Add indices to line
-        currentLine.push_back(idx0);
-        currentLine.push_back(idx1);
+    inline uint64_t operator()(uint64_t index) const {
+        do {
+            index = permuteDomain(index);
+        } while (index >= size);
+        return index;
     }
-    if (currentLine.size() > 0) {
-        lines.push_back(currentLine);
+
+private:
+    // Finalizer of SplitMix64
+    static inline uint64_t mixBits(uint64_t x) {
+        x ^= x >> 30;
+        x *= 0xBF58476D1CE4E5B9ull;
+        x ^= x >> 27;
+        x *= 0x94D049BB133111EBull;
+        x ^= x >> 31;
+        return x;
     }
 
-    // 2. Shuffle line list
-    auto rng = std::default_random_engine{};
-    rng.seed(std::chrono::system_clock::now().time_since_epoch().count());
-    std::shuffle(std::begin(lines), std::end(lines), rng);
+    inline uint64_t permuteDomain(uint64_t x) const {
+        uint64_t left = x >> halfBits;
+        uint64_t right = x & halfMask;
+        for (int i = 0; i < NUM_ROUNDS; i++) {
+            uint64_t newRight = left ^ (mixBits(right ^ roundKeys[i]) & halfMask);
+            left = right;
+            right = newRight;
+        }
+        return (left << halfBits) | right;
+    }
+
+    static const int NUM_ROUNDS = 4;
+    uint64_t size;
+    int halfBits;
+    uint64_t halfMask;
+    uint64_t roundKeys[NUM_ROUNDS];
+};
 
-    // 3. Reconstruct line list from shuffled lines
-    std::vector<uint32_t> shuffledIndices;
-    shuffledIndices.reserve(indices.size());
-    for (const std::vector<uint32_t> &line : lines) {
-        for (uint32_t idx : line) {
-            shuffledIndices.push_back(idx);
+/**
+ * Shuffles the order of the primitives (consisting of "indicesPerPrimitive" indices each) in the index buffer.
+ */
+std::vector<uint32_t> shufflePrimitives(const std::vector<uint32_t> &indices, size_t indicesPerPrimitive,
+        uint32_t seed) {
+    size_t numPrimitives = indices.size() / indicesPerPrimitive;
+    RandomPermutation permutation(numPrimitives, seed);
+
+    std::vector<uint32_t> shuffledIndices(numPrimitives * indicesPerPrimitive);
+    #pragma omp parallel for
+    for (size_t i = 0; i < numPrimitives; i++) {
+        size_t primitiveIndex = permutation(i);
+        for (size_t j = 0; j < indicesPerPrimitive; j++) {
+            shuffledIndices[i*indicesPerPrimitive + j] = indices[primitiveIndex*indicesPerPrimitive + j];
         }
     }
 
     return shuffledIndices;
 }
 
-std::vector<uint32_t> shuffleIndicesTriangles(const std::vector<uint32_t> &indices) {
-    size_t numSegments = indices.size() / 3;
-    std::vector<size_t> shuffleOffsets;
-    for (size_t i = 0; i < numSegments; i++) {
-        shuffleOffsets.push_back(i);
+std::vector<uint32_t> shuffleIndicesLines(const std::vector<uint32_t> &indices, uint32_t seed) {
+    return shufflePrimitives(indices, 2, seed);
+}
+
+std::vector<uint32_t> shuffleLineOrder(const std::vector<uint32_t> &indices, uint32_t seed) {
+    size_t numSegments = indices.size() / 2;
+    if (numSegments == 0) {
+        return std::vector<uint32_t>();
     }
-    auto rng = std::default_random_engine{};
-    rng.seed(std::chrono::system_clock::now().time_since_epoch().count());
-    std::shuffle(std::begin(shuffleOffsets), std::end(shuffleOffsets), rng);
 
-    std::vector<uint32_t> shuffledIndices;
-    shuffledIndices.reserve(numSegments*3);
+    // 1. Compute the line offsets (in segments): A new line starts where a segment isn't connected to its predecessor.
+    // lineIndices[i]: Index of the line segment i belongs to (inclusive prefix sum over the line start flags minus 1).
+    std::vector<uint32_t> lineIndices(numSegments);
+    #pragma omp parallel for
     for (size_t i = 0; i < numSegments; i++) {
-        size_t lineIndex = shuffleOffsets.at(i);
-        shuffledIndices.push_back(indices.at(lineIndex*3));
-        shuffledIndices.push_back(indices.at(lineIndex*3+1));
-        shuffledIndices.push_back(indices.at(lineIndex*3+2));
+        lineIndices[i] = (i == 0 || indices[i*2] != indices[(i-1)*2+1]) ? 1 : 0;
+    }
+    for (size_t i = 1; i < numSegments; i++) {
+        lineIndices[i] += lineIndices[i-1];
+    }
+    size_t numLines = lineIndices[numSegments-1];
+    std::vector<size_t> lineOffsets(numLines + 1);
+    lineOffsets[numLines] = numSegments;
+    #pragma omp parallel for
+    for (size_t i = 0; i < numSegments; i++) {
+        if (i == 0 || lineIndices[i] != lineIndices[i-1]) {
+            lineOffsets[lineIndices[i]-1] = i;
+        }
+    }
+
+    // 2. Shuffle the line list and compute the offsets of the lines in the shuffled index buffer.
+    RandomPermutation permutation(numLines, seed);
+    std::vector<size_t> shuffledLines(numLines);
+    #pragma omp parallel for
+    for (size_t i = 0; i < numLines; i++) {
+        shuffledLines[i] = permutation(i);
+    }
+    std::vector<size_t> shuffledLineOffsets(numLines);
+    size_t segmentOffset = 0;
+    for (size_t i = 0; i < numLines; i++) {
+        size_t lineIndex = shuffledLines[i];
+        shuffledLineOffsets[i] = segmentOffset;
+        segmentOffset += lineOffsets[lineIndex+1] - lineOffsets[lineIndex];
+    }
+
+    // 3. Scatter the segments of the lines to their new position.
+    std::vector<uint32_t> shuffledIndices(numSegments * 2);
+    #pragma omp parallel for schedule(dynamic, 256)
+    for (size_t i = 0; i < numLines; i++) {
+        size_t lineIndex = shuffledLines[i];
+        size_t srcOffset = lineOffsets[lineIndex] * 2;
+        size_t numLineIndices = (lineOffsets[lineIndex+1] - lineOffsets[lineIndex]) * 2;
+        std::copy(indices.begin() + srcOffset, indices.begin() + srcOffset + numLineIndices,
+                shuffledIndices.begin() + shuffledLineOffsets[i] * 2);
     }
 
     return shuffledIndices;
 }
 
+std::vector<uint32_t> shuffleIndicesTriangles(const std::vector<uint32_t> &indices, uint32_t seed) {
+    return shufflePrimitives(indices, 3, seed);
+}
+
 
-struct LinePointData
+/**
+ * Returns the position and tangent attribute data of a submesh (or nullptr if the submesh has no such attribute).
+ */
+static void getLineAttributePointers(
+        const BinarySubMesh &submesh, const glm::vec3 *&positions, const glm::vec3 *&tangents, size_t &numVertices)
 {
-    glm::vec3 vertexPosition;
-    float vertexAttribute;
-    glm::vec3 vertexTangent;
-    float padding;
-};
+    positions = nullptr;
+    tangents = nullptr;
+    numVertices = 0;
+    for (const BinaryMeshAttribute &meshAttribute : submesh.attributes) {
+        if (meshAttribute.numComponents != 3 || meshAttribute.data.empty()) {
+            continue;
+        }
+        if (meshAttribute.name == "vertexPosition") {
+            positions = (const glm::vec3*)&meshAttribute.data.front();
+            numVertices = meshAttribute.data.size() / sizeof(glm::vec3);
+        } else if (meshAttribute.name == "vertexLineTangent") {
+            tangents = (const glm::vec3*)&meshAttribute.data.front();
+        }
+    }
+}
 
 MeshRenderer parseMesh3D(const std::string &filename, sgl::ShaderProgramPtr shader, bool shuffleData,
-        bool useProgrammableFetch, bool programmableFetchUseAoS, float lineRadius)
+        bool useProgrammableFetch, ProgrammableFetchLayout programmableFetchLayout, float lineRadius,
+        uint32_t shuffleSeed)
 {
-    MeshRenderer meshRenderer(useProgrammableFetch);
+    auto startRead = std::chrono::system_clock::now();
+
     BinaryMesh mesh;
     readMesh3D(filename, mesh);
 
+    auto end = std::chrono::system_clock::now();
+    auto elapsedRead = std::chrono::duration_cast<std::chrono::milliseconds>(end - startRead);
+    Logfile::get()->writeInfo(std::string() + "Computational time to read binmesh: "
+            + std::to_string(elapsedRead.count()));
+
+    return createMeshRenderer(
+            mesh, shader, shuffleData, useProgrammableFetch, programmableFetchLayout, lineRadius, shuffleSeed);
+}
+
+static bool isDirectionAttribute(const BinaryMeshAttribute &meshAttribute)
+{
+    return meshAttribute.name == "vertexNormal" || meshAttribute.name == "vertexLineNormal"
+            || meshAttribute.name == "vertexLineTangent";
+}
+
+/**
+ * The vertex shaders decode either all or none of the positions (and directions) of a mesh. Returns false if the
+ * submeshes mix quantized and float attributes of one kind.
+ */
+static bool getVertexAttributeEncodings(
+        const BinaryMesh &mesh, bool &hasQuantizedPositions, bool &hasOctahedralDirections)
+{
+    int numPositions = 0, numQuantizedPositions = 0;
+    int numDirections = 0, numOctahedralDirections = 0;
+    for (const BinarySubMesh &submesh : mesh.submeshes) {
+        for (const BinaryMeshAttribute &meshAttribute : submesh.attributes) {
+            if (meshAttribute.name == "vertexPosition") {
+                numPositions++;
+                if (meshAttribute.encoding == ATTRIBUTE_ENCODING_POSITION_UNORM16) {
+                    numQuantizedPositions++;
+                }
+            } else if (isDirectionAttribute(meshAttribute)) {
+                numDirections++;
+                if (meshAttribute.encoding == ATTRIBUTE_ENCODING_OCTAHEDRAL_SNORM16
+                        || meshAttribute.encoding == ATTRIBUTE_ENCODING_OCTAHEDRAL_SNORM8) {
+                    numOctahedralDirections++;
+                }
+            }
+        }
+    }
+    hasQuantizedPositions = numQuantizedPositions > 0;
+    hasOctahedralDirections = numOctahedralDirections > 0;
+    return (numQuantizedPositions == 0 || numQuantizedPositions == numPositions)
+            && (numOctahedralDirections == 0 || numOctahedralDirections == numDirections);
+}
+
+MeshRenderer createMeshRenderer(const BinaryMesh &encodedMesh, sgl::ShaderProgramPtr shader, bool shuffleData,
+        bool useProgrammableFetch, ProgrammableFetchLayout programmableFetchLayout, float lineRadius,
+        uint32_t shuffleSeed)
+{
+    MeshRenderer meshRenderer(useProgrammableFetch);
+    if (shuffleData) {
+        Logfile::get()->writeInfo(std::string() + "createMeshRenderer: Shuffling the geometry with the seed "
+                + std::to_string(shuffleSeed) + ".");
+    }
+
+    auto startParse = std::chrono::system_clock::now();
+
+    // Quantized attributes are uploaded packed and decoded in the vertex shader. The SSBOs of programmable fetch
+    // store float vectors, so only in this case (or for inconsistent encodings) a decoded copy is created.
+    bool hasQuantizedPositions = false, hasOctahedralDirections = false;
+    bool isEncodingUniform = getVertexAttributeEncodings(encodedMesh, hasQuantizedPositions, hasOctahedralDirections);
+    BinaryMesh decodedMesh;
+    if ((hasQuantizedPositions || hasOctahedralDirections) && (useProgrammableFetch || !isEncodingUniform)) {
+        decodedMesh = encodedMesh;
+        dequantizeBinaryMesh(decodedMesh);
+        hasQuantizedPositions = false;
+        hasOctahedralDirections = false;
+    }
+    const BinaryMesh &mesh = decodedMesh.submeshes.empty() ? encodedMesh : decodedMesh;
+    meshRenderer.hasQuantizedPositions = hasQuantizedPositions;
+    meshRenderer.hasOctahedralDirections = hasOctahedralDirections;
+
     if (!shader) {
         shader = ShaderManager->getShaderProgram({"PseudoPhong.Vertex", "PseudoPhong.Fragment"});
     }
@@ -348,16 +872,25 @@ MeshRenderer parseMesh3D(const std::string &filename, sgl::ShaderProgramPtr shad
     shaderAttributes.reserve(mesh.submeshes.size());
     materials.reserve(mesh.submeshes.size());
 
-    // Bounding box of all submeshes combined
+    // Bounding box of all submeshes combined (the submesh bounding boxes are stored in the binmesh file)
     AABB3 totalBoundingBox(glm::vec3(FLT_MAX, FLT_MAX, FLT_MAX), glm::vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX));
 
     // Importance criterion attributes are bound to location 3 and onwards in vertex shader
     //int importanceCriterionLocationCounter = 3;
 
+    // Upload buffers reused by all attributes (line point data for programmable fetch, vec4 data for std430)
+    std::vector<LinePointData> linePointData;
+    std::vector<glm::vec4> vec4AttributeValues;
+    std::vector<float> sharedLinePointData;
+    std::vector<uint32_t> packedAttributeValues;
+
+    if (hasQuantizedPositions) {
+        meshRenderer.positionDequantization.resize(mesh.submeshes.size());
+    }
 
     // Iterate over all submeshes and create rendering data
     for (size_t i = 0; i < mesh.submeshes.size(); i++) {
-        BinarySubMesh &submesh = mesh.submeshes.at(i);
+        const BinarySubMesh &submesh = mesh.submeshes.at(i);
         ShaderAttributesPtr renderData = ShaderManager->createShaderAttributes(shader);
         if (!useProgrammableFetch) {
             renderData->setVertexMode(submesh.vertexMode);
@@ -365,17 +898,33 @@ MeshRenderer parseMesh3D(const std::string &filename, sgl::ShaderProgramPtr shad
             renderData->setVertexMode(VERTEX_MODE_TRIANGLES);
         }
 
+        // Point data sets with a LOD hierarchy are uploaded in one chunk per level (see MeshRenderer::pointLodChunks).
+        std::vector<PointLodLevel> lodLevels;
+        std::vector<ShaderAttributesPtr> lodChunks;
+        if (submesh.vertexMode == VERTEX_MODE_POINTS && !useProgrammableFetch && meshRenderer.pointLodLevels.empty()) {
+            lodLevels = readPointLodLevels(submesh);
+            if (!lodLevels.empty() && lodLevels.back().numPoints == 0) {
+                lodLevels.clear();
+            }
+            for (size_t k = 0; k < lodLevels.size(); k++) {
+                uint32_t chunkBegin = k == 0 ? 0 : lodLevels.at(k-1).numPoints;
+                ShaderAttributesPtr chunkRenderData;
+                if (lodLevels.at(k).numPoints > chunkBegin) {
+                    chunkRenderData = ShaderManager->createShaderAttributes(shader);
+                    chunkRenderData->setVertexMode(VERTEX_MODE_POINTS);
+                }
+                lodChunks.push_back(chunkRenderData);
+            }
+        }
+
         if (submesh.indices.size() > 0 && !useProgrammableFetch) {
             if (shuffleData && (submesh.vertexMode == VERTEX_MODE_LINES || submesh.vertexMode == VERTEX_MODE_TRIANGLES)) {
                 std::vector<uint32_t> shuffledIndices;
                 if (submesh.vertexMode == VERTEX_MODE_LINES) {
-                    //shuffledIndices = shuffleIndicesLines(submesh.indices);
-                    shuffledIndices = shuffleLineOrder(submesh.indices);
-                } else if (submesh.vertexMode == VERTEX_MODE_TRIANGLES) {
-                    shuffledIndices = shuffleIndicesTriangles(submesh.indices);
+                    //shuffledIndices = shuffleIndicesLines(submesh.indices, shuffleSeed);
+                    shuffledIndices = shuffleLineOrder(submesh.indices, shuffleSeed);
                 } else {
-                    Logfile::get()->writeError("ERROR in parseMesh3D: shuffleData and unsupported vertex mode!");
-                    shuffledIndices = submesh.indices;
+                    shuffledIndices = shuffleIndicesTriangles(submesh.indices, shuffleSeed);
                 }
                 GeometryBufferPtr indexBuffer = Renderer->createGeometryBuffer(
                         sizeof(uint32_t)*shuffledIndices.size(), (void*)&shuffledIndices.front(), INDEX_BUFFER);
@@ -387,174 +936,217 @@ MeshRenderer parseMesh3D(const std::string &filename, sgl::ShaderProgramPtr shad
             }
         }
         if (submesh.indices.size() > 0 && useProgrammableFetch) {
-            // Modify indices
-            std::vector<uint32_t> fetchIndices;
-            fetchIndices.reserve(submesh.indices.size()*3);
-            // Iterate over all line segments
-            for (size_t i = 0; i < submesh.indices.size(); i += 2) {
-                uint32_t base0 = submesh.indices.at(i)*2;
-                uint32_t base1 = submesh.indices.at(i+1)*2;
+            // Modify indices: Each line segment is expanded to a quad (two vertices per line point)
+            size_t numSegments = submesh.indices.size() / 2;
+            std::vector<uint32_t> fetchIndices(numSegments * 6);
+            #pragma omp parallel for
+            for (size_t j = 0; j < numSegments; j++) {
+                uint32_t base0 = submesh.indices[j*2]*2;
+                uint32_t base1 = submesh.indices[j*2+1]*2;
                 // 0,2,3,0,3,1
-                fetchIndices.push_back(base0);
-                fetchIndices.push_back(base1);
-                fetchIndices.push_back(base1+1);
-                fetchIndices.push_back(base0);
-                fetchIndices.push_back(base1+1);
-                fetchIndices.push_back(base0+1);
+                fetchIndices[j*6] = base0;
+                fetchIndices[j*6+1] = base1;
+                fetchIndices[j*6+2] = base1+1;
+                fetchIndices[j*6+3] = base0;
+                fetchIndices[j*6+4] = base1+1;
+                fetchIndices[j*6+5] = base0+1;
             }
             GeometryBufferPtr indexBuffer = Renderer->createGeometryBuffer(
                     sizeof(uint32_t)*fetchIndices.size(), (void*)&fetchIndices.front(), INDEX_BUFFER);
             renderData->setIndexGeometryBuffer(indexBuffer, ATTRIB_UNSIGNED_INT);
         }
 
-        // For programmableFetchUseAoS
-        std::vector<glm::vec3> vertexPositionData;
-        std::vector<std::vector<float>> vertexAttributeData;
-        std::vector<glm::vec3> vertexTangentData;
+        // For the AoS and shared layout: The line point data is interleaved directly from the attribute data.
+        const glm::vec3 *vertexPositions = nullptr;
+        const glm::vec3 *vertexTangents = nullptr;
+        size_t numLinePoints = 0;
+        bool useSoA = useProgrammableFetch && programmableFetchLayout == PROGRAMMABLE_FETCH_LAYOUT_SOA;
+        bool useAoS = useProgrammableFetch && programmableFetchLayout == PROGRAMMABLE_FETCH_LAYOUT_AOS;
+        bool useShared = useProgrammableFetch && programmableFetchLayout == PROGRAMMABLE_FETCH_LAYOUT_SHARED;
+        if (useAoS || useShared) {
+            getLineAttributePointers(submesh, vertexPositions, vertexTangents, numLinePoints);
+            if (vertexPositions == nullptr || vertexTangents == nullptr) {
+                Logfile::get()->writeError(std::string() + "Error in createMeshRenderer: Programmable fetch needs "
+                        + "the attributes \"vertexPosition\" and \"vertexLineTangent\" (submesh "
+                        + std::to_string(i) + ").");
+                useAoS = false;
+                useShared = false;
+            }
+        }
+        if (useShared) {
+            // Positions and tangents are stored only once for all importance criteria
+            buildSharedLinePointBuffer(vertexPositions, vertexTangents, numLinePoints, sharedLinePointData);
+            GeometryBufferPtr linePointBuffer = Renderer->createGeometryBuffer(
+                    sharedLinePointData.size()*sizeof(float), (void*)&sharedLinePointData.front(),
+                    SHADER_STORAGE_BUFFER);
+            meshRenderer.ssboEntries.push_back(SSBOEntry(2, "vertexPositionTangent", linePointBuffer));
+        }
 
+        bool hasPositions = false;
+        std::vector<std::string> scalarAttributeNames;
         for (size_t j = 0; j < submesh.attributes.size(); j++) {
-            BinaryMeshAttribute &meshAttribute = submesh.attributes.at(j);
+            const BinaryMeshAttribute &meshAttribute = submesh.attributes.at(j);
             GeometryBufferPtr attributeBuffer;
+            if (meshAttribute.data.empty()) {
+                continue;
+            }
+            if (meshAttribute.name == "vertexPosition") {
+                hasPositions = true;
+                if (meshAttribute.encoding == ATTRIBUTE_ENCODING_POSITION_UNORM16) {
+                    const std::vector<float> &params = meshAttribute.encodingParameters;
+                    PositionDequantization &positionDequantization = meshRenderer.positionDequantization.at(i);
+                    if (params.size() == 6) {
+                        positionDequantization.aabbMin = glm::vec3(params.at(0), params.at(1), params.at(2));
+                        positionDequantization.aabbExtent = glm::vec3(params.at(3), params.at(4), params.at(5));
+                    } else {
+                        Logfile::get()->writeError(std::string() + "Error in createMeshRenderer: Invalid "
+                                + "dequantization parameters of the positions (submesh " + std::to_string(i) + ").");
+                    }
+                }
+            }
 
             // Assume only one component means importance criterion like vorticity, line width, ...
             if (meshAttribute.numComponents == 1) {
+                scalarAttributeNames.push_back(meshAttribute.name);
                 ImportanceCriterionAttribute importanceCriterionAttribute;
                 importanceCriterionAttribute.name = meshAttribute.name;
+                // The value range is stored in the binmesh file (for unorm values: in [0, 1]).
+                importanceCriterionAttribute.minAttribute = meshAttribute.valueRange.x;
+                importanceCriterionAttribute.maxAttribute = meshAttribute.valueRange.y;
 
-                // Copy values to mesh renderer data structure
-                uint16_t *attributeValuesUnorm = (uint16_t*)&meshAttribute.data.front();
+                // Unpack the values to the mesh renderer data structure. For AoS programmable fetch, the line point
+                // data is written in the same pass.
+                const uint16_t *attributeValuesUnorm = (const uint16_t*)&meshAttribute.data.front();
                 size_t numAttributeValues = meshAttribute.data.size() / sizeof(uint16_t);
-                unpackUnorm16Array(attributeValuesUnorm, numAttributeValues, importanceCriterionAttribute.attributes);
-
-                // Compute minimum and maximum value
-                float minValue = FLT_MAX, maxValue = 0.0f;
-                #pragma omp parallel for reduction(min:minValue) reduction(max:maxValue)
-                for (size_t k = 0; k < numAttributeValues; k++) {
-                    minValue = std::min(minValue, importanceCriterionAttribute.attributes[k]);
-                    maxValue = std::max(maxValue, importanceCriterionAttribute.attributes[k]);
+                std::vector<float> &attributeValues = importanceCriterionAttribute.attributes;
+                if (useAoS && numAttributeValues != numLinePoints) {
+                    Logfile::get()->writeError(std::string() + "Error in createMeshRenderer: The number of values "
+                            + "of the attribute \"" + meshAttribute.name + "\" doesn't match the number of vertices.");
+                    useAoS = false;
+                }
+                if (useAoS) {
+                    unpackUnorm16Attribute(
+                            attributeValuesUnorm, numAttributeValues, attributeValues,
+                            vertexPositions, vertexTangents, &linePointData);
+                    GeometryBufferPtr linePointBuffer = Renderer->createGeometryBuffer(
+                            linePointData.size()*sizeof(LinePointData), (void*)&linePointData.front(),
+                            SHADER_STORAGE_BUFFER);
+                    meshRenderer.ssboEntries.push_back(SSBOEntry(2, meshAttribute.name, linePointBuffer));
+                } else {
+                    unpackUnorm16Attribute(attributeValuesUnorm, numAttributeValues, attributeValues);
                 }
-                importanceCriterionAttribute.minAttribute = minValue;
-                importanceCriterionAttribute.maxAttribute = maxValue;
-
-                meshRenderer.importanceCriterionAttributes.push_back(importanceCriterionAttribute);
 
                 // SSBOs can't directly perform process uint16_t -> float :(
-                if (useProgrammableFetch && !programmableFetchUseAoS) {
+                if (useSoA) {
                     attributeBuffer = Renderer->createGeometryBuffer(
-                            numAttributeValues*sizeof(float), (void*)&importanceCriterionAttribute.attributes.front(),
+                            numAttributeValues*sizeof(float), (void*)&attributeValues.front(),
                             SHADER_STORAGE_BUFFER);
-                } else if (useProgrammableFetch) {
-                    int attributeIndex = sgl::fromString<int>(meshAttribute.name.substr(15));
-                    if (attributeIndex >= vertexAttributeData.size()) {
-                        vertexAttributeData.resize(attributeIndex+1);
-                    }
-                    vertexAttributeData.at(attributeIndex).resize(numAttributeValues);
-                    for (size_t k = 0; k < numAttributeValues; k++) {
-                        vertexAttributeData.at(attributeIndex).at(k) = importanceCriterionAttribute.attributes[k];
-                    }
+                } else if (useShared) {
+                    // ... but the shader can unpack two 16-bit values from an uint.
+                    buildPackedUnorm16AttributeBuffer(attributeValuesUnorm, numAttributeValues, packedAttributeValues);
+                    attributeBuffer = Renderer->createGeometryBuffer(
+                            packedAttributeValues.size()*sizeof(uint32_t), (void*)&packedAttributeValues.front(),
+                            SHADER_STORAGE_BUFFER);
+                    meshRenderer.ssboEntries.push_back(SSBOEntry(4, meshAttribute.name, attributeBuffer));
                 }
+
+                meshRenderer.importanceCriterionAttributes.push_back(std::move(importanceCriterionAttribute));
             }
 
             BufferType bufferType = useProgrammableFetch ? SHADER_STORAGE_BUFFER : VERTEX_BUFFER;
 
-            if (!(useProgrammableFetch && programmableFetchUseAoS)
-                && !(meshAttribute.numComponents == 1 && useProgrammableFetch)
-                && !(meshAttribute.numComponents == 3 && useProgrammableFetch)) {
+            if (!useProgrammableFetch && lodChunks.empty()) {
                 attributeBuffer = Renderer->createGeometryBuffer(
                         meshAttribute.data.size(), (void*)&meshAttribute.data.front(), bufferType);
-            }
-            if (meshAttribute.numComponents == 3 && (useProgrammableFetch && !programmableFetchUseAoS)) {
+            } else if (useSoA && meshAttribute.numComponents == 3) {
                 // vec3 problematic in std430 struct
-                glm::vec3 *attributeValues = (glm::vec3*)&meshAttribute.data.front();
+                const glm::vec3 *attributeValues = (const glm::vec3*)&meshAttribute.data.front();
                 size_t numAttributeValues = meshAttribute.data.size() / sizeof(glm::vec3);
-                std::vector<glm::vec4> vec4AttributeValues;
-                vec4AttributeValues.reserve(numAttributeValues);
-                for (size_t i = 0; i < numAttributeValues; i++) {
-                    glm::vec3 vec3Value = attributeValues[i];
-                    vec4AttributeValues.push_back(glm::vec4(vec3Value.x, vec3Value.y, vec3Value.z, 1.0f));
+                vec4AttributeValues.resize(numAttributeValues);
+                #pragma omp parallel for
+                for (size_t k = 0; k < numAttributeValues; k++) {
+                    vec4AttributeValues[k] = glm::vec4(attributeValues[k], 1.0f);
                 }
                 attributeBuffer = Renderer->createGeometryBuffer(
                         vec4AttributeValues.size()*sizeof(glm::vec4), (void*)&vec4AttributeValues.front(), bufferType);
+            } else if (useSoA && meshAttribute.numComponents != 1) {
+                attributeBuffer = Renderer->createGeometryBuffer(
+                        meshAttribute.data.size(), (void*)&meshAttribute.data.front(), bufferType);
             }
 
             if (!useProgrammableFetch) {
-                if (meshAttribute.numComponents == 1) {
-                    // Importance criterion attributes are bound to location 3 and onwards in vertex shader
-                    renderData->addGeometryBufferOptional(
-                            attributeBuffer, meshAttribute.name.c_str(), meshAttribute.attributeFormat,
-                            meshAttribute.numComponents, 0, 0, 0, ATTRIB_CONVERSION_FLOAT_NORMALIZED);
-                } else {
-                    bool isNormalizedColor = (meshAttribute.name == "vertexColor");
+                // Importance criterion attributes (one component) are bound to location 3 and onwards in vertex shader
+                // Quantized positions and octahedral directions are mapped to [0, 1] and [-1, 1], respectively.
+                bool isNormalized = meshAttribute.numComponents == 1 || meshAttribute.name == "vertexColor"
+                        || meshAttribute.encoding != ATTRIBUTE_ENCODING_NONE;
+                if (lodChunks.empty()) {
                     renderData->addGeometryBufferOptional(
                             attributeBuffer, meshAttribute.name.c_str(), meshAttribute.attributeFormat,
                             meshAttribute.numComponents, 0, 0, 0,
-                            isNormalizedColor ? ATTRIB_CONVERSION_FLOAT_NORMALIZED : ATTRIB_CONVERSION_FLOAT);
-                }
-                meshRenderer.shaderAttributeNames.insert(meshAttribute.name);
-            } else {
-                if (programmableFetchUseAoS) {
-                    if (meshAttribute.name == "vertexPosition") {
-                        glm::vec3 *attributeValues = (glm::vec3*)&meshAttribute.data.front();
-                        size_t numAttributeValues = meshAttribute.data.size() / sizeof(glm::vec3);
-                        vertexPositionData.reserve(numAttributeValues);
-                        for (size_t i = 0; i < numAttributeValues; i++) {
-                            vertexPositionData.push_back(attributeValues[i]);
-                        }
-                    } else if (meshAttribute.name == "vertexLineTangent") {
-                        glm::vec3 *attributeValues = (glm::vec3*)&meshAttribute.data.front();
-                        size_t numAttributeValues = meshAttribute.data.size() / sizeof(glm::vec3);
-                        vertexTangentData.reserve(numAttributeValues);
-                        for (size_t i = 0; i < numAttributeValues; i++) {
-                            vertexTangentData.push_back(attributeValues[i]);
-                        }
-                    }
+                            isNormalized ? ATTRIB_CONVERSION_FLOAT_NORMALIZED : ATTRIB_CONVERSION_FLOAT);
                 } else {
-                    int bindingPoint = -1;
-                    if (meshAttribute.name == "vertexPosition") {
-                        bindingPoint = 2;
-                    } else if (meshAttribute.name == "vertexLineTangent") {
-                        bindingPoint = 3;
-                    } else if (boost::starts_with(meshAttribute.name, "vertexAttribute")) {
-                        bindingPoint = 4;
+                    size_t bytesPerPoint = meshAttribute.data.size() / lodLevels.back().numPoints;
+                    for (size_t k = 0; k < lodChunks.size(); k++) {
+                        if (!lodChunks.at(k)) {
+                            continue;
+                        }
+                        size_t chunkBegin = k == 0 ? 0 : lodLevels.at(k-1).numPoints;
+                        size_t chunkEnd = lodLevels.at(k).numPoints;
+                        GeometryBufferPtr chunkBuffer = Renderer->createGeometryBuffer(
+                                (chunkEnd - chunkBegin) * bytesPerPoint,
+                                (void*)&meshAttribute.data.at(chunkBegin * bytesPerPoint), bufferType);
+                        lodChunks.at(k)->addGeometryBufferOptional(
+                                chunkBuffer, meshAttribute.name.c_str(), meshAttribute.attributeFormat,
+                                meshAttribute.numComponents, 0, 0, 0,
+                                isNormalized ? ATTRIB_CONVERSION_FLOAT_NORMALIZED : ATTRIB_CONVERSION_FLOAT);
                     }
-                    meshRenderer.ssboEntries.push_back(SSBOEntry(bindingPoint, meshAttribute.name, attributeBuffer));
                 }
-            }
-
-            if (meshAttribute.name == "vertexPosition") {
-                std::vector<glm::vec3> vertices;
-                vertices.resize(meshAttribute.data.size() / sizeof(glm::vec3));
-                memcpy(&vertices.front(), &meshAttribute.data.front(), meshAttribute.data.size());
-                totalBoundingBox.combine(computeAABB(vertices));
+                meshRenderer.shaderAttributeNames.insert(meshAttribute.name);
+            } else if (useSoA) {
+                int bindingPoint = -1;
+                if (meshAttribute.name == "vertexPosition") {
+                    bindingPoint = 2;
+                } else if (meshAttribute.name == "vertexLineTangent") {
+                    bindingPoint = 3;
+                } else if (boost::starts_with(meshAttribute.name, "vertexAttribute")) {
+                    bindingPoint = 4;
+                }
+                meshRenderer.ssboEntries.push_back(SSBOEntry(bindingPoint, meshAttribute.name, attributeBuffer));
             }
         }
 
-        if (useProgrammableFetch && programmableFetchUseAoS) {
-            for (size_t attributeIndex = 0; attributeIndex < vertexAttributeData.size(); attributeIndex++) {
-                std::vector<LinePointData> linePointData;
-                linePointData.resize(vertexPositionData.size());
-
-                for (size_t i = 0; i < vertexPositionData.size(); i++) {
-                    linePointData.at(i).vertexPosition = vertexPositionData.at(i);
-                    linePointData.at(i).vertexAttribute = vertexAttributeData.at(attributeIndex).at(i);
-                    linePointData.at(i).vertexTangent = vertexTangentData.at(i);
-                    linePointData.at(i).padding = 0.0f;
-                }
+        if (hasPositions) {
+            totalBoundingBox.combine(AABB3(submesh.aabbMin, submesh.aabbMax));
+        }
 
-                GeometryBufferPtr attributeBuffer = Renderer->createGeometryBuffer(
-                        linePointData.size()*sizeof(LinePointData), (void*)&linePointData.front(),
-                        SHADER_STORAGE_BUFFER);
-                meshRenderer.ssboEntries.push_back(SSBOEntry(2, "vertexAttribute" + sgl::toString(attributeIndex),
-                        attributeBuffer));
+        // The clusters reference the original index buffer (i.e., no shuffling or programmable fetch indices).
+        if (!submesh.clusters.empty() && !shuffleData && !useProgrammableFetch
+                && (submesh.vertexMode == VERTEX_MODE_LINES || submesh.vertexMode == VERTEX_MODE_TRIANGLES)) {
+            if (meshRenderer.submeshClusterData.empty()) {
+                meshRenderer.submeshClusterData.resize(mesh.submeshes.size());
             }
+            SubmeshClusterData &clusterData = meshRenderer.submeshClusterData.at(i);
+            clusterData.clusters = submesh.clusters;
+            clusterData.attributeRangeNames = std::move(scalarAttributeNames);
+        }
+
+        if (!lodLevels.empty()) {
+            meshRenderer.pointLodLevels = std::move(lodLevels);
+            meshRenderer.pointLodChunks = std::move(lodChunks);
+            meshRenderer.pointLodSubmeshIndex = i;
         }
 
         shaderAttributes.push_back(renderData);
-        materials.push_back(mesh.submeshes.at(i).material);
+        materials.push_back(submesh.material);
     }
 
     meshRenderer.boundingBox = totalBoundingBox;
     meshRenderer.boundingSphere = sgl::Sphere(totalBoundingBox.getCenter(), glm::length(totalBoundingBox.getExtent()));
 
+    auto end = std::chrono::system_clock::now();
+    auto elapsedParse = std::chrono::duration_cast<std::chrono::milliseconds>(end - startParse);
+    Logfile::get()->writeInfo(std::string() + "Computational time to create mesh render data: "
+            + std::to_string(elapsedParse.count()));
+
     return meshRenderer;
 }
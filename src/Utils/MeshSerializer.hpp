@@ -11,11 +11,14 @@
 #include <glm/glm.hpp>
 #include <vector>
 #include <set>
+#include <map>
 
 #include <Math/Geometry/AABB3.hpp>
 #include <Math/Geometry/Sphere.hpp>
 #include <Graphics/Shader/ShaderAttributes.hpp>
 
+#include "ProgrammableFetchBuffers.hpp"
+
 /**
  * Parsing text-based mesh files, like .obj files, is really slow compared to binary formats.
  * The utility functions below serialize 3D mesh data to a file/read the data back from such a file.
@@ -68,14 +71,44 @@ struct ObjMesh
  *    The number of vertices can be explicitly computed by "data.size() / numComponents / dataFormatNumBytes".
  *
  * A uniform attribute is an attribute constant over all vertices.
+ *
+ * Optionally, a submesh can be partitioned into clusters of spatially coherent primitives (see MeshClustering.hpp),
+ * which store their bounds for culling.
+ *
+ * Positions, normals and tangents can optionally be stored in a quantized encoding (see MeshQuantization.hpp).
+ * In this case, attributeFormat and numComponents describe the encoded data.
  */
 
+/**
+ * New in version 5: Per-submesh clusters.
+ * New in version 6: Attribute encodings.
+ * New in version 7: Submesh bounding boxes and attribute value ranges (computed on load for version 4-6 files).
+ */
+const uint32_t MESH_FORMAT_VERSION = 7u;
+
+enum BinaryMeshAttributeEncoding
+{
+    // Stored as is
+    ATTRIBUTE_ENCODING_NONE = 0,
+    // 3x16-bit unsigned normalized positions relative to the AABB of the submesh.
+    // encodingParameters: AABB minimum (3 floats), AABB extent (3 floats).
+    ATTRIBUTE_ENCODING_POSITION_UNORM16,
+    // Unit vectors in octahedral encoding with 2x16-bit or 2x8-bit signed normalized components
+    ATTRIBUTE_ENCODING_OCTAHEDRAL_SNORM16,
+    ATTRIBUTE_ENCODING_OCTAHEDRAL_SNORM8
+};
+
 struct BinaryMeshAttribute
 {
     std::string name; // e.g. "vertexPosition"
     sgl::VertexAttributeFormat attributeFormat;
     uint32_t numComponents;
     std::vector<uint8_t> data;
+    BinaryMeshAttributeEncoding encoding = ATTRIBUTE_ENCODING_NONE;
+    std::vector<float> encodingParameters; // Dequantization parameters (see BinaryMeshAttributeEncoding)
+    // Minimum and maximum value of single-component attributes (normalized integers are mapped to [0, 1]).
+    // Computed by writeMesh3D, so that loading the mesh needs no pass over the data.
+    glm::vec2 valueRange = glm::vec2(0.0f);
 };
 
 struct BinaryMeshUniform
@@ -86,6 +119,28 @@ struct BinaryMeshUniform
     std::vector<uint8_t> data;
 };
 
+/**
+ * A cluster of primitives of a submesh, i.e., the index range [indexOffset, indexOffset + numIndices).
+ *  - The normal cone contains all face normals of the cluster. Like in meshoptimizer, "coneCutoff" is the sine of
+ *    the cone half angle, and all triangles are back-facing for a camera at position "p" if
+ *    dot(sphereCenter - p, coneAxis) >= coneCutoff * length(sphereCenter - p) + sphereRadius.
+ *    coneCutoff = 1 means that the cluster can't be culled (e.g., for lines or normals spread over >= 180 degrees).
+ *  - attributeRanges stores the minimum and maximum value of each single-component vertex attribute (in the order
+ *    of BinarySubMesh::attributes). Normalized integer attributes are mapped to [0, 1].
+ */
+struct BinaryMeshCluster
+{
+    uint32_t indexOffset;
+    uint32_t numIndices;
+    glm::vec3 aabbMin;
+    glm::vec3 aabbMax;
+    glm::vec3 sphereCenter;
+    float sphereRadius;
+    glm::vec3 coneAxis;
+    float coneCutoff;
+    std::vector<glm::vec2> attributeRanges;
+};
+
 struct BinarySubMesh
 {
     ObjMaterial material;
@@ -93,6 +148,10 @@ struct BinarySubMesh
     std::vector<uint32_t> indices;
     std::vector<BinaryMeshAttribute> attributes;
     std::vector<BinaryMeshUniform> uniforms;
+    std::vector<BinaryMeshCluster> clusters; // Optional, can be empty
+    // Bounding box of the vertex positions (computed by writeMesh3D)
+    glm::vec3 aabbMin = glm::vec3(0.0f);
+    glm::vec3 aabbMax = glm::vec3(0.0f);
 };
 
 struct BinaryMesh
@@ -128,6 +187,62 @@ struct SSBOEntry {
     sgl::GeometryBufferPtr attributeBuffer;
 };
 
+/**
+ * Per-submesh cluster data used for CPU culling (see MeshRenderer::setClusterCulling).
+ */
+struct SubmeshClusterData
+{
+    std::vector<BinaryMeshCluster> clusters;
+    // Names of the single-component attributes in the order of BinaryMeshCluster::attributeRanges
+    std::vector<std::string> attributeRangeNames;
+
+    // Culling result: Index ranges of the visible clusters (adjacent ranges are merged) for glMultiDrawElements
+    std::vector<int> drawCounts;
+    std::vector<const void*> drawOffsets;
+    size_t numCulledClusters = 0;
+};
+
+/**
+ * A level of detail of a point data set, i.e., the first numPoints points of the submesh (see PointLod.hpp).
+ */
+struct PointLodLevel
+{
+    uint32_t numPoints;
+    float voxelSize; ///< Edge length of the voxels represented by one point (0 for the level with all points).
+};
+
+/**
+ * Accumulated statistics of all culling passes since the last call to MeshRenderer::resetClusterCullingStatistics.
+ */
+struct ClusterCullingStatistics
+{
+    size_t numClusters = 0;
+    size_t numCulledClusters = 0;
+    double cullingTimeMS = 0.0;
+    float getCulledFraction() const { return numClusters == 0 ? 0.0f : float(numCulledClusters) / float(numClusters); }
+};
+
+/**
+ * Binding point, size and member offsets (-1 if not active) of the uniform block "MatrixBlock" (see GlobalDefines.glsl)
+ * of a shader program, as reported by the driver.
+ */
+struct MatrixBlockLayout
+{
+    int bindingPoint = 0;
+    int dataSize = 0;
+    int memberOffsets[4] = { -1, -1, -1, -1 }; ///< mMatrix, vMatrix, pMatrix, mvpMatrix
+};
+
+/**
+ * Dequantization parameters of the positions of a submesh with ATTRIBUTE_ENCODING_POSITION_UNORM16. The positions are
+ * uploaded as normalized 16-bit integers and decoded in the vertex shader (see VertexAttributeDecoding.glsl).
+ */
+struct PositionDequantization
+{
+    glm::vec3 aabbMin = glm::vec3(0.0f);
+    glm::vec3 aabbExtent = glm::vec3(1.0f);
+};
+
 class MeshRenderer
 {
 public:
@@ -142,6 +257,30 @@ public:
         return shaderAttributeNames.find(name) != shaderAttributeNames.end();
     }
 
+    /**
+     * CPU culling of the clusters of the submeshes (if the binmesh file contains clusters). In each call to render,
+     * the clusters are tested against the view frustum of the current model-view-projection matrix of the renderer.
+     * If "opacityMap" is not empty, clusters are also culled if the transfer function (with the entries of
+     * "opacityMap" for the range [minAttribute, maxAttribute] of the importance criterion "attributeIndex") is zero
+     * for all attribute values of the cluster. The visible clusters are rendered using glMultiDrawElements.
+     * @param boundsPadding The cluster bounding boxes only contain the line points, so they are enlarged by this
+     * distance (i.e., the line or tube radius) to account for the extent of the rendered geometry.
+     */
+    void setClusterCulling(
+            bool useClusterCulling, float boundsPadding = 0.0f,
+            const std::vector<float> &opacityMap = std::vector<float>());
+    inline bool hasClusters() { return !submeshClusterData.empty(); }
+    inline const ClusterCullingStatistics &getClusterCullingStatistics() { return clusterCullingStatistics; }
+    inline void resetClusterCullingStatistics() { clusterCullingStatistics = ClusterCullingStatistics(); }
+
+    /**
+     * Point data sets with a level of detail hierarchy: Only the points of the passed level are rendered (-1 renders
+     * all points). The levels are only used for submesh pointLodSubmeshIndex.
+     */
+    inline void setPointLodLevel(int level) { pointLodLevel = level; }
+    inline int getPointLodLevel() const { return pointLodLevel; }
+    inline bool hasPointLodLevels() const { return !pointLodLevels.empty(); }
+
     bool useProgrammableFetch;
     std::vector<sgl::ShaderAttributesPtr> shaderAttributes;
     std::vector<SSBOEntry> ssboEntries; // For programmable vertex fetching/pulling
@@ -150,15 +289,77 @@ public:
     sgl::AABB3 boundingBox;
     sgl::Sphere boundingSphere;
     std::vector<ImportanceCriterionAttribute> importanceCriterionAttributes;
+
+    // Quantized attributes uploaded in their packed encoding (only without programmable fetch). The vertex shaders
+    // need the preprocessor defines QUANTIZED_POSITIONS and OCTAHEDRAL_DIRECTIONS, respectively.
+    bool hasQuantizedPositions = false;
+    bool hasOctahedralDirections = false;
+    std::vector<PositionDequantization> positionDequantization; // One entry per submesh if hasQuantizedPositions
+
+    // Cluster culling data (empty if the mesh has no clusters)
+    std::vector<SubmeshClusterData> submeshClusterData;
+
+    // Point LOD levels (empty if the mesh has no LOD hierarchy). Chunk k contains the points added by level k, so
+    // level k is rendered as the chunks 0 to k (null for levels that add no points).
+    std::vector<PointLodLevel> pointLodLevels;
+    std::vector<sgl::ShaderAttributesPtr> pointLodChunks;
+    size_t pointLodSubmeshIndex = 0;
+
+private:
+    /// Recomputes the visible clusters if the matrix, the attribute or the opacity map changed since the last call.
+    void cullClusters(int attributeIndex);
+    /**
+     * Draws the passed ranges of the index buffer of "renderData" with glMultiDrawElements. Renderer->render can only
+     * draw whole buffers, so the setup it does before drawing is repeated here: The shader attributes are bound with
+     * the pass shader, and the current matrices of the renderer are uploaded to the uniform block "MatrixBlock" using
+     * the layout queried from the pass shader (once per shader). The matrix buffer of the renderer is bound again
+     * afterwards.
+     */
+    void renderIndexRanges(
+            sgl::ShaderAttributesPtr &renderData, sgl::ShaderProgramPtr &passShader,
+            const std::vector<int> &drawCounts, const std::vector<const void*> &drawOffsets);
+
+    bool useClusterCulling = false;
+    float clusterBoundsPadding = 0.0f;
+    bool cullingResultValid = false;
+    glm::mat4 cullingMvpMatrix;
+    int cullingAttributeIndex = -1;
+    std::vector<float> opacityMap;
+    std::vector<uint32_t> opacityMapNonZeroPrefixSum;
+    ClusterCullingStatistics clusterCullingStatistics;
+    // Used by renderIndexRanges
+    sgl::GeometryBufferPtr matrixBlockBuffer;
+    std::vector<uint8_t> matrixBlockData;
+    std::map<sgl::ShaderProgramPtr, MatrixBlockLayout> matrixBlockLayouts;
+    uint32_t rendererMatrixBlockBuffer = 0;
+    bool isRendererMatrixBlockBufferQueried = false;
+    int pointLodLevel = -1;
 };
 
 
 /**
  * Uses readMesh3D to read the mesh data from a file and assigns the data to a ShaderAttributesPtr object.
  * @param shader: The shader to use for the mesh.
+ * @param shuffleData: Whether to shuffle the order of the lines/triangles (for testing the order dependency of OIT).
+ * @param shuffleSeed: The seed of the shuffling. The same seed always results in the same order.
  * @return: The loaded mesh stored in a ShaderAttributes object.
  */
 MeshRenderer parseMesh3D(const std::string &filename, sgl::ShaderProgramPtr shader, bool shuffleData = false,
-        bool useProgrammableFetch = false, bool programmableFetchUseAoS = true, float lineRadius = 0.001f);
+        bool useProgrammableFetch = false,
+        ProgrammableFetchLayout programmableFetchLayout = PROGRAMMABLE_FETCH_LAYOUT_AOS, float lineRadius = 0.001f,
+        uint32_t shuffleSeed = 0);
+
+/**
+ * Creates the render data of a mesh that was already read with readMesh3D (e.g., by a background thread, see
+ * TimeStepSequence). The parameters are the same as for parseMesh3D. "mesh" is not modified, i.e., a cached mesh can
+ * be uploaded again later.
+ * Quantized positions and directions (see MeshQuantization.hpp) are uploaded in their packed encoding and decoded in
+ * the vertex shader. They are only decoded on the CPU for programmable fetch (the SSBO layouts use float vectors) or
+ * if the submeshes mix quantized and float data of one kind.
+ */
+MeshRenderer createMeshRenderer(const BinaryMesh &mesh, sgl::ShaderProgramPtr shader, bool shuffleData = false,
+        bool useProgrammableFetch = false,
+        ProgrammableFetchLayout programmableFetchLayout = PROGRAMMABLE_FETCH_LAYOUT_AOS, float lineRadius = 0.001f,
+        uint32_t shuffleSeed = 0);
 
 #endif /* UTILS_MESHSERIALIZER_HPP_ */
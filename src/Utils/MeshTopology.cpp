@@ -0,0 +1,207 @@
+//
+// Created by agent on 19.10.26.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+#include "MeshTopology.hpp"
+
+/**
+ * Builds a CSR table that maps "numRows" rows to the items 0 to numItems-1 (item i is stored in row getRow(i) with
+ * the value getValue(i)). This is used both for the vertex -> face adjacency and the buckets of the spatial hash grid.
+ */
+template<class RowFunction, class ValueFunction>
+static void buildCsrTable(
+        size_t numItems, size_t numRows, RowFunction getRow, ValueFunction getValue, bool sortRows,
+        std::vector<size_t> &rowOffsets, std::vector<uint32_t> &rowItems)
+{
+    std::vector<std::atomic<uint32_t>> rowCounters(numRows);
+    #pragma omp parallel for
+    for (size_t row = 0; row < numRows; row++) {
+        rowCounters[row].store(0u, std::memory_order_relaxed);
+    }
+
+    // Pass 1: Count the number of items per row.
+    #pragma omp parallel for
+    for (size_t i = 0; i < numItems; i++) {
+        rowCounters[getRow(i)].fetch_add(1u, std::memory_order_relaxed);
+    }
+
+    // Exclusive prefix sum over the counts. The rows are split into a fixed number of blocks, such that the block sums
+    // and the local prefix sums can be computed in parallel. The counters are reset for the scatter pass.
+    rowOffsets.resize(numRows + 1);
+    const size_t numBlocks = 256;
+    const size_t blockSize = (numRows + numBlocks - 1) / numBlocks;
+    std::vector<size_t> blockOffsets(numBlocks + 1, 0);
+    #pragma omp parallel for
+    for (size_t block = 0; block < numBlocks; block++) {
+        size_t rowEnd = std::min((block + 1) * blockSize, numRows);
+        size_t blockSum = 0;
+        for (size_t row = block * blockSize; row < rowEnd; row++) {
+            blockSum += rowCounters[row].load(std::memory_order_relaxed);
+        }
+        blockOffsets[block + 1] = blockSum;
+    }
+    for (size_t block = 0; block < numBlocks; block++) {
+        blockOffsets[block + 1] += blockOffsets[block];
+    }
+    #pragma omp parallel for
+    for (size_t block = 0; block < numBlocks; block++) {
+        size_t rowEnd = std::min((block + 1) * blockSize, numRows);
+        size_t offset = blockOffsets[block];
+        for (size_t row = block * blockSize; row < rowEnd; row++) {
+            rowOffsets[row] = offset;
+            offset += rowCounters[row].load(std::memory_order_relaxed);
+            rowCounters[row].store(0u, std::memory_order_relaxed);
+        }
+    }
+    rowOffsets[numRows] = blockOffsets[numBlocks];
+
+    // Pass 2: Scatter the items to their rows.
+    rowItems.resize(numItems);
+    #pragma omp parallel for
+    for (size_t i = 0; i < numItems; i++) {
+        size_t row = getRow(i);
+        size_t writeIndex = rowOffsets[row] + rowCounters[row].fetch_add(1u, std::memory_order_relaxed);
+        rowItems[writeIndex] = getValue(i);
+    }
+
+    if (sortRows) {
+        #pragma omp parallel for schedule(dynamic, 4096)
+        for (size_t row = 0; row < numRows; row++) {
+            if (rowOffsets[row + 1] - rowOffsets[row] > 1) {
+                std::sort(rowItems.begin() + rowOffsets[row], rowItems.begin() + rowOffsets[row + 1]);
+            }
+        }
+    }
+}
+
+void buildVertexFaceAdjacency(
+        const std::vector<uint32_t> &indices, size_t numVertices, VertexFaceAdjacency &adjacency, bool sortFaces)
+{
+    const uint32_t *indexData = indices.data();
+    buildCsrTable(
+            indices.size(), numVertices,
+            [indexData](size_t i) { return size_t(indexData[i]); },
+            [](size_t i) { return uint32_t(i / 3); },
+            sortFaces, adjacency.faceOffsets, adjacency.faceIndices);
+}
+
+
+/// Spatial hash of an integer grid cell (Teschner et al. 2003, with a final bit mix as only the low bits are used).
+static inline uint64_t hashGridCell(int64_t x, int64_t y, int64_t z)
+{
+    uint64_t hash = (uint64_t(x) * 73856093ull) ^ (uint64_t(y) * 19349663ull) ^ (uint64_t(z) * 83492791ull);
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+size_t weldVertices(std::vector<glm::vec3> &vertices, std::vector<uint32_t> &indices, float epsilon)
+{
+    const size_t numVertices = vertices.size();
+    if (numVertices == 0 || !(epsilon > 0.0f)) {
+        return 0;
+    }
+
+    // Hash grid with a cell size of epsilon, i.e., all neighbors of a vertex are in the 3x3x3 cells around it.
+    const double invCellSize = 1.0 / double(epsilon);
+    std::vector<int64_t> cellCoordinates(numVertices * 3);
+    #pragma omp parallel for
+    for (size_t i = 0; i < numVertices; i++) {
+        for (int j = 0; j < 3; j++) {
+            cellCoordinates[i * 3 + j] = int64_t(std::floor(double(vertices[i][j]) * invCellSize));
+        }
+    }
+
+    size_t numBuckets = 1;
+    while (numBuckets < numVertices * 2) {
+        numBuckets *= 2;
+    }
+    const uint64_t bucketMask = uint64_t(numBuckets - 1);
+    const int64_t *cells = cellCoordinates.data();
+    std::vector<size_t> bucketOffsets;
+    std::vector<uint32_t> bucketVertices;
+    buildCsrTable(
+            numVertices, numBuckets,
+            [cells, bucketMask](size_t i) {
+                return size_t(hashGridCell(cells[i * 3], cells[i * 3 + 1], cells[i * 3 + 2]) & bucketMask);
+            },
+            [](size_t i) { return uint32_t(i); },
+            false, bucketOffsets, bucketVertices);
+
+    // Map each vertex to the neighbor with the lowest index. Hash collisions are filtered by the distance test.
+    const float epsilonSquared = epsilon * epsilon;
+    std::vector<uint32_t> representatives(numVertices);
+    #pragma omp parallel for
+    for (size_t i = 0; i < numVertices; i++) {
+        const glm::vec3 &vertex = vertices[i];
+        uint32_t representative = uint32_t(i);
+        for (int64_t dz = -1; dz <= 1; dz++) {
+            for (int64_t dy = -1; dy <= 1; dy++) {
+                for (int64_t dx = -1; dx <= 1; dx++) {
+                    size_t bucket = size_t(hashGridCell(
+                            cells[i * 3] + dx, cells[i * 3 + 1] + dy, cells[i * 3 + 2] + dz) & bucketMask);
+                    for (size_t k = bucketOffsets[bucket]; k < bucketOffsets[bucket + 1]; k++) {
+                        uint32_t neighbor = bucketVertices[k];
+                        if (neighbor < representative) {
+                            glm::vec3 diff = vertices[neighbor] - vertex;
+                            if (glm::dot(diff, diff) <= epsilonSquared) {
+                                representative = neighbor;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+        representatives[i] = representative;
+    }
+    cellCoordinates = std::vector<int64_t>();
+    bucketOffsets = std::vector<size_t>();
+    bucketVertices = std::vector<uint32_t>();
+
+    // Resolve chains (representatives[i] <= i, so the representative of the representative is already final) and
+    // compute the new indices of the remaining vertices.
+    std::vector<uint32_t> newVertexIndices(numVertices);
+    uint32_t numWeldedVertices = 0;
+    for (size_t i = 0; i < numVertices; i++) {
+        uint32_t representative = representatives[representatives[i]];
+        representatives[i] = representative;
+        if (representative == i) {
+            newVertexIndices[i] = numWeldedVertices++;
+        } else {
+            newVertexIndices[i] = newVertexIndices[representative];
+        }
+    }
+
+    std::vector<glm::vec3> weldedVertices(numWeldedVertices);
+    #pragma omp parallel for
+    for (size_t i = 0; i < numVertices; i++) {
+        if (representatives[i] == i) {
+            weldedVertices[newVertexIndices[i]] = vertices[i];
+        }
+    }
+    vertices.swap(weldedVertices);
+
+    #pragma omp parallel for
+    for (size_t i = 0; i < indices.size(); i++) {
+        indices[i] = newVertexIndices[indices[i]];
+    }
+
+    // Remove the triangles that collapsed.
+    size_t numIndicesNew = 0;
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+        uint32_t i0 = indices[i], i1 = indices[i + 1], i2 = indices[i + 2];
+        if (i0 != i1 && i1 != i2 && i0 != i2) {
+            indices[numIndicesNew++] = i0;
+            indices[numIndicesNew++] = i1;
+            indices[numIndicesNew++] = i2;
+        }
+    }
+    indices.resize(numIndicesNew);
+
+    return numVertices - numWeldedVertices;
+}
@@ -0,0 +1,55 @@
+//
+// Created by agent on 19.10.26.
+//
+
+#ifndef PIXELSYNCOIT_MESHTOPOLOGY_HPP
+#define PIXELSYNCOIT_MESHTOPOLOGY_HPP
+
+#include <vector>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+/**
+ * Vertex -> face adjacency of an indexed triangle mesh in CSR (compressed sparse row) form. The indices of the faces
+ * (i.e., triangle index = index buffer position / 3) adjacent to vertex v are stored at
+ * faceIndices[faceOffsets[v]] to faceIndices[faceOffsets[v+1]-1].
+ */
+struct VertexFaceAdjacency
+{
+    std::vector<size_t> faceOffsets; ///< numVertices + 1 entries.
+    std::vector<uint32_t> faceIndices; ///< One entry per entry of the index buffer.
+
+    inline size_t getNumVertices() const { return faceOffsets.empty() ? 0 : faceOffsets.size() - 1; }
+    inline size_t getNumFaces(size_t vertexIndex) const {
+        return faceOffsets[vertexIndex + 1] - faceOffsets[vertexIndex];
+    }
+    inline const uint32_t *facesBegin(size_t vertexIndex) const {
+        return faceIndices.data() + faceOffsets[vertexIndex];
+    }
+    inline const uint32_t *facesEnd(size_t vertexIndex) const {
+        return faceIndices.data() + faceOffsets[vertexIndex + 1];
+    }
+};
+
+/**
+ * Builds the vertex -> face adjacency of a triangle mesh in parallel. The number of faces per vertex is counted with
+ * atomic increments, the offsets are computed with a prefix sum and the face indices are scattered to their rows with
+ * atomic per-vertex cursors.
+ * @param sortFaces The order of the faces within a row depends on the thread schedule of the scatter pass. If this is
+ * true, the rows are sorted afterwards, i.e., the result is deterministic (and equal to a serial build).
+ */
+void buildVertexFaceAdjacency(
+        const std::vector<uint32_t> &indices, size_t numVertices, VertexFaceAdjacency &adjacency,
+        bool sortFaces = true);
+
+/**
+ * Merges all vertices with a distance of at most "epsilon" to each other. The neighbors of a vertex are found with a
+ * spatial hash grid with a cell size of epsilon. Every vertex is mapped to the first vertex (i.e., the one with the
+ * lowest index) of its neighborhood, so the result doesn't depend on the number of threads.
+ * The vertices are compacted (in their old order) and the indices are remapped. Triangles that become degenerate
+ * (i.e., reference one vertex more than once) are removed.
+ * @return The number of vertices removed.
+ */
+size_t weldVertices(std::vector<glm::vec3> &vertices, std::vector<uint32_t> &indices, float epsilon);
+
+#endif //PIXELSYNCOIT_MESHTOPOLOGY_HPP
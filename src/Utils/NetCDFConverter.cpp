@@ -8,10 +8,21 @@
 #include <fstream>
 #include <iomanip>
 #include <cassert>
+#include <cmath>
+#include <cfloat>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
 
+#include <boost/algorithm/string.hpp>
 #include <glm/glm.hpp>
 #include <netcdf.h>
 
+#include <Utils/AppSettings.hpp>
+#include <Utils/File/Logfile.hpp>
+#include <Utils/Convert.hpp>
+
+#include "DerivedDataCache.hpp"
 #include "NetCDFConverter.hpp"
 
 #if defined(DEBUG) || !defined(NDEBUG)
@@ -211,55 +222,64 @@ void loadFloatArray3D(int ncid, const char *varname, size_t zstart, size_t ystar
 
 
 
-Trajectories convertLatLonToCartesian(float *lat, float *lon, float *pressure, size_t trajectoryDim,
-        size_t timeDim) {
-    Trajectories trajectories;
-    trajectories.reserve(timeDim);
+/**
+ * Reads the hyperslab [start, start+count) of a 3D floating point variable into "data", which needs to have space for
+ * count[0]*count[1]*count[2] values. The NetCDF library is not thread-safe, so the reads of all worker threads are
+ * serialized (the conversion of the data read runs in parallel).
+ * @return False if the data could not be read.
+ */
+static bool loadFloatHyperslab3D(int ncid, int varid, const size_t start[3], const size_t count[3], float *data)
+{
+    int status;
+    #pragma omp critical(netcdfLibrary)
+    {
+        status = nc_get_vara_float(ncid, varid, start, count, data);
+    }
+    if (status != NC_NOERR) {
+        sgl::Logfile::get()->writeError(std::string() + "Error in loadFloatHyperslab3D: "
+                + nc_strerror(status));
+        return false;
+    }
+    return true;
+}
 
-    float minPressure = FLT_MAX;
-    float maxPressure = -FLT_MAX;
-    //float minPressure = 1200.0f;
-    //float maxPressure = 0.0001f;
-	#pragma omp parallel for reduction(min:minPressure) reduction(max:maxPressure)
-	for (size_t idx = 0; idx < trajectoryDim*timeDim; idx++) {
-	    if (pressure[idx] > 0.0f) {
-            minPressure = std::min(minPressure, pressure[idx]);
-	    }
-		maxPressure = std::max(maxPressure, pressure[idx]);
-	}
-	float logMinPressure = log(minPressure);
-	float logMaxPressure = log(maxPressure);
-
-    for (int trajectoryIndex = 0; trajectoryIndex < trajectoryDim; trajectoryIndex++) {
-        Trajectory trajectory;
-        trajectory.attributes.resize(1);
-        std::vector<glm::vec3> &cartesianCoords = trajectory.positions;
-        std::vector<float> &pressureAttr = trajectory.attributes.at(0);
-        cartesianCoords.reserve(trajectoryDim);
-        pressureAttr.reserve(trajectoryDim);
-        for (int i = 0; i < timeDim; i++) {
-            int index = i + trajectoryIndex*timeDim;
+/**
+ * Converts one hyperslab of "numTrajectories" x "timeCount" points to Cartesian coordinates and appends the
+ * trajectories to "trajectories". Points with a pressure <= 0 (i.e., missing values) are skipped.
+ * @param normalizedLogPressure Buffer with space for numTrajectories*timeCount values.
+ */
+static void convertLatLonToCartesian(
+        const float *lat, const float *lon, const float *pressure, float *normalizedLogPressure,
+        size_t numTrajectories, size_t timeCount, float logMaxPressure, float invLogPressureRange,
+        Trajectories &trajectories)
+{
+    // The logarithm is computed for the whole hyperslab in a vectorizable loop (missing values are clamped to a valid
+    // argument and skipped below).
+    const size_t numValues = numTrajectories * timeCount;
+    #pragma omp simd
+    for (size_t i = 0; i < numValues; i++) {
+        normalizedLogPressure[i] = (std::log(std::max(pressure[i], FLT_MIN)) - logMaxPressure) * invLogPressureRange;
+    }
+
+    trajectories.reserve(trajectories.size() + numTrajectories, trajectories.getNumPoints() + numValues);
+    TrajectoryArray<glm::vec3> &cartesianCoords = trajectories.positions;
+    TrajectoryArray<float> &pressureAttr = trajectories.attributes.front();
+    for (size_t trajectoryIndex = 0; trajectoryIndex < numTrajectories; trajectoryIndex++) {
+        size_t trajectoryStart = cartesianCoords.size();
+        for (size_t index = trajectoryIndex * timeCount; index < (trajectoryIndex + 1) * timeCount; index++) {
             float pressureAtIdx = pressure[index];
             if (pressureAtIdx <= 0.0f) {
                 continue;
             }
-            //float normalizedPressure = (pressureAtIdx - minPressure) / (maxPressure - minPressure);
-            float normalizedLogPressure = (log(pressureAtIdx) - logMaxPressure) / (logMinPressure - logMaxPressure);
-            float x = lat[index]/100.0f;
-            float y = normalizedLogPressure;
-            float z = lon[index]/100.0f;
-
-            glm::vec3 cartesianCoord = glm::vec3(x, y, z);
-
-            cartesianCoords.push_back(cartesianCoord);
+            cartesianCoords.push_back(glm::vec3(
+                    lat[index] / 100.0f, normalizedLogPressure[index], lon[index] / 100.0f));
             pressureAttr.push_back(pressureAtIdx);
         }
 
-        if (!trajectory.positions.empty()) {
-            trajectories.push_back(trajectory);
+        if (cartesianCoords.size() > trajectoryStart) {
+            trajectories.finishTrajectory();
         }
     }
-    return trajectories;
 }
 
 /**
@@ -267,7 +287,7 @@ Trajectories convertLatLonToCartesian(float *lat, float *lon, float *pressure, s
  * @param trajectories The trajectory paths to export.
  * @param filename The filename of the .obj file.
  */
-void exportObjFile(Trajectories &trajectories, const std::string &filename)
+void exportObjFile(const Trajectories &trajectories, const std::string &filename)
 {
     std::ofstream outfile;
     outfile.open(filename.c_str());
@@ -285,14 +305,14 @@ void exportObjFile(Trajectories &trajectories, const std::string &filename)
 
     size_t trajectoryFileIndex = 0;
     for (size_t trajectoryIndex = 0; trajectoryIndex < trajectories.size(); trajectoryIndex++) {
-        Trajectory &trajectory = trajectories.at(trajectoryIndex);
+        ConstTrajectoryView trajectory = trajectories.at(trajectoryIndex);
         size_t trajectorySize = trajectory.positions.size();
         if (trajectorySize < 2) {
             continue;
         }
 
         for (size_t i = 0; i < trajectorySize; i++) {
-            glm::vec3 &v = trajectory.positions.at(i);
+            const glm::vec3 &v = trajectory.positions.at(i);
             outfile << "v " << std::setprecision(5) << v.x << " " << v.y << " " << v.z << "\n";
             outfile << "vt " << std::setprecision(5) << trajectory.attributes.at(0).at(i) << "\n";
         }
@@ -309,56 +329,207 @@ void exportObjFile(Trajectories &trajectories, const std::string &filename)
     outfile.close();
 }
 
-Trajectories loadNetCdfFile(const std::string &filename)
+NetCdfSelection getNetCdfSelection()
 {
-    Trajectories trajectories;
+    NetCdfSelection selection;
+    sgl::SettingsFile &settings = sgl::AppSettings::get()->getSettings();
+    if (settings.hasKey("netcdf-ensembleMembers")) {
+        std::string ensembleMembersString = settings.getValue("netcdf-ensembleMembers");
+        selection.ensembleMembers.clear();
+        if (ensembleMembersString != "all") {
+            std::vector<std::string> tokens;
+            boost::split(tokens, ensembleMembersString, boost::is_any_of(", "), boost::token_compress_on);
+            for (const std::string &token : tokens) {
+                if (!token.empty()) {
+                    selection.ensembleMembers.push_back(sgl::fromString<size_t>(token));
+                }
+            }
+        }
+    }
+    if (settings.hasKey("netcdf-timeBegin")) {
+        selection.timeBegin = size_t(std::max(settings.getIntValue("netcdf-timeBegin"), 0));
+    }
+    if (settings.hasKey("netcdf-timeEnd") && settings.getIntValue("netcdf-timeEnd") >= 0) {
+        selection.timeEnd = size_t(settings.getIntValue("netcdf-timeEnd"));
+    }
+    return selection;
+}
+
+void addNetCdfSelectionParameters(DerivedDataKey &key, const NetCdfSelection &selection)
+{
+    std::string ensembleMembersString;
+    for (size_t ensembleMember : selection.ensembleMembers) {
+        ensembleMembersString += (ensembleMembersString.empty() ? "" : ",") + std::to_string(ensembleMember);
+    }
+    key.addParameter("netcdfEnsembleMembers", selection.ensembleMembers.empty() ? "all" : ensembleMembersString);
+    key.addParameter("netcdfTimeBegin", int(selection.timeBegin));
+    key.addParameter("netcdfTimeEnd",
+            selection.timeEnd == std::numeric_limits<size_t>::max() ? -1 : int(selection.timeEnd));
+}
+
+/// One hyperslab of the selection, i.e., a range of trajectories of one ensemble member.
+struct NetCdfBatch
+{
+    size_t ensembleMember;
+    size_t trajectoryBegin, trajectoryEnd;
+};
+
+bool streamNetCdfFile(
+        const std::string &filename, const NetCdfSelection &selection,
+        std::function<void(Trajectories &batch, float progress)> batchCallback)
+{
+    auto start = std::chrono::system_clock::now();
 
-    // File handle
     int ncid;
+    if (nc_open(filename.c_str(), NC_NOWRITE, &ncid) != NC_NOERR) {
+        sgl::Logfile::get()->writeError(std::string() + "Error in streamNetCdfFile: File \"" + filename
+                + "\" couldn't be opened.");
+        return false;
+    }
 
-    // Open the NetCDF file for reading
-    int status = nc_open(filename.c_str(), NC_NOWRITE, &ncid);
-    if (status != 0) {
-        std::cerr << "ERROR in loadNetCdfFile: File \"" << filename << "\" couldn't be opened!" << std::endl;
-        return trajectories;
+    int lonVarId, latVarId, pressureVarId;
+    if (nc_inq_varid(ncid, "lon", &lonVarId) != NC_NOERR || nc_inq_varid(ncid, "lat", &latVarId) != NC_NOERR
+            || nc_inq_varid(ncid, "pressure", &pressureVarId) != NC_NOERR) {
+        sgl::Logfile::get()->writeError(std::string() + "Error in streamNetCdfFile: The file \"" + filename
+                + "\" has no variables \"lon\", \"lat\" and \"pressure\".");
+        nc_close(ncid);
+        return false;
     }
 
-    // Load dimension data
+    // Clamp the selection to the dimensions of the file.
     size_t timeDim = getDim(ncid, "time");
     size_t trajectoryDim = getDim(ncid, "trajectory");
     size_t ensembleDim = getDim(ncid, "ensemble");
-    size_t startLonDim = getDim(ncid, "start_lon");
-    size_t startLatDim = getDim(ncid, "start_lat");
-    size_t timeIntervalDim = getDim(ncid, "time_interval");
-
-    // Load data arrays
-    double *time = NULL;
-    float *lon = NULL, *lat = NULL, *pressure = NULL, *startLon = NULL, *startLat = NULL, *timeInterval = NULL;
-    loadDoubleArray1D(ncid, "time", timeDim, &time);
-    loadFloatArray3D(ncid, "lon", 1, trajectoryDim, timeDim, &lon);
-    loadFloatArray3D(ncid, "lat", 1, trajectoryDim, timeDim, &lat);
-    loadFloatArray3D(ncid, "pressure", 1, trajectoryDim, timeDim, &pressure);
-    loadFloatArray1D(ncid, "start_lon", startLonDim, &startLon);
-    loadFloatArray1D(ncid, "start_lat", startLatDim, &startLat);
-    loadFloatArray1D(ncid, "time_interval", timeIntervalDim, &timeInterval);
+    size_t timeBegin = std::min(selection.timeBegin, timeDim);
+    size_t timeEnd = std::min(selection.timeEnd, timeDim);
+    size_t timeCount = timeEnd > timeBegin ? timeEnd - timeBegin : 0;
+    std::vector<size_t> ensembleMembers;
+    if (selection.ensembleMembers.empty()) {
+        for (size_t ensembleMember = 0; ensembleMember < ensembleDim; ensembleMember++) {
+            ensembleMembers.push_back(ensembleMember);
+        }
+    }
+    for (size_t ensembleMember : selection.ensembleMembers) {
+        if (ensembleMember < ensembleDim) {
+            ensembleMembers.push_back(ensembleMember);
+        } else {
+            sgl::Logfile::get()->writeError(std::string() + "Error in streamNetCdfFile: The file \"" + filename
+                    + "\" has no ensemble member " + std::to_string(ensembleMember) + ".");
+        }
+    }
 
+    const size_t trajectoriesPerBatch = std::max(selection.trajectoriesPerBatch, size_t(1));
+    std::vector<NetCdfBatch> batches;
+    for (size_t ensembleMember : ensembleMembers) {
+        for (size_t trajectoryBegin = 0; trajectoryBegin < trajectoryDim; trajectoryBegin += trajectoriesPerBatch) {
+            batches.push_back({ensembleMember, trajectoryBegin,
+                    std::min(trajectoryBegin + trajectoriesPerBatch, trajectoryDim)});
+        }
+    }
+    if (timeCount == 0 || batches.empty()) {
+        nc_close(ncid);
+        return true;
+    }
+    const size_t numBatches = batches.size();
+    const size_t batchBufferSize = trajectoriesPerBatch * timeCount;
+    std::atomic<bool> readError(false);
 
-    trajectories = convertLatLonToCartesian(lat, lon, pressure, trajectoryDim, timeDim);
-    std::string outputFilename = filename.substr(0, filename.find_last_of(".")) + ".obj";
-    //exportObjFile(trajectories, outputFilename);
+    // Pass 1: Compute the range of the pressure over the whole selection.
+    float minPressure = FLT_MAX;
+    float maxPressure = -FLT_MAX;
+    #pragma omp parallel reduction(min:minPressure) reduction(max:maxPressure)
+    {
+        std::vector<float> pressure(batchBufferSize);
+        #pragma omp for schedule(dynamic, 1)
+        for (size_t batchIndex = 0; batchIndex < numBatches; batchIndex++) {
+            const NetCdfBatch &batch = batches[batchIndex];
+            size_t startp[] = {batch.ensembleMember, batch.trajectoryBegin, timeBegin};
+            size_t countp[] = {1, batch.trajectoryEnd - batch.trajectoryBegin, timeCount};
+            if (!loadFloatHyperslab3D(ncid, pressureVarId, startp, countp, pressure.data())) {
+                readError = true;
+                continue;
+            }
+            const size_t numValues = countp[1] * timeCount;
+            #pragma omp simd reduction(min:minPressure) reduction(max:maxPressure)
+            for (size_t i = 0; i < numValues; i++) {
+                minPressure = std::min(minPressure, pressure[i] > 0.0f ? pressure[i] : FLT_MAX);
+                maxPressure = std::max(maxPressure, pressure[i]);
+            }
+        }
+    }
+    if (readError || !(minPressure <= maxPressure)) {
+        // Either the file is damaged or all pressure values of the selection are missing.
+        nc_close(ncid);
+        return !readError;
+    }
+    const float logMaxPressure = std::log(maxPressure);
+    const float invLogPressureRange =
+            minPressure < maxPressure ? 1.0f / (std::log(minPressure) - logMaxPressure) : 0.0f;
+
+    // Pass 2: Read the positions and convert them. The threads wait for their turn to pass the batches to the
+    // callback, i.e., at most one batch per thread is in memory at a time.
+    #pragma omp parallel
+    {
+        std::vector<float> lon(batchBufferSize), lat(batchBufferSize), pressure(batchBufferSize);
+        std::vector<float> normalizedLogPressure(batchBufferSize);
+        Trajectories batchTrajectories;
+        #pragma omp for ordered schedule(dynamic, 1)
+        for (size_t batchIndex = 0; batchIndex < numBatches; batchIndex++) {
+            const NetCdfBatch &batch = batches[batchIndex];
+            size_t startp[] = {batch.ensembleMember, batch.trajectoryBegin, timeBegin};
+            size_t countp[] = {1, batch.trajectoryEnd - batch.trajectoryBegin, timeCount};
+            bool batchRead = !readError
+                    && loadFloatHyperslab3D(ncid, lonVarId, startp, countp, lon.data())
+                    && loadFloatHyperslab3D(ncid, latVarId, startp, countp, lat.data())
+                    && loadFloatHyperslab3D(ncid, pressureVarId, startp, countp, pressure.data());
+            if (batchRead) {
+                // The callback may have taken the arrays of the previous batch.
+                batchTrajectories.clear();
+                batchTrajectories.attributes.resize(1);
+                convertLatLonToCartesian(
+                        lat.data(), lon.data(), pressure.data(), normalizedLogPressure.data(), countp[1], timeCount,
+                        logMaxPressure, invLogPressureRange, batchTrajectories);
+            } else {
+                readError = true;
+            }
 
+            #pragma omp ordered
+            {
+                if (batchRead && !readError && !batchTrajectories.empty()) {
+                    batchCallback(batchTrajectories, float(batchIndex + 1) / float(numBatches));
+                }
+            }
+        }
+    }
 
-    // Close the file
     myassert(nc_close(ncid) == NC_NOERR);
 
-    SAFE_DELETE_ARRAY(time);
-    SAFE_DELETE_ARRAY(lon);
-    SAFE_DELETE_ARRAY(lat);
-    SAFE_DELETE_ARRAY(pressure);
-    SAFE_DELETE_ARRAY(startLon);
-    SAFE_DELETE_ARRAY(startLat);
-    SAFE_DELETE_ARRAY(timeInterval);
+    auto end = std::chrono::system_clock::now();
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+    sgl::Logfile::get()->writeInfo(std::string() + "Computational time to read NetCDF file: "
+            + std::to_string(elapsed.count()));
 
-    return trajectories;
+    return !readError;
 }
 
+Trajectories loadNetCdfFile(const std::string &filename, const NetCdfSelection &selection)
+{
+    Trajectories trajectories;
+    trajectories.setNumAttributes(1);
+
+    bool success = streamNetCdfFile(filename, selection, [&trajectories](Trajectories &batch, float progress) {
+        size_t pointOffset = trajectories.getNumPoints();
+        trajectories.positions.insert(trajectories.positions.end(), batch.positions.begin(), batch.positions.end());
+        trajectories.attributes.front().insert(
+                trajectories.attributes.front().end(),
+                batch.attributes.front().begin(), batch.attributes.front().end());
+        for (size_t trajectoryIndex = 1; trajectoryIndex < batch.trajectoryOffsets.size(); trajectoryIndex++) {
+            trajectories.trajectoryOffsets.push_back(pointOffset + batch.trajectoryOffsets[trajectoryIndex]);
+        }
+    });
+    if (!success) {
+        return Trajectories();
+    }
+
+    return trajectories;
+}
@@ -6,8 +6,52 @@
 #define NETCDFIMPORTER_NETCDFCONVERTER_HPP
 
 #include <string>
+#include <vector>
+#include <limits>
+#include <functional>
 #include "TrajectoryFile.hpp"
 
-Trajectories loadNetCdfFile(const std::string &filename);
+class DerivedDataKey;
+
+/**
+ * The part of a NetCDF trajectory file (variables "lon", "lat" and "pressure" with the dimensions ensemble x
+ * trajectory x time) that is loaded. Only the hyperslabs of the selected ensemble members and time steps are read.
+ * The settings are read from the application settings ("netcdf-ensembleMembers" as a comma-separated list of indices
+ * or "all", "netcdf-timeBegin" and "netcdf-timeEnd"). By default, all time steps of the first member are loaded.
+ */
+struct NetCdfSelection
+{
+    /// The indices of the ensemble members to load (empty: all members).
+    std::vector<size_t> ensembleMembers = std::vector<size_t>(1, 0);
+    /// The time steps [timeBegin, timeEnd) to load (clamped to the time dimension of the file).
+    size_t timeBegin = 0;
+    size_t timeEnd = std::numeric_limits<size_t>::max();
+    /// The number of trajectories read and converted as one hyperslab.
+    size_t trajectoriesPerBatch = 1024;
+};
+
+NetCdfSelection getNetCdfSelection();
+
+/**
+ * Adds the selection to the key of an artifact of the derived data cache that was created from a NetCDF file.
+ */
+void addNetCdfSelectionParameters(DerivedDataKey &key, const NetCdfSelection &selection);
+
+/**
+ * Reads the selected trajectories of a NetCDF file in batches of "selection.trajectoriesPerBatch" trajectories. The
+ * batches are read as hyperslabs and converted to Cartesian coordinates by a pool of OpenMP threads, and the callback
+ * is called for the batches in order (ensemble member major). The y coordinate is the logarithmic pressure normalized
+ * over the whole selection, so the pressure hyperslabs are read in a first pass to compute its range.
+ * @param batchCallback Called for every batch with the trajectories and the fraction of the batches read so far.
+ * @return Whether the file could be read successfully.
+ */
+bool streamNetCdfFile(
+        const std::string &filename, const NetCdfSelection &selection,
+        std::function<void(Trajectories &batch, float progress)> batchCallback);
+
+/**
+ * Loads the selected trajectories of a NetCDF file (see streamNetCdfFile). The only attribute is the pressure.
+ */
+Trajectories loadNetCdfFile(const std::string &filename, const NetCdfSelection &selection = NetCdfSelection());
 
 #endif //NETCDFIMPORTER_NETCDFCONVERTER_HPP
@@ -6,9 +6,11 @@
  */
 
 #include <algorithm>
+#include <chrono>
 #include <iostream>
 #include <fstream>
 #include <vector>
+#include <map>
 #include <string>
 #include <boost/algorithm/string.hpp>
 #include <boost/algorithm/string/split.hpp>
@@ -17,12 +19,16 @@
 #include <Utils/File/Logfile.hpp>
 #include <Utils/File/FileUtils.hpp>
 #include <Utils/Convert.hpp>
+#include <Utils/AppSettings.hpp>
 #include <Graphics/Shader/ShaderManager.hpp>
 #include <Graphics/Shader/ShaderAttributes.hpp>
 #include <Graphics/Renderer.hpp>
 
 #include "MeshSerializer.hpp"
-#include "KDTree.hpp"
+#include "MeshOptimizer.hpp"
+#include "MeshClustering.hpp"
+#include "MeshQuantization.hpp"
+#include "MeshTopology.hpp"
 
 using namespace std;
 using namespace sgl;
@@ -79,35 +85,52 @@ struct TempSubmesh
     std::vector<uint32_t> normalIndices;
 };
 
-void globalIndicesToLocal(std::vector<uint32_t> &globalIndexBuffer, std::vector<glm::vec3> &globalVertexBuffer,
-                          std::vector<uint32_t> &localIndexBuffer, std::vector<glm::vec3> &localVertexBuffer)
+static const uint32_t INVALID_VERTEX_INDEX = 0xFFFFFFFFu;
+
+/**
+ * Maps the global vertex indices referenced by a submesh to local indices. The local vertices are ordered by their
+ * global index. "globalToLocalTable" is a workspace with one entry per global vertex that needs to be filled with
+ * INVALID_VERTEX_INDEX. It is reset to this state before returning, so it can be reused for all submeshes, i.e., the
+ * cost only depends on the size of the submesh and not on the size of the global vertex buffer.
+ */
+void globalIndicesToLocal(const std::vector<uint32_t> &globalIndexBuffer, const std::vector<glm::vec3> &globalVertexBuffer,
+                          std::vector<uint32_t> &localIndexBuffer, std::vector<glm::vec3> &localVertexBuffer,
+                          std::vector<uint32_t> &globalToLocalTable)
 {
-    // Create global indices <-> local indices mapping
-    std::vector<uint32_t> sortedIndexBuffer = globalIndexBuffer;
-    std::sort(sortedIndexBuffer.begin(), sortedIndexBuffer.end());
-    std::map<uint32_t, uint32_t> mappingGlobalToLocal;
-    std::map<uint32_t, uint32_t> mappingLocalToGlobal;
-    size_t index = 0;
+    // Find the used global indices
+    std::vector<uint32_t> usedGlobalIndices;
     for (size_t i = 0; i < globalIndexBuffer.size(); i++) {
-        if (i == 0 || sortedIndexBuffer.at(i) != sortedIndexBuffer.at(i-1)) {
-            mappingGlobalToLocal.insert(make_pair(sortedIndexBuffer.at(i), index));
-            mappingLocalToGlobal.insert(make_pair(index, sortedIndexBuffer.at(i)));
-            index++;
+        uint32_t globalIndex = globalIndexBuffer[i];
+        if (globalToLocalTable.at(globalIndex) == INVALID_VERTEX_INDEX) {
+            globalToLocalTable[globalIndex] = 0;
+            usedGlobalIndices.push_back(globalIndex);
         }
     }
+    std::sort(usedGlobalIndices.begin(), usedGlobalIndices.end());
 
-    localVertexBuffer.resize(index);
-    for (size_t i = 0; i < index; i++) {
-        localVertexBuffer.at(i) = globalVertexBuffer.at(mappingLocalToGlobal[i]);
+    // Create global indices <-> local indices mapping
+    const size_t numLocalVertices = usedGlobalIndices.size();
+    localVertexBuffer.resize(numLocalVertices);
+    #pragma omp parallel for
+    for (size_t i = 0; i < numLocalVertices; i++) {
+        globalToLocalTable[usedGlobalIndices[i]] = uint32_t(i);
+        localVertexBuffer[i] = globalVertexBuffer[usedGlobalIndices[i]];
     }
     localIndexBuffer.resize(globalIndexBuffer.size());
+    #pragma omp parallel for
     for (size_t i = 0; i < globalIndexBuffer.size(); i++) {
-        localIndexBuffer.at(i) = mappingGlobalToLocal[globalIndexBuffer.at(i)];
+        localIndexBuffer[i] = globalToLocalTable[globalIndexBuffer[i]];
+    }
+
+    #pragma omp parallel for
+    for (size_t i = 0; i < numLocalVertices; i++) {
+        globalToLocalTable[usedGlobalIndices[i]] = INVALID_VERTEX_INDEX;
     }
 }
 
 void processTempSubmesh(ObjMesh &mesh, TempSubmesh &tempSubmesh, std::vector<glm::vec3> &globalVertices,
-        std::vector<glm::vec2> &globalTexcoords, std::vector<glm::vec3> &globalNormals)
+        std::vector<glm::vec2> &globalTexcoords, std::vector<glm::vec3> &globalNormals,
+        std::vector<uint32_t> &globalToLocalTable, float weldEpsilon)
 {
     // Input
     bool smooth = tempSubmesh.smooth;
@@ -145,50 +168,56 @@ void processTempSubmesh(ObjMesh &mesh, TempSubmesh &tempSubmesh, std::vector<glm
         }
     } else {
         std::vector<uint32_t> &globalIndices = vertexIndices;
-        globalIndicesToLocal(globalIndices, globalVertices, indices, vertices);
-
+        globalIndicesToLocal(globalIndices, globalVertices, indices, vertices, globalToLocalTable);
+        if (weldEpsilon > 0.0f) {
+            size_t numWeldedVertices = weldVertices(vertices, indices, weldEpsilon);
+            Logfile::get()->writeInfo(std::string() + "Welded " + sgl::toString(numWeldedVertices)
+                    + " vertices of submesh with " + sgl::toString(vertices.size() + numWeldedVertices)
+                    + " vertices.");
+        }
 
-        // For finding all triangles with a specific index. Maps vertex index -> first triangle index.
-        std::multimap<size_t, size_t> indexMap;
-        for (size_t j = 0; j < indices.size(); j++) {
-            indexMap.insert(make_pair(indices.at(j), (j/3)*3));
+        // Per-face normals (not weighted by area).
+        const size_t numFaces = indices.size() / 3;
+        std::vector<glm::vec3> faceNormals(numFaces);
+        #pragma omp parallel for
+        for (size_t f = 0; f < numFaces; f++) {
+            size_t i1 = indices[f*3], i2 = indices[f*3+1], i3 = indices[f*3+2];
+            glm::vec3 faceNormal = glm::cross(vertices[i1] - vertices[i2], vertices[i1] - vertices[i3]);
+            faceNormals[f] = glm::normalize(faceNormal);
         }
 
+        // Average the normals of all triangles sharing a vertex. The faces of each vertex are sorted, i.e., the sum
+        // is deterministic.
+        VertexFaceAdjacency adjacency;
+        buildVertexFaceAdjacency(indices, vertices.size(), adjacency);
+        normals.resize(vertices.size());
+        #pragma omp parallel for
         for (size_t i = 0; i < vertices.size(); i++) {
             glm::vec3 normal(0.0f, 0.0f, 0.0f);
-            int numTrianglesSharedBy = 0;
-            auto triangleRange = indexMap.equal_range(i);
-            for (auto it = triangleRange.first; it != triangleRange.second; it++) {
-                size_t j = it->second;
-                size_t i1 = indices.at(j), i2 = indices.at(j+1), i3 = indices.at(j+2);
-                glm::vec3 faceNormal = glm::cross(vertices.at(i1) - vertices.at(i2), vertices.at(i1) - vertices.at(i3));
-                faceNormal = glm::normalize(faceNormal);
-                normal += faceNormal;
-                numTrianglesSharedBy++;
+            for (const uint32_t *face = adjacency.facesBegin(i); face != adjacency.facesEnd(i); face++) {
+                normal += faceNormals[*face];
             }
-            /*for (size_t j = 0; j < indices.size(); j += 3) {
-                // Does this triangle contain vertex #i?
-                if (indices.at(j) == i || indices.at(j+1) == i || indices.at(j+2) == i) {
-                    size_t i1 = indices.at(j), i2 = indices.at(j+1), i3 = indices.at(j+2);
-                    glm::vec3 faceNormal = glm::cross(vertices.at(i1) - vertices.at(i2), vertices.at(i1) - vertices.at(i3));
-                    faceNormal = glm::normalize(faceNormal);
-                    normal += faceNormal;
-                    numTrianglesSharedBy++;
-                }
-            }*/
-
-            if (numTrianglesSharedBy == 0) {
-                Logfile::get()->writeError("Error in parseObjMesh: numTrianglesSharedBy == 0");
-                exit(1); // TODO: Global vertex buffer
+            // After welding, vertices only used by collapsed triangles are not referenced anymore.
+            size_t numTrianglesSharedBy = adjacency.getNumFaces(i);
+            if (numTrianglesSharedBy > 0) {
+                normal /= float(numTrianglesSharedBy);
             }
-            normal /= (float)numTrianglesSharedBy;
-            normals.push_back(normal);
+            normals[i] = normal;
         }
     }
 
     mesh.submeshes.push_back(submesh);
 }
 
+float getObjWeldEpsilon()
+{
+    sgl::SettingsFile &settings = sgl::AppSettings::get()->getSettings();
+    if (settings.hasKey("objLoader-weldEpsilon")) {
+        return fromString<float>(settings.getValue("objLoader-weldEpsilon"));
+    }
+    return 0.0f;
+}
+
 void addMaterialsFromFile(const std::string &filename, const std::string &objFilename,
         std::map<std::string, ObjMaterial> &materials)
 {
@@ -359,11 +388,19 @@ void convertObjMeshToBinary(
 
 
 
+    auto start = std::chrono::system_clock::now();
     ObjMesh mesh;
     mesh.submeshes.reserve(tempMesh.size());
-    for (TempSubmesh tempSubmesh : tempMesh) {
-        processTempSubmesh(mesh, tempSubmesh, globalVertices, globalTexcoords, globalNormals);
+    std::vector<uint32_t> globalToLocalTable(globalVertices.size(), INVALID_VERTEX_INDEX);
+    const float weldEpsilon = getObjWeldEpsilon();
+    for (TempSubmesh &tempSubmesh : tempMesh) {
+        processTempSubmesh(
+                mesh, tempSubmesh, globalVertices, globalTexcoords, globalNormals, globalToLocalTable, weldEpsilon);
     }
+    auto end = std::chrono::system_clock::now();
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+    Logfile::get()->writeInfo(std::string() + "Computational time to process submeshes: "
+            + std::to_string(elapsed.count()));
 
     file.close();
 
@@ -407,7 +444,9 @@ void convertObjMeshToBinary(
         }
     }
 
-
+    optimizeBinaryMesh(binaryMesh);
+    buildMeshClusters(binaryMesh);
+    quantizeBinaryMesh(binaryMesh);
     writeMesh3D(binaryFilename, binaryMesh);
 }
 
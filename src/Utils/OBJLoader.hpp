@@ -17,9 +17,16 @@
  *
  * @param objFilename: The input .obj file.
  * @param binaryFilename: The filename of the binary output file.
+ *
+ * The vertices of smooth-shaded submeshes are shared between the triangles referencing them. If the setting
+ * "objLoader-weldEpsilon" is larger than zero, vertices closer than this distance are additionally merged (see
+ * weldVertices in MeshTopology.hpp).
  */
 void convertObjMeshToBinary(
         const std::string &objFilename,
         const std::string &binaryFilename);
 
+/// @return The value of the setting "objLoader-weldEpsilon" (0 if not set, i.e., welding is disabled).
+float getObjWeldEpsilon();
+
 #endif /* OBJLOADER_HPP_ */
@@ -26,16 +26,157 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+#include <limits>
 #include <boost/algorithm/string/predicate.hpp>
+#include <boost/filesystem.hpp>
+#include <Utils/AppSettings.hpp>
 #include <Utils/File/Logfile.hpp>
+#include <Math/Math.hpp>
 #include "import_uintah.h"
 #include "import_cosmic_web.h"
 #include "../MeshSerializer.hpp"
 #include "../ImportanceCriteria.hpp"
+#include "../KDTree.hpp"
+#include "PointLod.hpp"
 #include "PointFileLoader.hpp"
 
 // timestep.xml -> uintah
 // .dat -> cosmic_web
+// Directory or wildcard pattern (e.g. "CosmicWeb/*.dat") -> all bricks of the cosmic web
+
+bool getPointDataSetMortonSort()
+{
+    sgl::SettingsFile &settings = sgl::AppSettings::get()->getSettings();
+    return settings.hasKey("pointDataSet-mortonSort") && settings.getBoolValue("pointDataSet-mortonSort");
+}
+
+bool getPointDataSetLod()
+{
+    sgl::SettingsFile &settings = sgl::AppSettings::get()->getSettings();
+    return !settings.hasKey("pointDataSet-lod") || settings.getBoolValue("pointDataSet-lod");
+}
+
+int getPointDataSetDensityNeighbors()
+{
+    sgl::SettingsFile &settings = sgl::AppSettings::get()->getSettings();
+    if (settings.hasKey("pointDataSet-densityNeighbors")) {
+        return std::max(settings.getIntValue("pointDataSet-densityNeighbors"), 0);
+    }
+    return 0;
+}
+
+std::string getPointDataSetSourceSignature(const std::string &inputFilename)
+{
+    if (!pl::is_cosmic_web_brick_set(pl::FileName(inputFilename))) {
+        return "";
+    }
+    std::vector<pl::FileName> bricks = pl::find_cosmic_web_bricks(pl::FileName(inputFilename));
+    uint64_t totalSize = 0;
+    int64_t lastWriteTime = 0;
+    for (const pl::FileName &brick : bricks) {
+        boost::system::error_code errorCode;
+        totalSize += uint64_t(boost::filesystem::file_size(brick.file_name, errorCode));
+        lastWriteTime = std::max(lastWriteTime, int64_t(boost::filesystem::last_write_time(brick.file_name, errorCode)));
+    }
+    return std::to_string(bricks.size()) + "_" + std::to_string(totalSize) + "_" + std::to_string(lastWriteTime);
+}
+
+// Spreads the lower 10 bits of v to every third bit
+static inline uint32_t expandBits10(uint32_t v)
+{
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+/**
+ * Sorts the points by the Morton code of their position on a 1024^3 grid over the passed bounding box, i.e., points
+ * close to each other in space are also close to each other in memory.
+ * @return The permutation applied (new index -> old index), which needs to be applied to the per-point attributes.
+ */
+static std::vector<uint32_t> sortPointsByMortonCode(
+        glm::vec3 *positions, size_t numPoints, const sgl::AABB3 &aabb)
+{
+    glm::vec3 minimum = aabb.getMinimum();
+    glm::vec3 extent = glm::max(aabb.getMaximum() - minimum, glm::vec3(1e-6f));
+
+    std::vector<std::pair<uint32_t, uint32_t>> mortonCodes(numPoints);
+    #pragma omp parallel for
+    for (int64_t i = 0; i < int64_t(numPoints); i++) {
+        glm::ivec3 quantizedPosition = glm::clamp(
+                glm::ivec3((positions[i] - minimum) / extent * 1024.0f), glm::ivec3(0), glm::ivec3(1023));
+        uint32_t mortonCode = (expandBits10(uint32_t(quantizedPosition.x)) << 2)
+                | (expandBits10(uint32_t(quantizedPosition.y)) << 1) | expandBits10(uint32_t(quantizedPosition.z));
+        mortonCodes[i] = std::make_pair(mortonCode, uint32_t(i));
+    }
+    std::sort(mortonCodes.begin(), mortonCodes.end());
+
+    std::vector<uint32_t> permutation(numPoints);
+    std::vector<glm::vec3> sortedPositions(numPoints);
+    #pragma omp parallel for
+    for (int64_t i = 0; i < int64_t(numPoints); i++) {
+        permutation[i] = mortonCodes[i].second;
+        sortedPositions[i] = positions[mortonCodes[i].second];
+    }
+    memcpy(positions, &sortedPositions.front(), numPoints * sizeof(glm::vec3));
+    return permutation;
+}
+
+/**
+ * Estimates the local point density as numNeighbors divided by the volume of the sphere containing the numNeighbors
+ * nearest neighbors of a point (found with a k-d tree). The logarithm of the density is stored, as the density of
+ * e.g. the cosmic web data set spans several orders of magnitude.
+ * @return False if the data set has too few or too many points.
+ */
+static bool computePointDensities(
+        const glm::vec3 *positions, size_t numPoints, int numNeighbors, std::vector<float> &logDensities)
+{
+    // The points are queried in blocks to limit the memory of the neighbor lists.
+    const size_t QUERY_BLOCK_SIZE = size_t(1) << 20;
+    // The k-nearest neighbor query also returns the point itself.
+    const int k = numNeighbors + 1;
+
+    if (numPoints < size_t(k)) {
+        return false;
+    }
+    if (numPoints > size_t(std::numeric_limits<uint32_t>::max())) {
+        sgl::Logfile::get()->writeError("Error in computePointDensities: Too many points for the k-d tree.");
+        return false;
+    }
+
+    auto start = std::chrono::system_clock::now();
+    logDensities.resize(numPoints);
+    KDTree kdTree;
+    kdTree.build(positions, numPoints);
+
+    const float logSphereVolumeFactor = std::log(4.0f / 3.0f * sgl::PI);
+    const float logNumNeighbors = std::log(float(numNeighbors));
+    std::vector<glm::vec3> queryPoints;
+    std::vector<uint32_t> neighborIndices;
+    std::vector<float> neighborDistancesSquared;
+    for (size_t blockStart = 0; blockStart < numPoints; blockStart += QUERY_BLOCK_SIZE) {
+        size_t blockEnd = std::min(blockStart + QUERY_BLOCK_SIZE, numPoints);
+        queryPoints.assign(positions + blockStart, positions + blockEnd);
+        kdTree.findKNearestNeighborsBatched(queryPoints, k, neighborIndices, &neighborDistancesSquared);
+        #pragma omp parallel for
+        for (int64_t i = 0; i < int64_t(blockEnd - blockStart); i++) {
+            // Duplicate points would have an infinite density.
+            float radiusSquared = std::max(neighborDistancesSquared[i * k + k - 1], 1e-12f);
+            logDensities[blockStart + i] = logNumNeighbors - logSphereVolumeFactor - 1.5f * std::log(radiusSquared);
+        }
+    }
+
+    auto end = std::chrono::system_clock::now();
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+    sgl::Logfile::get()->writeInfo(std::string() + "Computational time to estimate the point density ("
+            + std::to_string(numNeighbors) + " neighbors): " + std::to_string(elapsed.count()));
+    return true;
+}
 
 void convertPointDataSetToBinmesh(
         const std::string &inputFilename,
@@ -43,7 +184,16 @@ void convertPointDataSetToBinmesh(
     sgl::Logfile::get()->writeInfo(std::string() + "Loading point data from \"" + inputFilename + "\"...");
 
     pl::ParticleModel particleModel;
-    if (boost::ends_with(inputFilename, "timestep.xml")) {
+    if (pl::is_cosmic_web_brick_set(pl::FileName(inputFilename))) {
+        std::vector<pl::FileName> bricks = pl::find_cosmic_web_bricks(pl::FileName(inputFilename));
+        if (bricks.empty()) {
+            sgl::Logfile::get()->writeError(
+                    std::string() + "Error in convertPointDataSetToBinmesh: No cosmic web bricks found for \""
+                    + inputFilename + "\"!");
+            return;
+        }
+        pl::import_cosmic_web_bricks(bricks, particleModel);
+    } else if (boost::ends_with(inputFilename, "timestep.xml")) {
         pl::import_uintah(pl::FileName(inputFilename), particleModel);
     } else if (boost::ends_with(inputFilename, ".dat")) {
         pl::import_cosmic_web(pl::FileName(inputFilename), particleModel);
@@ -89,20 +239,13 @@ void convertPointDataSetToBinmesh(
     BinarySubMesh &binarySubmesh = binaryMesh.submeshes.at(0);
     binarySubmesh.vertexMode = sgl::VERTEX_MODE_POINTS;
 
-    BinaryMeshAttribute positionAttribute;
-    positionAttribute.name = "vertexPosition";
-    positionAttribute.attributeFormat = sgl::ATTRIB_FLOAT;
-    positionAttribute.numComponents = 3;
-    positionAttribute.data.resize(numPoints * sizeof(glm::vec3));
-    memcpy(&positionAttribute.data.front(), positions->data.data(), numPoints * sizeof(glm::vec3));
-    binarySubmesh.attributes.push_back(positionAttribute);
-
-    BinaryMeshAttribute vertexAttribute;
-    vertexAttribute.name = "vertexAttribute0";
-    vertexAttribute.attributeFormat = sgl::ATTRIB_UNSIGNED_SHORT;
-    vertexAttribute.numComponents = 1;
     std::vector<uint16_t> vertexAttributeData(numPoints, 0u); // Just zero if no other attribute exists
-    if (particleModel.find("velocities") != particleModel.end()) {
+    if (particleModel.find("velocity_magnitudes") != particleModel.end()) {
+        // Merged bricks of the cosmic web data set (the magnitudes are computed while loading).
+        auto velocityMagnitudes = static_cast<pl::DataT<float>*>(particleModel["velocity_magnitudes"].get());
+        assert(numPoints == velocityMagnitudes->size());
+        packUnorm16Array(velocityMagnitudes->data, vertexAttributeData);
+    } else if (particleModel.find("velocities") != particleModel.end()) {
         // Cosmic web data set.
         // Compute velocity magnitudes as the vertex attribute.
         auto velocities = static_cast<pl::DataT<float>*>(particleModel["velocities"].get());
@@ -133,7 +276,54 @@ void convertPointDataSetToBinmesh(
             velocityMagnitudes[i] = glm::length(glm::vec3(uValues[i], vValues[i], wValues[i]));
         }
         packUnorm16Array(velocityMagnitudes, vertexAttributeData);
+    } else if (getPointDataSetDensityNeighbors() > 0) {
+        // No attribute exists, so the point density is used.
+        std::vector<float> logDensities;
+        if (computePointDensities(positionValues, numPoints, getPointDataSetDensityNeighbors(), logDensities)) {
+            packUnorm16Array(logDensities, vertexAttributeData);
+        }
     }
+
+    // Both the LOD hierarchy and the Morton order reorder the points. The LOD levels are sorted by Morton code, too.
+    if (numPoints > size_t(std::numeric_limits<uint32_t>::max())) {
+        if (getPointDataSetLod() || getPointDataSetMortonSort()) {
+            sgl::Logfile::get()->writeError(
+                    "Error in convertPointDataSetToBinmesh: Too many points for reordering the points.");
+        }
+    } else if (getPointDataSetLod()) {
+        PointLodHierarchy lodHierarchy;
+        buildPointLodHierarchy(positionValues, numPoints, vertexAttributeData, lodHierarchy);
+        addPointLodUniforms(lodHierarchy, binarySubmesh);
+    } else if (getPointDataSetMortonSort()) {
+        auto startSort = std::chrono::system_clock::now();
+        sgl::AABB3 normalizedAabb;
+        normalizedAabb.combine((aabb.getMinimum() - aabb.getCenter()) / largestAxis);
+        normalizedAabb.combine((aabb.getMaximum() - aabb.getCenter()) / largestAxis);
+        std::vector<uint32_t> mortonPermutation = sortPointsByMortonCode(positionValues, numPoints, normalizedAabb);
+        std::vector<uint16_t> sortedVertexAttributeData(numPoints);
+        #pragma omp parallel for
+        for (int64_t i = 0; i < int64_t(numPoints); i++) {
+            sortedVertexAttributeData[i] = vertexAttributeData[mortonPermutation[i]];
+        }
+        vertexAttributeData.swap(sortedVertexAttributeData);
+        auto endSort = std::chrono::system_clock::now();
+        auto elapsedSort = std::chrono::duration_cast<std::chrono::milliseconds>(endSort - startSort);
+        sgl::Logfile::get()->writeInfo(std::string() + "Computational time to sort the points by Morton code: "
+                + std::to_string(elapsedSort.count()));
+    }
+
+    BinaryMeshAttribute positionAttribute;
+    positionAttribute.name = "vertexPosition";
+    positionAttribute.attributeFormat = sgl::ATTRIB_FLOAT;
+    positionAttribute.numComponents = 3;
+    positionAttribute.data.resize(numPoints * sizeof(glm::vec3));
+    memcpy(&positionAttribute.data.front(), positions->data.data(), numPoints * sizeof(glm::vec3));
+    binarySubmesh.attributes.push_back(positionAttribute);
+
+    BinaryMeshAttribute vertexAttribute;
+    vertexAttribute.name = "vertexAttribute0";
+    vertexAttribute.attributeFormat = sgl::ATTRIB_UNSIGNED_SHORT;
+    vertexAttribute.numComponents = 1;
     vertexAttribute.data.resize(vertexAttributeData.size() * sizeof(uint16_t));
     memcpy(&vertexAttribute.data.front(), &vertexAttributeData.front(), vertexAttributeData.size() * sizeof(uint16_t));
     binarySubmesh.attributes.push_back(vertexAttribute);
@@ -29,10 +29,19 @@
 #ifndef PIXELSYNCOIT_POINTFILELOADER_HPP
 #define PIXELSYNCOIT_POINTFILELOADER_HPP
 
+#include <string>
+
 /**
  * File associations:
  * - timestep.xml -> uintah data set
- * - .dat -> cosmic_web data set
+ * - .dat -> cosmic_web data set (single brick)
+ * - Directory or wildcard pattern (e.g. "CosmicWeb/*.dat") -> all bricks of the cosmic_web data set merged into one
+ *   point set
+ * Unless the setting "pointDataSet-lod" is false, a level of detail hierarchy of the points is built and stored in
+ * the binmesh (see PointLod.hpp). Otherwise, if the setting "pointDataSet-mortonSort" is set, the points are sorted by
+ * their Morton code for better locality.
+ * If the data set has no attribute and the setting "pointDataSet-densityNeighbors" is set to k > 0, the logarithm of
+ * the local point density (estimated from the distance to the k-th nearest neighbor) is stored as the attribute.
  * @param inputFilename The file name of the input data set.
  * @param binaryFilename: The file name of the binary output file.
  */
@@ -40,4 +49,18 @@ void convertPointDataSetToBinmesh(
         const std::string &inputFilename,
         const std::string &binaryFilename);
 
+/// @return The value of the setting "pointDataSet-mortonSort" (false if not set).
+bool getPointDataSetMortonSort();
+/// @return The value of the setting "pointDataSet-lod" (true if not set).
+bool getPointDataSetLod();
+/// @return The value of the setting "pointDataSet-densityNeighbors" (0, i.e., no density attribute, if not set).
+int getPointDataSetDensityNeighbors();
+
+/**
+ * The derived data cache only checks the size and modification time of a single source file. For brick sets (see
+ * above), this returns a string containing the number of bricks, their total size and the latest modification time,
+ * such that changes to the bricks create a new artifact. For all other data sets, an empty string is returned.
+ */
+std::string getPointDataSetSourceSignature(const std::string &inputFilename);
+
 #endif //PIXELSYNCOIT_POINTFILELOADER_HPP
@@ -0,0 +1,444 @@
+//
+// Created by agent on 19.10.26.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cfloat>
+#include <cstring>
+
+#include <Utils/File/Logfile.hpp>
+
+#include "PointLod.hpp"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/// Number of bits per axis of the Morton codes, i.e., the finest possible grid has 2^21 voxels per axis.
+const int POINT_LOD_MORTON_BITS = 21;
+/// A grid is only used as a level if it has at most this fraction of the points of the next finer level.
+const float POINT_LOD_MAX_LEVEL_RATIO = 0.5f;
+/// No coarser levels are created once a level has at most this number of points.
+const size_t POINT_LOD_MIN_LEVEL_POINTS = 4096;
+
+// Spreads the lower 21 bits of v to every third bit
+static inline uint64_t expandBits21(uint64_t v)
+{
+    v &= 0x1FFFFFull;
+    v = (v | (v << 32)) & 0x1F00000000FFFFull;
+    v = (v | (v << 16)) & 0x1F0000FF0000FFull;
+    v = (v | (v << 8)) & 0x100F00F00F00F00Full;
+    v = (v | (v << 4)) & 0x10C30C30C30C30C3ull;
+    v = (v | (v << 2)) & 0x1249249249249249ull;
+    return v;
+}
+
+static inline int highestBitIndex(uint64_t v)
+{
+#if defined(__GNUC__)
+    return 63 - __builtin_clzll(v);
+#else
+    int index = 0;
+    while (v >>= 1) {
+        index++;
+    }
+    return index;
+#endif
+}
+
+/**
+ * Sorts the passed array in parallel: The array is split into one block per thread, the blocks are sorted and then
+ * merged pairwise in parallel.
+ */
+template<class T>
+static void parallelSort(std::vector<T> &values)
+{
+#ifdef _OPENMP
+    const size_t numBlocks = size_t(std::max(omp_get_max_threads(), 1));
+#else
+    const size_t numBlocks = 1;
+#endif
+    const size_t blockSize = (values.size() + numBlocks - 1) / std::max(numBlocks, size_t(1));
+    if (numBlocks == 1 || blockSize == 0) {
+        std::sort(values.begin(), values.end());
+        return;
+    }
+
+    #pragma omp parallel for schedule(static, 1)
+    for (int64_t block = 0; block < int64_t(numBlocks); block++) {
+        size_t begin = std::min(size_t(block) * blockSize, values.size());
+        size_t end = std::min(begin + blockSize, values.size());
+        std::sort(values.begin() + begin, values.begin() + end);
+    }
+    for (size_t mergeSize = blockSize; mergeSize < values.size(); mergeSize *= 2) {
+        const int64_t numMerges = int64_t((values.size() + 2 * mergeSize - 1) / (2 * mergeSize));
+        #pragma omp parallel for schedule(static, 1)
+        for (int64_t merge = 0; merge < numMerges; merge++) {
+            size_t begin = size_t(merge) * 2 * mergeSize;
+            size_t middle = std::min(begin + mergeSize, values.size());
+            size_t end = std::min(begin + 2 * mergeSize, values.size());
+            std::inplace_merge(values.begin() + begin, values.begin() + middle, values.begin() + end);
+        }
+    }
+}
+
+/**
+ * @return The start indices of the runs of equal values of code >> shift in the sorted array of Morton codes.
+ */
+static std::vector<uint32_t> computeVoxelStarts(
+        const std::vector<std::pair<uint64_t, uint32_t>> &mortonCodes, int shift, size_t numVoxels)
+{
+    const size_t numPoints = mortonCodes.size();
+    const size_t numBlocks = 256;
+    const size_t blockSize = (numPoints + numBlocks - 1) / numBlocks;
+    std::vector<std::vector<uint32_t>> blockVoxelStarts(numBlocks);
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int64_t block = 0; block < int64_t(numBlocks); block++) {
+        size_t begin = std::min(size_t(block) * blockSize, numPoints);
+        size_t end = std::min(begin + blockSize, numPoints);
+        std::vector<uint32_t> &voxelStarts = blockVoxelStarts.at(block);
+        for (size_t i = begin; i < end; i++) {
+            if (i == 0 || (mortonCodes[i].first >> shift) != (mortonCodes[i - 1].first >> shift)) {
+                voxelStarts.push_back(uint32_t(i));
+            }
+        }
+    }
+
+    std::vector<uint32_t> voxelStarts;
+    voxelStarts.reserve(numVoxels + 1);
+    for (const std::vector<uint32_t> &blockStarts : blockVoxelStarts) {
+        voxelStarts.insert(voxelStarts.end(), blockStarts.begin(), blockStarts.end());
+    }
+    voxelStarts.push_back(uint32_t(numPoints));
+    return voxelStarts;
+}
+
+std::vector<uint32_t> buildPointLodHierarchy(
+        glm::vec3 *positions, size_t numPoints, std::vector<uint16_t> &attributeValues,
+        PointLodHierarchy &hierarchy)
+{
+    auto startTime = std::chrono::system_clock::now();
+
+    const bool hasAttribute = attributeValues.size() == numPoints;
+    hierarchy = PointLodHierarchy();
+    if (numPoints == 0) {
+        return std::vector<uint32_t>();
+    }
+
+    // Cubic grid over the bounding box
+    glm::vec3 minimum(FLT_MAX), maximum(-FLT_MAX);
+    #pragma omp parallel
+    {
+        glm::vec3 threadMinimum(FLT_MAX), threadMaximum(-FLT_MAX);
+        #pragma omp for nowait
+        for (int64_t i = 0; i < int64_t(numPoints); i++) {
+            threadMinimum = glm::min(threadMinimum, positions[i]);
+            threadMaximum = glm::max(threadMaximum, positions[i]);
+        }
+        #pragma omp critical
+        {
+            minimum = glm::min(minimum, threadMinimum);
+            maximum = glm::max(maximum, threadMaximum);
+        }
+    }
+    glm::vec3 extent = maximum - minimum;
+    const float gridSize = std::max(std::max(extent.x, extent.y), std::max(extent.z, 1e-6f));
+    const float gridResolution = float(1u << POINT_LOD_MORTON_BITS);
+    const uint32_t maxCell = (1u << POINT_LOD_MORTON_BITS) - 1u;
+
+    std::vector<std::pair<uint64_t, uint32_t>> mortonCodes(numPoints);
+    #pragma omp parallel for
+    for (int64_t i = 0; i < int64_t(numPoints); i++) {
+        glm::vec3 cell = (positions[i] - minimum) / gridSize * gridResolution;
+        uint64_t x = std::min(uint32_t(std::max(cell.x, 0.0f)), maxCell);
+        uint64_t y = std::min(uint32_t(std::max(cell.y, 0.0f)), maxCell);
+        uint64_t z = std::min(uint32_t(std::max(cell.z, 0.0f)), maxCell);
+        mortonCodes[i] = std::make_pair(
+                (expandBits21(x) << 2) | (expandBits21(y) << 1) | expandBits21(z), uint32_t(i));
+    }
+    parallelSort(mortonCodes);
+
+    // Number of occupied voxels for all grid resolutions 2^r: Two consecutive points lie in different voxels of the
+    // grid with resolution 2^r iff their codes differ in the highest 3*r bits.
+    std::vector<size_t> numVoxels(POINT_LOD_MORTON_BITS + 1, 0);
+    #pragma omp parallel
+    {
+        std::vector<size_t> threadNumBoundaries(POINT_LOD_MORTON_BITS + 1, 0);
+        #pragma omp for nowait
+        for (int64_t i = 1; i < int64_t(numPoints); i++) {
+            uint64_t difference = mortonCodes[i].first ^ mortonCodes[i - 1].first;
+            if (difference != 0) {
+                threadNumBoundaries[POINT_LOD_MORTON_BITS - highestBitIndex(difference) / 3]++;
+            }
+        }
+        #pragma omp critical
+        {
+            for (int r = 0; r <= POINT_LOD_MORTON_BITS; r++) {
+                numVoxels[r] += threadNumBoundaries[r];
+            }
+        }
+    }
+    numVoxels[0] += 1;
+    for (int r = 1; r <= POINT_LOD_MORTON_BITS; r++) {
+        numVoxels[r] += numVoxels[r - 1];
+    }
+
+    // Select the grid resolutions of the coarse levels (from fine to coarse).
+    std::vector<int> levelResolutions;
+    size_t lastNumPoints = numPoints;
+    for (int r = POINT_LOD_MORTON_BITS; r >= 0 && lastNumPoints > POINT_LOD_MIN_LEVEL_POINTS; r--) {
+        if (float(numVoxels[r]) <= float(lastNumPoints) * POINT_LOD_MAX_LEVEL_RATIO) {
+            levelResolutions.push_back(r);
+            lastNumPoints = numVoxels[r];
+        }
+    }
+    const size_t numCoarseLevels = levelResolutions.size();
+    const size_t numLevels = numCoarseLevels + 1;
+
+    // Coarse levels from fine to coarse: The representatives of a voxel are chosen from the representatives of the
+    // next finer level (or all points for the finest coarse level).
+    std::vector<std::vector<uint32_t>> levelVoxelStarts(numCoarseLevels);
+    std::vector<std::vector<uint32_t>> levelRepresentatives(numCoarseLevels);
+    std::vector<std::vector<uint32_t>> levelNodeNumPoints(numCoarseLevels);
+    std::vector<std::vector<uint16_t>> levelNodeStatistics(numCoarseLevels);
+    for (size_t k = 0; k < numCoarseLevels; k++) {
+        const int shift = 3 * (POINT_LOD_MORTON_BITS - levelResolutions.at(k));
+        std::vector<uint32_t> &voxelStarts = levelVoxelStarts.at(k);
+        voxelStarts = computeVoxelStarts(mortonCodes, shift, numVoxels[levelResolutions.at(k)]);
+        const size_t numLevelVoxels = voxelStarts.size() - 1;
+        const std::vector<uint32_t> *finerVoxelStarts = k == 0 ? nullptr : &levelVoxelStarts.at(k - 1);
+        const std::vector<uint32_t> *finerRepresentatives = k == 0 ? nullptr : &levelRepresentatives.at(k - 1);
+
+        std::vector<uint32_t> &representatives = levelRepresentatives.at(k);
+        std::vector<uint32_t> &nodeNumPoints = levelNodeNumPoints.at(k);
+        std::vector<uint16_t> &nodeStatistics = levelNodeStatistics.at(k);
+        representatives.resize(numLevelVoxels);
+        nodeNumPoints.resize(numLevelVoxels);
+        nodeStatistics.resize(numLevelVoxels * 3);
+
+        #pragma omp parallel for schedule(dynamic, 1024)
+        for (int64_t v = 0; v < int64_t(numLevelVoxels); v++) {
+            const uint32_t begin = voxelStarts[v], end = voxelStarts[v + 1];
+            glm::dvec3 positionSum(0.0);
+            uint64_t attributeSum = 0;
+            uint16_t attributeMin = 0xFFFFu, attributeMax = 0u;
+            for (uint32_t i = begin; i < end; i++) {
+                uint32_t pointIndex = mortonCodes[i].second;
+                positionSum += glm::dvec3(positions[pointIndex]);
+                if (hasAttribute) {
+                    uint16_t value = attributeValues[pointIndex];
+                    attributeSum += value;
+                    attributeMin = std::min(attributeMin, value);
+                    attributeMax = std::max(attributeMax, value);
+                }
+            }
+            const uint32_t count = end - begin;
+            glm::vec3 centroid = glm::vec3(positionSum / double(count));
+
+            // Representative: Candidate closest to the centroid (lowest sorted index for equal distances)
+            uint32_t representative = begin;
+            float minDistanceSquared = FLT_MAX;
+            auto testCandidate = [&](uint32_t sortedIndex) {
+                glm::vec3 difference = positions[mortonCodes[sortedIndex].second] - centroid;
+                float distanceSquared = glm::dot(difference, difference);
+                if (distanceSquared < minDistanceSquared) {
+                    minDistanceSquared = distanceSquared;
+                    representative = sortedIndex;
+                }
+            };
+            if (finerVoxelStarts == nullptr) {
+                for (uint32_t i = begin; i < end; i++) {
+                    testCandidate(i);
+                }
+            } else {
+                // The finer voxels are nested in this voxel, i.e., their starts are in [begin, end).
+                auto it = std::lower_bound(finerVoxelStarts->begin(), finerVoxelStarts->end() - 1, begin);
+                for (; it != finerVoxelStarts->end() - 1 && *it < end; ++it) {
+                    testCandidate(finerRepresentatives->at(it - finerVoxelStarts->begin()));
+                }
+            }
+
+            representatives[v] = representative;
+            nodeNumPoints[v] = count;
+            nodeStatistics[v * 3] = hasAttribute ? uint16_t((attributeSum + count / 2) / count) : 0u;
+            nodeStatistics[v * 3 + 1] = hasAttribute ? attributeMin : 0u;
+            nodeStatistics[v * 3 + 2] = hasAttribute ? attributeMax : 0u;
+        }
+    }
+
+    // Level index (0 = coarsest) of each point in Morton order. As the levels are nested, the coarsest level a point
+    // is a representative of is written last.
+    std::vector<uint8_t> pointLevels(numPoints, uint8_t(numLevels - 1));
+    for (size_t k = 0; k < numCoarseLevels; k++) {
+        const uint8_t levelIndex = uint8_t(numCoarseLevels - 1 - k);
+        const std::vector<uint32_t> &representatives = levelRepresentatives.at(k);
+        #pragma omp parallel for
+        for (int64_t v = 0; v < int64_t(representatives.size()); v++) {
+            pointLevels[representatives[v]] = levelIndex;
+        }
+    }
+
+    // Stable counting sort by the level, i.e., the Morton order is kept within the levels.
+    std::vector<uint32_t> levelOffsets(numLevels + 1, 0);
+    for (size_t i = 0; i < numPoints; i++) {
+        levelOffsets[pointLevels[i] + 1]++;
+    }
+    for (size_t level = 0; level < numLevels; level++) {
+        levelOffsets[level + 1] += levelOffsets[level];
+    }
+    std::vector<uint32_t> newIndices(numPoints);
+    std::vector<uint32_t> levelCursors(levelOffsets.begin(), levelOffsets.end() - 1);
+    for (size_t i = 0; i < numPoints; i++) {
+        newIndices[i] = levelCursors[pointLevels[i]]++;
+    }
+    std::vector<uint8_t>().swap(pointLevels);
+
+    hierarchy.levels.resize(numLevels);
+    for (size_t level = 0; level < numLevels; level++) {
+        PointLodLevel &lodLevel = hierarchy.levels.at(level);
+        lodLevel.numPoints = levelOffsets[level + 1];
+        lodLevel.voxelSize = level + 1 == numLevels ? 0.0f
+                : gridSize / float(1u << levelResolutions.at(numCoarseLevels - 1 - level));
+    }
+
+    // Node statistics in the order of the representatives in the level prefixes
+    hierarchy.nodeOffsets.resize(numCoarseLevels + 1, 0);
+    for (size_t level = 0; level < numCoarseLevels; level++) {
+        hierarchy.nodeOffsets.at(level + 1) = hierarchy.nodeOffsets.at(level) + hierarchy.levels.at(level).numPoints;
+    }
+    hierarchy.nodeNumPoints.resize(hierarchy.nodeOffsets.back());
+    hierarchy.nodeAttributeStatistics.resize(hierarchy.nodeOffsets.back() * 3);
+    for (size_t level = 0; level < numCoarseLevels; level++) {
+        const size_t k = numCoarseLevels - 1 - level;
+        const size_t nodeOffset = hierarchy.nodeOffsets.at(level);
+        const std::vector<uint32_t> &representatives = levelRepresentatives.at(k);
+        #pragma omp parallel for
+        for (int64_t v = 0; v < int64_t(representatives.size()); v++) {
+            size_t nodeIndex = nodeOffset + newIndices[representatives[v]];
+            hierarchy.nodeNumPoints[nodeIndex] = levelNodeNumPoints.at(k)[v];
+            for (int j = 0; j < 3; j++) {
+                hierarchy.nodeAttributeStatistics[nodeIndex * 3 + j] = levelNodeStatistics.at(k)[v * 3 + j];
+            }
+        }
+    }
+
+    // Apply the permutation to the points
+    std::vector<uint32_t> permutation(numPoints);
+    #pragma omp parallel for
+    for (int64_t i = 0; i < int64_t(numPoints); i++) {
+        permutation[newIndices[i]] = mortonCodes[i].second;
+    }
+    std::vector<std::pair<uint64_t, uint32_t>>().swap(mortonCodes);
+    std::vector<glm::vec3> sortedPositions(numPoints);
+    #pragma omp parallel for
+    for (int64_t i = 0; i < int64_t(numPoints); i++) {
+        sortedPositions[i] = positions[permutation[i]];
+    }
+    memcpy(positions, &sortedPositions.front(), numPoints * sizeof(glm::vec3));
+    if (hasAttribute) {
+        std::vector<uint16_t> sortedAttributeValues(numPoints);
+        #pragma omp parallel for
+        for (int64_t i = 0; i < int64_t(numPoints); i++) {
+            sortedAttributeValues[i] = attributeValues[permutation[i]];
+        }
+        attributeValues.swap(sortedAttributeValues);
+    }
+
+    auto endTime = std::chrono::system_clock::now();
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime);
+    sgl::Logfile::get()->writeInfo(std::string() + "Computational time to build the point LOD hierarchy: "
+            + std::to_string(elapsed.count()));
+    for (size_t level = 0; level < numLevels; level++) {
+        sgl::Logfile::get()->writeInfo(std::string() + "Point LOD level " + std::to_string(level) + ": "
+                + std::to_string(hierarchy.levels.at(level).numPoints) + " points (voxel size "
+                + std::to_string(hierarchy.levels.at(level).voxelSize) + ")");
+    }
+
+    return permutation;
+}
+
+
+template<class T>
+static void addUniform(
+        const std::string &name, sgl::VertexAttributeFormat format, uint32_t numComponents,
+        const std::vector<T> &values, BinarySubMesh &submesh)
+{
+    BinaryMeshUniform uniform;
+    uniform.name = name;
+    uniform.attributeFormat = format;
+    uniform.numComponents = numComponents;
+    uniform.data.resize(values.size() * sizeof(T));
+    if (!values.empty()) {
+        memcpy(&uniform.data.front(), &values.front(), values.size() * sizeof(T));
+    }
+    submesh.uniforms.push_back(uniform);
+}
+
+void addPointLodUniforms(const PointLodHierarchy &hierarchy, BinarySubMesh &submesh)
+{
+    std::vector<uint32_t> levelNumPoints;
+    std::vector<float> levelVoxelSizes;
+    for (const PointLodLevel &level : hierarchy.levels) {
+        levelNumPoints.push_back(level.numPoints);
+        levelVoxelSizes.push_back(level.voxelSize);
+    }
+    addUniform("pointLodLevelNumPoints", sgl::ATTRIB_UNSIGNED_INT, 1, levelNumPoints, submesh);
+    addUniform("pointLodLevelVoxelSizes", sgl::ATTRIB_FLOAT, 1, levelVoxelSizes, submesh);
+    addUniform("pointLodNodeNumPoints", sgl::ATTRIB_UNSIGNED_INT, 1, hierarchy.nodeNumPoints, submesh);
+    addUniform(
+            "pointLodNodeAttributeStatistics", sgl::ATTRIB_UNSIGNED_SHORT, 3,
+            hierarchy.nodeAttributeStatistics, submesh);
+}
+
+std::vector<PointLodLevel> readPointLodLevels(const BinarySubMesh &submesh)
+{
+    const BinaryMeshUniform *numPointsUniform = nullptr;
+    const BinaryMeshUniform *voxelSizesUniform = nullptr;
+    for (const BinaryMeshUniform &uniform : submesh.uniforms) {
+        if (uniform.name == "pointLodLevelNumPoints") {
+            numPointsUniform = &uniform;
+        } else if (uniform.name == "pointLodLevelVoxelSizes") {
+            voxelSizesUniform = &uniform;
+        }
+    }
+
+    std::vector<PointLodLevel> levels;
+    if (numPointsUniform == nullptr || voxelSizesUniform == nullptr
+            || numPointsUniform->data.size() != voxelSizesUniform->data.size()) {
+        return levels;
+    }
+    levels.resize(numPointsUniform->data.size() / sizeof(uint32_t));
+    for (size_t i = 0; i < levels.size(); i++) {
+        memcpy(&levels.at(i).numPoints, &numPointsUniform->data.at(i * sizeof(uint32_t)), sizeof(uint32_t));
+        memcpy(&levels.at(i).voxelSize, &voxelSizesUniform->data.at(i * sizeof(float)), sizeof(float));
+    }
+    return levels;
+}
+
+int selectPointLodLevel(
+        const std::vector<PointLodLevel> &levels, const sgl::AABB3 &boundingBox, const glm::mat4 &modelViewMatrix,
+        const glm::mat4 &projectionMatrix, int viewportHeight, float maxVoxelSizePixels)
+{
+    if (levels.empty()) {
+        return -1;
+    }
+
+    // Distance of the camera to the closest point of the bounding box (in model space, assuming uniform scaling)
+    glm::vec3 cameraPosition = glm::vec3(glm::inverse(modelViewMatrix) * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+    glm::vec3 closestPoint = glm::clamp(cameraPosition, boundingBox.getMinimum(), boundingBox.getMaximum());
+    float distance = glm::length(closestPoint - cameraPosition);
+    if (distance <= 0.0f) {
+        return int(levels.size()) - 1;
+    }
+
+    // Height in pixels of an object of size 1 at distance 1 (perspective projection)
+    float pixelsPerUnit = projectionMatrix[1][1] * 0.5f * float(viewportHeight);
+    for (size_t level = 0; level + 1 < levels.size(); level++) {
+        if (levels.at(level).voxelSize * pixelsPerUnit / distance <= maxVoxelSizePixels) {
+            return int(level);
+        }
+    }
+    return int(levels.size()) - 1;
+}
@@ -0,0 +1,68 @@
+//
+// Created by agent on 19.10.26.
+//
+
+#ifndef PIXELSYNCOIT_POINTLOD_HPP
+#define PIXELSYNCOIT_POINTLOD_HPP
+
+#include <vector>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <Math/Geometry/AABB3.hpp>
+
+#include "../MeshSerializer.hpp"
+
+/// Version of the LOD data stored in point binmesh files (part of the key of the derived data cache).
+const int POINT_LOD_FORMAT_VERSION = 1;
+
+/**
+ * Level of detail hierarchy of a point data set. The levels are built by sampling one representative point per voxel
+ * of successively finer regular grids over the bounding box. The representatives of a level are a subset of the
+ * representatives of the next finer level, so the points can be stored sorted by the coarsest level they are part of.
+ * Then, level k consists of the first levels[k].numPoints points, i.e., the points added by each level can be uploaded
+ * as a separate chunk (see MeshRenderer::pointLodChunks). The last level contains all points. Within a level, the
+ * points are sorted by their Morton code.
+ *
+ * The representative of a voxel is the point closest to the centroid of all points in the voxel (for the finer levels
+ * restricted to the representatives of the next finer level). Additionally, the number of points and the mean,
+ * minimum and maximum of the attribute of the points in each voxel ("node") are accumulated for all levels but the
+ * last one.
+ */
+struct PointLodHierarchy
+{
+    std::vector<PointLodLevel> levels;
+    /// The node of level k represented by point i (i < levels[k].numPoints) is stored at nodeOffsets[k] + i.
+    std::vector<size_t> nodeOffsets;
+    std::vector<uint32_t> nodeNumPoints;
+    /// Mean, minimum and maximum of the (unorm16) attribute per node.
+    std::vector<uint16_t> nodeAttributeStatistics;
+};
+
+/**
+ * Builds the LOD hierarchy of the passed points. The positions and the attribute values (may be empty) are reordered
+ * as described for PointLodHierarchy.
+ * @return The permutation applied (new index -> old index).
+ */
+std::vector<uint32_t> buildPointLodHierarchy(
+        glm::vec3 *positions, size_t numPoints, std::vector<uint16_t> &attributeValues,
+        PointLodHierarchy &hierarchy);
+
+/**
+ * Stores the levels and node statistics as uniforms of the passed submesh ("pointLodLevelNumPoints",
+ * "pointLodLevelVoxelSizes", "pointLodNodeNumPoints" and "pointLodNodeAttributeStatistics").
+ */
+void addPointLodUniforms(const PointLodHierarchy &hierarchy, BinarySubMesh &submesh);
+
+/// @return The levels stored in the uniforms of the passed submesh (empty if the submesh has no LOD data).
+std::vector<PointLodLevel> readPointLodLevels(const BinarySubMesh &submesh);
+
+/**
+ * Selects the coarsest level whose voxels appear at most "maxVoxelSizePixels" pixels large at the point of the
+ * bounding box closest to the camera (i.e., the level is chosen conservatively for the whole data set).
+ * @return The index of the selected level (-1 if "levels" is empty).
+ */
+int selectPointLodLevel(
+        const std::vector<PointLodLevel> &levels, const sgl::AABB3 &boundingBox, const glm::mat4 &modelViewMatrix,
+        const glm::mat4 &projectionMatrix, int viewportHeight, float maxVoxelSizePixels);
+
+#endif //PIXELSYNCOIT_POINTLOD_HPP
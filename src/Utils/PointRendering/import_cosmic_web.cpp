@@ -2,6 +2,11 @@
 #include <algorithm>
 #include <limits>
 #include <fstream>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <boost/filesystem.hpp>
+#include "../MappedFile.hpp"
 #include "import_cosmic_web.h"
 
 using namespace pl;
@@ -32,62 +37,208 @@ std::ostream& operator<<(std::ostream &os, const CosmicWebHeader &h) {
 	return os;
 }
 
-void pl::import_cosmic_web(const FileName &file_name, ParticleModel &model) {
-	std::ifstream fin(file_name.c_str(), std::ios::binary);
+#pragma pack()
+
+// The cosmic web bricking is 8^3
+const int COSMIC_WEB_BRICKS_PER_AXIS = 8;
+// Each cell is 768x768x768 units
+const float COSMIC_WEB_BRICK_SIZE = 768.f;
+
+// Compute the brick offset for this file, given in the last 3 numbers of the name
+vec3f cosmic_web_brick_offset(const FileName &file_name) {
+	std::string brick_name = file_name.name();
+	if (brick_name.size() < 3) {
+		throw std::runtime_error("Invalid cosmic web brick file name " + file_name.file_name);
+	}
+	brick_name = brick_name.substr(brick_name.size() - 3, 3);
+	const int brick_number = std::stoi(brick_name);
+
+	const int brick_z = brick_number / (COSMIC_WEB_BRICKS_PER_AXIS * COSMIC_WEB_BRICKS_PER_AXIS);
+	const int brick_y = (brick_number / COSMIC_WEB_BRICKS_PER_AXIS) % COSMIC_WEB_BRICKS_PER_AXIS;
+	const int brick_x = brick_number % COSMIC_WEB_BRICKS_PER_AXIS;
+	return vec3f(COSMIC_WEB_BRICK_SIZE * brick_x, COSMIC_WEB_BRICK_SIZE * brick_y,
+			COSMIC_WEB_BRICK_SIZE * brick_z);
+}
 
+CosmicWebHeader read_cosmic_web_header(const FileName &file_name) {
+	std::ifstream fin(file_name.c_str(), std::ios::binary);
 	if (!fin.good()) {
 		throw std::runtime_error("could not open particle data file " + file_name.file_name);
 	}
-
 	CosmicWebHeader header;
 	if (!fin.read(reinterpret_cast<char*>(&header), sizeof(CosmicWebHeader))) {
-		throw std::runtime_error("Failed to read header");
+		throw std::runtime_error("Failed to read header of " + file_name.file_name);
 	}
+	if (header.np_local < 0) {
+		throw std::runtime_error("Invalid particle count in " + file_name.file_name);
+	}
+	return header;
+}
 
-	std::cout << "Cosmic Web Header: " << header << "\n";
-
-	// Compute the brick offset for this file, given in the last 3 numbers of the name
-	std::string brick_name = file_name.name();
-	brick_name = brick_name.substr(brick_name.size() - 3, 3);
-	const int brick_number = std::stoi(brick_name);
-
-	// The cosmic web bricking is 8^3
-	const int brick_z = brick_number / 64;
-	const int brick_y = (brick_number / 8) % 8;
-	const int brick_x = brick_number % 8;
-	std::cout << "Brick position = { " << brick_x << ", " << brick_y
-		<< ", " << brick_z << " }\n";
+// Maps the brick into memory and calls "fn(i, position, velocity)" for each particle. Only the
+// brick currently processed needs to be resident, the mapping is released when returning.
+template<typename F>
+void for_each_cosmic_web_particle(const FileName &file_name, const CosmicWebHeader &header, const F &fn) {
+	MappedFile mapped_file;
+	if (!mapped_file.open(file_name.file_name)) {
+		throw std::runtime_error("could not open particle data file " + file_name.file_name);
+	}
+	const size_t num_particles = static_cast<size_t>(header.np_local);
+	if (mapped_file.getSize() < sizeof(CosmicWebHeader) + num_particles * 2 * sizeof(vec3f)) {
+		throw std::runtime_error("Cosmic web file " + file_name.file_name + " is truncated");
+	}
+	mapped_file.adviseSequential();
+
+	const vec3f offset = cosmic_web_brick_offset(file_name);
+	const char *particles = mapped_file.getData() + sizeof(CosmicWebHeader);
+	for (size_t i = 0; i < num_particles; ++i) {
+		// The particle data directly follows the packed header, i.e., it is not aligned
+		vec3f pv[2];
+		std::memcpy(pv, particles + i * sizeof(pv), sizeof(pv));
+		fn(i, pv[0] + offset, pv[1]);
+	}
+}
 
-	// Each cell is 768x768x768 units
-	const float step = 768.f;
-	const vec3f offset(step * brick_x, step * brick_y, step * brick_z);
+void pl::import_cosmic_web(const FileName &file_name, ParticleModel &model) {
+	const CosmicWebHeader header = read_cosmic_web_header(file_name);
+	std::cout << "Cosmic Web Header: " << header << "\n";
 
+	const size_t num_particles = static_cast<size_t>(header.np_local);
 	auto positions = std::make_shared<DataT<float>>();
 	auto velocities = std::make_shared<DataT<float>>();
-	positions->data.reserve(header.np_local * 3);
-	velocities->data.reserve(header.np_local * 3);
+	positions->data.resize(num_particles * 3);
+	velocities->data.resize(num_particles * 3);
+	float *pos = positions->data.data();
+	float *vel = velocities->data.data();
+
+	for_each_cosmic_web_particle(file_name, header,
+		[pos, vel](const size_t i, const vec3f &position, const vec3f &velocity) {
+			pos[i * 3] = position.x;
+			pos[i * 3 + 1] = position.y;
+			pos[i * 3 + 2] = position.z;
+			vel[i * 3] = velocity.x;
+			vel[i * 3 + 1] = velocity.y;
+			vel[i * 3 + 2] = velocity.z;
+		});
 
-	std::vector<char> file_data(header.np_local * 2 * sizeof(vec3f), 0);
-	if (!fin.read(file_data.data(), file_data.size())) {
-		throw std::runtime_error("Failed to read cosmic web file");
+	model["positions"] = std::move(positions);
+	model["velocities"] = std::move(velocities);
+}
+
+// Matches a file name against a pattern with the wildcards '*' and '?'
+bool match_wildcard(const char *pattern, const char *str) {
+	const char *star = nullptr;
+	const char *star_str = nullptr;
+	while (*str) {
+		if (*pattern == '?' || *pattern == *str) {
+			++pattern;
+			++str;
+		} else if (*pattern == '*') {
+			star = pattern++;
+			star_str = str;
+		} else if (star) {
+			pattern = star + 1;
+			str = ++star_str;
+		} else {
+			return false;
+		}
+	}
+	while (*pattern == '*') {
+		++pattern;
 	}
+	return *pattern == '\0';
+}
+
+bool pl::is_cosmic_web_brick_set(const FileName &brick_set) {
+	const std::string &name = brick_set.file_name;
+	return name.find_first_of("*?") != std::string::npos || boost::filesystem::is_directory(name);
+}
 
-	vec3f *vecs = reinterpret_cast<vec3f*>(file_data.data());
+std::vector<FileName> pl::find_cosmic_web_bricks(const FileName &brick_set) {
+	FileName directory = brick_set;
+	std::string pattern = "*xv???.dat";
+	if (!boost::filesystem::is_directory(brick_set.file_name)) {
+		directory = brick_set.path();
+		const size_t fnd = brick_set.file_name.rfind("/");
+		pattern = fnd == std::string::npos ? brick_set.file_name : brick_set.file_name.substr(fnd + 1);
+	}
 
-	for (int i = 0; i < header.np_local; ++i) { 
-		const vec3f position = vecs[i * 2] + offset;
-		const vec3f velocity = vecs[i * 2 + 1];
+	std::vector<FileName> bricks;
+	boost::system::error_code error_code;
+	boost::filesystem::directory_iterator it(directory.file_name, error_code), end;
+	if (error_code) {
+		throw std::runtime_error("Failed to open cosmic web brick directory " + directory.file_name);
+	}
+	for (; it != end; ++it) {
+		const std::string name = it->path().filename().string();
+		if (boost::filesystem::is_regular_file(it->path()) && match_wildcard(pattern.c_str(), name.c_str())) {
+			bricks.push_back(directory.join(FileName(name)));
+		}
+	}
+	// Sort by name so the order of the particles doesn't depend on the directory order
+	std::sort(bricks.begin(), bricks.end(), [](const FileName &a, const FileName &b) {
+		return a.file_name < b.file_name;
+	});
+	return bricks;
+}
 
-		positions->data.push_back(position.x);
-		positions->data.push_back(position.y);
-		positions->data.push_back(position.z);
+void pl::import_cosmic_web_bricks(const std::vector<FileName> &bricks, ParticleModel &model) {
+	auto start_time = std::chrono::system_clock::now();
+	const int64_t num_bricks = static_cast<int64_t>(bricks.size());
+
+	// Read the headers first to know where the particles of each brick go in the merged arrays
+	std::vector<CosmicWebHeader> headers(bricks.size());
+	std::vector<size_t> brick_offsets(bricks.size() + 1, 0);
+	for (int64_t b = 0; b < num_bricks; ++b) {
+		headers[b] = read_cosmic_web_header(bricks[b]);
+		// Fail early (and not in the parallel loop) for file names without brick number
+		cosmic_web_brick_offset(bricks[b]);
+		brick_offsets[b + 1] = brick_offsets[b] + static_cast<size_t>(headers[b].np_local);
+	}
+	const size_t num_particles = brick_offsets.back();
+	std::cout << "Importing " << num_particles << " particles from " << bricks.size()
+		<< " cosmic web bricks\n";
 
-		velocities->data.push_back(velocity.x);
-		velocities->data.push_back(velocity.y);
-		velocities->data.push_back(velocity.z);
+	// Only the velocity magnitudes are kept to save 8 bytes per particle
+	auto positions = std::make_shared<DataT<float>>();
+	auto velocity_magnitudes = std::make_shared<DataT<float>>();
+	positions->data.resize(num_particles * 3);
+	velocity_magnitudes->data.resize(num_particles);
+	float *pos = positions->data.data();
+	float *vel_mag = velocity_magnitudes->data.data();
+
+	// Every thread maps one brick at a time, i.e., at most one brick per thread is resident
+	bool success = true;
+	std::string error_message;
+	#pragma omp parallel for schedule(dynamic, 1)
+	for (int64_t b = 0; b < num_bricks; ++b) {
+		try {
+			float *brick_pos = pos + brick_offsets[b] * 3;
+			float *brick_vel_mag = vel_mag + brick_offsets[b];
+			for_each_cosmic_web_particle(bricks[b], headers[b],
+				[brick_pos, brick_vel_mag](const size_t i, const vec3f &position, const vec3f &velocity) {
+					brick_pos[i * 3] = position.x;
+					brick_pos[i * 3 + 1] = position.y;
+					brick_pos[i * 3 + 2] = position.z;
+					brick_vel_mag[i] = std::sqrt(velocity.x * velocity.x + velocity.y * velocity.y
+						+ velocity.z * velocity.z);
+				});
+		} catch (const std::exception &e) {
+			#pragma omp critical
+			{
+				success = false;
+				error_message = e.what();
+			}
+		}
+	}
+	if (!success) {
+		throw std::runtime_error(error_message);
 	}
 
 	model["positions"] = std::move(positions);
-	model["velocities"] = std::move(velocities);
-}
+	model["velocity_magnitudes"] = std::move(velocity_magnitudes);
 
+	auto end_time = std::chrono::system_clock::now();
+	std::cout << "Read cosmic web bricks in "
+		<< std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time).count() << "ms\n";
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <vector>
 #include "types.h"
 
 namespace pl {
@@ -7,5 +8,18 @@ namespace pl {
 // Import a single brick of the cosmic web dataset into the model
 void import_cosmic_web(const FileName &file_name, ParticleModel &model);
 
+// Check if the file name refers to a set of bricks, i.e. is a directory or a
+// pattern with the wildcards '*' and '?' (e.g. "cosmic_web/0.000xv*.dat")
+bool is_cosmic_web_brick_set(const FileName &brick_set);
+
+// Find the brick files of a brick set, sorted by name. For a directory, all
+// files named "*xv???.dat" are used
+std::vector<FileName> find_cosmic_web_bricks(const FileName &brick_set);
+
+// Import all passed bricks (in parallel) into one model. The brick offsets are
+// applied to the positions and, to save memory, only the velocity magnitudes
+// are stored (as "velocity_magnitudes" instead of "velocities")
+void import_cosmic_web_bricks(const std::vector<FileName> &bricks, ParticleModel &model);
+
 }
 
@@ -5,7 +5,13 @@
 #include <cstdlib>
 #include <cstdio>
 #include <limits>
+#include <map>
+#include <memory>
+#include <chrono>
+#include <cstring>
+#include <cstdint>
 #include "tinyxml2.h"
+#include "../MappedFile.hpp"
 #include "import_uintah.h"
 
 using namespace pl;
@@ -58,94 +64,75 @@ std::string tinyxml_error_string(const XMLError e){
 			return "XML_SUCCESS";
 	}
 }
-double ntohd(double d){
-	double ret = 0;
-	char *in = reinterpret_cast<char*>(&d);
-	char *out = reinterpret_cast<char*>(&ret);
-	for (int i = 0; i < 8; ++i){
-		out[i] = in[7 - i];
-	}
-	return ret;
+// The type of the values stored for a particle variable in a Uintah data file.
+enum UintahValueType {
+	UINTAH_POINT, // 3 doubles, converted to 3 floats
+	UINTAH_DOUBLE,
+	UINTAH_FLOAT,
+	UINTAH_LONG64
+};
+
+// The byte range of one variable of one patch in a Uintah data file, as listed in the XML
+// data file index. All ranges are resolved before reading any particle data.
+struct UintahVariableRange {
+	std::string variable;
+	UintahValueType value_type;
+	FileName file_name;
+	size_t num_particles;
+	size_t start;
+	size_t end;
+	// Offset of the first value of this range in the output array (in values, not particles)
+	size_t output_offset;
+};
+
+inline uint32_t byte_swap(uint32_t x){
+	return ((x & 0x000000FFu) << 24) | ((x & 0x0000FF00u) << 8)
+		| ((x & 0x00FF0000u) >> 8) | ((x & 0xFF000000u) >> 24);
 }
-float ntohf(float f){
-	float ret = 0;
-	char *in = reinterpret_cast<char*>(&f);
-	char *out = reinterpret_cast<char*>(&ret);
-	for (int i = 0; i < 4; ++i){
-		out[i] = in[3 - i];
-	}
-	return ret;
+inline uint64_t byte_swap(uint64_t x){
+	return (uint64_t(byte_swap(uint32_t(x & 0xFFFFFFFFu))) << 32) | uint64_t(byte_swap(uint32_t(x >> 32)));
 }
-bool read_particles(const FileName &file_name, Data *pos_data, const size_t num_particles,
-		const size_t start, const size_t end) {
-	auto *positions = static_cast<DataT<float>*>(pos_data);
-	assert(positions);
-	// TODO: Would mmap'ing the file at the start and keeping each new file we encounter
-	// mapped be faster than fopen/fread/fclose?
-	FILE *fp = fopen(file_name.file_name.c_str(), "rb");
-	if (!fp){
-		std::cout << "Failed to open Uintah data file '" << file_name << "'\n";
-		return false;
-	}
-	fseek(fp, start, SEEK_SET);
-	size_t len = end - start;
-	if (len != num_particles * sizeof(double) * 3){
-		std::cout << "Length of data != expected length of particle data\n";
-		return false;
-		fclose(fp);
-	}
+template<size_t N> struct uint_of_size;
+template<> struct uint_of_size<4> { typedef uint32_t type; };
+template<> struct uint_of_size<8> { typedef uint64_t type; };
 
-	double position[3];
-	for (size_t i = 0; i < num_particles; ++i){
-		if (fread(position, sizeof(position), 1, fp) != 1){
-			std::cout << "Error reading particle from file\n";
-			fclose(fp);
-			return false;
+// Converts "count" values of type In stored at "src" (no alignment required) to Out,
+// swapping the byte order if the data file is big endian. The loops are written such
+// that the compiler can vectorize them (the memcpy calls are only unaligned loads).
+template<typename In, typename Out>
+void convert_values(const char *src, Out *dst, const size_t count, const bool swap_bytes){
+	typedef typename uint_of_size<sizeof(In)>::type Bits;
+	if (swap_bytes){
+		#pragma omp simd
+		for (size_t i = 0; i < count; ++i){
+			Bits bits;
+			std::memcpy(&bits, src + i * sizeof(In), sizeof(In));
+			bits = byte_swap(bits);
+			In value;
+			std::memcpy(&value, &bits, sizeof(In));
+			dst[i] = static_cast<Out>(value);
 		}
-		if (uintah_is_big_endian){
-			position[0] = ntohd(position[0]);
-			position[1] = ntohd(position[1]);
-			position[2] = ntohd(position[2]);
+	} else {
+		#pragma omp simd
+		for (size_t i = 0; i < count; ++i){
+			In value;
+			std::memcpy(&value, src + i * sizeof(In), sizeof(In));
+			dst[i] = static_cast<Out>(value);
 		}
-		positions->data.push_back(static_cast<float>(position[0]));
-		positions->data.push_back(static_cast<float>(position[1]));
-		positions->data.push_back(static_cast<float>(position[2]));
 	}
-	fclose(fp);
-	return true;
 }
-template<typename In, typename Out = In>
-bool read_particle_attribute(const FileName &file_name, Data *attrib_data, const size_t num_particles,
-		const size_t start, const size_t end){
-	auto attribs = static_cast<DataT<Out>*>(attrib_data);
-	// TODO: Would mmap'ing the file at the start and keeping each new file we encounter
-	// mapped be faster than fopen/fread/fclose?
-	FILE *fp = fopen(file_name.file_name.c_str(), "rb");
-	if (!fp){
-		std::cout << "Failed to open Uintah data file '" << file_name << "'\n";
-		return false;
+size_t uintah_value_size(const UintahValueType type){
+	switch (type){
+		case UINTAH_POINT: return 3 * sizeof(double);
+		case UINTAH_FLOAT: return sizeof(float);
+		default: return 8;
 	}
-	fseek(fp, start, SEEK_SET);
-	size_t len = end - start;
-	if (len != num_particles * sizeof(In)){
-		std::cout << "Length of data != expected length of particle data\n";
-		return false;
-		fclose(fp);
-	}
-
-	std::vector<In> data(num_particles, In());
-	if (fread(data.data(), sizeof(In), num_particles, fp) != num_particles){
-		std::cout << "Error reading particle attribute from file\n";
-		fclose(fp);
-		return false;
-	}
-	fclose(fp);
-	std::transform(data.begin(), data.end(), std::back_inserter(attribs->data),
-			[](const In &t){ return static_cast<Out>(t); });
-	return true;
+}
+size_t uintah_values_per_particle(const UintahValueType type){
+	return type == UINTAH_POINT ? 3 : 1;
 }
 bool read_uintah_particle_variable(const FileName &base_path, XMLElement *elem,
-		ParticleModel &model)
+		std::vector<UintahVariableRange> &ranges)
 {
 	std::string type;
 	{
@@ -182,79 +169,51 @@ bool read_uintah_particle_variable(const FileName &base_path, XMLElement *elem,
 		} else if (name == "filename"){
 			file_name = text;
 		} else if (name == "index"){
-			try {
-				index = std::strtoul(text, NULL, 10);
-			} catch (const std::range_error &r){
-				std::cout << "Invalid index value specified\n";
-				return false;
-			}
+			index = std::strtoull(text, NULL, 10);
 		}  else if (name == "start"){
-			try {
-				start = std::strtoul(text, NULL, 10);
-			} catch (const std::range_error &r){
-				std::cout << "Invalid start value specified\n";
-				return false;
-			}
+			start = std::strtoull(text, NULL, 10);
 		} else if (name == "end"){
-			try {
-				end = std::strtoul(text, NULL, 10);
-			} catch (const std::range_error &r){
-				std::cout << "Invalid end value specified\n";
-				return false;
-			}
+			end = std::strtoull(text, NULL, 10);
 		} else if (name == "patch"){
-			try {
-				patch = std::strtoul(text, NULL, 10);
-			} catch (const std::range_error &r){
-				std::cout << "Invalid patch value specified\n";
-				return false;
-			}
+			patch = std::strtoull(text, NULL, 10);
 		} else if (name == "numParticles"){
-			try {
-				num_particles = std::strtoul(text, NULL, 10);
-			} catch (const std::range_error &r){
-				std::cout << "Invalid numParticles value specified\n";
-				return false;
-			}
+			num_particles = std::strtoull(text, NULL, 10);
 		}
 	}
 	if (num_particles > 0){
+		// Particle positions are p.x, rename them to position when we load them
+		// TODO: This should handle arbitrary ParticleVariable<Point> types
+		UintahVariableRange range;
 		if (variable == "p.x") {
 			variable = "positions";
 		}
-		const bool need_new_array = model.find(variable) == model.end();
-		// Particle positions are p.x, rename them to position when we load them
-		// TODO: This should handle arbitrary ParticleVariable<Point> types
 		if (variable == "positions"){
-			if (need_new_array) {
-				std::cout << "new positions array\n";
-				model["positions"] = std::make_shared<DataT<float>>();
-			}
-			return read_particles(base_path.join(FileName(file_name)),
-					model["positions"].get(), num_particles, start, end);
+			range.value_type = UINTAH_POINT;
 		} else if (type == "ParticleVariable<double>"){
-			if (need_new_array) {
-				model[variable] = std::make_shared<DataT<double>>();
-			}
-			return read_particle_attribute<double>(base_path.join(FileName(file_name)),
-					model[variable].get(), num_particles, start, end);
+			range.value_type = UINTAH_DOUBLE;
 		} else if (type == "ParticleVariable<float>"){
-			if (need_new_array) {
-				model[variable] = std::make_shared<DataT<float>>();
-			}
-			return read_particle_attribute<float>(base_path.join(FileName(file_name)),
-					model[variable].get(), num_particles, start, end);
+			range.value_type = UINTAH_FLOAT;
 		} else if (type == "ParticleVariable<long64>"){
-			if (need_new_array) {
-				model[variable] = std::make_shared<DataT<int64_t>>();
-			}
-			return read_particle_attribute<int64_t>(base_path.join(FileName(file_name)),
-					model[variable].get(), num_particles, start, end);
+			range.value_type = UINTAH_LONG64;
+		} else {
+			return true;
+		}
+		if (end - start != num_particles * uintah_value_size(range.value_type)){
+			std::cout << "Length of data != expected length of particle data\n";
+			return false;
 		}
+		range.variable = variable;
+		range.file_name = base_path.join(FileName(file_name));
+		range.num_particles = num_particles;
+		range.start = start;
+		range.end = end;
+		range.output_offset = 0;
+		ranges.push_back(range);
 	}
 	return true;
 }
-bool read_uintah_datafile(const FileName &file_name, XMLDocument &doc, ParticleModel &model){
+bool read_uintah_datafile(const FileName &file_name, XMLDocument &doc,
+		std::vector<UintahVariableRange> &ranges){
 	XMLElement *node = doc.FirstChildElement("Uintah_Output");
 	const static std::string VAR_TYPE = "ParticleVariable";
 	for (XMLNode *c = node->FirstChild(); c; c = c->NextSibling()){
@@ -269,13 +228,121 @@ bool read_uintah_datafile(const FileName &file_name, XMLDocument &doc, ParticleM
 		}
 		std::string var_type = e->Attribute("type");
 		if (var_type.substr(0, VAR_TYPE.size()) == VAR_TYPE){
-			if (!read_uintah_particle_variable(file_name.path(), e, model)){
+			if (!read_uintah_particle_variable(file_name.path(), e, ranges)){
 				return false;
 			}
 		}
 	}
 	return true;
 }
+template<typename T>
+T* allocate_uintah_array(ParticleModel &model, const std::string &variable, const size_t size){
+	auto array = std::make_shared<DataT<T>>();
+	array->data.resize(size);
+	model[variable] = array;
+	return array->data.data();
+}
+// Reads the particle data of all ranges into the model. Every referenced data file is mapped
+// into memory once, the output arrays are allocated with their final size and the ranges
+// are converted in parallel (split into chunks, so that large patches are distributed as
+// well) directly into the output arrays.
+bool read_uintah_variable_ranges(std::vector<UintahVariableRange> &ranges, ParticleModel &model){
+	// Output arrays (the ranges of each variable are stored in the order they are listed in)
+	std::map<std::string, size_t> array_sizes;
+	std::map<std::string, UintahValueType> array_types;
+	for (UintahVariableRange &range : ranges){
+		auto type_it = array_types.find(range.variable);
+		if (type_it != array_types.end() && type_it->second != range.value_type){
+			std::cout << "Uintah variable '" << range.variable << "' is stored with different types\n";
+			return false;
+		}
+		array_types[range.variable] = range.value_type;
+		size_t &array_size = array_sizes[range.variable];
+		range.output_offset = array_size;
+		array_size += range.num_particles * uintah_values_per_particle(range.value_type);
+	}
+	std::map<std::string, void*> array_data;
+	for (const auto &array : array_sizes){
+		switch (array_types[array.first]){
+			case UINTAH_POINT:
+			case UINTAH_FLOAT:
+				array_data[array.first] = allocate_uintah_array<float>(model, array.first, array.second);
+				break;
+			case UINTAH_DOUBLE:
+				array_data[array.first] = allocate_uintah_array<double>(model, array.first, array.second);
+				break;
+			case UINTAH_LONG64:
+				array_data[array.first] = allocate_uintah_array<int64_t>(model, array.first, array.second);
+				break;
+		}
+	}
+
+	// Map each data file once
+	std::map<std::string, std::unique_ptr<MappedFile>> mapped_files;
+	for (const UintahVariableRange &range : ranges){
+		std::unique_ptr<MappedFile> &mapped_file = mapped_files[range.file_name.file_name];
+		if (!mapped_file){
+			mapped_file.reset(new MappedFile());
+			if (!mapped_file->open(range.file_name.file_name)){
+				std::cout << "Failed to open Uintah data file '" << range.file_name << "'\n";
+				return false;
+			}
+			mapped_file->adviseSequential();
+		}
+		if (range.end > mapped_file->getSize()){
+			std::cout << "Uintah data file '" << range.file_name << "' is too small for variable '"
+				<< range.variable << "'\n";
+			return false;
+		}
+	}
+
+	// Split the ranges into chunks of at most CHUNK_SIZE particles
+	struct Chunk {
+		const UintahVariableRange *range;
+		const char *src;
+		void *dst;
+		size_t first_particle;
+		size_t num_particles;
+	};
+	const size_t CHUNK_SIZE = 1 << 18;
+	std::vector<Chunk> chunks;
+	for (const UintahVariableRange &range : ranges){
+		const char *src = mapped_files[range.file_name.file_name]->getData() + range.start;
+		void *dst = array_data[range.variable];
+		for (size_t first = 0; first < range.num_particles; first += CHUNK_SIZE){
+			Chunk chunk = { &range, src, dst, first, std::min(CHUNK_SIZE, range.num_particles - first) };
+			chunks.push_back(chunk);
+		}
+	}
+
+	const bool swap_bytes = uintah_is_big_endian;
+	const int64_t num_chunks = int64_t(chunks.size());
+	#pragma omp parallel for schedule(dynamic, 1)
+	for (int64_t i = 0; i < num_chunks; ++i){
+		const Chunk &chunk = chunks[i];
+		const UintahVariableRange &range = *chunk.range;
+		const size_t values_per_particle = uintah_values_per_particle(range.value_type);
+		const size_t value_size = uintah_value_size(range.value_type) / values_per_particle;
+		const char *src = chunk.src + chunk.first_particle * values_per_particle * value_size;
+		const size_t dst_offset = range.output_offset + chunk.first_particle * values_per_particle;
+		const size_t count = chunk.num_particles * values_per_particle;
+		switch (range.value_type){
+			case UINTAH_POINT:
+				convert_values<double, float>(src, static_cast<float*>(chunk.dst) + dst_offset, count, swap_bytes);
+				break;
+			case UINTAH_FLOAT:
+				convert_values<float, float>(src, static_cast<float*>(chunk.dst) + dst_offset, count, swap_bytes);
+				break;
+			case UINTAH_DOUBLE:
+				convert_values<double, double>(src, static_cast<double*>(chunk.dst) + dst_offset, count, swap_bytes);
+				break;
+			case UINTAH_LONG64:
+				convert_values<int64_t, int64_t>(src, static_cast<int64_t*>(chunk.dst) + dst_offset, count, swap_bytes);
+				break;
+		}
+	}
+	return true;
+}
 bool read_uintah_timestep_meta(XMLNode *node){
 	for (XMLNode *c = node->FirstChild(); c; c = c->NextSibling()){
 		XMLElement *e = c->ToElement();
@@ -310,8 +377,9 @@ bool read_uintah_patches(XMLNode *node, std::vector<UintahPatch> &patches) {
 	return true;
 }
 bool read_uintah_timestep_data(const FileName &base_path, XMLNode *node,
-		ParticleModel &model)
+		std::vector<UintahVariableRange> &ranges)
 {
+	std::vector<FileName> data_files;
 	for (XMLNode *c = node->FirstChild(); c; c = c->NextSibling()){
 		if (std::string(c->Value()) == "Datafile"){
 			XMLElement *e = c->ToElement();
@@ -324,24 +392,43 @@ bool read_uintah_timestep_data(const FileName &base_path, XMLNode *node,
 				std::cout << "Error parsing Uintah timestep data: Missing file href\n";
 				return false;
 			}
-			FileName data_file = base_path.join(FileName(std::string(href)));
-			std::cout << "Reading " << data_file << "\n";
-			XMLDocument doc;
-			XMLError err = doc.LoadFile(data_file.file_name.c_str());
-			if (err != XML_SUCCESS){
-				std::cout << "Error loading Uintah data file '" << data_file << "': "
-					<< tinyxml_error_string(err) << "\n";
-				return false;
-			}
-			if (!read_uintah_datafile(data_file, doc, model)){
+			data_files.push_back(base_path.join(FileName(std::string(href))));
+		}
+	}
+
+	// The XML indices of the data files are independent, so they are parsed in parallel.
+	std::cout << "Reading " << data_files.size() << " Uintah data files\n";
+	std::vector<std::vector<UintahVariableRange>> data_file_ranges(data_files.size());
+	bool success = true;
+	const int64_t num_data_files = int64_t(data_files.size());
+	#pragma omp parallel for schedule(dynamic, 1)
+	for (int64_t i = 0; i < num_data_files; ++i){
+		const FileName &data_file = data_files[i];
+		XMLDocument doc;
+		XMLError err = doc.LoadFile(data_file.file_name.c_str());
+		bool file_success = err == XML_SUCCESS && read_uintah_datafile(data_file, doc, data_file_ranges[i]);
+		if (!file_success){
+			#pragma omp critical
+			{
+				if (err != XML_SUCCESS){
+					std::cout << "Error loading Uintah data file '" << data_file << "': "
+						<< tinyxml_error_string(err) << "\n";
+				}
 				std::cout << "Error reading Uintah data file " << data_file << "\n";
-				return false;
+				success = false;
 			}
 		}
 	}
+	if (!success){
+		return false;
+	}
+	for (const std::vector<UintahVariableRange> &file_ranges : data_file_ranges){
+		ranges.insert(ranges.end(), file_ranges.begin(), file_ranges.end());
+	}
 	return true;
 }
-bool read_uintah_timestep(const FileName &file_name, XMLElement *node, ParticleModel &model){
+bool read_uintah_timestep(const FileName &file_name, XMLElement *node,
+		std::vector<UintahVariableRange> &ranges){
 	std::vector<UintahPatch> patches;
 	for (XMLNode *c = node->FirstChild(); c; c = c->NextSibling()){
 		std::cout << c->Value() << "\n" << std::flush;
@@ -353,7 +440,7 @@ bool read_uintah_timestep(const FileName &file_name, XMLElement *node, ParticleM
 		}
 	}
 	XMLNode *c = node->FirstChildElement("Data");
-	if (!c || !read_uintah_timestep_data(file_name.path(), c, model)){
+	if (!c || !read_uintah_timestep_data(file_name.path(), c, ranges)){
 		return false;
 	}
 	return true;
@@ -368,13 +455,16 @@ void pl::import_uintah(const FileName &file_name, ParticleModel &model){
 			<< tinyxml_error_string(err) << "\n";
 		throw std::runtime_error("Failed to open XML file");
 	}
+	auto start_time = std::chrono::system_clock::now();
+	uintah_is_big_endian = false;
+	std::vector<UintahVariableRange> ranges;
 	if (doc.FirstChildElement("Uintah_timestep")) {
-		if (!read_uintah_timestep(file_name, doc.FirstChildElement("Uintah_timestep"), model)) {
+		if (!read_uintah_timestep(file_name, doc.FirstChildElement("Uintah_timestep"), ranges)) {
 			std::cout << "Error reading Uintah timestep\n";
 			throw std::runtime_error("Failed to read Uintah timestep");
 		}
 	} else if (doc.FirstChildElement("Uintah_Output")) {
-		if (!read_uintah_datafile(file_name, doc, model)) {
+		if (!read_uintah_datafile(file_name, doc, ranges)) {
 			std::cout << "Error reading Uintah Output\n";
 			throw std::runtime_error("Failed to read Uintah output");
 		}
@@ -382,6 +472,13 @@ void pl::import_uintah(const FileName &file_name, ParticleModel &model){
 		std::cout << "Unrecognized UDA XML file!\n";
 		throw std::runtime_error("Failed to read Uintah data");
 	}
+	if (!read_uintah_variable_ranges(ranges, model)) {
+		std::cout << "Error reading Uintah particle data\n";
+		throw std::runtime_error("Failed to read Uintah particle data");
+	}
+	auto end_time = std::chrono::system_clock::now();
+	std::cout << "Read " << ranges.size() << " Uintah variable ranges in "
+		<< std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time).count() << "ms\n";
 	if (model.find("positions") != model.end()) {
 		auto positions = static_cast<DataT<float>*>(model["positions"].get());
 		std::cout << "Read Uintah data with " << positions->data.size() / 3 << " particles\n";
@@ -0,0 +1,62 @@
+//
+// Created by agent on 19.10.26.
+//
+
+#include "ProgrammableFetchBuffers.hpp"
+
+void unpackUnorm16Attribute(
+        const uint16_t *attributeValuesUnorm, size_t numValues, std::vector<float> &attributeValues,
+        const glm::vec3 *positions, const glm::vec3 *tangents, std::vector<LinePointData> *linePointData)
+{
+    attributeValues.resize(numValues);
+    if (linePointData == nullptr) {
+        #pragma omp parallel for
+        for (size_t i = 0; i < numValues; i++) {
+            attributeValues[i] = attributeValuesUnorm[i] / 65535.0f;
+        }
+        return;
+    }
+
+    linePointData->resize(numValues);
+    LinePointData *linePoints = linePointData->data();
+    #pragma omp parallel for
+    for (size_t i = 0; i < numValues; i++) {
+        float value = attributeValuesUnorm[i] / 65535.0f;
+        attributeValues[i] = value;
+        LinePointData &linePoint = linePoints[i];
+        linePoint.vertexPosition = positions[i];
+        linePoint.vertexAttribute = value;
+        linePoint.vertexTangent = tangents[i];
+        linePoint.padding = 0.0f;
+    }
+}
+
+void buildSharedLinePointBuffer(
+        const glm::vec3 *positions, const glm::vec3 *tangents, size_t numVertices,
+        std::vector<float> &linePointBuffer)
+{
+    linePointBuffer.resize(numVertices * 6);
+    #pragma omp parallel for
+    for (size_t i = 0; i < numVertices; i++) {
+        float *linePoint = &linePointBuffer[i * 6];
+        linePoint[0] = positions[i].x;
+        linePoint[1] = positions[i].y;
+        linePoint[2] = positions[i].z;
+        linePoint[3] = tangents[i].x;
+        linePoint[4] = tangents[i].y;
+        linePoint[5] = tangents[i].z;
+    }
+}
+
+void buildPackedUnorm16AttributeBuffer(
+        const uint16_t *attributeValues, size_t numValues, std::vector<uint32_t> &packedAttributeBuffer)
+{
+    size_t numPackedValues = (numValues + 1) / 2;
+    packedAttributeBuffer.resize(numPackedValues);
+    #pragma omp parallel for
+    for (size_t i = 0; i < numPackedValues; i++) {
+        uint32_t lowerValue = attributeValues[i * 2];
+        uint32_t upperValue = i * 2 + 1 < numValues ? attributeValues[i * 2 + 1] : 0u;
+        packedAttributeBuffer[i] = lowerValue | (upperValue << 16u);
+    }
+}
@@ -0,0 +1,63 @@
+//
+// Created by agent on 19.10.26.
+//
+
+#ifndef PIXELSYNCOIT_PROGRAMMABLEFETCHBUFFERS_HPP
+#define PIXELSYNCOIT_PROGRAMMABLEFETCHBUFFERS_HPP
+
+#include <vector>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+/**
+ * Layout of the shader storage buffers for programmable vertex fetching/pulling of lines
+ * (see "FetchVertex" in PseudoPhongTrajectories.glsl).
+ *  - SoA: One vec4 buffer each for the positions and tangents, one float buffer per importance criterion.
+ *  - AoS: One LinePointData buffer (position, attribute, tangent, padding = 32 bytes per vertex) per importance
+ *    criterion, i.e., the positions and tangents are duplicated for each criterion.
+ *  - Shared: Positions and tangents are stored once interleaved (24 bytes per vertex), and each importance criterion
+ *    is stored in a 16-bit unorm side buffer (2 bytes per vertex). The side buffer is selected at draw time.
+ */
+enum ProgrammableFetchLayout
+{
+    PROGRAMMABLE_FETCH_LAYOUT_SOA = 0, PROGRAMMABLE_FETCH_LAYOUT_AOS, PROGRAMMABLE_FETCH_LAYOUT_SHARED
+};
+const char *const PROGRAMMABLE_FETCH_LAYOUT_NAMES[] = {
+        "SoA", "AoS", "Shared + 16-bit"
+};
+
+/// One vertex of PROGRAMMABLE_FETCH_LAYOUT_AOS (std430 layout, 32 bytes).
+struct LinePointData
+{
+    glm::vec3 vertexPosition;
+    float vertexAttribute;
+    glm::vec3 vertexTangent;
+    float padding;
+};
+
+/**
+ * Unpacks the 16-bit unorm values of an importance criterion to float. If "linePointData" is not null, the values are
+ * interleaved with the positions and tangents to the PROGRAMMABLE_FETCH_LAYOUT_AOS buffer in the same pass.
+ */
+void unpackUnorm16Attribute(
+        const uint16_t *attributeValuesUnorm, size_t numValues, std::vector<float> &attributeValues,
+        const glm::vec3 *positions = nullptr, const glm::vec3 *tangents = nullptr,
+        std::vector<LinePointData> *linePointData = nullptr);
+
+/**
+ * Interleaves positions and tangents for PROGRAMMABLE_FETCH_LAYOUT_SHARED: The entries 6*i to 6*i+2 of
+ * "linePointBuffer" contain the position of vertex i, the entries 6*i+3 to 6*i+5 contain its tangent.
+ */
+void buildSharedLinePointBuffer(
+        const glm::vec3 *positions, const glm::vec3 *tangents, size_t numVertices,
+        std::vector<float> &linePointBuffer);
+
+/**
+ * Packs 16-bit unorm attribute values for PROGRAMMABLE_FETCH_LAYOUT_SHARED: Entry i of "packedAttributeBuffer"
+ * contains value 2*i in the lower and value 2*i+1 in the upper 16 bits (as expected by GLSL's unpackUnorm2x16).
+ * An odd number of values is padded with zero.
+ */
+void buildPackedUnorm16AttributeBuffer(
+        const uint16_t *attributeValues, size_t numValues, std::vector<uint32_t> &packedAttributeBuffer);
+
+#endif //PIXELSYNCOIT_PROGRAMMABLEFETCHBUFFERS_HPP
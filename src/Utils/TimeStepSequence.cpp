@@ -0,0 +1,330 @@
+//
+// Created by agent on 19.10.26.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cctype>
+#include <boost/algorithm/string/case_conv.hpp>
+#include <boost/filesystem.hpp>
+
+#include <Utils/AppSettings.hpp>
+#include <Utils/File/Logfile.hpp>
+
+#include "TimeStepSequence.hpp"
+
+TimeStepSequenceSettings getTimeStepSequenceSettings()
+{
+    TimeStepSequenceSettings timeStepSettings;
+    sgl::SettingsFile &settings = sgl::AppSettings::get()->getSettings();
+    if (settings.hasKey("timeSteps-prefetchDistance")) {
+        timeStepSettings.prefetchDistance = size_t(std::max(settings.getIntValue("timeSteps-prefetchDistance"), 0));
+    }
+    if (settings.hasKey("timeSteps-maxCacheSizeMiB")) {
+        timeStepSettings.maxCacheSizeBytes =
+                size_t(std::max(settings.getIntValue("timeSteps-maxCacheSizeMiB"), 0)) << 20;
+    }
+    return timeStepSettings;
+}
+
+
+/// Matches a file name against a pattern with the wildcards '*' (any sequence) and '?' (any character).
+static bool matchWildcard(const char *pattern, const char *str)
+{
+    const char *star = nullptr;
+    const char *starStr = nullptr;
+    while (*str) {
+        if (*pattern == '?' || *pattern == *str) {
+            pattern++;
+            str++;
+        } else if (*pattern == '*') {
+            star = pattern++;
+            starStr = str;
+        } else if (star) {
+            pattern = star + 1;
+            str = ++starStr;
+        } else {
+            return false;
+        }
+    }
+    while (*pattern == '*') {
+        pattern++;
+    }
+    return *pattern == '\0';
+}
+
+/// Compares two strings with runs of digits compared by their numeric value (e.g. "step_9" < "step_10").
+static bool naturalLess(const std::string &a, const std::string &b)
+{
+    size_t i = 0, j = 0;
+    while (i < a.size() && j < b.size()) {
+        if (isdigit((unsigned char)a[i]) && isdigit((unsigned char)b[j])) {
+            // Skip leading zeros (but not the last digit of the run).
+            size_t digitsBeginA = i, digitsBeginB = j;
+            while (a[digitsBeginA] == '0' && digitsBeginA + 1 < a.size()
+                    && isdigit((unsigned char)a[digitsBeginA + 1])) {
+                digitsBeginA++;
+            }
+            while (b[digitsBeginB] == '0' && digitsBeginB + 1 < b.size()
+                    && isdigit((unsigned char)b[digitsBeginB + 1])) {
+                digitsBeginB++;
+            }
+            size_t digitsEndA = digitsBeginA, digitsEndB = digitsBeginB;
+            while (digitsEndA < a.size() && isdigit((unsigned char)a[digitsEndA])) {
+                digitsEndA++;
+            }
+            while (digitsEndB < b.size() && isdigit((unsigned char)b[digitsEndB])) {
+                digitsEndB++;
+            }
+            // Without leading zeros, the longer number is the larger one.
+            if (digitsEndA - digitsBeginA != digitsEndB - digitsBeginB) {
+                return digitsEndA - digitsBeginA < digitsEndB - digitsBeginB;
+            }
+            int comparison = a.compare(
+                    digitsBeginA, digitsEndA - digitsBeginA, b, digitsBeginB, digitsEndB - digitsBeginB);
+            if (comparison != 0) {
+                return comparison < 0;
+            }
+            i = digitsEndA;
+            j = digitsEndB;
+        } else {
+            if (a[i] != b[j]) {
+                return a[i] < b[j];
+            }
+            i++;
+            j++;
+        }
+    }
+    return a.size() - i < b.size() - j;
+}
+
+static bool isTimeStepFile(const std::string &filename)
+{
+    std::string lowerCaseFilename = boost::to_lower_copy(filename);
+    return lowerCaseFilename.find(".binmesh") != std::string::npos;
+}
+
+bool isTimeStepSequence(const std::string &filename)
+{
+    std::string name = boost::filesystem::path(filename).filename().string();
+    return name.find_first_of("*?") != std::string::npos || boost::filesystem::is_directory(filename);
+}
+
+std::vector<std::string> findTimeStepFiles(const std::string &pattern)
+{
+    std::vector<std::string> filenames;
+
+    boost::filesystem::path directory(pattern);
+    std::string namePattern = "*";
+    if (!boost::filesystem::is_directory(directory)) {
+        namePattern = directory.filename().string();
+        directory = directory.parent_path();
+        if (directory.empty()) {
+            directory = ".";
+        }
+    }
+    if (!boost::filesystem::is_directory(directory)) {
+        sgl::Logfile::get()->writeError(std::string() + "Error in findTimeStepFiles: Directory \""
+                + directory.string() + "\" does not exist.");
+        return filenames;
+    }
+
+    std::vector<std::string> names;
+    for (boost::filesystem::directory_iterator it(directory), end; it != end; ++it) {
+        std::string name = it->path().filename().string();
+        if (boost::filesystem::is_regular_file(it->path()) && isTimeStepFile(name)
+                && matchWildcard(namePattern.c_str(), name.c_str())) {
+            names.push_back(name);
+        }
+    }
+    // The directory order is arbitrary, and the time steps are usually numbered without leading zeros.
+    std::sort(names.begin(), names.end(), naturalLess);
+    for (const std::string &name : names) {
+        filenames.push_back((directory / name).string());
+    }
+    return filenames;
+}
+
+
+TimeStepSequence::TimeStepSequence(
+        const std::vector<std::string> &filenames, const TimeStepSequenceSettings &settings)
+        : filenames(filenames), settings(settings)
+{
+    if (!filenames.empty()) {
+        prefetchThread = std::thread(&TimeStepSequence::prefetchThreadFunction, this);
+    }
+}
+
+TimeStepSequence::~TimeStepSequence()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quitPrefetchThread = true;
+    }
+    prefetchCondition.notify_all();
+    loadedCondition.notify_all();
+    if (prefetchThread.joinable()) {
+        prefetchThread.join();
+    }
+}
+
+TimeStepDataPtr TimeStepSequence::requestTimeStep(size_t timeStep)
+{
+    if (timeStep >= filenames.size()) {
+        return TimeStepDataPtr();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (timeStep != currentTimeStep) {
+        currentTimeStep = timeStep;
+        evictTimeSteps();
+        prefetchCondition.notify_all();
+    }
+
+    auto it = cachedTimeSteps.find(timeStep);
+    if (it == cachedTimeSteps.end()) {
+        statistics.numRequestsNotReady++;
+        return TimeStepDataPtr();
+    }
+    statistics.numRequestsReady++;
+    return it->second;
+}
+
+TimeStepDataPtr TimeStepSequence::waitForTimeStep(size_t timeStep)
+{
+    TimeStepDataPtr timeStepData = requestTimeStep(timeStep);
+    if (timeStepData || timeStep >= filenames.size()) {
+        return timeStepData;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    loadedCondition.wait(lock, [this, timeStep] {
+        return quitPrefetchThread || currentTimeStep != timeStep || cachedTimeSteps.count(timeStep) != 0
+                || failedTimeSteps.count(timeStep) != 0;
+    });
+    auto it = cachedTimeSteps.find(timeStep);
+    return it != cachedTimeSteps.end() ? it->second : TimeStepDataPtr();
+}
+
+TimeStepSequenceStatistics TimeStepSequence::getStatistics()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return statistics;
+}
+
+void TimeStepSequence::evictTimeSteps()
+{
+    for (auto it = cachedTimeSteps.begin(); it != cachedTimeSteps.end();) {
+        if (getPlaybackDistance(it->first) > settings.prefetchDistance) {
+            cacheSizeBytes -= it->second->sizeBytes;
+            it = cachedTimeSteps.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+bool TimeStepSequence::findTimeStepToLoad(size_t &timeStep)
+{
+    size_t windowSize = std::min(settings.prefetchDistance + 1, filenames.size());
+    for (size_t distance = 0; distance < windowSize; distance++) {
+        size_t candidate = (currentTimeStep + distance) % filenames.size();
+        if (cachedTimeSteps.count(candidate) != 0 || failedTimeSteps.count(candidate) != 0) {
+            continue;
+        }
+        // The current time step is always loaded, the following ones only if the cache isn't full.
+        if (distance > 0 && cacheSizeBytes >= settings.maxCacheSizeBytes) {
+            return false;
+        }
+        timeStep = candidate;
+        return true;
+    }
+    return false;
+}
+
+void TimeStepSequence::prefetchThreadFunction()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        size_t timeStep = 0;
+        prefetchCondition.wait(lock, [this, &timeStep] {
+            return quitPrefetchThread || findTimeStepToLoad(timeStep);
+        });
+        if (quitPrefetchThread) {
+            break;
+        }
+
+        // Read and decode the file without holding the lock, i.e., the renderer can request time steps meanwhile.
+        lock.unlock();
+        auto start = std::chrono::system_clock::now();
+        std::shared_ptr<TimeStepData> timeStepData = std::make_shared<TimeStepData>();
+        bool success = loadTimeStep(timeStep, *timeStepData);
+        auto end = std::chrono::system_clock::now();
+        lock.lock();
+
+        if (success) {
+            statistics.numTimeStepsLoaded++;
+            statistics.numBytesLoaded += timeStepData->sizeBytes;
+            statistics.loadTimeSeconds += std::chrono::duration<double>(end - start).count();
+            // The window may have moved while the file was loaded.
+            if (getPlaybackDistance(timeStep) <= settings.prefetchDistance) {
+                cacheSizeBytes += timeStepData->sizeBytes;
+                cachedTimeSteps.insert(std::make_pair(timeStep, TimeStepDataPtr(timeStepData)));
+            }
+        } else {
+            failedTimeSteps.insert(timeStep);
+        }
+        loadedCondition.notify_all();
+    }
+}
+
+bool TimeStepSequence::loadTimeStep(size_t timeStep, TimeStepData &data)
+{
+    const std::string &filename = filenames.at(timeStep);
+    data.timeStep = timeStep;
+    data.sizeBytes = 0;
+
+    readMesh3D(filename, data.mesh);
+    if (data.mesh.submeshes.empty()) {
+        return false;
+    }
+    for (const BinarySubMesh &submesh : data.mesh.submeshes) {
+        data.sizeBytes += submesh.indices.size() * sizeof(uint32_t);
+        for (const BinaryMeshAttribute &attribute : submesh.attributes) {
+            data.sizeBytes += attribute.data.size();
+        }
+        for (const BinaryMeshUniform &uniform : submesh.uniforms) {
+            data.sizeBytes += uniform.data.size();
+        }
+    }
+    return true;
+}
+
+
+TimeStepSequenceStatistics benchmarkTimeStepSequence(
+        const std::vector<std::string> &filenames, const TimeStepSequenceSettings &settings)
+{
+    TimeStepSequence timeStepSequence(filenames, settings);
+
+    auto start = std::chrono::system_clock::now();
+    size_t numTimeStepsLoaded = 0;
+    size_t numBytesLoaded = 0;
+    for (size_t timeStep = 0; timeStep < timeStepSequence.getNumTimeSteps(); timeStep++) {
+        TimeStepDataPtr timeStepData = timeStepSequence.waitForTimeStep(timeStep);
+        if (timeStepData) {
+            numTimeStepsLoaded++;
+            numBytesLoaded += timeStepData->sizeBytes;
+        }
+    }
+    auto end = std::chrono::system_clock::now();
+    double elapsedSeconds = std::chrono::duration<double>(end - start).count();
+
+    TimeStepSequenceStatistics statistics = timeStepSequence.getStatistics();
+    double timeStepsPerSecond = elapsedSeconds > 0.0 ? double(numTimeStepsLoaded) / elapsedSeconds : 0.0;
+    double mibPerSecond = elapsedSeconds > 0.0 ? double(numBytesLoaded) / double(1 << 20) / elapsedSeconds : 0.0;
+    sgl::Logfile::get()->writeInfo(std::string() + "Sustained time step throughput (prefetch distance "
+            + std::to_string(settings.prefetchDistance) + "): " + std::to_string(timeStepsPerSecond)
+            + " steps/s, " + std::to_string(mibPerSecond) + " MiB/s (" + std::to_string(numTimeStepsLoaded) + " of "
+            + std::to_string(timeStepSequence.getNumTimeSteps()) + " time steps loaded)");
+    return statistics;
+}
@@ -0,0 +1,141 @@
+//
+// Created by agent on 19.10.26.
+//
+
+#ifndef PIXELSYNCOIT_TIMESTEPSEQUENCE_HPP
+#define PIXELSYNCOIT_TIMESTEPSEQUENCE_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "MeshSerializer.hpp"
+
+/**
+ * The decoded data of one time step of a time-dependent data set, i.e., the mesh of a .binmesh file (with quantized
+ * attributes still packed, see createMeshRenderer).
+ */
+struct TimeStepData
+{
+    size_t timeStep = 0;
+    BinaryMesh mesh;
+    size_t sizeBytes = 0; ///< The size of the decoded data in memory.
+};
+typedef std::shared_ptr<const TimeStepData> TimeStepDataPtr;
+
+/**
+ * The settings are read from the application settings ("timeSteps-prefetchDistance" and "timeSteps-maxCacheSizeMiB").
+ */
+struct TimeStepSequenceSettings
+{
+    /// The number of time steps after the requested one that are loaded in advance.
+    size_t prefetchDistance = 4;
+    /// The prefetch thread doesn't load further ahead if the cached time steps exceed this size.
+    size_t maxCacheSizeBytes = size_t(2048) << 20;
+};
+
+TimeStepSequenceSettings getTimeStepSequenceSettings();
+
+struct TimeStepSequenceStatistics
+{
+    size_t numTimeStepsLoaded = 0;
+    size_t numBytesLoaded = 0;
+    double loadTimeSeconds = 0.0; ///< The time the prefetch thread spent reading and decoding files.
+    size_t numRequestsReady = 0;
+    size_t numRequestsNotReady = 0;
+
+    /// @return The sustained throughput of the prefetch thread (excluding the time it was idle).
+    inline double getTimeStepsPerSecond() const {
+        return loadTimeSeconds > 0.0 ? double(numTimeStepsLoaded) / loadTimeSeconds : 0.0;
+    }
+    inline double getMiBPerSecond() const {
+        return loadTimeSeconds > 0.0 ? double(numBytesLoaded) / double(1 << 20) / loadTimeSeconds : 0.0;
+    }
+};
+
+/**
+ * @return Whether the passed file name refers to a time step sequence, i.e., is a directory or contains the wildcards
+ * '*' or '?' in its file name part (e.g. "Data/Trajectories/Flow/step_*.binmesh").
+ */
+bool isTimeStepSequence(const std::string &filename);
+
+/**
+ * @return The .binmesh files of a time step sequence (all of these files if "pattern" is a directory) in natural order
+ * (i.e., "step_9" comes before "step_10").
+ */
+std::vector<std::string> findTimeStepFiles(const std::string &pattern);
+
+/**
+ * A time-dependent data set stored as one .binmesh file per time step. Trajectory time steps need to be converted to
+ * binmesh files for the selected line rendering technique beforehand (e.g., with a static load of each time step).
+ *
+ * The renderer calls requestTimeStep(t) every frame for the time step it wants to display. A background thread reads
+ * and decodes the time steps t to t+prefetchDistance (wrapping around at the end of the sequence, as the playback
+ * loops) into a cache, so that the request returns the data without waiting if the disk keeps up with the playback.
+ * Otherwise, the request returns null ("not ready") and the renderer keeps displaying the last time step.
+ * Time steps outside of the prefetch window are evicted from the cache. The data stays valid for as long as the
+ * caller holds the returned pointer.
+ */
+class TimeStepSequence
+{
+public:
+    /// Starts the prefetch thread, which begins loading the first time steps immediately.
+    TimeStepSequence(
+            const std::vector<std::string> &filenames,
+            const TimeStepSequenceSettings &settings = TimeStepSequenceSettings());
+    ~TimeStepSequence();
+
+    inline size_t getNumTimeSteps() const { return filenames.size(); }
+    inline const std::string &getFilename(size_t timeStep) const { return filenames.at(timeStep); }
+
+    /**
+     * Moves the prefetch window to the passed time step.
+     * @return The decoded time step, or null if it isn't loaded yet (or could not be loaded).
+     */
+    TimeStepDataPtr requestTimeStep(size_t timeStep);
+    /// Like requestTimeStep, but waits for the prefetch thread if the time step isn't loaded yet.
+    TimeStepDataPtr waitForTimeStep(size_t timeStep);
+
+    TimeStepSequenceStatistics getStatistics();
+
+private:
+    void prefetchThreadFunction();
+    bool loadTimeStep(size_t timeStep, TimeStepData &data);
+    /// @return The distance of the passed time step to the current one in playback order.
+    inline size_t getPlaybackDistance(size_t timeStep) const {
+        return (timeStep + filenames.size() - currentTimeStep) % filenames.size();
+    }
+    /// Removes all time steps outside of the prefetch window from the cache (the mutex must be locked).
+    void evictTimeSteps();
+    /// @return Whether a time step of the prefetch window needs to be loaded (the mutex must be locked).
+    bool findTimeStepToLoad(size_t &timeStep);
+
+    std::vector<std::string> filenames;
+    TimeStepSequenceSettings settings;
+
+    std::thread prefetchThread;
+    std::mutex mutex;
+    std::condition_variable prefetchCondition; ///< Notified if the prefetch window moves or the thread should quit.
+    std::condition_variable loadedCondition; ///< Notified if a time step was loaded.
+    bool quitPrefetchThread = false;
+    size_t currentTimeStep = 0;
+    std::map<size_t, TimeStepDataPtr> cachedTimeSteps;
+    size_t cacheSizeBytes = 0;
+    std::set<size_t> failedTimeSteps;
+    TimeStepSequenceStatistics statistics;
+};
+
+/**
+ * Loads all time steps of the passed sequence in order with the prefetch thread, as fast as possible (i.e., without
+ * rendering), and writes the sustained throughput (time steps per second and MiB/s) to the log file.
+ */
+TimeStepSequenceStatistics benchmarkTimeStepSequence(
+        const std::vector<std::string> &filenames,
+        const TimeStepSequenceSettings &settings = TimeStepSequenceSettings());
+
+#endif //PIXELSYNCOIT_TIMESTEPSEQUENCE_HPP
@@ -7,14 +7,37 @@
 #include <cstdio>
 #include <boost/algorithm/string/case_conv.hpp>
 #include <boost/algorithm/string/predicate.hpp>
+#include <Utils/AppSettings.hpp>
 #include <Utils/File/Logfile.hpp>
 #include <Math/Geometry/AABB3.hpp>
-#include <Utils/Events/Stream/Stream.hpp>
 #include "NetCDFConverter.hpp"
+#include "ImportanceCriteriaBatched.hpp"
+#include "DerivedDataCache.hpp"
+#include "MappedFile.hpp"
+#include "BinLinesFile.hpp"
 #include "TrajectoryFile.hpp"
 #include <iostream>
+#include <fstream>
+#include <limits>
+#include <algorithm>
+#include <cstring>
+#include <cfloat>
+
+/**
+ * Whether .obj, .nc and .binlines v1 files are converted to binlines v2 files in the derived data cache when they are
+ * loaded for the first time (setting "binlinesV2-cacheConversions", default: false). The cached files need as much disk
+ * space as the loaded data, so the conversion is opt-in.
+ */
+static bool getUseBinLinesV2Cache()
+{
+    sgl::SettingsFile &settings = sgl::AppSettings::get()->getSettings();
+    if (settings.hasKey("binlinesV2-cacheConversions")) {
+        return settings.getBoolValue("binlinesV2-cacheConversions");
+    }
+    return false;
+}
 
-Trajectories loadTrajectoriesFromFile(const std::string &filename, TrajectoryType trajectoryType)
+static Trajectories loadTrajectoriesFromSourceFile(const std::string &filename, TrajectoryType trajectoryType)
 {
     Trajectories trajectories;
 
@@ -27,12 +50,118 @@ Trajectories loadTrajectoriesFromFile(const std::string &filename, TrajectoryTyp
         trajectories = loadTrajectoriesFromBinLines(filename, trajectoryType);
     }
 
+    return trajectories;
+}
+
+Trajectories loadTrajectoriesFromFile(const std::string &filename, TrajectoryType trajectoryType)
+{
+    Trajectories trajectories;
+
+    std::string lowerCaseFilename = boost::to_lower_copy(filename);
+    bool isBinLinesV2 = boost::ends_with(lowerCaseFilename, ".binlines")
+            && getBinLinesFormatVersion(filename) == BINLINES_FORMAT_VERSION_2;
+    // Binlines v2 files store the bounding box of the positions and the attribute ranges in the header, i.e., the
+    // mapped points are only touched if they need to be normalized.
     sgl::AABB3 boundingBox;
-    for (Trajectory &trajectory : trajectories) {
-        for (glm::vec3 &position : trajectory.positions) {
-            boundingBox.combine(position);
+    std::vector<glm::vec2> attributeRanges;
+    bool hasBoundingBox = false;
+    if (isBinLinesV2) {
+        trajectories = loadTrajectoriesFromBinLinesV2(filename, &boundingBox, &attributeRanges);
+        hasBoundingBox = true;
+    } else if (getUseBinLinesV2Cache()) {
+        // The binlines v2 file contains the data before the normalization below (the attributes of .obj and .nc files
+        // are the importance criteria, which depend on the trajectory type).
+        DerivedDataKey binlinesKey(filename, "binlines", BINLINES_FORMAT_VERSION_2);
+        binlinesKey.addParameter("trajectoryType", int(trajectoryType));
+        binlinesKey.addParameter("importanceCriteria", IMPORTANCE_CRITERIA_VERSION);
+        if (boost::ends_with(lowerCaseFilename, ".nc")) {
+            addNetCdfSelectionParameters(binlinesKey, getNetCdfSelection());
+        }
+        std::string binlinesFilename = DerivedDataCache::get()->getArtifactFilename(binlinesKey);
+        if (DerivedDataCache::get()->lookup(binlinesFilename)) {
+            trajectories = loadTrajectoriesFromBinLinesV2(binlinesFilename, &boundingBox, &attributeRanges);
+            hasBoundingBox = !trajectories.empty();
+        }
+        if (trajectories.empty()) {
+            trajectories = loadTrajectoriesFromSourceFile(filename, trajectoryType);
+            if (!trajectories.empty() && writeTrajectoriesToBinLinesV2(binlinesFilename, trajectories)) {
+                DerivedDataCache::get()->commit(binlinesFilename);
+            }
         }
+    } else {
+        trajectories = loadTrajectoriesFromSourceFile(filename, trajectoryType);
+    }
+
+    if (!hasBoundingBox) {
+        float minX = FLT_MAX, minY = FLT_MAX, minZ = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX, maxZ = -FLT_MAX;
+        #pragma omp parallel for reduction(min:minX,minY,minZ) reduction(max:maxX,maxY,maxZ)
+        for (size_t i = 0; i < trajectories.positions.size(); i++) {
+            const glm::vec3 &position = trajectories.positions[i];
+            minX = std::min(minX, position.x);
+            minY = std::min(minY, position.y);
+            minZ = std::min(minZ, position.z);
+            maxX = std::max(maxX, position.x);
+            maxY = std::max(maxY, position.y);
+            maxZ = std::max(maxZ, position.z);
+        }
+        if (!trajectories.positions.empty()) {
+            boundingBox = sgl::AABB3(glm::vec3(minX, minY, minZ), glm::vec3(maxX, maxY, maxZ));
+        }
+    }
+
+    float minAttr = std::numeric_limits<float>::max();
+    float maxAttr = std::numeric_limits<float>::lowest();
+    if (trajectoryType == TRAJECTORY_TYPE_UCLA && hasBoundingBox && !attributeRanges.empty()) {
+        minAttr = attributeRanges.front().x;
+        maxAttr = attributeRanges.front().y;
+    } else if (trajectoryType == TRAJECTORY_TYPE_UCLA && !trajectories.attributes.empty()) {
+        const TrajectoryArray<float> &firstAttribute = trajectories.attributes.front();
+        #pragma omp parallel for reduction(min:minAttr) reduction(max:maxAttr)
+        for (size_t i = 0; i < firstAttribute.size(); i++) {
+            minAttr = std::min(minAttr, firstAttribute[i]);
+            maxAttr = std::max(maxAttr, firstAttribute[i]);
+        }
+    }
+
+    TrajectoryNormalization normalization = computeTrajectoryNormalization(
+            trajectoryType, boundingBox, minAttr, maxAttr);
+    normalization.apply(trajectories);
+
+    return trajectories;
+}
+
+void Trajectories::setNumAttributes(size_t numAttributes)
+{
+    if (!empty()) {
+        throw std::logic_error("Trajectories::setNumAttributes: The container is not empty.");
+    }
+    attributes.resize(numAttributes);
+}
+
+void Trajectories::reserve(size_t numTrajectories, size_t numPoints)
+{
+    trajectoryOffsets.reserve(numTrajectories + 1);
+    positions.reserve(numPoints);
+    for (TrajectoryArray<float> &attributeArray : attributes) {
+        attributeArray.reserve(numPoints);
+    }
+}
+
+void Trajectories::clear()
+{
+    // Keeps the number of attributes and the capacity (e.g., for reusing the container for batches of trajectories)
+    positions.clear();
+    for (TrajectoryArray<float> &attributeArray : attributes) {
+        attributeArray.clear();
     }
+    trajectoryOffsets.resize(1);
+    trajectoryOffsets.front() = 0;
+}
+
+TrajectoryNormalization computeTrajectoryNormalization(
+        TrajectoryType trajectoryType, const sgl::AABB3 &boundingBox, float minAttr, float maxAttr)
+{
+    TrajectoryNormalization normalization;
 
     bool isConvectionRolls = trajectoryType == TRAJECTORY_TYPE_CONVECTION_ROLLS_NEW;
     bool isUCLA = trajectoryType == TRAJECTORY_TYPE_UCLA;
@@ -42,26 +171,12 @@ Trajectories loadTrajectoriesFromFile(const std::string &filename, TrajectoryTyp
     glm::vec3 minVec(boundingBox.getMinimum());
     glm::vec3 maxVec(boundingBox.getMaximum());
 
-    float minAttr = std::numeric_limits<float>::max();
-    float maxAttr = std::numeric_limits<float>::lowest();
-
     if (isConvectionRolls) {
         minVec = glm::vec3(0);
         maxVec = glm::vec3(0.5);
-    } else if (isUCLA)
-    {
+    } else if (isUCLA) {
         minVec = glm::vec3(glm::min(boundingBox.getMinimum().x, std::min(boundingBox.getMinimum().y, boundingBox.getMinimum().z)));
         maxVec = glm::vec3(glm::max(boundingBox.getMaximum().x, std::max(boundingBox.getMaximum().y, boundingBox.getMaximum().z)));
-
-        for(const Trajectory& traj : trajectories)
-        {
-            for (const float& attr : traj.attributes[0])
-            {
-                minAttr = std::min(minAttr, attr);
-                maxAttr = std::max(maxAttr, attr);
-            }
-        }
-
     } else {
         // Normalize data for rings
         float minValue = glm::min(boundingBox.getMinimum().x, std::min(boundingBox.getMinimum().y, boundingBox.getMinimum().z));
@@ -71,31 +186,64 @@ Trajectories loadTrajectoriesFromFile(const std::string &filename, TrajectoryTyp
     }
 
     if (isRings || isConvectionRolls || isCfdData || isUCLA) {
-        for (Trajectory &trajectory : trajectories) {
-            for (glm::vec3 &position : trajectory.positions) {
-                position = (position - minVec) / (maxVec - minVec);
-                if (isConvectionRolls || isCfdData) {
-                    glm::vec3 dims = glm::vec3(1);
-                    dims.y = boundingBox.getDimensions().y;
-                    position -= dims;
-                }
-            }
+        normalization.normalizePositions = true;
+        normalization.minVec = minVec;
+        normalization.maxVec = maxVec;
+        if (isConvectionRolls || isCfdData) {
+            glm::vec3 dims = glm::vec3(1);
+            dims.y = boundingBox.getDimensions().y;
+            normalization.positionOffset = dims;
         }
     }
 
     // if UCLA --> normalize attributes
-    if (isUCLA)
-    {
-        for(Trajectory& traj : trajectories)
-        {
-            for (float& attr : traj.attributes[0])
-            {
-                attr = (attr - minAttr) / (maxAttr - minAttr);
-            }
+    if (isUCLA) {
+        normalization.normalizeAttributes = true;
+        normalization.minAttr = minAttr;
+        normalization.maxAttr = maxAttr;
+    }
+
+    return normalization;
+}
+
+glm::vec3 TrajectoryNormalization::normalizePosition(const glm::vec3 &position) const
+{
+    if (!normalizePositions) {
+        return position;
+    }
+    return (position - minVec) / (maxVec - minVec) - positionOffset;
+}
+
+void TrajectoryNormalization::apply(const TrajectoryView &trajectory) const
+{
+    if (normalizePositions) {
+        for (glm::vec3 &position : trajectory.positions) {
+            position = normalizePosition(position);
         }
     }
+    if (normalizeAttributes && !trajectory.attributes.empty()) {
+        for (float &attr : trajectory.attributes[0]) {
+            attr = (attr - minAttr) / (maxAttr - minAttr);
+        }
+    }
+}
 
-    return trajectories;
+void TrajectoryNormalization::apply(Trajectories &trajectories) const
+{
+    if (normalizePositions) {
+        TrajectoryArray<glm::vec3> &positions = trajectories.positions;
+        #pragma omp parallel for
+        for (size_t i = 0; i < positions.size(); i++) {
+            positions[i] = normalizePosition(positions[i]);
+        }
+    }
+    if (normalizeAttributes && !trajectories.attributes.empty()) {
+        TrajectoryArray<float> &firstAttribute = trajectories.attributes.front();
+        #pragma omp parallel for
+        for (size_t i = 0; i < firstAttribute.size(); i++) {
+            firstAttribute[i] = (firstAttribute[i] - minAttr) / (maxAttr - minAttr);
+        }
+    }
 }
 
 Trajectories loadTrajectoriesFromObj(const std::string &filename, TrajectoryType trajectoryType)
@@ -104,6 +252,8 @@ Trajectories loadTrajectoriesFromObj(const std::string &filename, TrajectoryType
     bool isRings = trajectoryType == TRAJECTORY_TYPE_RINGS;
     bool isUCLA = trajectoryType == TRAJECTORY_TYPE_UCLA;
     Trajectories trajectories;
+    trajectories.setNumAttributes(1);
+    TrajectoryArray<float> &trajectoryAttributes = trajectories.attributes.front();
 
     std::vector<glm::vec3> globalLineVertices;
     std::vector<float> globalLineVertexAttributes;
@@ -196,11 +346,6 @@ Trajectories loadTrajectoriesFromObj(const std::string &filename, TrajectoryType
                 numberString.clear();
             }
 
-            Trajectory trajectory;
-
-            std::vector<float> pathLineVorticities;
-            trajectory.positions.reserve(currentLineIndices.size());
-            pathLineVorticities.reserve(currentLineIndices.size());
             for (size_t i = 0; i < currentLineIndices.size(); i++) {
                 glm::vec3 pos = globalLineVertices.at(currentLineIndices.at(i));
 
@@ -210,14 +355,10 @@ Trajectories loadTrajectoriesFromObj(const std::string &filename, TrajectoryType
                     continue;
                 }
 
-                trajectory.positions.push_back(globalLineVertices.at(currentLineIndices.at(i)));
-                pathLineVorticities.push_back(globalLineVertexAttributes.at(currentLineIndices.at(i)));
+                trajectories.positions.push_back(pos);
+                trajectoryAttributes.push_back(globalLineVertexAttributes.at(currentLineIndices.at(i)));
             }
 
-            // Compute importance criteria
-            computeTrajectoryAttributes(
-                    trajectoryType, trajectory.positions, pathLineVorticities, trajectory.attributes);
-
             // Line filtering for WCB trajectories
             //if (trajectoryType == TRAJECTORY_TYPE_WCB) {
             //  if (importanceCriteriaIn.at(3).size() > 0 && importanceCriteriaIn.at(3).at(0) < 500.0f) {
@@ -225,7 +366,7 @@ Trajectories loadTrajectoriesFromObj(const std::string &filename, TrajectoryType
             //  }
             //}
 
-            trajectories.push_back(trajectory);
+            trajectories.finishTrajectory();
         } else if (command = '#') {
             // Ignore comments
         } else {
@@ -235,13 +376,11 @@ Trajectories loadTrajectoriesFromObj(const std::string &filename, TrajectoryType
         lineBuffer.clear();
     }
 
+    // Compute importance criteria
+    computeTrajectoryAttributesBatched(trajectoryType, trajectories);
+
     // compute byte size of raw representation with 1 attribute for paper
-    uint64_t byteSize = 0;
-    for (const auto& traj : trajectories)
-    {
-        byteSize += traj.positions.size() * sizeof(float) * 3;
-        byteSize += traj.attributes[0].size() * sizeof(float);
-    }
+    uint64_t byteSize = trajectories.getNumPoints() * (sizeof(float) * 3 + sizeof(float));
 
     byteSize = byteSize / 1024 / 1024;
     std::cout << "Raw byte size of obj file: " << byteSize << "MB" << std::endl << std::flush;
@@ -250,15 +389,10 @@ Trajectories loadTrajectoriesFromObj(const std::string &filename, TrajectoryType
 }
 
 Trajectories loadTrajectoriesFromNetCdf(const std::string &filename, TrajectoryType trajectoryType) {
-    Trajectories trajectories = loadNetCdfFile(filename);
-
-    for (Trajectory &trajectory : trajectories) {
-        // Compute importance criteria
-        std::vector<float> oldAttributes = trajectory.attributes.at(0);
-        trajectory.attributes.clear();
-        computeTrajectoryAttributes(
-                trajectoryType, trajectory.positions, oldAttributes, trajectory.attributes);
-    }
+    Trajectories trajectories = loadNetCdfFile(filename, getNetCdfSelection());
+
+    // Compute importance criteria (from the first attribute)
+    computeTrajectoryAttributesBatched(trajectoryType, trajectories);
 
     return trajectories;
 }
@@ -266,50 +400,142 @@ Trajectories loadTrajectoriesFromNetCdf(const std::string &filename, TrajectoryT
 Trajectories loadTrajectoriesFromBinLines(const std::string &filename, TrajectoryType trajectoryType) {
     Trajectories trajectories;
 
-    std::ifstream file(filename.c_str(), std::ifstream::binary);
-    if (!file.is_open()) {
+    // The file is mapped into memory, i.e., the points are copied directly from the page cache to the flat arrays.
+    MappedFile file;
+    if (!file.open(filename)) {
         sgl::Logfile::get()->writeError(std::string() + "Error in loadTrajectoriesFromBinLines: File \""
                 + filename + "\" not found.");
         return trajectories;
     }
-
-    file.seekg(0, file.end);
-    size_t size = file.tellg();
-    file.seekg(0);
-    char *buffer = new char[size];
-    file.read(buffer, size);
+    const char *buffer = file.getData();
+    size_t size = file.getSize();
 
     // Read format version
-    sgl::BinaryReadStream stream(buffer, size);
-    const uint32_t LINE_FILE_FORMAT_VERSION = 1u;
-    uint32_t versionNumber;
-    stream.read(versionNumber);
-    if (versionNumber != LINE_FILE_FORMAT_VERSION) {
+    uint32_t header[3] = { 0, 0, 0 };
+    memcpy(header, buffer, std::min(size, sizeof(header)));
+    uint32_t versionNumber = header[0];
+    if (versionNumber == BINLINES_FORMAT_VERSION_2) {
+        file.close();
+        return loadTrajectoriesFromBinLinesV2(filename);
+    }
+    if (versionNumber != BINLINES_FORMAT_VERSION_1 || size < sizeof(header)) {
         sgl::Logfile::get()->writeError(std::string()
                 + "Error in loadTrajectoriesFromBinLines: Invalid magic number in file \"" + filename + "\".");
         return trajectories;
     }
 
-
-
     // Rest of header after format version
-    uint32_t numTrajectories, numAttributes, trajectoryNumPoints;
-    stream.read(numTrajectories);
-    stream.read(numAttributes);
-    trajectories.resize(numTrajectories);
+    uint32_t numTrajectories = header[1], numAttributes = header[2];
 
+    // First pass: Compute the offsets of the trajectories in the file and in the flat point arrays.
+    std::vector<size_t> fileOffsets(numTrajectories);
+    trajectories.trajectoryOffsets.resize(numTrajectories + 1);
+    size_t fileOffset = 3 * sizeof(uint32_t);
     for (uint32_t trajectoryIndex = 0; trajectoryIndex < numTrajectories; trajectoryIndex++) {
-        Trajectory &currentTrajectory = trajectories.at(trajectoryIndex);
-        stream.read(trajectoryNumPoints);
-        currentTrajectory.positions.resize(trajectoryNumPoints);
-        stream.read((void*)&currentTrajectory.positions.front(), sizeof(glm::vec3)*trajectoryNumPoints);
-        currentTrajectory.attributes.resize(numAttributes);
+        uint32_t trajectoryNumPoints = 0;
+        if (fileOffset + sizeof(uint32_t) <= size) {
+            memcpy(&trajectoryNumPoints, buffer + fileOffset, sizeof(uint32_t));
+        }
+        fileOffsets.at(trajectoryIndex) = fileOffset + sizeof(uint32_t);
+        fileOffset += sizeof(uint32_t)
+                + size_t(trajectoryNumPoints) * (sizeof(glm::vec3) + numAttributes * sizeof(float));
+        trajectories.trajectoryOffsets.at(trajectoryIndex + 1) =
+                trajectories.trajectoryOffsets.at(trajectoryIndex) + trajectoryNumPoints;
+    }
+    if (fileOffset > size) {
+        sgl::Logfile::get()->writeError(std::string()
+                + "Error in loadTrajectoriesFromBinLines: Unexpected end of file \"" + filename + "\".");
+        return Trajectories();
+    }
+
+    // Second pass: Copy the points of all trajectories to the flat arrays in parallel.
+    size_t numPoints = trajectories.trajectoryOffsets.back();
+    trajectories.positions.resize(numPoints);
+    trajectories.attributes.resize(numAttributes, TrajectoryArray<float>(numPoints));
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (size_t trajectoryIndex = 0; trajectoryIndex < size_t(numTrajectories); trajectoryIndex++) {
+        size_t pointOffset = trajectories.trajectoryOffsets[trajectoryIndex];
+        size_t trajectoryNumPoints = trajectories.getNumPoints(trajectoryIndex);
+        if (trajectoryNumPoints == 0) {
+            continue;
+        }
+        const char *trajectoryData = buffer + fileOffsets[trajectoryIndex];
+        memcpy(&trajectories.positions[pointOffset], trajectoryData, sizeof(glm::vec3)*trajectoryNumPoints);
+        trajectoryData += sizeof(glm::vec3)*trajectoryNumPoints;
         for (uint32_t attributeIndex = 0; attributeIndex < numAttributes; attributeIndex++) {
-            std::vector<float> &currentAttribute = currentTrajectory.attributes.at(attributeIndex);
-            currentAttribute.resize(trajectoryNumPoints);
-            stream.read((void*)&currentAttribute.front(), sizeof(float)*trajectoryNumPoints);
+            memcpy(&trajectories.attributes[attributeIndex][pointOffset], trajectoryData,
+                    sizeof(float)*trajectoryNumPoints);
+            trajectoryData += sizeof(float)*trajectoryNumPoints;
         }
     }
 
     return trajectories;
 }
+
+bool streamTrajectoriesFromBinLines(
+        const std::string &filename, size_t maxBatchSizeBytes,
+        std::function<void(Trajectories &batch, float progress)> batchCallback)
+{
+    std::ifstream file(filename.c_str(), std::ifstream::binary);
+    if (!file.is_open()) {
+        sgl::Logfile::get()->writeError(std::string() + "Error in streamTrajectoriesFromBinLines: File \""
+                + filename + "\" not found.");
+        return false;
+    }
+
+    file.seekg(0, file.end);
+    size_t size = file.tellg();
+    file.seekg(0);
+
+    // Read format version
+    uint32_t versionNumber = 0;
+    file.read((char*)&versionNumber, sizeof(uint32_t));
+    if (versionNumber == BINLINES_FORMAT_VERSION_2) {
+        file.close();
+        return streamTrajectoriesFromBinLinesV2(filename, maxBatchSizeBytes, batchCallback);
+    }
+    if (versionNumber != BINLINES_FORMAT_VERSION_1) {
+        sgl::Logfile::get()->writeError(std::string()
+                + "Error in streamTrajectoriesFromBinLines: Invalid magic number in file \"" + filename + "\".");
+        return false;
+    }
+
+    // Rest of header after format version
+    uint32_t numTrajectories = 0, numAttributes = 0, trajectoryNumPoints = 0;
+    file.read((char*)&numTrajectories, sizeof(uint32_t));
+    file.read((char*)&numAttributes, sizeof(uint32_t));
+
+    // The batch container is reused, i.e., its arrays are only reallocated if a batch is larger than all previous ones.
+    Trajectories batch;
+    batch.setNumAttributes(numAttributes);
+    size_t batchSizeBytes = 0;
+    for (uint32_t trajectoryIndex = 0; trajectoryIndex < numTrajectories; trajectoryIndex++) {
+        file.read((char*)&trajectoryNumPoints, sizeof(uint32_t));
+        if (!file.good()) {
+            trajectoryNumPoints = 0;
+        }
+        size_t pointOffset = batch.getNumPoints();
+        batch.positions.resize(pointOffset + trajectoryNumPoints);
+        file.read((char*)(batch.positions.data() + pointOffset), sizeof(glm::vec3)*trajectoryNumPoints);
+        for (uint32_t attributeIndex = 0; attributeIndex < numAttributes; attributeIndex++) {
+            TrajectoryArray<float> &currentAttribute = batch.attributes.at(attributeIndex);
+            currentAttribute.resize(pointOffset + trajectoryNumPoints);
+            file.read((char*)(currentAttribute.data() + pointOffset), sizeof(float)*trajectoryNumPoints);
+        }
+        batch.finishTrajectory();
+        if (!file.good()) {
+            sgl::Logfile::get()->writeError(std::string()
+                    + "Error in streamTrajectoriesFromBinLines: Unexpected end of file \"" + filename + "\".");
+            return false;
+        }
+
+        batchSizeBytes += trajectoryNumPoints * (sizeof(glm::vec3) + numAttributes * sizeof(float));
+        if (batchSizeBytes >= maxBatchSizeBytes || trajectoryIndex == numTrajectories - 1) {
+            batchCallback(batch, float(double(file.tellg()) / double(size)));
+            batch.clear();
+            batchSizeBytes = 0;
+        }
+    }
+
+    return true;
+}
@@ -7,19 +7,297 @@
 
 #include <string>
 #include <vector>
+#include <memory>
+#include <utility>
+#include <functional>
+#include <stdexcept>
+#include <type_traits>
 #include <glm/glm.hpp>
+#include <Math/Geometry/AABB3.hpp>
 #include "Utils/ImportanceCriteria.hpp"
 
-struct Trajectory {
-    std::vector<glm::vec3> positions;
-    std::vector<std::vector<float>> attributes;
+/**
+ * Non-owning view of a contiguous array (e.g., the points of one trajectory in the flat Trajectories container).
+ */
+template<class T>
+class ArrayView
+{
+public:
+    ArrayView() : ptr(nullptr), n(0) {}
+    ArrayView(T *data, size_t size) : ptr(data), n(size) {}
+
+    inline size_t size() const { return n; }
+    inline bool empty() const { return n == 0; }
+    inline T *data() const { return ptr; }
+    inline T *begin() const { return ptr; }
+    inline T *end() const { return ptr + n; }
+    inline T &front() const { return ptr[0]; }
+    inline T &back() const { return ptr[n - 1]; }
+    inline T &operator[](size_t i) const { return ptr[i]; }
+    inline T &at(size_t i) const {
+        if (i >= n) {
+            throw std::out_of_range("ArrayView::at: Index out of range.");
+        }
+        return ptr[i];
+    }
+
+private:
+    T *ptr;
+    size_t n;
+};
+
+class MappedFile;
+
+/**
+ * Array of the Trajectories container. Like std::vector, it owns its elements, or it is a view of a block of a file
+ * that is mapped copy-on-write (see loadTrajectoriesFromBinLinesV2), which stays mapped as long as the view exists.
+ * The elements of a mapped array are read and written like owned ones: The operating system only reads the pages that
+ * are accessed and only copies the pages that are written. Operations changing the size copy the elements to owned
+ * memory first, and copies of an array always own their elements.
+ */
+template<class T>
+class TrajectoryArray
+{
+public:
+    typedef T value_type;
+    typedef T *iterator;
+    typedef const T *const_iterator;
+
+    TrajectoryArray() {}
+    explicit TrajectoryArray(size_t size, const T &value = T()) : elements(size, value) {}
+    explicit TrajectoryArray(std::vector<T> &&elements) : elements(std::move(elements)) {}
+    TrajectoryArray(const TrajectoryArray &other) : elements(other.begin(), other.end()) {}
+    TrajectoryArray(TrajectoryArray &&other) noexcept { swap(other); }
+    TrajectoryArray &operator=(TrajectoryArray other) { swap(other); return *this; }
+
+    inline void swap(TrajectoryArray &other) noexcept {
+        elements.swap(other.elements);
+        mappedFile.swap(other.mappedFile);
+        std::swap(mappedData, other.mappedData);
+        std::swap(mappedSize, other.mappedSize);
+    }
+
+    /// Makes the array a view of "size" elements at "data", which lies in the copy-on-write mapping of "file".
+    inline void setMappedData(const std::shared_ptr<MappedFile> &file, T *data, size_t size) {
+        elements = std::vector<T>();
+        mappedFile = file;
+        mappedData = data;
+        mappedSize = size;
+    }
+    inline bool isMapped() const { return mappedData != nullptr; }
+
+    inline size_t size() const { return mappedData ? mappedSize : elements.size(); }
+    inline bool empty() const { return size() == 0; }
+    inline T *data() { return mappedData ? mappedData : elements.data(); }
+    inline const T *data() const { return mappedData ? mappedData : elements.data(); }
+    inline T *begin() { return data(); }
+    inline T *end() { return data() + size(); }
+    inline const T *begin() const { return data(); }
+    inline const T *end() const { return data() + size(); }
+    inline T &front() { return data()[0]; }
+    inline const T &front() const { return data()[0]; }
+    inline T &back() { return data()[size() - 1]; }
+    inline const T &back() const { return data()[size() - 1]; }
+    inline T &operator[](size_t i) { return data()[i]; }
+    inline const T &operator[](size_t i) const { return data()[i]; }
+    inline T &at(size_t i) {
+        if (i >= size()) {
+            throw std::out_of_range("TrajectoryArray::at: Index out of range.");
+        }
+        return data()[i];
+    }
+    inline const T &at(size_t i) const {
+        if (i >= size()) {
+            throw std::out_of_range("TrajectoryArray::at: Index out of range.");
+        }
+        return data()[i];
+    }
+
+    inline void resize(size_t newSize) { makeOwned(); elements.resize(newSize); }
+    inline void resize(size_t newSize, const T &value) { makeOwned(); elements.resize(newSize, value); }
+    inline void reserve(size_t capacity) { makeOwned(); elements.reserve(capacity); }
+    inline void push_back(const T &value) { makeOwned(); elements.push_back(value); }
+    template<class InputIt>
+    inline void insert(const T *position, InputIt first, InputIt last) {
+        size_t index = size_t(position - data());
+        makeOwned();
+        elements.insert(elements.begin() + index, first, last);
+    }
+    inline void clear() { unmap(); elements.clear(); }
+
+private:
+    inline void makeOwned() {
+        if (mappedData) {
+            std::vector<T> ownedElements(mappedData, mappedData + mappedSize);
+            unmap();
+            elements.swap(ownedElements);
+        }
+    }
+    inline void unmap() {
+        mappedFile.reset();
+        mappedData = nullptr;
+        mappedSize = 0;
+    }
+
+    std::vector<T> elements;
+    std::shared_ptr<MappedFile> mappedFile;
+    T *mappedData = nullptr;
+    size_t mappedSize = 0;
 };
 
-typedef std::vector<Trajectory> Trajectories;
+/**
+ * The attributes of one trajectory, i.e., one ArrayView per attribute array of the Trajectories container.
+ */
+template<class T, class AttributeArrays>
+class TrajectoryAttributesView
+{
+public:
+    TrajectoryAttributesView(AttributeArrays *attributeArrays, size_t offset, size_t numPoints)
+            : attributeArrays(attributeArrays), offset(offset), numPoints(numPoints) {}
+
+    inline size_t size() const { return attributeArrays->size(); }
+    inline bool empty() const { return attributeArrays->empty(); }
+    inline ArrayView<T> operator[](size_t i) const {
+        return ArrayView<T>((*attributeArrays)[i].data() + offset, numPoints);
+    }
+    inline ArrayView<T> at(size_t i) const {
+        return ArrayView<T>(attributeArrays->at(i).data() + offset, numPoints);
+    }
+
+private:
+    AttributeArrays *attributeArrays;
+    size_t offset, numPoints;
+};
+
+/**
+ * View of one trajectory stored in the Trajectories container. Views are cheap to copy and are returned by value.
+ */
+template<bool IsConst>
+struct TrajectoryViewBase
+{
+    typedef typename std::conditional<IsConst, const glm::vec3, glm::vec3>::type PositionType;
+    typedef typename std::conditional<IsConst, const float, float>::type AttributeType;
+    typedef typename std::conditional<IsConst, const std::vector<TrajectoryArray<float>>,
+            std::vector<TrajectoryArray<float>>>::type AttributeArrays;
+
+    typedef ArrayView<PositionType> PositionsView;
+    typedef TrajectoryAttributesView<AttributeType, AttributeArrays> AttributesView;
+
+    TrajectoryViewBase(PositionType *allPositions, AttributeArrays *attributeArrays, size_t offset, size_t numPoints)
+            : positions(allPositions + offset, numPoints), attributes(attributeArrays, offset, numPoints) {}
+
+    PositionsView positions;
+    AttributesView attributes;
+};
+
+typedef TrajectoryViewBase<false> TrajectoryView;
+typedef TrajectoryViewBase<true> ConstTrajectoryView;
+
+template<class TrajectoriesType, class ViewType>
+class TrajectoryIterator
+{
+public:
+    TrajectoryIterator(TrajectoriesType *trajectories, size_t index) : trajectories(trajectories), index(index) {}
+    inline ViewType operator*() const { return (*trajectories)[index]; }
+    inline TrajectoryIterator &operator++() { index++; return *this; }
+    inline bool operator==(const TrajectoryIterator &other) const { return index == other.index; }
+    inline bool operator!=(const TrajectoryIterator &other) const { return index != other.index; }
+
+private:
+    TrajectoriesType *trajectories;
+    size_t index;
+};
+
+/**
+ * Flat (CSR-like) storage of a set of trajectories: One array for the positions of all points, one array per
+ * attribute (with one value per point), and the offsets of the trajectories in these arrays. The points of trajectory
+ * i are stored at the indices trajectoryOffsets[i] to trajectoryOffsets[i+1]-1. This avoids two small allocations
+ * per trajectory and attribute, and passes over all points (e.g., normalization) become plain array loops.
+ *
+ * Trajectories are added by appending their points to "positions" and to all attribute arrays and calling
+ * finishTrajectory afterwards. Single trajectories are accessed with views (see TrajectoryView). The point arrays of
+ * trajectories loaded from binlines v2 files are views of the mapped file (see TrajectoryArray).
+ */
+class Trajectories
+{
+public:
+    TrajectoryArray<glm::vec3> positions;
+    std::vector<TrajectoryArray<float>> attributes;
+    std::vector<size_t> trajectoryOffsets = std::vector<size_t>(1, 0); ///< numTrajectories + 1 entries.
+
+    /// @return The number of trajectories.
+    inline size_t size() const { return trajectoryOffsets.size() - 1; }
+    inline bool empty() const { return trajectoryOffsets.size() <= 1; }
+    inline size_t getNumPoints() const { return positions.size(); }
+    inline size_t getNumPoints(size_t trajectoryIndex) const {
+        return trajectoryOffsets[trajectoryIndex + 1] - trajectoryOffsets[trajectoryIndex];
+    }
+
+    inline TrajectoryView operator[](size_t i) {
+        return TrajectoryView(positions.data(), &attributes, trajectoryOffsets[i], getNumPoints(i));
+    }
+    inline ConstTrajectoryView operator[](size_t i) const {
+        return ConstTrajectoryView(positions.data(), &attributes, trajectoryOffsets[i], getNumPoints(i));
+    }
+    inline TrajectoryView at(size_t i) {
+        if (i >= size()) {
+            throw std::out_of_range("Trajectories::at: Index out of range.");
+        }
+        return (*this)[i];
+    }
+    inline ConstTrajectoryView at(size_t i) const {
+        if (i >= size()) {
+            throw std::out_of_range("Trajectories::at: Index out of range.");
+        }
+        return (*this)[i];
+    }
+
+    typedef TrajectoryIterator<Trajectories, TrajectoryView> iterator;
+    typedef TrajectoryIterator<const Trajectories, ConstTrajectoryView> const_iterator;
+    inline iterator begin() { return iterator(this, 0); }
+    inline iterator end() { return iterator(this, size()); }
+    inline const_iterator begin() const { return const_iterator(this, 0); }
+    inline const_iterator end() const { return const_iterator(this, size()); }
+
+    /// Marks all points appended to the point arrays since the last call as a new trajectory.
+    inline void finishTrajectory() { trajectoryOffsets.push_back(positions.size()); }
+    /// Resizes the attribute arrays to "numAttributes" (only allowed while the container is empty).
+    void setNumAttributes(size_t numAttributes);
+    void reserve(size_t numTrajectories, size_t numPoints);
+    void clear();
+};
+
+/**
+ * The normalization loadTrajectoriesFromFile applies to special datasets (e.g. the rings dataset). It only depends on
+ * the bounding box of the positions and on the range of the first attribute. Thus, it can also be applied to
+ * trajectories that are streamed in batches.
+ */
+struct TrajectoryNormalization {
+    bool normalizePositions = false;
+    glm::vec3 minVec = glm::vec3(0.0f), maxVec = glm::vec3(1.0f);
+    glm::vec3 positionOffset = glm::vec3(0.0f); ///< Subtracted after the normalization.
+    bool normalizeAttributes = false;
+    float minAttr = 0.0f, maxAttr = 1.0f;
+
+    glm::vec3 normalizePosition(const glm::vec3 &position) const;
+    void apply(const TrajectoryView &trajectory) const;
+    /// Normalizes all points in parallel.
+    void apply(Trajectories &trajectories) const;
+};
+
+/**
+ * @param boundingBox The bounding box of all trajectory positions.
+ * @param minAttr, maxAttr The range of the first attribute (only needed for TRAJECTORY_TYPE_UCLA).
+ */
+TrajectoryNormalization computeTrajectoryNormalization(
+        TrajectoryType trajectoryType, const sgl::AABB3 &boundingBox, float minAttr, float maxAttr);
 
 /**
  * Selects loadTrajectoriesFromObj, loadTrajectoriesFromNetCdf or loadTrajectoriesFromBinLines depending on the file
  * endings and performs some normalization for special datasets (e.g. the rings dataset).
+ * Binlines v2 files are mapped into memory instead of being copied (see loadTrajectoriesFromBinLinesV2). If the setting
+ * "binlinesV2-cacheConversions" is enabled, .obj, .nc and .binlines v1 files are converted to binlines v2 files in the
+ * derived data cache when they are loaded for the first time, which are loaded instead on subsequent calls.
  * @param filename The name of the trajectory file to open.
  * @return The trajectories loaded from the file (empty if the file could not be opened).
  */
@@ -31,4 +309,15 @@ Trajectories loadTrajectoriesFromNetCdf(const std::string &filename, TrajectoryT
 
 Trajectories loadTrajectoriesFromBinLines(const std::string &filename, TrajectoryType trajectoryType);
 
+/**
+ * Reads the trajectories of a .binlines file (v1 or v2) in batches without loading the whole file into memory.
+ * NOTE: The normalization of loadTrajectoriesFromFile is not applied (see computeTrajectoryNormalization).
+ * @param maxBatchSizeBytes The approximate maximum size of one batch of trajectories in bytes.
+ * @param batchCallback Called for every batch with the trajectories and the fraction of the file read so far.
+ * @return Whether the file could be read successfully.
+ */
+bool streamTrajectoriesFromBinLines(
+        const std::string &filename, size_t maxBatchSizeBytes,
+        std::function<void(Trajectories &batch, float progress)> batchCallback);
+
 #endif //PIXELSYNCOIT_TRAJECTORYFILE_HPP
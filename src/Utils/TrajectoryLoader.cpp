@@ -16,6 +16,9 @@
 
 #include "MeshSerializer.hpp"
 #include "TrajectoryFile.hpp"
+#include "MeshOptimizer.hpp"
+#include "MeshClustering.hpp"
+#include "MeshQuantization.hpp"
 #include "TrajectoryLoader.hpp"
 
 using namespace sgl;
@@ -233,8 +236,8 @@ void createTubeRenderData(const std::vector<glm::vec3> &pathLineCenters,
         vertexAttributes.clear();
     }
 }
-void createTubeRenderData(const std::vector<glm::vec3> &pathLineCenters,
-                          std::vector<std::vector<float>> &importanceCriteriaLine,
+void createTubeRenderData(const ConstTrajectoryView::PositionsView &pathLineCenters,
+                          const ConstTrajectoryView::AttributesView &importanceCriteriaLine,
                           std::vector<glm::vec3> &vertices,
                           std::vector<glm::vec3> &normals,
                           std::vector<std::vector<float>> &importanceCriteriaVertex,
@@ -393,19 +396,26 @@ void convertTrajectoryDataToBinaryTriangleMesh(
     uint32_t numLineSegments = 0;
 
 
-    Trajectories trajectories = loadTrajectoriesFromFile(trajectoriesFilename, trajectoryType);
+    const Trajectories trajectories = loadTrajectoriesFromFile(trajectoriesFilename, trajectoryType);
 
+    // The per-trajectory arrays are reused to avoid allocations per trajectory.
+    std::vector<glm::vec3> localVertices;
+    std::vector<std::vector<float>> importanceCriteriaVertex;
+    std::vector<glm::vec3> localNormals;
+    std::vector<uint32_t> localIndices;
     for (size_t i = 0; i < trajectories.size(); i++) {
-        Trajectory &trajectory = trajectories.at(i);
+        ConstTrajectoryView trajectory = trajectories.at(i);
 
         numLines++;
         numLineSegments += trajectory.positions.size() - 1;
 
         // Create tube render data
-        std::vector<glm::vec3> localVertices;
-        std::vector<std::vector<float>> importanceCriteriaVertex;
-        std::vector<glm::vec3> localNormals;
-        std::vector<uint32_t> localIndices;
+        localVertices.clear();
+        for (std::vector<float> &criterion : importanceCriteriaVertex) {
+            criterion.clear();
+        }
+        localNormals.clear();
+        localIndices.clear();
         createTubeRenderData(trajectory.positions, trajectory.attributes, localVertices, localNormals,
                              importanceCriteriaVertex, localIndices);
 
@@ -484,6 +494,9 @@ void convertTrajectoryDataToBinaryTriangleMesh(
                               + sgl::toString(numVertices) + " vertices, "
                               + sgl::toString(numIndices / 3) + " faces, "
                               + sgl::toString(numIndices) + " indices.");
+    optimizeBinaryMesh(binaryMesh);
+    buildMeshClusters(binaryMesh);
+    quantizeBinaryMesh(binaryMesh);
     Logfile::get()->writeInfo(std::string() + "Writing binary mesh...");
     writeMesh3D(binaryFilename, binaryMesh);
 
@@ -524,8 +537,8 @@ void computeLineNormal(const glm::vec3 &tangent, glm::vec3 &normal, const glm::v
  * @param vertices: The (output) vertex points, which are a set of oriented circles around the centers (see above).
  * @param indices: The (output) indices specifying how tube triangles are built from the circle vertices.
  */
-void createTangentAndNormalData(std::vector<glm::vec3> &pathLineCenters,
-                                std::vector<std::vector<float>> &importanceCriteriaIn,
+void createTangentAndNormalData(const ConstTrajectoryView::PositionsView &pathLineCenters,
+                                const ConstTrajectoryView::AttributesView &importanceCriteriaIn,
                                 std::vector<glm::vec3> &vertices,
                                 std::vector<std::vector<float>> &importanceCriteriaOut,
                                 std::vector<glm::vec3> &tangents,
@@ -667,21 +680,24 @@ void convertTrajectoryDataToBinaryTriangleMeshGPU(
 
     auto startLoad = std::chrono::system_clock::now();
 
-    Trajectories trajectories = loadTrajectoriesFromFile(trajectoriesFilename, trajectoryType);
+    const Trajectories trajectories = loadTrajectoriesFromFile(trajectoriesFilename, trajectoryType);
+
+    // The flat point arrays of the trajectories already have the layout of the input buffer.
+    const size_t numTrajectoryPoints = trajectories.getNumPoints();
+    const TrajectoryArray<float> &lineAttributes = trajectories.attributes.at(0);
+    inputLinePoints.resize(numTrajectoryPoints);
+    #pragma omp parallel for
+    for (size_t i = 0; i < numTrajectoryPoints; i++) {
+        inputLinePoints[i].linePoint = trajectories.positions[i];
+        inputLinePoints[i].lineAttribute = lineAttributes[i];
+    }
 
+    lineOffsetsInput.reserve(trajectories.size() + 1);
     lineOffsetsInput.push_back(0);
     for (size_t i = 0; i < trajectories.size(); i++) {
-        Trajectory &trajectory = trajectories.at(i);
-
-        InputLinePoint inputLinePoint;
-        for (int j = 0; j < trajectory.positions.size(); j++) {
-            inputLinePoint.linePoint = trajectory.positions.at(j);
-            inputLinePoint.lineAttribute = trajectory.attributes.at(0).at(j);
-            inputLinePoints.push_back(inputLinePoint);
-        }
-
-        if (trajectory.positions.size() > 0) {
-            numLinePointsInput += trajectory.positions.size();
+        size_t numTrajectoryPointsLocal = trajectories.getNumPoints(i);
+        if (numTrajectoryPointsLocal > 0) {
+            numLinePointsInput += numTrajectoryPointsLocal;
             numLinesInput++;
         } else {
             continue;
@@ -914,6 +930,9 @@ void convertTrajectoryDataToBinaryTriangleMeshGPU(
                               + sgl::toString(numVertices) + " vertices, "
                               + sgl::toString(numIndicesTubes / 3) + " faces, "
                               + sgl::toString(numIndicesTubes) + " indices.");
+    optimizeBinaryMesh(binaryMesh);
+    buildMeshClusters(binaryMesh);
+    quantizeBinaryMesh(binaryMesh);
     Logfile::get()->writeInfo(std::string() + "Writing binary mesh...");
     writeMesh3D(binaryFilename, binaryMesh);
 
@@ -956,17 +975,25 @@ void convertTrajectoryDataToBinaryLineMesh(
     std::vector<uint32_t> globalIndices;
 
 
-    Trajectories trajectories = loadTrajectoriesFromFile(trajectoriesFilename, trajectoryType);
+    const Trajectories trajectories = loadTrajectoriesFromFile(trajectoriesFilename, trajectoryType);
 
+    // The per-trajectory arrays are reused to avoid allocations per trajectory.
+    std::vector<glm::vec3> localVertices;
+    std::vector<glm::vec3> localTangents;
+    std::vector<glm::vec3> localNormals;
+    std::vector<uint32_t> localIndices;
+    std::vector<std::vector<float>> importanceCriteriaOut;
     for (size_t i = 0; i < trajectories.size(); i++) {
-        Trajectory &trajectory = trajectories.at(i);
+        ConstTrajectoryView trajectory = trajectories.at(i);
 
         // Create tube render data
-        std::vector<glm::vec3> localVertices;
-        std::vector<glm::vec3> localTangents;
-        std::vector<glm::vec3> localNormals;
-        std::vector<uint32_t> localIndices;
-        std::vector<std::vector<float>> importanceCriteriaOut;
+        localVertices.clear();
+        localTangents.clear();
+        localNormals.clear();
+        localIndices.clear();
+        for (std::vector<float> &criterion : importanceCriteriaOut) {
+            criterion.clear();
+        }
         createTangentAndNormalData(trajectory.positions, trajectory.attributes, localVertices,
                                    importanceCriteriaOut, localTangents, localNormals, localIndices);
 
@@ -1059,6 +1086,8 @@ void convertTrajectoryDataToBinaryLineMesh(
                               + sgl::toString(numVertices) + " vertices, "
                               + sgl::toString(numIndices / 3) + " faces, "
                               + sgl::toString(numIndices) + " indices.");
+    buildMeshClusters(binaryMesh);
+    quantizeBinaryMesh(binaryMesh);
     Logfile::get()->writeInfo(std::string() + "Writing binary mesh...");
     writeMesh3D(binaryFilename, binaryMesh);
 
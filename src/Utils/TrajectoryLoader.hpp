@@ -40,6 +40,8 @@ void createTubeRenderData<uint32_t>(const std::vector<glm::vec3> &pathLineCenter
                                     std::vector<uint32_t> &vertexAttributes,
                                     std::vector<uint32_t> &indices);
 
+/// Appends "numSegments" points on the circle with the passed center and radius to "points".
+void getPointsOnCircle(std::vector<glm::vec2> &points, const glm::vec2 &center, float radius, int numSegments);
 void initializeCircleData(int numSegments, float radius);
 
 void convertTrajectoryDataToBinaryTriangleMesh(
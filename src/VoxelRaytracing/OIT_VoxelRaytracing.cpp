@@ -4,17 +4,21 @@
 
 #include <cmath>
 #include <chrono>
+#include <algorithm>
 #include <boost/algorithm/string/predicate.hpp>
+#include <boost/filesystem.hpp>
 
 #include <GL/glew.h>
 
 #include <Utils/File/FileUtils.hpp>
 #include <Utils/File/Logfile.hpp>
+#include <Utils/Convert.hpp>
 #include <Graphics/Texture/TextureManager.hpp>
 #include <Graphics/Scene/Camera.hpp>
 #include <ImGui/ImGuiWrapper.hpp>
 
 #include "../Performance/InternalState.hpp"
+#include "../Utils/DerivedDataCache.hpp"
 #include "VoxelCurveDiscretizer.hpp"
 #include "OIT_VoxelRaytracing.hpp"
 #include "../OIT/BufferSizeWatch.hpp"
@@ -22,6 +26,44 @@
 //#define VOXEL_RAYTRACING_COMPUTE_SHADER
 
 static bool useNeighborSearch = true;
+// Recompute density and AO factors on the CPU using the attribute histograms when the transfer function changes
+static bool recomputeDensityOnGPU = false;
+
+/**
+ * Settings read from the application settings: "voxelPyramid-numLevels" (1 disables the voxel grid pyramid),
+ * "voxelPyramid-maxVoxelSizePixels" (see selectPyramidLevel), "voxelOutOfCore-minFileSizeMiB" and
+ * "voxelOutOfCore-memoryCeilingMiB" (see VoxelCurveDiscretizer::createFromTrajectoryDatasetOutOfCore).
+ */
+struct VoxelRaytracingSettings
+{
+    int pyramidNumLevels = 4;
+    float pyramidMaxVoxelSizePixels = 1.0f;
+    /// Trajectory datasets larger than this are voxelized out-of-core (only .binlines files).
+    uintmax_t outOfCoreMinFileSizeBytes = uintmax_t(8) << 30;
+    size_t outOfCoreMemoryCeilingBytes = size_t(2) << 30;
+};
+
+static VoxelRaytracingSettings getVoxelRaytracingSettings()
+{
+    VoxelRaytracingSettings voxelSettings;
+    sgl::SettingsFile &settings = sgl::AppSettings::get()->getSettings();
+    if (settings.hasKey("voxelPyramid-numLevels")) {
+        voxelSettings.pyramidNumLevels = std::max(settings.getIntValue("voxelPyramid-numLevels"), 1);
+    }
+    if (settings.hasKey("voxelPyramid-maxVoxelSizePixels")) {
+        voxelSettings.pyramidMaxVoxelSizePixels = sgl::fromString<float>(
+                settings.getValue("voxelPyramid-maxVoxelSizePixels"));
+    }
+    if (settings.hasKey("voxelOutOfCore-minFileSizeMiB")) {
+        voxelSettings.outOfCoreMinFileSizeBytes =
+                uintmax_t(std::max(settings.getIntValue("voxelOutOfCore-minFileSizeMiB"), 0)) << 20;
+    }
+    if (settings.hasKey("voxelOutOfCore-memoryCeilingMiB")) {
+        voxelSettings.outOfCoreMemoryCeilingBytes =
+                size_t(std::max(settings.getIntValue("voxelOutOfCore-memoryCeilingMiB"), 1)) << 20;
+    }
+    return voxelSettings;
+}
 
 OIT_VoxelRaytracing::OIT_VoxelRaytracing(sgl::CameraPtr &camera, const sgl::Color &clearColor) : camera(camera), clearColor(clearColor)
 {
@@ -76,6 +118,21 @@ void OIT_VoxelRaytracing::renderGUI()
         reloadShader();
         reRender = true;
     }
+
+    if (ImGui::Checkbox("Recompute Density on GPU", &recomputeDensityOnGPU)) {
+        onTransferFunctionMapRebuilt();
+        reRender = true;
+    }
+
+    if (pyramid.levels.size() > 1) {
+        if (ImGui::Checkbox("Use Voxel Grid Pyramid", &usePyramid)) {
+            reRender = true;
+        }
+        if (usePyramid && ImGui::SliderFloat("Max. Voxel Size (Pixels)", &maxVoxelSizePixels, 0.25f, 8.0f)) {
+            reRender = true;
+        }
+        ImGui::Text("Pyramid Level: %d (Grid Resolution %d)", pyramidLevel, data.gridResolution.x);
+    }
 }
 
 void OIT_VoxelRaytracing::resolutionChanged(sgl::FramebufferObjectPtr &sceneFramebuffer, sgl::TexturePtr &sceneTexture,
@@ -102,6 +159,7 @@ void OIT_VoxelRaytracing::setNewState(const InternalState &newState)
     //int quantizationResolution = newState.oitAlgorithmSettings.getIntValue("quantizationResolution");
 
     newState.oitAlgorithmSettings.getValueOpt("useNeighborSearch", useNeighborSearch);
+    newState.oitAlgorithmSettings.getValueOpt("recomputeDensityOnGPU", recomputeDensityOnGPU);
     if (useNeighborSearch) {
         sgl::ShaderManager->removePreprocessorDefine("VOXEL_RAY_CASTING_FAST");
     } else {
@@ -113,12 +171,9 @@ void OIT_VoxelRaytracing::setNewState(const InternalState &newState)
 void OIT_VoxelRaytracing::fromFile(const std::string &filename, TrajectoryType trajectoryType,
         std::vector<float> &attributes, float &maxVorticity)
 {
-    // Check if voxel grid is already created
-    // Pure filename without extension (to create compressed .voxel filename)
+    // Pure filename without extension (to get the source filename of the voxel grid)
     std::string modelFilenamePure = sgl::FileUtils::get()->removeExtension(filename);
 
-    std::string modelFilenameVoxelGrid = modelFilenamePure + ".voxel";
-
     // Can be either hair dataset or trajectory dataset
     isHairDataset = boost::starts_with(
             modelFilenamePure, sgl::AppSettings::get()->getDataDirectory() + "Hair");
@@ -169,7 +224,58 @@ void OIT_VoxelRaytracing::fromFile(const std::string &filename, TrajectoryType t
         maxNumLinesPerVoxel = 64;
     }*/
 
-    if (!sgl::FileUtils::get()->exists(modelFilenameVoxelGrid)) {
+    VoxelRaytracingSettings voxelSettings = getVoxelRaytracingSettings();
+    bool useOutOfCoreVoxelization = !isHairDataset && boost::ends_with(filename, ".binlines")
+            && sgl::FileUtils::get()->exists(filename)
+            && boost::filesystem::file_size(filename) > voxelSettings.outOfCoreMinFileSizeBytes;
+
+    // Check if voxel grid with the same build parameters is already created
+    std::string sourceFilename = modelFilenamePure + (isHairDataset ? ".hair" : ".obj");
+    if (useOutOfCoreVoxelization) {
+        sourceFilename = filename;
+    }
+    DerivedDataKey voxelGridKey(sourceFilename, "voxel", VOXEL_GRID_FORMAT_VERSION);
+    voxelGridKey.addParameter("trajectoryType", int(trajectoryType));
+    voxelGridKey.addParameter("gridResolution", int(voxelRes));
+    voxelGridKey.addParameter("quantizationResolution", int(quantizationRes));
+    voxelGridKey.addParameter("maxNumLinesPerVoxel", maxNumLinesPerVoxel);
+    if (useOutOfCoreVoxelization) {
+        // Version 2 stores the attribute values and their maximum.
+        voxelGridKey.addParameter("outOfCoreVersion", 2);
+    }
+#ifdef PACK_LINES
+    voxelGridKey.addParameter("packLines", true);
+#else
+    voxelGridKey.addParameter("packLines", false);
+#endif
+    std::string modelFilenameVoxelGrid = DerivedDataCache::get()->getArtifactFilename(voxelGridKey);
+
+    // The coarser pyramid levels are derived from the voxel grid and cached as a separate artifact.
+    maxVoxelSizePixels = voxelSettings.pyramidMaxVoxelSizePixels;
+    DerivedDataKey pyramidKey = voxelGridKey;
+    pyramidKey.artifactType = "voxelpyramid";
+    pyramidKey.formatVersion = VOXEL_GRID_PYRAMID_FORMAT_VERSION;
+    pyramidKey.addParameter("voxelGridFormatVersion", int(VOXEL_GRID_FORMAT_VERSION));
+    pyramidKey.addParameter("numLevels", voxelSettings.pyramidNumLevels);
+    std::string modelFilenamePyramid = DerivedDataCache::get()->getArtifactFilename(pyramidKey);
+    bool usePyramidFile = voxelSettings.pyramidNumLevels > 1;
+
+    VoxelGridDataCompressed compressedData;
+    bool isVoxelGridCached = DerivedDataCache::get()->lookup(modelFilenameVoxelGrid);
+
+    if (!isVoxelGridCached && useOutOfCoreVoxelization) {
+        VoxelCurveDiscretizer discretizer(glm::ivec3(voxelRes),
+                glm::ivec3(quantizationRes, quantizationRes, quantizationRes));
+        // The brick files are spilled to a directory next to the artifact in the cache directory.
+        isVoxelGridCached = discretizer.createFromTrajectoryDatasetOutOfCore(
+                filename, trajectoryType, modelFilenameVoxelGrid, modelFilenameVoxelGrid + "_tmp",
+                voxelSettings.outOfCoreMemoryCeilingBytes);
+        if (isVoxelGridCached) {
+            DerivedDataCache::get()->commit(modelFilenameVoxelGrid);
+        }
+    }
+
+    if (!isVoxelGridCached) {
         VoxelCurveDiscretizer discretizer(glm::ivec3(voxelRes),
                 glm::ivec3(quantizationRes, quantizationRes, quantizationRes));
 
@@ -206,6 +312,7 @@ void OIT_VoxelRaytracing::fromFile(const std::string &filename, TrajectoryType t
                                        + std::to_string(elapsed.count()));
 
         saveToFile(modelFilenameVoxelGrid, compressedData);
+        DerivedDataCache::get()->commit(modelFilenameVoxelGrid);
     } else {
         loadFromFile(modelFilenameVoxelGrid, compressedData);
         if (isHairDataset) {
@@ -216,15 +323,32 @@ void OIT_VoxelRaytracing::fromFile(const std::string &filename, TrajectoryType t
             maxVorticity = compressedData.maxVorticity;
         }
     }
-    compressedToGPUData(compressedData, data);
+
+    // The pyramid file only contains the coarse levels, level 0 is the voxel grid loaded or created above.
+    if (usePyramidFile && DerivedDataCache::get()->lookup(modelFilenamePyramid)) {
+        pyramid.levels.clear();
+        pyramid.levels.push_back(std::move(compressedData));
+        loadFromFile(modelFilenamePyramid, pyramid);
+    } else if (usePyramidFile) {
+        VoxelCurveDiscretizer discretizer(compressedData.gridResolution, compressedData.quantizationResolution);
+        pyramid = discretizer.createPyramid(std::move(compressedData), voxelSettings.pyramidNumLevels);
+        saveToFile(modelFilenamePyramid, pyramid);
+        DerivedDataCache::get()->commit(modelFilenamePyramid);
+    } else {
+        pyramid.levels.clear();
+        pyramid.levels.push_back(std::move(compressedData));
+    }
+
+    pyramidData.clear();
+    pyramidData.resize(pyramid.levels.size());
+    for (size_t level = 0; level < pyramid.levels.size(); level++) {
+        compressedToGPUData(pyramid.levels.at(level), pyramidData.at(level));
+    }
+    pyramidLevel = 0;
+    data = pyramidData.front();
     setCurrentAlgorithmBufferSizeBytes(byteSize);
 
-    // Create shader program
-    sgl::ShaderManager->invalidateShaderCache();
-    sgl::ShaderManager->addPreprocessorDefine("gridResolution", ivec3ToString(data.gridResolution));
-    sgl::ShaderManager->addPreprocessorDefine("GRID_RESOLUTION_LOG2",
-            sgl::toString(sgl::intlog2(data.gridResolution.x)));
-    sgl::ShaderManager->addPreprocessorDefine("GRID_RESOLUTION", data.gridResolution.x);
+    // Create shader program (the grid resolution is set per pyramid level in reloadShader)
     sgl::ShaderManager->addPreprocessorDefine("quantizationResolution", ivec3ToString(data.quantizationResolution));
     sgl::ShaderManager->addPreprocessorDefine("QUANTIZATION_RESOLUTION", sgl::toString(data.quantizationResolution.x));
     sgl::ShaderManager->addPreprocessorDefine("QUANTIZATION_RESOLUTION_LOG2",
@@ -258,30 +382,78 @@ void OIT_VoxelRaytracing::fromFile(const std::string &filename, TrajectoryType t
         sgl::ShaderManager->removePreprocessorDefine("CONVECTION_ROLLS");
     }
 
+#ifndef VOXEL_RAYTRACING_COMPUTE_SHADER
+    // Create blitting data (fullscreen rectangle in normalized device coordinates)
+    if (!blitGeometryBuffer) {
+        std::vector<glm::vec3> fullscreenQuad{
+                glm::vec3(1,1,0), glm::vec3(-1,-1,0), glm::vec3(1,-1,0),
+                glm::vec3(-1,-1,0), glm::vec3(1,1,0), glm::vec3(-1,1,0)};
+        blitGeometryBuffer = sgl::Renderer->createGeometryBuffer(
+                sizeof(glm::vec3)*fullscreenQuad.size(), (void*)&fullscreenQuad.front());
+    }
+#endif
+    reloadShader();
+}
+
+void OIT_VoxelRaytracing::reloadShader()
+{
+    // The grid resolution is a preprocessor define, i.e., every pyramid level needs its own shader program.
+    pyramidShaders.clear();
+#ifndef VOXEL_RAYTRACING_COMPUTE_SHADER
+    pyramidBlitRenderData.clear();
+#endif
+    for (const VoxelGridDataGPU &levelData : pyramidData) {
+        sgl::ShaderManager->invalidateShaderCache();
+        sgl::ShaderManager->addPreprocessorDefine("gridResolution", ivec3ToString(levelData.gridResolution));
+        sgl::ShaderManager->addPreprocessorDefine("GRID_RESOLUTION_LOG2",
+                sgl::toString(sgl::intlog2(levelData.gridResolution.x)));
+        sgl::ShaderManager->addPreprocessorDefine("GRID_RESOLUTION", levelData.gridResolution.x);
 #ifdef VOXEL_RAYTRACING_COMPUTE_SHADER
-    renderShader = sgl::ShaderManager->getShaderProgram({ "VoxelRaytracingMain.Compute" });
+        pyramidShaders.push_back(sgl::ShaderManager->getShaderProgram({ "VoxelRaytracingMain.Compute" }));
 #else
-    renderShader = sgl::ShaderManager->getShaderProgram({ "VoxelRaytracingMainFrag.Vertex",
-                                                          "VoxelRaytracingMainFrag.Fragment" });
+        sgl::ShaderProgramPtr levelShader = sgl::ShaderManager->getShaderProgram({
+                "VoxelRaytracingMainFrag.Vertex", "VoxelRaytracingMainFrag.Fragment" });
+        sgl::ShaderAttributesPtr levelBlitRenderData = sgl::ShaderManager->createShaderAttributes(levelShader);
+        levelBlitRenderData->addGeometryBuffer(blitGeometryBuffer, "vertexPosition", sgl::ATTRIB_FLOAT, 3);
+        pyramidShaders.push_back(levelShader);
+        pyramidBlitRenderData.push_back(levelBlitRenderData);
+#endif
+    }
 
-    // Create blitting data (fullscreen rectangle in normalized device coordinates)
-    blitRenderData = sgl::ShaderManager->createShaderAttributes(renderShader);
-
-    std::vector<glm::vec3> fullscreenQuad{
-            glm::vec3(1,1,0), glm::vec3(-1,-1,0), glm::vec3(1,-1,0),
-            glm::vec3(-1,-1,0), glm::vec3(1,1,0), glm::vec3(-1,1,0)};
-    sgl::GeometryBufferPtr geomBuffer = sgl::Renderer->createGeometryBuffer(
-            sizeof(glm::vec3)*fullscreenQuad.size(), (void*)&fullscreenQuad.front());
-    blitRenderData->addGeometryBuffer(geomBuffer, "vertexPosition", sgl::ATTRIB_FLOAT, 3);
+    if (!pyramidShaders.empty()) {
+        renderShader = pyramidShaders.at(pyramidLevel);
+#ifndef VOXEL_RAYTRACING_COMPUTE_SHADER
+        blitRenderData = pyramidBlitRenderData.at(pyramidLevel);
 #endif
+    }
 }
 
-void OIT_VoxelRaytracing::reloadShader()
+void OIT_VoxelRaytracing::updatePyramidLevel()
 {
-    sgl::ShaderManager->invalidateShaderCache();
-    renderShader = sgl::ShaderManager->getShaderProgram({ "VoxelRaytracingMainFrag.Vertex",
-                                                          "VoxelRaytracingMainFrag.Fragment" });
-    blitRenderData = blitRenderData->copy(renderShader);
+    int newPyramidLevel = 0;
+    if (usePyramid && pyramid.levels.size() > 1) {
+        // Distance of the camera to the closest point of the voxel grid (zero if the camera is inside of the grid)
+        const VoxelGridDataGPU &finestLevel = pyramidData.front();
+        const glm::mat4 &worldToVoxel = finestLevel.worldToVoxelGridMatrix;
+        glm::vec3 cameraPositionVoxel = glm::vec3(worldToVoxel * glm::vec4(camera->getPosition(), 1.0f));
+        glm::vec3 closestPointVoxel = glm::clamp(
+                cameraPositionVoxel, glm::vec3(0.0f), glm::vec3(finestLevel.gridResolution));
+        float cameraDistance = glm::length(cameraPositionVoxel - closestPointVoxel)
+                / glm::length(glm::vec3(worldToVoxel[0]));
+
+        int viewportHeight = sgl::AppSettings::get()->getMainWindow()->getHeight();
+        newPyramidLevel = selectPyramidLevel(
+                pyramid, cameraDistance, camera->getFOVy(), viewportHeight, maxVoxelSizePixels);
+    }
+
+    if (newPyramidLevel != pyramidLevel) {
+        pyramidLevel = newPyramidLevel;
+        data = pyramidData.at(pyramidLevel);
+        renderShader = pyramidShaders.at(pyramidLevel);
+#ifndef VOXEL_RAYTRACING_COMPUTE_SHADER
+        blitRenderData = pyramidBlitRenderData.at(pyramidLevel);
+#endif
+    }
 }
 
 void OIT_VoxelRaytracing::setUniformData()
@@ -359,6 +531,7 @@ glm::ivec2 getNumWorkGroups(const glm::ivec2 &globalWorkSize, const glm::ivec2 &
 
 void OIT_VoxelRaytracing::renderToScreen()
 {
+    updatePyramidLevel();
     setUniformData();
 
     sgl::Window *window = sgl::AppSettings::get()->getMainWindow();
@@ -385,6 +558,15 @@ void OIT_VoxelRaytracing::renderToScreen()
 
 void OIT_VoxelRaytracing::onTransferFunctionMapRebuilt()
 {
-    VoxelCurveDiscretizer discretizer(compressedData.gridResolution, compressedData.quantizationResolution);
-    discretizer.recreateDensityAndAOFactors(compressedData, data, maxNumLinesPerVoxel);
+    for (size_t level = 0; level < pyramid.levels.size(); level++) {
+        // The compute shaders of the GPU path depend on the grid resolution of the level.
+        sgl::ShaderManager->invalidateShaderCache();
+        VoxelGridDataCompressed &levelData = pyramid.levels.at(level);
+        VoxelCurveDiscretizer discretizer(levelData.gridResolution, levelData.quantizationResolution);
+        discretizer.recreateDensityAndAOFactors(
+                levelData, pyramidData.at(level), maxNumLinesPerVoxel, recomputeDensityOnGPU);
+    }
+    if (!pyramidData.empty()) {
+        data = pyramidData.at(pyramidLevel);
+    }
 }
\ No newline at end of file
@@ -47,6 +47,8 @@ private:
             float &maxVorticity);
     void reloadShader();
     void setUniformData();
+    // Selects the pyramid level for the current camera position and makes it the level used for rendering.
+    void updatePyramidLevel();
 
     sgl::ShaderProgramPtr renderShader;
     sgl::TexturePtr renderImage;
@@ -54,6 +56,8 @@ private:
 #ifndef VOXEL_RAYTRACING_COMPUTE_SHADER
     // Blit data (ignores model-view-projection matrix and uses normalized device coordinates)
     sgl::ShaderAttributesPtr blitRenderData;
+    sgl::GeometryBufferPtr blitGeometryBuffer;
+    std::vector<sgl::ShaderAttributesPtr> pyramidBlitRenderData;
 #endif
 
     // Data from MainApp
@@ -66,9 +70,14 @@ private:
     bool isHairDataset = false;
     glm::vec4 hairStrandColor;
 
-    // Data compressed for GPU
+    // Data compressed for GPU (one entry per pyramid level). "data" and "renderShader" refer to the current level.
     VoxelGridDataGPU data;
-    VoxelGridDataCompressed compressedData;
+    VoxelGridPyramidCompressed pyramid;
+    std::vector<VoxelGridDataGPU> pyramidData;
+    std::vector<sgl::ShaderProgramPtr> pyramidShaders;
+    int pyramidLevel = 0;
+    bool usePyramid = true;
+    float maxVoxelSizePixels = 1.0f;
     int maxNumLinesPerVoxel = 32;
 };
 
@@ -5,9 +5,14 @@
 #include <fstream>
 #include <iostream>
 #include <chrono>
+#include <algorithm>
+#include <limits>
+#include <atomic>
+#include <tuple>
 
 #include <boost/algorithm/string.hpp>
 #include <boost/algorithm/string/split.hpp>
+#include <boost/filesystem.hpp>
 
 #include <GL/glew.h>
 
@@ -23,6 +28,8 @@
 
 #include "Utils/HairLoader.hpp"
 #include "Utils/TrajectoryFile.hpp"
+#include "Utils/BinLinesFile.hpp"
+#include "../TransferFunctionWindow.hpp"
 #include "VoxelCurveDiscretizer.hpp"
 
 #define BIAS 0.001
@@ -92,23 +99,28 @@ bool rayBoxIntersection(glm::vec3 rayOrigin, glm::vec3 rayDirection, glm::vec3 l
 
 
 
-bool VoxelDiscretizer::addPossibleIntersections(const glm::vec3 &v1, const glm::vec3 &v2, float a1, float a2)
+/**
+ * Appends the entrance and/or exit point of the line segment (v1, v2) in the voxel "voxelIndex" to "intersections".
+ * @return True if the passed line intersects the voxel boundaries.
+ */
+static bool addPossibleIntersections(const glm::ivec3 &voxelIndex, uint32_t voxelIndex1D,
+        const glm::vec3 &v1, const glm::vec3 &v2, float a1, float a2, std::vector<VoxelIntersection> &intersections)
 {
     float tNear, tFar;
-    glm::vec3 voxelLower = glm::vec3(index);
-    glm::vec3 voxelUpper = glm::vec3(index + glm::ivec3(1,1,1));
+    glm::vec3 voxelLower = glm::vec3(voxelIndex);
+    glm::vec3 voxelUpper = glm::vec3(voxelIndex + glm::ivec3(1,1,1));
     if (rayBoxIntersection(v1, (v2 - v1), voxelLower, voxelUpper, tNear, tFar)) {
         bool intersectionNear = 0.0f <= tNear && tNear <= 1.0f;
         bool intersectionFar = 0.0f <= tFar && tFar <= 1.0f;
         if (intersectionNear) {
             glm::vec3 entrancePoint = v1 + tNear * (v2 - v1);
             float interpolatedAttribute = a1 + tNear * (a2 - a1);
-            currentCurveIntersections.emplace_back(entrancePoint, interpolatedAttribute);
+            intersections.push_back(VoxelIntersection(voxelIndex1D, entrancePoint, interpolatedAttribute));
         }
         if (intersectionFar) {
             glm::vec3 exitPoint = v1 + tFar * (v2 - v1);
             float interpolatedAttribute = a1 + tFar * (a2 - a1);
-            currentCurveIntersections.emplace_back(exitPoint, interpolatedAttribute);
+            intersections.push_back(VoxelIntersection(voxelIndex1D, exitPoint, interpolatedAttribute));
         }
         if (intersectionNear || intersectionFar) {
             return true; // Intersection found
@@ -118,29 +130,6 @@ bool VoxelDiscretizer::addPossibleIntersections(const glm::vec3 &v1, const glm::
     return false;
 }
 
-void VoxelDiscretizer::setIndex(glm::ivec3 index)
-{
-    this->index = index;
-}
-
-float VoxelDiscretizer::computeDensity(float maxVorticity)
-{
-    float density = 0.0f;
-    for (LineSegment &line : lines) {
-        density += line.length() * line.avgOpacity(maxVorticity);
-    }
-    return density;
-}
-
-float VoxelDiscretizer::computeDensityHair(float opacity)
-{
-    float density = 0.0f;
-    for (LineSegment &line : lines) {
-        density += line.length() * opacity;
-    }
-    return density;
-}
-
 
 
 
@@ -150,15 +139,9 @@ float VoxelDiscretizer::computeDensityHair(float opacity)
 VoxelCurveDiscretizer::VoxelCurveDiscretizer(const glm::ivec3 &gridResolution, const glm::ivec3 &quantizationResolution)
         : gridResolution(gridResolution), quantizationResolution(quantizationResolution)
 {
-    voxels = nullptr;
-}
-
-VoxelCurveDiscretizer::~VoxelCurveDiscretizer()
-{
-    delete[] voxels;
 }
 
-void VoxelCurveDiscretizer::setVoxelGrid(const sgl::AABB3 &aabb)
+void VoxelCurveDiscretizer::adaptGridResolutionToAABB(const sgl::AABB3 &aabb)
 {
     glm::vec3 gridDimensions = aabb.getDimensions();
     glm::vec3 gridResolutionCubic = gridResolution;
@@ -171,16 +154,6 @@ void VoxelCurveDiscretizer::setVoxelGrid(const sgl::AABB3 &aabb)
         float sideLengthFactor = gridDimensions[i] / maxDimensionLength;
         gridResolution[i] = (int)std::ceil(gridResolution[i] * sideLengthFactor);
     }
-
-    voxels = new VoxelDiscretizer[gridResolution.x * gridResolution.y * gridResolution.z];
-    for (int z = 0; z < gridResolution.z; z++) {
-        for (int y = 0; y < gridResolution.y; y++) {
-            for (int x = 0; x < gridResolution.x; x++) {
-                int index = x + y*gridResolution.x + z*gridResolution.x*gridResolution.y;
-                voxels[index].setIndex(glm::ivec3(x, y, z));
-            }
-        }
-    }
 }
 
 
@@ -204,14 +177,17 @@ VoxelGridDataCompressed VoxelCurveDiscretizer::createFromTrajectoryDataset(const
             filename, sgl::AppSettings::get()->getDataDirectory() + "ConvectionRolls/turbulence20000");
 
 
-    Trajectories trajectories = loadTrajectoriesFromFile(filename, trajectoryType);
+    const Trajectories trajectories = loadTrajectoriesFromFile(filename, trajectoryType);
 
+    curves.reserve(curves.size() + trajectories.size());
     for (size_t i = 0; i < trajectories.size(); i++) {
-        Trajectory &trajectory = trajectories.at(i);
+        ConstTrajectoryView trajectory = trajectories.at(i);
 
         currentCurve = Curve();
+        currentCurve.points.reserve(trajectory.positions.size());
+        currentCurve.attributes.reserve(trajectory.positions.size());
         for (size_t j = 0; j < trajectory.positions.size(); j++) {
-            glm::vec3 &position = trajectory.positions.at(j);
+            const glm::vec3 &position = trajectory.positions.at(j);
             linesBoundingBox.combine(position);
             currentCurve.points.push_back(position);
             currentCurve.attributes.push_back(trajectory.attributes.at(0).at(j));
@@ -249,7 +225,7 @@ VoxelGridDataCompressed VoxelCurveDiscretizer::createFromTrajectoryDataset(const
 
 
     // Move to origin and scale to range from (0, 0, 0) to (rx, ry, rz).
-    setVoxelGrid(linesBoundingBox);
+    adaptGridResolutionToAABB(linesBoundingBox);
     linesToVoxel = sgl::matrixScaling(1.0f / linesBoundingBox.getDimensions() * glm::vec3(gridResolution))
             * sgl::matrixTranslation(-linesBoundingBox.getMinimum());
     voxelToLines = glm::inverse(linesToVoxel);
@@ -267,16 +243,7 @@ VoxelGridDataCompressed VoxelCurveDiscretizer::createFromTrajectoryDataset(const
     }
 
     if (!useGPU) {
-        // Insert lines into voxel representation
-        //int lineNum = 0;
-        for (const Curve &curve : curves) {
-            /*if (lineNum == 1000) {
-                break;
-            }*/
-            nextStreamline(curve);
-            //lineNum++;
-        }
-        return compressData();
+        return createVoxelGridCPU(curves);
     } else {
         return createVoxelGridGPU(curves, maxNumLinesPerVoxel);
     }
@@ -286,46 +253,53 @@ VoxelGridDataCompressed VoxelCurveDiscretizer::createFromTrajectoryDataset(const
 VoxelGridDataCompressed VoxelCurveDiscretizer::createFromHairDataset(const std::string &filename, float &lineRadius,
         glm::vec4 &hairStrandColor, unsigned int maxNumLinesPerVoxel, bool useGPU)
 {
-    HairData hairData;
-    loadHairFile(filename, hairData);
-    downscaleHairData(hairData, HAIR_MODEL_SCALING_FACTOR);
+    // The strands are read directly from the mapped file (without loading them to a HairData object first).
+    MappedHairFile hairFile;
+    if (!hairFile.open(filename)) {
+        return VoxelGridDataCompressed();
+    }
+    hairFile.adviseSequential();
+    glm::mat4 hairTransform = getHairDataTransform(filename, HAIR_MODEL_SCALING_FACTOR);
 
     // Assume default thickness, opacity and color for now to simplify the implementation
-    lineRadius = hairData.defaultThickness;
-    hairStrandColor = glm::vec4(hairData.defaultColor, hairData.defaultOpacity);
+    lineRadius = hairFile.getDefaultThickness() * HAIR_MODEL_SCALING_FACTOR;
+    hairStrandColor = glm::vec4(hairFile.getDefaultColor(), hairFile.getDefaultOpacity());
     this->hairThickness = lineRadius;
     this->hairStrandColor = hairStrandColor;
-    this->hairOpacity = hairData.defaultOpacity;
+    this->hairOpacity = hairFile.getDefaultOpacity();
 
 
     linesBoundingBox = sgl::AABB3();
-    std::vector<Curve> curves;
-    Curve currentCurve;
+    const size_t numStrands = hairFile.getNumStrands();
+    std::vector<Curve> curves(numStrands);
     maxVorticity = 0.0f;
-    int lineCounter = 0;
     isHairDataset = true;
 
     // Process all strands and convert them to curves
-    for (HairStrand &strand : hairData.strands) {
-        lineCounter++;
-        if (lineCounter % 1000 == 999) {
-            sgl::Logfile::get()->writeInfo(std::string() + "Parsing hair strand " + sgl::toString(lineCounter) + "...");
-        }
-
-        for (glm::vec3 point : strand.points) {
-            glm::vec3 scaledPoint = point;
-            currentCurve.points.push_back(scaledPoint);
-            currentCurve.attributes.push_back(this->hairOpacity);
-            linesBoundingBox.combine(scaledPoint);
+    sgl::Logfile::get()->writeInfo(std::string() + "Parsing " + sgl::toString(numStrands) + " hair strands...");
+    #pragma omp parallel
+    {
+        sgl::AABB3 threadBoundingBox;
+        #pragma omp for schedule(dynamic, 1024)
+        for (size_t i = 0; i < numStrands; i++) {
+            ArrayView<const glm::vec3> strandPoints = hairFile.getStrandPoints(i);
+            Curve &curve = curves[i];
+            curve.lineID = (unsigned int)i;
+            curve.points.resize(strandPoints.size());
+            curve.attributes.assign(strandPoints.size(), this->hairOpacity);
+            for (size_t j = 0; j < strandPoints.size(); j++) {
+                glm::vec3 scaledPoint = sgl::transformPoint(hairTransform, strandPoints[j]);
+                curve.points[j] = scaledPoint;
+                threadBoundingBox.combine(scaledPoint);
+            }
         }
-
-        curves.push_back(currentCurve);
-        currentCurve = Curve();
-        currentCurve.lineID = lineCounter;
+        #pragma omp critical
+        linesBoundingBox.combine(threadBoundingBox);
     }
+    hairFile.close();
 
     // Move to origin and scale to range from (0, 0, 0) to (rx, ry, rz).
-    setVoxelGrid(linesBoundingBox);
+    adaptGridResolutionToAABB(linesBoundingBox);
     linesToVoxel = sgl::matrixScaling(1.0f / linesBoundingBox.getDimensions() * glm::vec3(gridResolution))
                    * sgl::matrixTranslation(-linesBoundingBox.getMinimum());
     voxelToLines = glm::inverse(linesToVoxel);
@@ -338,18 +312,32 @@ VoxelGridDataCompressed VoxelCurveDiscretizer::createFromHairDataset(const std::
     }
 
     if (!useGPU) {
-        // Insert lines into voxel representation
-        for (const Curve &curve : curves) {
-            nextStreamline(curve);
-        }
-        return compressData();
+        return createVoxelGridCPU(curves);
     } else {
         return createVoxelGridGPU(curves, maxNumLinesPerVoxel);
     }
 }
 
 
-VoxelGridDataCompressed VoxelCurveDiscretizer::compressData()
+/**
+ * Strict weak ordering of the line segments stored in one voxel. Used for making the order of the line segments
+ * independent of the scheduling of the threads scattering them.
+ */
+#ifdef PACK_LINES
+static inline bool lineSegmentLess(const LineSegmentCompressed &l1, const LineSegmentCompressed &l2)
+{
+    return l1.linePosition < l2.linePosition
+            || (l1.linePosition == l2.linePosition && l1.attributes < l2.attributes);
+}
+#else
+static inline bool lineSegmentLess(const LineSegment &l1, const LineSegment &l2)
+{
+    return std::tie(l1.lineID, l1.v1.x, l1.v1.y, l1.v1.z, l1.v2.x, l1.v2.y, l1.v2.z)
+            < std::tie(l2.lineID, l2.v1.x, l2.v1.y, l2.v1.z, l2.v2.x, l2.v2.y, l2.v2.z);
+}
+#endif
+
+VoxelGridDataCompressed VoxelCurveDiscretizer::createVoxelGridCPU(const std::vector<Curve> &curves)
 {
     VoxelGridDataCompressed dataCompressed;
     dataCompressed.gridResolution = gridResolution;
@@ -365,92 +353,350 @@ VoxelGridDataCompressed VoxelCurveDiscretizer::compressData()
         dataCompressed.maxVorticity = maxVorticity;
     }
 
-    int n = gridResolution.x * gridResolution.y * gridResolution.z;
-    std::vector<float> voxelDensities;
-    std::vector<uint32_t> usedVoxels;
-    voxelDensities.reserve(n);
-    usedVoxels.reserve(n);
-
-    size_t lineOffset = 0;
-    dataCompressed.voxelLineListOffsets.reserve(n);
-    dataCompressed.numLinesInVoxel.reserve(n);
-    dataCompressed.lineSegments.clear();
+    const int n = gridResolution.x * gridResolution.y * gridResolution.z;
+    const int numCurves = int(curves.size());
+    auto startClip = std::chrono::system_clock::now();
 
+    // PASS 1: Clip the curves to the voxels and count the line segments per voxel. The clipped segments are discarded
+    // and recomputed in the scatter pass, as storing them per curve would need more memory than the voxel grid itself.
+    std::vector<std::atomic<uint32_t>> voxelCounters(n);
+    #pragma omp parallel for
     for (int i = 0; i < n; i++) {
-        dataCompressed.voxelLineListOffsets.push_back(lineOffset);
-        size_t numLines = voxels[i].lines.size();
-        dataCompressed.numLinesInVoxel.push_back(numLines);
-        if (isHairDataset) {
-            voxelDensities.push_back(voxels[i].computeDensityHair(hairOpacity));
-        } else {
-            voxelDensities.push_back(voxels[i].computeDensity(maxVorticity));
+        voxelCounters[i].store(0u, std::memory_order_relaxed);
+    }
+    #pragma omp parallel
+    {
+        std::vector<ClippedLineSegment> clippedSegments;
+        #pragma omp for schedule(dynamic, 64)
+        for (int curveIndex = 0; curveIndex < numCurves; curveIndex++) {
+            clippedSegments.clear();
+            clipStreamline(curves.at(curveIndex), clippedSegments);
+            for (const ClippedLineSegment &clippedSegment : clippedSegments) {
+                voxelCounters[clippedSegment.voxelIndex1D].fetch_add(1u, std::memory_order_relaxed);
+            }
         }
-        usedVoxels.push_back(numLines > 0 ? 1 : 0);
+    }
+
+    // PASS 2: Compute the offsets using a prefix sum over the counts. The counters are reset for the scatter pass.
+    dataCompressed.numLinesInVoxel.resize(n);
+    dataCompressed.voxelLineListOffsets.resize(n);
+    uint32_t lineOffset = 0;
+    for (int i = 0; i < n; i++) {
+        uint32_t numLines = voxelCounters[i].load(std::memory_order_relaxed);
+        dataCompressed.numLinesInVoxel[i] = numLines;
+        dataCompressed.voxelLineListOffsets[i] = lineOffset;
+        lineOffset += numLines;
+        voxelCounters[i].store(0u, std::memory_order_relaxed);
+    }
 
+    // PASS 3: Clip the curves again and scatter the compressed line segments directly to their voxels.
+    dataCompressed.lineSegments.resize(lineOffset);
+    const uint32_t *voxelLineListOffsets = dataCompressed.voxelLineListOffsets.data();
+    #pragma omp parallel
+    {
+        std::vector<ClippedLineSegment> clippedSegments;
+        #pragma omp for schedule(dynamic, 64)
+        for (int curveIndex = 0; curveIndex < numCurves; curveIndex++) {
+            clippedSegments.clear();
+            clipStreamline(curves.at(curveIndex), clippedSegments);
+            for (ClippedLineSegment &clippedSegment : clippedSegments) {
+                uint32_t voxelIndex1D = clippedSegment.voxelIndex1D;
+                uint32_t writeIndex = voxelLineListOffsets[voxelIndex1D]
+                        + voxelCounters[voxelIndex1D].fetch_add(1u, std::memory_order_relaxed);
 #ifdef PACK_LINES
-        std::vector<LineSegmentCompressed> lineSegments;
-        lineSegments.resize(voxels[i].lines.size());
-        for (size_t j = 0; j < voxels[i].lines.size(); j++) {
-            compressLine(voxels[i].getIndex(), voxels[i].lines[j], lineSegments[j]);
-
-            // Test
-            /*LineSegment originalLine = voxels[i].lines[j];
-            LineSegment decompressedLine;
-            decompressLine(glm::vec3(voxels[i].getIndex()), lineSegments[j], decompressedLine);
-            if (!checkLinesEqual(originalLine, decompressedLine)) {
-                compressLine(voxels[i].getIndex(), voxels[i].lines[j], lineSegments[j]);
-                decompressLine(glm::vec3(voxels[i].getIndex()), lineSegments[j], decompressedLine);
-            }*/
-        }
-        dataCompressed.lineSegments.insert(dataCompressed.lineSegments.end(),
-                lineSegments.begin(), lineSegments.end());
+                glm::ivec3 voxelIndex = glm::ivec3(voxelIndex1D % gridResolution.x,
+                        (voxelIndex1D / gridResolution.x) % gridResolution.y,
+                        voxelIndex1D / (gridResolution.x * gridResolution.y));
+                compressLine(voxelIndex, clippedSegment.segment, dataCompressed.lineSegments[writeIndex]);
 #else
-        dataCompressed.lineSegments.insert(dataCompressed.lineSegments.end(),
-                voxels[i].lines.begin(), voxels[i].lines.end());
+                dataCompressed.lineSegments[writeIndex] = clippedSegment.segment;
 #endif
+            }
+        }
+    }
 
-        lineOffset += numLines;
+    // PASS 4: Sort the line segments of each voxel to keep their order deterministic and compute the densities. Like
+    // in recreateDensityAndAOFactors, the density is computed from the stored (i.e., possibly quantized) segments.
+    dataCompressed.voxelDensities.resize(n);
+    #pragma omp parallel for schedule(dynamic, 4096)
+    for (int i = 0; i < n; i++) {
+        auto voxelLinesBegin = dataCompressed.lineSegments.begin() + dataCompressed.voxelLineListOffsets[i];
+        auto voxelLinesEnd = voxelLinesBegin + dataCompressed.numLinesInVoxel[i];
+        std::sort(voxelLinesBegin, voxelLinesEnd, lineSegmentLess);
+
+        glm::vec3 voxelPosition = glm::vec3(i % gridResolution.x, (i / gridResolution.x) % gridResolution.y,
+                i / (gridResolution.x * gridResolution.y));
+        float density = 0.0f;
+        LineSegment line;
+        for (auto it = voxelLinesBegin; it != voxelLinesEnd; it++) {
+#ifdef PACK_LINES
+            decompressLine(voxelPosition, *it, line);
+#else
+            line = *it;
+#endif
+            if (isHairDataset) {
+                density += line.length() * hairOpacity;
+            } else {
+                density += line.length() * line.avgOpacity(maxVorticity);
+            }
+        }
+        dataCompressed.voxelDensities[i] = density;
     }
 
-    std::vector<float> voxelAOFactors;
-    voxelAOFactors.resize(n);
-    generateVoxelAOFactorsFromDensity(voxelDensities, voxelAOFactors, gridResolution, isHairDataset);
+    auto endClip = std::chrono::system_clock::now();
+    auto elapsedClip = std::chrono::duration_cast<std::chrono::milliseconds>(endClip - startClip);
+    sgl::Logfile::get()->writeInfo(std::string() + "Computational time to voxelize the lines (CPU): "
+                                   + std::to_string(elapsedClip.count()));
 
-    dataCompressed.voxelDensities = voxelDensities;
-    dataCompressed.voxelAOFactors = voxelAOFactors;
+    dataCompressed.voxelAOFactors.resize(n);
+    generateVoxelAOFactorsFromDensity(dataCompressed.voxelDensities, dataCompressed.voxelAOFactors,
+            gridResolution, isHairDataset);
+    computeAttributeHistograms(dataCompressed);
     return dataCompressed;
 }
 
 
 
-std::vector<VoxelDiscretizer*> VoxelCurveDiscretizer::getVoxelsInAABB(const sgl::AABB3 &aabb)
+VoxelGridPyramidCompressed VoxelCurveDiscretizer::createPyramid(
+        VoxelGridDataCompressed finestLevelData, int numLevels)
+{
+    VoxelGridPyramidCompressed pyramid;
+    // Reserved up front, as "finestLevel" references the first element while the coarse levels are appended.
+    pyramid.levels.reserve(std::max(numLevels, 1));
+    pyramid.levels.push_back(std::move(finestLevelData));
+    const VoxelGridDataCompressed &finestLevel = pyramid.levels.front();
+
+    auto start = std::chrono::system_clock::now();
+
+    // The coarse levels are compressed with the settings of the finest level.
+    gridResolution = finestLevel.gridResolution;
+    quantizationResolution = finestLevel.quantizationResolution;
+    isHairDataset = finestLevel.dataType == 1u;
+    hairStrandColor = finestLevel.hairStrandColor;
+    hairThickness = finestLevel.hairThickness;
+    hairOpacity = finestLevel.hairStrandColor.a;
+    maxVorticity = finestLevel.maxVorticity;
+    attributes = finestLevel.attributes;
+
+    // Decompress the clipped line segments of the finest level.
+    glm::ivec3 levelResolution = gridResolution;
+    int n = gridResolution.x * gridResolution.y * gridResolution.z;
+    std::vector<uint32_t> offsets(n + 1);
+    offsets[0] = 0;
+    for (int i = 0; i < n; i++) {
+        offsets[i+1] = offsets[i] + finestLevel.numLinesInVoxel[i];
+    }
+    std::vector<LineSegment> segments(offsets[n]);
+    #pragma omp parallel for schedule(dynamic, 256)
+    for (int i = 0; i < n; i++) {
+        glm::vec3 voxelPosition = glm::vec3(i % levelResolution.x, (i / levelResolution.x) % levelResolution.y,
+                i / (levelResolution.x * levelResolution.y));
+        uint32_t lineOffset = finestLevel.voxelLineListOffsets[i];
+        for (uint32_t j = 0; j < finestLevel.numLinesInVoxel[i]; j++) {
+#ifdef PACK_LINES
+            decompressLine(voxelPosition, finestLevel.lineSegments[lineOffset+j], segments[offsets[i]+j]);
+#else
+            segments[offsets[i]+j] = finestLevel.lineSegments[lineOffset+j];
+#endif
+        }
+    }
+
+    glm::mat4 levelWorldToVoxel = finestLevel.worldToVoxelGridMatrix;
+    for (int level = 1; level < numLevels; level++) {
+        if (levelResolution.x <= 1 && levelResolution.y <= 1 && levelResolution.z <= 1) {
+            break;
+        }
+
+        glm::ivec3 coarseResolution = (levelResolution + glm::ivec3(1)) / 2;
+        std::vector<uint32_t> coarseOffsets;
+        std::vector<LineSegment> coarseSegments;
+        mergeLineSegmentsCoarseLevel(levelResolution, offsets, segments,
+                coarseResolution, coarseOffsets, coarseSegments);
+        levelWorldToVoxel = sgl::matrixScaling(glm::vec3(0.5f)) * levelWorldToVoxel;
+        pyramid.levels.push_back(compressLevel(coarseResolution, levelWorldToVoxel, coarseOffsets, coarseSegments));
+
+        std::cout << "Pyramid level " << level << ": Grid resolution " << coarseResolution.x << " "
+                  << coarseResolution.y << " " << coarseResolution.z << ", num line segments "
+                  << coarseSegments.size() << std::endl;
+
+        levelResolution = coarseResolution;
+        offsets.swap(coarseOffsets);
+        segments.swap(coarseSegments);
+    }
+
+    auto end = std::chrono::system_clock::now();
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+    sgl::Logfile::get()->writeInfo(std::string() + "Computational time to create the voxel grid pyramid: "
+                                   + std::to_string(elapsed.count()));
+    return pyramid;
+}
+
+void VoxelCurveDiscretizer::mergeLineSegmentsCoarseLevel(
+        const glm::ivec3 &fineResolution, const std::vector<uint32_t> &fineOffsets,
+        const std::vector<LineSegment> &fineSegments, const glm::ivec3 &coarseResolution,
+        std::vector<uint32_t> &coarseOffsets, std::vector<LineSegment> &coarseSegments)
+{
+    const int numCoarseVoxels = coarseResolution.x * coarseResolution.y * coarseResolution.z;
+    const float EPSILON = 1e-4f;
+    std::vector<std::vector<LineSegment>> coarseVoxelSegments(numCoarseVoxels);
+
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (int i = 0; i < numCoarseVoxels; i++) {
+        glm::ivec3 coarseIndex = glm::ivec3(i % coarseResolution.x, (i / coarseResolution.x) % coarseResolution.y,
+                i / (coarseResolution.x * coarseResolution.y));
+
+        // Gather the line segments of the (up to) eight child voxels and transform them to the coarse voxel space.
+        std::vector<LineSegment> childSegments;
+        for (int offsetZ = 0; offsetZ < 2; offsetZ++) {
+            for (int offsetY = 0; offsetY < 2; offsetY++) {
+                for (int offsetX = 0; offsetX < 2; offsetX++) {
+                    glm::ivec3 fineIndex = coarseIndex * 2 + glm::ivec3(offsetX, offsetY, offsetZ);
+                    if (fineIndex.x >= fineResolution.x || fineIndex.y >= fineResolution.y
+                            || fineIndex.z >= fineResolution.z) {
+                        continue;
+                    }
+                    int fineIndex1D = fineIndex.x + fineIndex.y*fineResolution.x
+                            + fineIndex.z*fineResolution.x*fineResolution.y;
+                    for (uint32_t j = fineOffsets[fineIndex1D]; j < fineOffsets[fineIndex1D+1]; j++) {
+                        LineSegment segment = fineSegments[j];
+                        segment.v1 *= 0.5f;
+                        segment.v2 *= 0.5f;
+                        childSegments.push_back(segment);
+                    }
+                }
+            }
+        }
+        if (childSegments.empty()) {
+            continue;
+        }
+
+        // Link every segment to the segment continuing the line at its end point. With PACK_LINES, only the lowest
+        // five bits of the line ID survive the compression, i.e., equal IDs are only a necessary condition. Thus, a
+        // link is only created if the continuation is unique in both directions.
+        const size_t numChildSegments = childSegments.size();
+        const uint32_t INVALID_INDEX = std::numeric_limits<uint32_t>::max();
+        std::vector<uint32_t> numSuccessors(numChildSegments, 0);
+        std::vector<uint32_t> numPredecessors(numChildSegments, 0);
+        std::vector<uint32_t> successor(numChildSegments, INVALID_INDEX);
+        for (size_t j = 0; j < numChildSegments; j++) {
+            for (size_t k = 0; k < numChildSegments; k++) {
+                if (j != k && childSegments[j].lineID == childSegments[k].lineID
+                        && glm::length(childSegments[k].v1 - childSegments[j].v2) < EPSILON) {
+                    numSuccessors[j]++;
+                    numPredecessors[k]++;
+                    successor[j] = uint32_t(k);
+                }
+            }
+        }
+        std::vector<bool> hasPredecessor(numChildSegments, false);
+        for (size_t j = 0; j < numChildSegments; j++) {
+            if (numSuccessors[j] != 1 || numPredecessors[successor[j]] != 1) {
+                successor[j] = INVALID_INDEX;
+            } else {
+                hasPredecessor[successor[j]] = true;
+            }
+        }
+
+        // Replace every chain by one segment. Chains are started at segments without a predecessor first, the
+        // remaining segments belong to closed loops.
+        std::vector<bool> used(numChildSegments, false);
+        std::vector<LineSegment> &mergedSegments = coarseVoxelSegments[i];
+        for (int pass = 0; pass < 2; pass++) {
+            for (size_t j = 0; j < numChildSegments; j++) {
+                if (used[j] || (pass == 0 && hasPredecessor[j])) {
+                    continue;
+                }
+                used[j] = true;
+                LineSegment chain = childSegments[j];
+                for (uint32_t k = successor[j]; k != INVALID_INDEX && !used[k]; k = successor[k]) {
+                    used[k] = true;
+                    chain.v2 = childSegments[k].v2;
+                    chain.a2 = childSegments[k].a2;
+                }
+
+                // Chains leaving the voxel through their entrance point are degenerate.
+                if (chain.length() > EPSILON) {
+                    mergedSegments.push_back(chain);
+                }
+            }
+        }
+    }
+
+    coarseOffsets.resize(numCoarseVoxels + 1);
+    coarseOffsets[0] = 0;
+    for (int i = 0; i < numCoarseVoxels; i++) {
+        coarseOffsets[i+1] = coarseOffsets[i] + uint32_t(coarseVoxelSegments[i].size());
+    }
+    coarseSegments.clear();
+    coarseSegments.reserve(coarseOffsets[numCoarseVoxels]);
+    for (int i = 0; i < numCoarseVoxels; i++) {
+        coarseSegments.insert(coarseSegments.end(), coarseVoxelSegments[i].begin(), coarseVoxelSegments[i].end());
+    }
+}
+
+VoxelGridDataCompressed VoxelCurveDiscretizer::compressLevel(
+        const glm::ivec3 &levelResolution, const glm::mat4 &worldToVoxelGridMatrix,
+        const std::vector<uint32_t> &offsets, const std::vector<LineSegment> &segments)
 {
-    std::vector<VoxelDiscretizer*> voxelsInAABB;
-    glm::vec3 minimum = aabb.getMinimum();
-    glm::vec3 maximum = aabb.getMaximum();
-
-    glm::ivec3 lower = glm::ivec3(minimum); // Round down
-    glm::ivec3 upper = glm::ivec3(ceil(maximum.x), ceil(maximum.y), ceil(maximum.z)); // Round up
-    lower = glm::max(lower, glm::ivec3(0));
-    upper = glm::min(upper, gridResolution - glm::ivec3(1));
-
-    for (int z = lower.z; z <= upper.z; z++) {
-        for (int y = lower.y; y <= upper.y; y++) {
-            for (int x = lower.x; x <= upper.x; x++) {
-                int index = x + y*gridResolution.x + z*gridResolution.x*gridResolution.y;
-                voxelsInAABB.push_back(voxels + index);
+    VoxelGridDataCompressed dataCompressed;
+    dataCompressed.gridResolution = levelResolution;
+    dataCompressed.quantizationResolution = quantizationResolution;
+    dataCompressed.worldToVoxelGridMatrix = worldToVoxelGridMatrix;
+    dataCompressed.dataType = isHairDataset ? 1u : 0u;
+
+    if (isHairDataset) {
+        dataCompressed.hairStrandColor = hairStrandColor;
+        dataCompressed.hairThickness = hairThickness;
+    } else {
+        // The attributes of the finest level are shared by all levels and not duplicated.
+        dataCompressed.maxVorticity = maxVorticity;
+    }
+
+    int n = levelResolution.x * levelResolution.y * levelResolution.z;
+    dataCompressed.voxelLineListOffsets.resize(n);
+    dataCompressed.numLinesInVoxel.resize(n);
+    dataCompressed.voxelDensities.resize(n);
+    dataCompressed.lineSegments.resize(segments.size());
+
+    #pragma omp parallel for
+    for (int i = 0; i < n; i++) {
+        glm::ivec3 voxelIndex = glm::ivec3(i % levelResolution.x, (i / levelResolution.x) % levelResolution.y,
+                i / (levelResolution.x * levelResolution.y));
+        dataCompressed.voxelLineListOffsets[i] = offsets[i];
+        dataCompressed.numLinesInVoxel[i] = offsets[i+1] - offsets[i];
+
+        float density = 0.0f;
+        for (uint32_t j = offsets[i]; j < offsets[i+1]; j++) {
+            LineSegment line = segments[j];
+            if (isHairDataset) {
+                density += line.length() * hairOpacity;
+            } else {
+                density += line.length() * line.avgOpacity(maxVorticity);
             }
+#ifdef PACK_LINES
+            compressLine(voxelIndex, line, dataCompressed.lineSegments[j]);
+#else
+            dataCompressed.lineSegments[j] = line;
+#endif
         }
+        dataCompressed.voxelDensities[i] = density;
     }
-    return voxelsInAABB;
+
+    dataCompressed.voxelAOFactors.resize(n);
+    generateVoxelAOFactorsFromDensity(dataCompressed.voxelDensities, dataCompressed.voxelAOFactors,
+            levelResolution, isHairDataset);
+    computeAttributeHistograms(dataCompressed);
+    return dataCompressed;
 }
 
-void VoxelCurveDiscretizer::nextStreamline(const Curve &line)
+
+
+void VoxelCurveDiscretizer::clipStreamline(const Curve &line, std::vector<ClippedLineSegment> &clippedSegments)
 {
     int N = line.points.size();
 
-    // Add intersections to voxels
-    std::set<VoxelDiscretizer*> usedVoxels;
+    // Add intersections with all voxels
+    std::vector<VoxelIntersection> intersections;
     for (int i = 0; i < N-1; i++) {
         // Get line segment
         glm::vec3 v1 = line.points.at(i);
@@ -465,40 +711,316 @@ void VoxelCurveDiscretizer::nextStreamline(const Curve &line)
             continue;
         }
 
-        // Compute AABB of current segment
-        sgl::AABB3 segmentAABB = sgl::AABB3();
-        segmentAABB.combine(v1);
-        segmentAABB.combine(v2);
+        // Iterate over all voxels with possible intersections (i.e., in the AABB of the current segment)
+        glm::vec3 minimum = glm::min(v1, v2);
+        glm::vec3 maximum = glm::max(v1, v2);
+        glm::ivec3 lower = glm::max(glm::ivec3(minimum), glm::ivec3(0)); // Round down
+        glm::ivec3 upper = glm::min(glm::ivec3(ceil(maximum.x), ceil(maximum.y), ceil(maximum.z)),
+                gridResolution - glm::ivec3(1)); // Round up
+        for (int z = lower.z; z <= upper.z; z++) {
+            for (int y = lower.y; y <= upper.y; y++) {
+                for (int x = lower.x; x <= upper.x; x++) {
+                    uint32_t index = x + y*gridResolution.x + z*gridResolution.x*gridResolution.y;
+                    addPossibleIntersections(glm::ivec3(x, y, z), index, v1, v2, a1, a2, intersections);
+                }
+            }
+        }
+    }
+
+    // Group the intersections by voxel (keeping the order along the line) and convert them to clipped line segments
+    std::stable_sort(intersections.begin(), intersections.end(),
+            [](const VoxelIntersection &i1, const VoxelIntersection &i2) {
+        return i1.voxelIndex1D < i2.voxelIndex1D;
+    });
+    size_t groupStart = 0;
+    while (groupStart < intersections.size()) {
+        size_t groupEnd = groupStart;
+        while (groupEnd < intersections.size()
+                && intersections.at(groupEnd).voxelIndex1D == intersections.at(groupStart).voxelIndex1D) {
+            groupEnd++;
+        }
+        for (size_t i = groupStart; i + 1 < groupEnd; i += 2) {
+            ClippedLineSegment clippedSegment;
+            clippedSegment.voxelIndex1D = intersections.at(i).voxelIndex1D;
+            clippedSegment.segment = LineSegment(intersections.at(i).v, intersections.at(i).a,
+                    intersections.at(i+1).v, intersections.at(i+1).a, line.lineID);
+            clippedSegments.push_back(clippedSegment);
+        }
+        groupStart = groupEnd;
+    }
+}
+
+static void logOutOfCoreProgress(const std::string &stage, float progress)
+{
+    sgl::Logfile::get()->writeInfo(std::string() + "Out-of-core voxelization: " + stage + " ("
+            + sgl::toString(int(progress * 100.0f)) + "%)");
+}
+
+bool VoxelCurveDiscretizer::createFromTrajectoryDatasetOutOfCore(const std::string &filename,
+        TrajectoryType trajectoryType, const std::string &outputFilename, const std::string &tempDirectory,
+        size_t memoryCeilingBytes, int brickSize)
+{
+    if (!boost::ends_with(boost::to_lower_copy(filename), ".binlines")) {
+        sgl::Logfile::get()->writeError(std::string() + "Error in VoxelCurveDiscretizer::"
+                + "createFromTrajectoryDatasetOutOfCore: Only .binlines files can be streamed (\"" + filename + "\").");
+        return false;
+    }
+
+    auto start = std::chrono::system_clock::now();
+    maxVorticity = 0.0f;
+    isHairDataset = false;
+
+    // A quarter of the memory for the trajectory batches, half of it for the spill buffers.
+    const size_t batchSizeBytes = std::max(memoryCeilingBytes / 4, size_t(1) << 20);
+    const size_t maxSpillBufferSizeBytes = std::max(memoryCeilingBytes / 2, size_t(1) << 20);
+
+
+    // PASS 1: Compute the bounding box (and the attribute range needed for the normalization of the dataset).
+    sgl::AABB3 rawBoundingBox;
+    float minAttr = std::numeric_limits<float>::max();
+    float maxAttr = std::numeric_limits<float>::lowest();
+    size_t numPoints = 0;
+    bool success = false;
+    MappedTrajectories mappedTrajectories;
+    if (getBinLinesFormatVersion(filename) == BINLINES_FORMAT_VERSION_2 && mappedTrajectories.open(filename)) {
+        // Binlines v2 files store the bounding box and the attribute ranges in the header.
+        rawBoundingBox = mappedTrajectories.getBoundingBox();
+        numPoints = mappedTrajectories.getNumPoints();
+        if (mappedTrajectories.getNumAttributes() > 0) {
+            minAttr = mappedTrajectories.getAttributeRange(0).x;
+            maxAttr = mappedTrajectories.getAttributeRange(0).y;
+        }
+        mappedTrajectories.close();
+    } else {
+        success = streamTrajectoriesFromBinLines(filename, batchSizeBytes, [&](Trajectories &batch, float progress) {
+            for (const glm::vec3 &position : batch.positions) {
+                rawBoundingBox.combine(position);
+            }
+            numPoints += batch.positions.size();
+            if (!batch.attributes.empty()) {
+                for (float attr : batch.attributes.front()) {
+                    minAttr = std::min(minAttr, attr);
+                    maxAttr = std::max(maxAttr, attr);
+                }
+            }
+            logOutOfCoreProgress("Computing the bounding box", progress);
+        });
+        if (!success) {
+            return false;
+        }
+    }
+
+    TrajectoryNormalization normalization = computeTrajectoryNormalization(
+            trajectoryType, rawBoundingBox, minAttr, maxAttr);
+    linesBoundingBox = sgl::AABB3();
+    linesBoundingBox.combine(normalization.normalizePosition(rawBoundingBox.getMinimum()));
+    linesBoundingBox.combine(normalization.normalizePosition(rawBoundingBox.getMaximum()));
+
+    // Move to origin and scale to range from (0, 0, 0) to (rx, ry, rz).
+    adaptGridResolutionToAABB(linesBoundingBox);
+    linesToVoxel = sgl::matrixScaling(1.0f / linesBoundingBox.getDimensions() * glm::vec3(gridResolution))
+            * sgl::matrixTranslation(-linesBoundingBox.getMinimum());
+    voxelToLines = glm::inverse(linesToVoxel);
 
-        // Iterate over all voxels with possible intersections
-        std::vector<VoxelDiscretizer*> voxelsInAABB = getVoxelsInAABB(segmentAABB);
+    std::cout << "Grid resolution: " << gridResolution.x << " " << gridResolution.y
+              << " " << gridResolution.z << std::endl << std::flush;
+
+
+    // PASS 2: Clip the trajectories and spill the clipped segments to the brick files. The brick files are opened in
+    // append mode, i.e., left-overs of an interrupted run need to be removed first.
+    auto removeTempDirectory = [&]() {
+        boost::system::error_code errorCode;
+        boost::filesystem::remove_all(tempDirectory, errorCode);
+    };
+    removeTempDirectory();
+    boost::filesystem::create_directories(tempDirectory);
+    glm::ivec3 numBricks = (gridResolution + glm::ivec3(brickSize - 1)) / brickSize;
+    int numBricks1D = numBricks.x * numBricks.y * numBricks.z;
+    auto getBrickFilename = [&](int brickIndex) {
+        return tempDirectory + "/brick_" + sgl::toString(brickIndex) + ".tmp";
+    };
+    auto getBrickIndex = [&](uint32_t voxelIndex1D) {
+        int x = voxelIndex1D % gridResolution.x;
+        int y = (voxelIndex1D / gridResolution.x) % gridResolution.y;
+        int z = voxelIndex1D / (gridResolution.x * gridResolution.y);
+        return x / brickSize + (y / brickSize) * numBricks.x + (z / brickSize) * numBricks.x * numBricks.y;
+    };
+
+    std::vector<std::vector<ClippedLineSegment>> spillBuffers(numBricks1D);
+    std::vector<uint64_t> numSegmentsPerBrick(numBricks1D, 0);
+    size_t spillBufferSizeBytes = 0;
+    auto flushSpillBuffers = [&]() {
+        for (int brickIndex = 0; brickIndex < numBricks1D; brickIndex++) {
+            std::vector<ClippedLineSegment> &spillBuffer = spillBuffers.at(brickIndex);
+            if (spillBuffer.empty()) {
+                continue;
+            }
+            std::ofstream brickFile(getBrickFilename(brickIndex).c_str(),
+                    std::ofstream::binary | std::ofstream::app);
+            brickFile.write((const char*)spillBuffer.data(), spillBuffer.size() * sizeof(ClippedLineSegment));
+            numSegmentsPerBrick.at(brickIndex) += spillBuffer.size();
+            spillBuffer = std::vector<ClippedLineSegment>();
+        }
+        spillBufferSizeBytes = 0;
+    };
+
+    // The normalized attributes are stored in the voxel file for the histogram of the transfer function window. Only
+    // every attributeStride-th value is kept, such that they use at most an eighth of the memory ceiling.
+    const size_t maxNumLineAttributes = std::max(memoryCeilingBytes / 8 / sizeof(float), size_t(1));
+    const size_t attributeStride = std::max((numPoints + maxNumLineAttributes - 1) / maxNumLineAttributes, size_t(1));
+    std::vector<float> lineAttributes;
+    size_t pointOffset = 0;
+
+    uint32_t numLines = 0;
+    success = streamTrajectoriesFromBinLines(filename, batchSizeBytes, [&](Trajectories &batch, float progress) {
+        normalization.apply(batch);
+        if (!batch.attributes.empty()) {
+            const TrajectoryArray<float> &batchAttributes = batch.attributes.front();
+            size_t firstIndex = (attributeStride - pointOffset % attributeStride) % attributeStride;
+            for (size_t j = firstIndex; j < batchAttributes.size(); j += attributeStride) {
+                lineAttributes.push_back(batchAttributes[j]);
+            }
+            for (float attr : batchAttributes) {
+                maxVorticity = std::max(maxVorticity, attr);
+            }
+        }
+        pointOffset += batch.positions.size();
+        const Trajectories &normalizedBatch = batch;
+        std::vector<std::vector<ClippedLineSegment>> batchClippedSegments(batch.size());
+        #pragma omp parallel for schedule(dynamic)
+        for (int i = 0; i < int(batch.size()); i++) {
+            ConstTrajectoryView trajectory = normalizedBatch.at(i);
+            Curve curve;
+            curve.lineID = numLines + i;
+            curve.points.reserve(trajectory.positions.size());
+            for (const glm::vec3 &position : trajectory.positions) {
+                curve.points.push_back(sgl::transformPoint(linesToVoxel, position));
+            }
+            if (trajectory.attributes.empty()) {
+                curve.attributes.resize(trajectory.positions.size(), 0.0f);
+            } else {
+                ArrayView<const float> attributes = trajectory.attributes.at(0);
+                curve.attributes.assign(attributes.begin(), attributes.end());
+            }
+            clipStreamline(curve, batchClippedSegments.at(i));
+        }
+        numLines += batch.size();
 
-        for (VoxelDiscretizer *voxel : voxelsInAABB) {
-            // Line-voxel intersection
-            if (voxel->addPossibleIntersections(v1, v2, a1, a2)) {
-                // Intersection(s) added to "currentLineIntersections", voxel used
-                usedVoxels.insert(voxel);
+        for (std::vector<ClippedLineSegment> &clippedSegments : batchClippedSegments) {
+            for (const ClippedLineSegment &clippedSegment : clippedSegments) {
+                spillBuffers.at(getBrickIndex(clippedSegment.voxelIndex1D)).push_back(clippedSegment);
             }
+            spillBufferSizeBytes += clippedSegments.size() * sizeof(ClippedLineSegment);
         }
+        if (spillBufferSizeBytes >= maxSpillBufferSizeBytes) {
+            flushSpillBuffers();
+        }
+        logOutOfCoreProgress("Clipping the trajectories", progress);
+    });
+    flushSpillBuffers();
+    if (!success) {
+        removeTempDirectory();
+        return false;
     }
+    std::cout << "Num Lines: " << numLines << std::endl << std::flush;
+
+
+    // PASS 3: Finalize the bricks one at a time. The compressed line segments of all bricks are appended to a
+    // temporary file, as the offsets stored per voxel allow an arbitrary order of the voxels in the line buffer.
+    VoxelGridDataCompressed dataCompressed;
+    dataCompressed.gridResolution = gridResolution;
+    dataCompressed.quantizationResolution = quantizationResolution;
+    dataCompressed.worldToVoxelGridMatrix = this->getWorldToVoxelGridMatrix();
+    dataCompressed.dataType = 0u;
+    dataCompressed.attributes = std::move(lineAttributes);
+    dataCompressed.maxVorticity = maxVorticity;
 
-    // Convert intersections to clipped line segments
-    for (VoxelDiscretizer *voxel : usedVoxels) {
-        if (voxel->currentCurveIntersections.size() < 2) {
-            voxel->currentCurveIntersections.clear();
+    int n = gridResolution.x * gridResolution.y * gridResolution.z;
+    dataCompressed.voxelLineListOffsets.resize(n, 0);
+    dataCompressed.numLinesInVoxel.resize(n, 0);
+    dataCompressed.voxelDensities.resize(n, 0.0f);
+
+    std::string lineSegmentsFilename = tempDirectory + "/line_segments.tmp";
+    std::ofstream lineSegmentsFile(lineSegmentsFilename.c_str(), std::ofstream::binary);
+    uint64_t lineOffset = 0;
+    for (int brickIndex = 0; brickIndex < numBricks1D; brickIndex++) {
+        uint64_t numBrickSegments = numSegmentsPerBrick.at(brickIndex);
+        if (numBrickSegments == 0) {
             continue;
         }
-        auto it1 = voxel->currentCurveIntersections.begin();
-        auto it2 = voxel->currentCurveIntersections.begin();
-        it2++;
-        while (it2 != voxel->currentCurveIntersections.end()) {
-            voxel->lines.push_back(LineSegment(it1->v, it1->a, it2->v, it2->a, line.lineID));
-            it1++; it1++;
-            if (it1 == voxel->currentCurveIntersections.end()) break;
-            it2++; it2++;
+        if (numBrickSegments * sizeof(ClippedLineSegment) > memoryCeilingBytes) {
+            sgl::Logfile::get()->writeInfo(std::string() + "Warning in VoxelCurveDiscretizer::"
+                    + "createFromTrajectoryDatasetOutOfCore: Brick " + sgl::toString(brickIndex)
+                    + " exceeds the memory ceiling. Consider using a smaller brick size.");
+        }
+
+        std::vector<ClippedLineSegment> brickSegments(numBrickSegments);
+        std::string brickFilename = getBrickFilename(brickIndex);
+        std::ifstream brickFile(brickFilename.c_str(), std::ifstream::binary);
+        brickFile.read((char*)brickSegments.data(), numBrickSegments * sizeof(ClippedLineSegment));
+        brickFile.close();
+        boost::filesystem::remove(brickFilename);
+
+        // Group the segments by voxel (stable to keep the order of the lines deterministic).
+        std::stable_sort(brickSegments.begin(), brickSegments.end(),
+                [](const ClippedLineSegment &s1, const ClippedLineSegment &s2) {
+            return s1.voxelIndex1D < s2.voxelIndex1D;
+        });
+
+#ifdef PACK_LINES
+        std::vector<LineSegmentCompressed> brickLineSegments(numBrickSegments);
+#else
+        std::vector<LineSegment> brickLineSegments(numBrickSegments);
+#endif
+        for (size_t i = 0; i < brickSegments.size(); i++) {
+            uint32_t voxelIndex1D = brickSegments.at(i).voxelIndex1D;
+            LineSegment &line = brickSegments.at(i).segment;
+            if (i == 0 || brickSegments.at(i-1).voxelIndex1D != voxelIndex1D) {
+                dataCompressed.voxelLineListOffsets.at(voxelIndex1D) = uint32_t(lineOffset + i);
+            }
+            dataCompressed.numLinesInVoxel.at(voxelIndex1D)++;
+            dataCompressed.voxelDensities.at(voxelIndex1D) += line.length() * line.avgOpacity(maxVorticity);
+#ifdef PACK_LINES
+            glm::ivec3 voxelIndex = glm::ivec3(voxelIndex1D % gridResolution.x,
+                    (voxelIndex1D / gridResolution.x) % gridResolution.y,
+                    voxelIndex1D / (gridResolution.x * gridResolution.y));
+            compressLine(voxelIndex, line, brickLineSegments.at(i));
+#else
+            brickLineSegments.at(i) = line;
+#endif
         }
-        voxel->currentCurveIntersections.clear();
+        lineSegmentsFile.write((const char*)brickLineSegments.data(),
+                brickLineSegments.size() * sizeof(brickLineSegments.front()));
+        lineOffset += numBrickSegments;
+
+        logOutOfCoreProgress("Finalizing the bricks", float(brickIndex + 1) / float(numBricks1D));
+    }
+    lineSegmentsFile.close();
+
+    if (lineOffset > std::numeric_limits<uint32_t>::max()) {
+        sgl::Logfile::get()->writeError(std::string() + "Error in VoxelCurveDiscretizer::"
+                + "createFromTrajectoryDatasetOutOfCore: Too many line segments for the voxel file format.");
+        removeTempDirectory();
+        return false;
     }
+
+    dataCompressed.voxelAOFactors.resize(n);
+    generateVoxelAOFactorsFromDensity(dataCompressed.voxelDensities, dataCompressed.voxelAOFactors,
+            gridResolution, false);
+    success = saveToFileWithExternalLineSegments(
+            outputFilename, dataCompressed, lineSegmentsFilename, uint32_t(lineOffset));
+    removeTempDirectory();
+    if (!success) {
+        boost::system::error_code errorCode;
+        boost::filesystem::remove(outputFilename, errorCode);
+        return false;
+    }
+
+    auto end = std::chrono::system_clock::now();
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+    sgl::Logfile::get()->writeInfo(std::string() + "Computational time to create voxel grid out-of-core: "
+                                   + std::to_string(elapsed.count()));
+    return true;
 }
 
 template<typename T>
@@ -692,8 +1214,13 @@ std::string ivec3ToString(const glm::ivec3 &v) {
 }
 
 void VoxelCurveDiscretizer::recreateDensityAndAOFactors(VoxelGridDataCompressed &dataCompressed,
-        VoxelGridDataGPU &dataGPU, unsigned int maxNumLinesPerVoxel)
+        VoxelGridDataGPU &dataGPU, unsigned int maxNumLinesPerVoxel, bool useGPU)
 {
+    if (!useGPU) {
+        recreateDensityAndAOFactorsCPU(dataCompressed, dataGPU);
+        return;
+    }
+
     glm::ivec3 numWorkGroupsVoxel = glm::ivec3(sgl::iceil(gridResolution.x, 64), sgl::iceil(gridResolution.y, 4),
                                                gridResolution.z);
     uint32_t gridSize1D = gridResolution.x *gridResolution.y *gridResolution.z;
@@ -753,6 +1280,164 @@ void VoxelCurveDiscretizer::recreateDensityAndAOFactors(VoxelGridDataCompressed
     glUseProgram(0); // For ImGui to stop complaining when binding last_program...
 }
 
+uint32_t VoxelCurveDiscretizer::computeVoxelHistogram(const VoxelGridDataCompressed &dataCompressed,
+        int voxelIndex1D, float *binWeights, uint8_t *usedBins)
+{
+    const glm::ivec3 &res = dataCompressed.gridResolution;
+    glm::vec3 voxelPosition = glm::vec3(
+            voxelIndex1D % res.x, (voxelIndex1D / res.x) % res.y, voxelIndex1D / (res.x * res.y));
+    uint32_t lineOffset = dataCompressed.voxelLineListOffsets[voxelIndex1D];
+    uint32_t numLines = dataCompressed.numLinesInVoxel[voxelIndex1D];
+
+    // Same mapping of the attributes to [0, 1] as opacityMapping (hair data has no attributes, i.e., no maximum).
+    const float maxAttribute = dataCompressed.maxVorticity;
+
+    uint32_t numUsedBins = 0;
+    LineSegment line;
+    for (uint32_t i = 0; i < numLines; i++) {
+#ifdef PACK_LINES
+        decompressLine(voxelPosition, dataCompressed.lineSegments[lineOffset+i], line);
+#else
+        line = dataCompressed.lineSegments[lineOffset+i];
+#endif
+        // density += length * (opacity(a1) + opacity(a2)) / 2
+        float halfLength = line.length() / 2.0f;
+        if (halfLength <= 0.0f) {
+            continue;
+        }
+        const float lineAttributes[2] = { line.a1, line.a2 };
+        for (int j = 0; j < 2; j++) {
+            float attribute = maxAttribute > 0.0f ? glm::clamp(lineAttributes[j] / maxAttribute, 0.0f, 1.0f) : 0.0f;
+            int bin = glm::clamp((int)std::round(attribute * float(VOXEL_HISTOGRAM_NUM_BINS-1)),
+                    0, VOXEL_HISTOGRAM_NUM_BINS-1);
+            if (binWeights[bin] == 0.0f) {
+                usedBins[numUsedBins++] = (uint8_t)bin;
+            }
+            binWeights[bin] += halfLength;
+        }
+    }
+    return numUsedBins;
+}
+
+void VoxelCurveDiscretizer::computeAttributeHistograms(VoxelGridDataCompressed &dataCompressed)
+{
+    auto start = std::chrono::system_clock::now();
+
+    VoxelAttributeHistograms &histograms = dataCompressed.attributeHistograms;
+    const glm::ivec3 &res = dataCompressed.gridResolution;
+    const int n = res.x * res.y * res.z;
+    histograms.voxelHistogramOffsets.resize(n + 1);
+
+    // Pass 1: Count the number of non-empty bins per voxel.
+    #pragma omp parallel
+    {
+        float binWeights[VOXEL_HISTOGRAM_NUM_BINS] = { 0.0f };
+        uint8_t usedBins[VOXEL_HISTOGRAM_NUM_BINS];
+        #pragma omp for
+        for (int i = 0; i < n; i++) {
+            uint32_t numUsedBins = computeVoxelHistogram(dataCompressed, i, binWeights, usedBins);
+            for (uint32_t j = 0; j < numUsedBins; j++) {
+                binWeights[usedBins[j]] = 0.0f;
+            }
+            histograms.voxelHistogramOffsets[i+1] = numUsedBins;
+        }
+    }
+
+    // Prefix sum over the bin counts.
+    histograms.voxelHistogramOffsets[0] = 0;
+    for (int i = 0; i < n; i++) {
+        histograms.voxelHistogramOffsets[i+1] += histograms.voxelHistogramOffsets[i];
+    }
+    histograms.bins.resize(histograms.voxelHistogramOffsets[n]);
+    histograms.weights.resize(histograms.voxelHistogramOffsets[n]);
+
+    // Pass 2: Write the non-empty bins to the determined offsets.
+    #pragma omp parallel
+    {
+        float binWeights[VOXEL_HISTOGRAM_NUM_BINS] = { 0.0f };
+        uint8_t usedBins[VOXEL_HISTOGRAM_NUM_BINS];
+        #pragma omp for
+        for (int i = 0; i < n; i++) {
+            uint32_t numUsedBins = computeVoxelHistogram(dataCompressed, i, binWeights, usedBins);
+            uint32_t offset = histograms.voxelHistogramOffsets[i];
+            for (uint32_t j = 0; j < numUsedBins; j++) {
+                histograms.bins[offset+j] = usedBins[j];
+                histograms.weights[offset+j] = binWeights[usedBins[j]];
+                binWeights[usedBins[j]] = 0.0f;
+            }
+        }
+    }
+
+    auto end = std::chrono::system_clock::now();
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+    sgl::Logfile::get()->writeInfo(std::string() + "Computational time to create the attribute histograms: "
+                                   + std::to_string(elapsed.count()) + " (number of bins: "
+                                   + sgl::toString(histograms.bins.size()) + ")");
+}
+
+void VoxelCurveDiscretizer::recreateDensityAndAOFactorsCPU(VoxelGridDataCompressed &dataCompressed,
+        VoxelGridDataGPU &dataGPU)
+{
+    if (dataCompressed.attributeHistograms.empty()) {
+        computeAttributeHistograms(dataCompressed);
+    }
+
+    // PART 1: Compute the densities as dot product of the attribute histograms with the opacity map.
+    auto startDensity = std::chrono::system_clock::now();
+
+    bool isHairData = dataCompressed.dataType == 1u;
+    float opacityLUT[VOXEL_HISTOGRAM_NUM_BINS];
+    for (int i = 0; i < VOXEL_HISTOGRAM_NUM_BINS; i++) {
+        if (isHairData) {
+            opacityLUT[i] = dataCompressed.hairStrandColor.a;
+        } else {
+            opacityLUT[i] = g_TransferFunctionWindowHandle->getOpacityAtAttribute(
+                    float(i) / float(VOXEL_HISTOGRAM_NUM_BINS-1));
+        }
+    }
+
+    const glm::ivec3 &res = dataCompressed.gridResolution;
+    const int n = res.x * res.y * res.z;
+    const uint32_t *histogramOffsets = &dataCompressed.attributeHistograms.voxelHistogramOffsets.front();
+    const uint8_t *histogramBins = dataCompressed.attributeHistograms.bins.data();
+    const float *histogramWeights = dataCompressed.attributeHistograms.weights.data();
+    dataCompressed.voxelDensities.resize(n);
+    float *voxelDensities = &dataCompressed.voxelDensities.front();
+
+    #pragma omp parallel for
+    for (int i = 0; i < n; i++) {
+        float density = 0.0f;
+        const uint32_t begin = histogramOffsets[i];
+        const uint32_t end = histogramOffsets[i+1];
+        #pragma omp simd reduction(+:density)
+        for (uint32_t j = begin; j < end; j++) {
+            density += histogramWeights[j] * opacityLUT[histogramBins[j]];
+        }
+        voxelDensities[i] = density;
+    }
+
+    auto endDensity = std::chrono::system_clock::now();
+    auto elapsedDensity = std::chrono::duration_cast<std::chrono::milliseconds>(endDensity - startDensity);
+    sgl::Logfile::get()->writeInfo(std::string() + "Computational time to compute the densities (CPU): "
+                                   + std::to_string(elapsedDensity.count()));
+
+
+    // PART 2: Blur the densities to get the ambient occlusion factors.
+    auto startAO = std::chrono::system_clock::now();
+
+    dataCompressed.voxelAOFactors.resize(n);
+    generateVoxelAOFactorsFromDensity(dataCompressed.voxelDensities, dataCompressed.voxelAOFactors, res, isHairData);
+
+    auto endAO = std::chrono::system_clock::now();
+    auto elapsedAO = std::chrono::duration_cast<std::chrono::milliseconds>(endAO - startAO);
+    sgl::Logfile::get()->writeInfo(std::string() + "Computational time to compute the ambient occlusion factors (CPU): "
+                                   + std::to_string(elapsedAO.count()));
+
+    // PART 3: Upload the new data to the GPU.
+    dataGPU.densityTexture = generateDensityTexture(dataCompressed.voxelDensities, res);
+    dataGPU.aoTexture = generateDensityTexture(dataCompressed.voxelAOFactors, res);
+}
+
 VoxelGridDataCompressed VoxelCurveDiscretizer::createVoxelGridGPU(
         std::vector<Curve> &curves, unsigned int maxNumLinesPerVoxel)
 {
@@ -971,5 +1656,6 @@ VoxelGridDataCompressed VoxelCurveDiscretizer::createVoxelGridGPU(
 
     dataCompressed.voxelDensities = voxelDensities;
     dataCompressed.voxelAOFactors = voxelAOFactors;
+    computeAttributeHistograms(dataCompressed);
     return dataCompressed;
 }
\ No newline at end of file
@@ -27,21 +27,19 @@ struct AttributePoint
     float a;
 };
 
-class VoxelDiscretizer
+// Intersection point of a line with the boundary of the voxel with the index "voxelIndex1D".
+struct VoxelIntersection : public AttributePoint
 {
-public:
-    // Returns true if the passed line intersects the voxel boundaries
-    bool addPossibleIntersections(const glm::vec3 &v1, const glm::vec3 &v2, float a1, float a2);
-    void setIndex(glm::ivec3 index);
-    const glm::ivec3 &getIndex() const { return index; }
-    float computeDensity(float maxVorticity);
-    float computeDensityHair(float opacity);
-
-    glm::ivec3 index;
-    std::vector<LineSegment> lines;
-
-    // For clipping lines to voxel
-    std::vector<AttributePoint> currentCurveIntersections;
+    VoxelIntersection(uint32_t voxelIndex1D, const glm::vec3 &v, float a)
+            : AttributePoint(v, a), voxelIndex1D(voxelIndex1D) {}
+    uint32_t voxelIndex1D;
+};
+
+// Line segment clipped to the voxel with the index "voxelIndex1D".
+struct ClippedLineSegment
+{
+    uint32_t voxelIndex1D;
+    LineSegment segment;
 };
 
 
@@ -52,21 +50,45 @@ public:
     VoxelCurveDiscretizer(
             const glm::ivec3 &gridResolution = glm::ivec3(256, 256, 256),
             const glm::ivec3 &quantizationResolution = glm::ivec3(8, 8, 8));
-    ~VoxelCurveDiscretizer();
     VoxelGridDataCompressed createFromTrajectoryDataset(const std::string &filename, TrajectoryType trajectoryType,
             std::vector<float> &attributes, float &maxVorticity, unsigned int maxNumLinesPerVoxel, bool useGPU = true);
     VoxelGridDataCompressed createFromHairDataset(const std::string &filename, float &lineRadius,
             glm::vec4 &hairStrandColor, unsigned int maxNumLinesPerVoxel, bool useGPU = true);
     glm::mat4 getWorldToVoxelGridMatrix() { return linesToVoxel; }
 
+    /**
+     * Out-of-core voxelization for trajectory datasets that don't fit into main memory (only .binlines files).
+     * The trajectories are streamed in batches and the clipped line segments are spilled to temporary per-brick files
+     * in "tempDirectory" (cleared before use and removed afterwards). Then, the bricks are finalized one at a time and
+     * written to the voxel file "outputFilename", which can be loaded with loadFromFile.
+     * The voxel file stores a subset of the (normalized) attribute values for the histogram of the transfer function
+     * and their maximum as maxVorticity.
+     * @param memoryCeilingBytes Approximate upper bound for the memory used by trajectory batches, spill buffers,
+     * the attribute subset and the currently finalized brick (excluding the per-voxel arrays with 16 bytes per voxel).
+     * @param brickSize The side length of the bricks in voxels.
+     * @return Whether the voxel file could be created.
+     */
+    bool createFromTrajectoryDatasetOutOfCore(const std::string &filename, TrajectoryType trajectoryType,
+            const std::string &outputFilename, const std::string &tempDirectory,
+            size_t memoryCeilingBytes = size_t(2) << 30, int brickSize = 32);
+
+    /**
+     * Creates a pyramid with "numLevels" levels of which "finestLevel" is level 0. The coarser levels are created by
+     * merging the line segments clipped at the finest level (i.e., no re-voxelization is necessary). Consecutive
+     * segments of one line inside of a coarse voxel are simplified to one segment if the continuation is unique.
+     */
+    VoxelGridPyramidCompressed createPyramid(VoxelGridDataCompressed finestLevel, int numLevels);
+
     // Recompute density and AO factor if the transfer function changed.
     void recreateDensityAndAOFactors(VoxelGridDataCompressed &dataCompressed, VoxelGridDataGPU &dataGPU,
-            unsigned int maxNumLinesPerVoxel);
+            unsigned int maxNumLinesPerVoxel, bool useGPU = true);
+
+    // Creates the per-voxel attribute histograms used for recomputing the densities on the CPU.
+    void computeAttributeHistograms(VoxelGridDataCompressed &dataCompressed);
 
 private:
     bool isHairDataset = false;
     glm::ivec3 gridResolution, quantizationResolution;
-    VoxelDiscretizer *voxels;
 
     // Trajectory dataset
     float maxVorticity;
@@ -78,14 +100,28 @@ private:
     float hairOpacity;
 
     // Grid generation
-    void setVoxelGrid(const sgl::AABB3 &aabb);
+    void adaptGridResolutionToAABB(const sgl::AABB3 &aabb);
 
-    // On CPU
-    VoxelGridDataCompressed compressData();
-    void nextStreamline(const Curve &line);
+    // On CPU (counting sort of the clipped line segments by voxel, i.e., no per-voxel containers)
+    VoxelGridDataCompressed createVoxelGridCPU(const std::vector<Curve> &curves);
+    void clipStreamline(const Curve &line, std::vector<ClippedLineSegment> &clippedSegments);
     // On GPU
     VoxelGridDataCompressed createVoxelGridGPU(std::vector<Curve> &curves, unsigned int maxNumLinesPerVoxel);
 
+    // Density & AO recomputation
+    void recreateDensityAndAOFactorsCPU(VoxelGridDataCompressed &dataCompressed, VoxelGridDataGPU &dataGPU);
+    uint32_t computeVoxelHistogram(const VoxelGridDataCompressed &dataCompressed, int voxelIndex1D,
+            float *binWeights, uint8_t *usedBins);
+
+    // Pyramid generation
+    void mergeLineSegmentsCoarseLevel(
+            const glm::ivec3 &fineResolution, const std::vector<uint32_t> &fineOffsets,
+            const std::vector<LineSegment> &fineSegments, const glm::ivec3 &coarseResolution,
+            std::vector<uint32_t> &coarseOffsets, std::vector<LineSegment> &coarseSegments);
+    VoxelGridDataCompressed compressLevel(
+            const glm::ivec3 &levelResolution, const glm::mat4 &worldToVoxelGridMatrix,
+            const std::vector<uint32_t> &offsets, const std::vector<LineSegment> &segments);
+
     // Compression
     void quantizeLine(const glm::vec3 &voxelPos, const LineSegment &line, LineSegmentQuantized &lineQuantized,
             int faceIndex1, int faceIndex2);
@@ -99,7 +135,6 @@ private:
             LineSegment &decompressedLine);
     bool checkLinesEqual(const LineSegment &originalLine, const LineSegment &decompressedLine);
 
-    std::vector<VoxelDiscretizer*> getVoxelsInAABB(const sgl::AABB3 &aabb);
     sgl::AABB3 linesBoundingBox;
     glm::mat4 linesToVoxel, voxelToLines;
 };
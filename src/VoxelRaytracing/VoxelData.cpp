@@ -2,10 +2,12 @@
 // Created by christoph on 04.10.18.
 //
 
+#include <cmath>
 #include <cstring>
 #include <cassert>
 #include <fstream>
 #include <iostream>
+#include <algorithm>
 
 #include <GL/glew.h>
 #include <glm/glm.hpp>
@@ -21,19 +23,10 @@
 #include "VoxelData.hpp"
 
 /**
- * New in version 4: Support for non-uniform grids.
+ * Writes everything except for the line segments (which are the last entry in the file).
  */
-const uint32_t VOXEL_GRID_FORMAT_VERSION = 4u;
-
-void saveToFile(const std::string &filename, const VoxelGridDataCompressed &data)
+static void writeVoxelGridDataWithoutLineSegments(sgl::BinaryWriteStream &stream, const VoxelGridDataCompressed &data)
 {
-    std::ofstream file(filename.c_str(), std::ofstream::binary);
-    if (!file.is_open()) {
-        sgl::Logfile::get()->writeError(std::string() + "Error in saveToFile: File \"" + filename + "\" not found.");
-        return;
-    }
-
-    sgl::BinaryWriteStream stream;
     stream.write((uint32_t)VOXEL_GRID_FORMAT_VERSION);
     stream.write(data.gridResolution);
     stream.write(data.quantizationResolution);
@@ -52,6 +45,18 @@ void saveToFile(const std::string &filename, const VoxelGridDataCompressed &data
     stream.writeArray(data.numLinesInVoxel);
     stream.writeArray(data.voxelDensities);
     stream.writeArray(data.voxelAOFactors);
+}
+
+void saveToFile(const std::string &filename, const VoxelGridDataCompressed &data)
+{
+    std::ofstream file(filename.c_str(), std::ofstream::binary);
+    if (!file.is_open()) {
+        sgl::Logfile::get()->writeError(std::string() + "Error in saveToFile: File \"" + filename + "\" not found.");
+        return;
+    }
+
+    sgl::BinaryWriteStream stream;
+    writeVoxelGridDataWithoutLineSegments(stream, data);
     stream.writeArray(data.lineSegments);
     std::cout << "Number of line segments written: " << data.lineSegments.size() << std::endl;
     std::cout << "Buffer size (in MB): " << (stream.getSize() / 1024. / 1024.) << std::endl;
@@ -60,6 +65,54 @@ void saveToFile(const std::string &filename, const VoxelGridDataCompressed &data
     file.close();
 }
 
+bool saveToFileWithExternalLineSegments(const std::string &filename, const VoxelGridDataCompressed &data,
+        const std::string &lineSegmentsFilename, uint32_t numLineSegments)
+{
+    std::ofstream file(filename.c_str(), std::ofstream::binary);
+    if (!file.is_open()) {
+        sgl::Logfile::get()->writeError(std::string() + "Error in saveToFileWithExternalLineSegments: File \""
+                + filename + "\" not found.");
+        return false;
+    }
+    std::ifstream lineSegmentsFile(lineSegmentsFilename.c_str(), std::ifstream::binary);
+    if (!lineSegmentsFile.is_open()) {
+        sgl::Logfile::get()->writeError(std::string() + "Error in saveToFileWithExternalLineSegments: File \""
+                + lineSegmentsFilename + "\" not found.");
+        return false;
+    }
+
+    sgl::BinaryWriteStream stream;
+    writeVoxelGridDataWithoutLineSegments(stream, data);
+    // Same layout as sgl::BinaryWriteStream::writeArray (number of elements followed by the data).
+    stream.write(numLineSegments);
+    file.write((const char*)stream.getBuffer(), stream.getSize());
+
+#ifdef PACK_LINES
+    size_t lineSegmentsSize = numLineSegments * sizeof(LineSegmentCompressed);
+#else
+    size_t lineSegmentsSize = numLineSegments * sizeof(LineSegment);
+#endif
+    const size_t CHUNK_SIZE = 64 * 1024 * 1024;
+    std::vector<char> chunk(std::min(lineSegmentsSize, CHUNK_SIZE));
+    for (size_t bytesCopied = 0; bytesCopied < lineSegmentsSize; ) {
+        size_t chunkSize = std::min(lineSegmentsSize - bytesCopied, CHUNK_SIZE);
+        lineSegmentsFile.read(chunk.data(), chunkSize);
+        file.write(chunk.data(), chunkSize);
+        if (!lineSegmentsFile || !file) {
+            sgl::Logfile::get()->writeError(std::string() + "Error in saveToFileWithExternalLineSegments: Could not "
+                    + "copy the line segments from \"" + lineSegmentsFilename + "\" to \"" + filename + "\".");
+            return false;
+        }
+        bytesCopied += chunkSize;
+    }
+    std::cout << "Number of line segments written: " << numLineSegments << std::endl;
+    std::cout << "Buffer size (in MB): " << ((stream.getSize() + lineSegmentsSize) / 1024. / 1024.) << std::endl;
+
+    lineSegmentsFile.close();
+    file.close();
+    return !file.fail();
+}
+
 void loadFromFile(const std::string &filename, VoxelGridDataCompressed &data)
 {
     std::ifstream file(filename.c_str(), std::ifstream::binary);
@@ -113,6 +166,114 @@ void loadFromFile(const std::string &filename, VoxelGridDataCompressed &data)
 }
 
 
+void saveToFile(const std::string &filename, const VoxelGridPyramidCompressed &pyramid)
+{
+    if (pyramid.levels.empty()) {
+        sgl::Logfile::get()->writeError(std::string() + "Error in saveToFile: Empty voxel grid pyramid.");
+        return;
+    }
+
+    std::ofstream file(filename.c_str(), std::ofstream::binary);
+    if (!file.is_open()) {
+        sgl::Logfile::get()->writeError(std::string() + "Error in saveToFile: File \"" + filename + "\" not found.");
+        return;
+    }
+
+    // Only the coarse levels are written. The finest level and the shared metadata are stored in the voxel grid file.
+    sgl::BinaryWriteStream stream;
+    stream.write((uint32_t)VOXEL_GRID_PYRAMID_FORMAT_VERSION);
+    stream.write((uint32_t)(pyramid.levels.size() - 1));
+    for (size_t i = 1; i < pyramid.levels.size(); i++) {
+        const VoxelGridDataCompressed &level = pyramid.levels.at(i);
+        stream.write(level.gridResolution);
+        stream.write(level.worldToVoxelGridMatrix);
+        stream.writeArray(level.voxelLineListOffsets);
+        stream.writeArray(level.numLinesInVoxel);
+        stream.writeArray(level.voxelDensities);
+        stream.writeArray(level.voxelAOFactors);
+        stream.writeArray(level.lineSegments);
+        std::cout << "Number of line segments written (level resolution " << level.gridResolution.x << "): "
+                  << level.lineSegments.size() << std::endl;
+    }
+    std::cout << "Buffer size (in MB): " << (stream.getSize() / 1024. / 1024.) << std::endl;
+
+    file.write((const char*)stream.getBuffer(), stream.getSize());
+    file.close();
+}
+
+void loadFromFile(const std::string &filename, VoxelGridPyramidCompressed &pyramid)
+{
+    if (pyramid.levels.empty()) {
+        sgl::Logfile::get()->writeError(std::string() + "Error in loadFromFile: The finest level of the voxel grid "
+                                        + "pyramid needs to be loaded before \"" + filename + "\".");
+        return;
+    }
+    pyramid.levels.resize(1);
+
+    std::ifstream file(filename.c_str(), std::ifstream::binary);
+    if (!file.is_open()) {
+        sgl::Logfile::get()->writeError(std::string() + "Error in loadFromFile: File \"" + filename + "\" not found.");
+        return;
+    }
+
+    file.seekg(0, file.end);
+    size_t size = file.tellg();
+    file.seekg(0);
+    char *buffer = new char[size];
+    file.read(buffer, size);
+
+    sgl::BinaryReadStream stream(buffer, size);
+    uint32_t version;
+    stream.read(version);
+    if (version != VOXEL_GRID_PYRAMID_FORMAT_VERSION) {
+        sgl::Logfile::get()->writeError(std::string() + "Error in loadFromFile: Invalid version in file \""
+                                        + filename + "\".");
+        return;
+    }
+
+    uint32_t numCoarseLevels;
+    stream.read(numCoarseLevels);
+    pyramid.levels.resize(numCoarseLevels + 1);
+
+    // The attributes are only needed once and stay in the finest level.
+    const VoxelGridDataCompressed &finestLevel = pyramid.levels.front();
+    for (size_t i = 1; i < pyramid.levels.size(); i++) {
+        VoxelGridDataCompressed &level = pyramid.levels.at(i);
+        level.quantizationResolution = finestLevel.quantizationResolution;
+        level.dataType = finestLevel.dataType;
+        level.maxVorticity = finestLevel.maxVorticity;
+        level.hairStrandColor = finestLevel.hairStrandColor;
+        level.hairThickness = finestLevel.hairThickness;
+        stream.read(level.gridResolution);
+        stream.read(level.worldToVoxelGridMatrix);
+        stream.readArray(level.voxelLineListOffsets);
+        stream.readArray(level.numLinesInVoxel);
+        stream.readArray(level.voxelDensities);
+        stream.readArray(level.voxelAOFactors);
+        stream.readArray(level.lineSegments);
+    }
+
+    //delete[] buffer; // BinaryReadStream does deallocation
+    file.close();
+}
+
+int selectPyramidLevel(const VoxelGridPyramidCompressed &pyramid, float cameraDistance, float fovy,
+        int viewportHeight, float maxVoxelSizePixels)
+{
+    // Height of the view frustum at the passed distance in world space
+    float frustumHeight = 2.0f * cameraDistance * std::tan(fovy / 2.0f);
+    for (int level = int(pyramid.levels.size()) - 1; level > 0; level--) {
+        const glm::mat4 &worldToVoxel = pyramid.levels.at(level).worldToVoxelGridMatrix;
+        float voxelSizeWorld = 1.0f / glm::length(glm::vec3(worldToVoxel[0]));
+        float voxelSizePixels = voxelSizeWorld / frustumHeight * float(viewportHeight);
+        if (voxelSizePixels <= maxVoxelSizePixels) {
+            return level;
+        }
+    }
+    return 0;
+}
+
+
 std::vector<float> generateMipmapsForDensity(float *density, glm::ivec3 size)
 {
     std::vector<float> allLODs;
@@ -310,6 +471,14 @@ void generateGaussianBlurKernel(float *filterKernel, int filterSize, float sigma
     }
 }
 
+void generateGaussianBlurKernel1D(float *filterKernel, int filterSize, float sigma)
+{
+    const int FILTER_EXTENT = (filterSize - 1) / 2;
+    for (int offset = -FILTER_EXTENT; offset <= FILTER_EXTENT; offset++) {
+        filterKernel[offset+FILTER_EXTENT] = std::exp(-(offset*offset) / (2.0f * sigma * sigma));
+    }
+}
+
 // Divides all values by the maximum value.
 void normalizeVoxelAOFactors(std::vector<float> &voxelAOFactors, glm::ivec3 size, bool isHairDataset)
 {
@@ -347,34 +516,60 @@ void generateVoxelAOFactorsFromDensity(const std::vector<float> &voxelDensities,
 {
     const int FILTER_SIZE = 7;
     const int FILTER_EXTENT = (FILTER_SIZE - 1) / 2;
-    const int FILTER_NUM_FIELDS = FILTER_SIZE*FILTER_SIZE*FILTER_SIZE;
-    float blurKernel[FILTER_NUM_FIELDS];
-    generateGaussianBlurKernel(blurKernel, FILTER_SIZE, FILTER_EXTENT);
+    const float SIGMA = FILTER_EXTENT;
+
+    // The Gaussian kernel is separable. Thus, instead of applying the 7x7x7 kernel directly, we apply three
+    // 1D passes along x, y and z. The normalization constant of the 3D kernel is applied in the x pass.
+    float blurKernelX[FILTER_SIZE], blurKernel[FILTER_SIZE];
+    generateGaussianBlurKernel1D(blurKernel, FILTER_SIZE, SIGMA);
+    for (int i = 0; i < FILTER_SIZE; i++) {
+        blurKernelX[i] = blurKernel[i] / (sgl::TWO_PI * SIGMA * SIGMA);
+    }
 
-    // 1. Filter the densities
+    const int strideY = size.x;
+    const int strideZ = size.x * size.y;
+    std::vector<float> tmpFactors(voxelAOFactors.size());
+
+    // 1. Filter the densities (voxels outside of the grid have a density of zero)
     #pragma omp parallel for
     for (int gz = 0; gz < size.z; gz++) {
         for (int gy = 0; gy < size.y; gy++) {
             for (int gx = 0; gx < size.x; gx++) {
-                int writeIdx = gz*size.y*size.x + gy*size.x + gx;
-                voxelAOFactors[writeIdx] = 0.0f;
-                // 3x3 box filter
-                for (int offsetZ = -FILTER_EXTENT; offsetZ <= FILTER_EXTENT; offsetZ++) {
-                    for (int offsetY = -FILTER_EXTENT; offsetY <= FILTER_EXTENT; offsetY++) {
-                        for (int offsetX = -FILTER_EXTENT; offsetX <= FILTER_EXTENT; offsetX++) {
-                            int readX = gx + offsetX;
-                            int readY = gy + offsetY;
-                            int readZ = gz + offsetZ;
-                            if (readX >= 0 && readY >= 0 && readZ >= 0 && readX < size.x
-                                    && readY < size.y && readZ < size.z) {
-                                int filterIdx = (offsetZ+FILTER_EXTENT)*FILTER_SIZE*FILTER_SIZE
-                                        + (offsetY+FILTER_EXTENT)*FILTER_SIZE + (offsetX+FILTER_EXTENT);
-                                int readIdx = readZ*size.y*size.x + readY*size.y + readX;
-                                voxelAOFactors[writeIdx] += voxelDensities[readIdx] * blurKernel[filterIdx];
-                            }
-                        }
-                    }
+                int writeIdx = gz*strideZ + gy*strideY + gx;
+                float value = 0.0f;
+                for (int offsetX = std::max(-FILTER_EXTENT, -gx);
+                        offsetX <= std::min(FILTER_EXTENT, size.x-1-gx); offsetX++) {
+                    value += voxelDensities[writeIdx + offsetX] * blurKernelX[offsetX+FILTER_EXTENT];
+                }
+                voxelAOFactors[writeIdx] = value;
+            }
+        }
+    }
+    #pragma omp parallel for
+    for (int gz = 0; gz < size.z; gz++) {
+        for (int gy = 0; gy < size.y; gy++) {
+            for (int gx = 0; gx < size.x; gx++) {
+                int writeIdx = gz*strideZ + gy*strideY + gx;
+                float value = 0.0f;
+                for (int offsetY = std::max(-FILTER_EXTENT, -gy);
+                        offsetY <= std::min(FILTER_EXTENT, size.y-1-gy); offsetY++) {
+                    value += voxelAOFactors[writeIdx + offsetY*strideY] * blurKernel[offsetY+FILTER_EXTENT];
+                }
+                tmpFactors[writeIdx] = value;
+            }
+        }
+    }
+    #pragma omp parallel for
+    for (int gz = 0; gz < size.z; gz++) {
+        for (int gy = 0; gy < size.y; gy++) {
+            for (int gx = 0; gx < size.x; gx++) {
+                int writeIdx = gz*strideZ + gy*strideY + gx;
+                float value = 0.0f;
+                for (int offsetZ = std::max(-FILTER_EXTENT, -gz);
+                        offsetZ <= std::min(FILTER_EXTENT, size.z-1-gz); offsetZ++) {
+                    value += tmpFactors[writeIdx + offsetZ*strideZ] * blurKernel[offsetZ+FILTER_EXTENT];
                 }
+                voxelAOFactors[writeIdx] = value;
             }
         }
     }
@@ -64,6 +64,24 @@ struct LineSegmentCompressed
     uint32_t attributes;
 };
 
+// Number of opacity histogram bins (equal to the number of entries of the transfer function map).
+const int VOXEL_HISTOGRAM_NUM_BINS = 256;
+
+/**
+ * Sparse per-voxel histograms of the line attributes weighted by the clipped segment length. Like in opacityMapping,
+ * the attributes are divided by maxVorticity and clamped to [0, 1] before binning.
+ * The density of voxel i for a transfer function opacity map "opacityLUT" is
+ * sum_{j = offsets[i]}^{offsets[i+1]-1} weights[j] * opacityLUT[bins[j]].
+ * Thus, the densities can be recomputed on the CPU without traversing the line segments again.
+ */
+struct VoxelAttributeHistograms
+{
+    std::vector<uint32_t> voxelHistogramOffsets; // Size: number of voxels + 1
+    std::vector<uint8_t> bins;
+    std::vector<float> weights;
+    inline bool empty() const { return voxelHistogramOffsets.empty(); }
+};
+
 
 struct VoxelGridDataCompressed
 {
@@ -90,6 +108,20 @@ struct VoxelGridDataCompressed
 #else
     std::vector<LineSegment> lineSegments;
 #endif
+
+    // Not stored in the voxel file. Created during voxelization or lazily after loading.
+    VoxelAttributeHistograms attributeHistograms;
+};
+
+/**
+ * Multi-resolution pyramid of voxel grids. Level 0 is the finest level, every following level has half the
+ * resolution of the previous one. The pyramid file only stores the coarse levels. Level 0 and the metadata shared by
+ * all levels (data type, hair data, quantization resolution) come from the voxel grid file. The attributes are only
+ * stored in level 0.
+ */
+struct VoxelGridPyramidCompressed
+{
+    std::vector<VoxelGridDataCompressed> levels;
 };
 
 struct VoxelGridDataGPU
@@ -107,8 +139,36 @@ struct VoxelGridDataGPU
 };
 
 
+/**
+ * New in version 4: Support for non-uniform grids.
+ */
+const uint32_t VOXEL_GRID_FORMAT_VERSION = 4u;
+/**
+ * New in pyramid version 2: Level 0 and the attributes are no longer duplicated in the pyramid file.
+ */
+const uint32_t VOXEL_GRID_PYRAMID_FORMAT_VERSION = 2u;
+
 void saveToFile(const std::string &filename, const VoxelGridDataCompressed &data);
 void loadFromFile(const std::string &filename, VoxelGridDataCompressed &data);
+/**
+ * Same as saveToFile, but the line segments are copied from the raw binary file "lineSegmentsFilename" containing
+ * "numLineSegments" line segments (used by the out-of-core voxelization). data.lineSegments is ignored.
+ * Returns false if the file could not be written completely.
+ */
+bool saveToFileWithExternalLineSegments(const std::string &filename, const VoxelGridDataCompressed &data,
+        const std::string &lineSegmentsFilename, uint32_t numLineSegments);
+void saveToFile(const std::string &filename, const VoxelGridPyramidCompressed &pyramid);
+/**
+ * Loads the coarse levels of the pyramid. pyramid.levels.front() must already contain the finest level (i.e., the
+ * data of the voxel grid file), as the coarse levels copy its metadata.
+ */
+void loadFromFile(const std::string &filename, VoxelGridPyramidCompressed &pyramid);
+/**
+ * Returns the coarsest level of the pyramid at which a voxel at distance "cameraDistance" to the camera still covers
+ * at most "maxVoxelSizePixels" pixels on the screen. If no level fulfills this criterion, the finest level is used.
+ */
+int selectPyramidLevel(const VoxelGridPyramidCompressed &pyramid, float cameraDistance, float fovy,
+        int viewportHeight, float maxVoxelSizePixels = 1.0f);
 void compressedToGPUData(const VoxelGridDataCompressed &compressedData, VoxelGridDataGPU &gpuData);
 std::vector<float> generateMipmapsForDensity(float *density, glm::ivec3 size);
 std::vector<uint32_t> generateMipmapsForOctree(uint32_t *numLines, glm::ivec3 size);
@@ -119,6 +179,8 @@ void generateVoxelAOFactorsFromDensity(const std::vector<float> &voxelDensities,
 // Called automatically by generateVoxelAOFactorsFromDensity, but necessary for GPU implementation.
 void normalizeVoxelAOFactors(std::vector<float> &voxelAOFactors, glm::ivec3 size, bool isHairDataset);
 void generateGaussianBlurKernel(float *filterKernel, int filterSize, float sigma);
+// Unnormalized 1D factor of the separable 3D Gaussian kernel above (without the factor 1/(2*pi*sigma^2)).
+void generateGaussianBlurKernel1D(float *filterKernel, int filterSize, float sigma);
 void generateBoxBlurKernel(float *filterKernel, int filterSize);
 
 #endif //PIXELSYNCOIT_VOXELDATA_HPP